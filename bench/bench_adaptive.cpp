@@ -0,0 +1,180 @@
+// Throughput of static running limits against the adaptive one (simulated).
+//
+//   bench_adaptive [--cores 16] [--job-ms 10000] [--duration-s 600]
+//                  [--thrash 1.0] [--target-cpu 90]
+//
+// A backlog that never runs dry is worked through on a host of --cores cores
+// for --duration-s, on a synthetic clock ticked every 500ms as the daemon
+// does. Halfway through, another tenant takes half the cores. Each job needs
+// --job-ms of one core; running jobs share the cores the host has, and every
+// job beyond them costs all of them --thrash / cores of their speed (cache and
+// memory contention), so overcommit loses work rather than just queueing it.
+// The runner sees CPU usage and a CPU `some` stall derived from that. Limits
+// compared: half the cores, the cores, four times the cores, and adaptive
+// between 1 and four times the cores, aiming at --target-cpu percent give or
+// take 5. Reported per limit: jobs finished in each half, mean jobs running,
+// and mean cores doing useful work.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+struct Options {
+  int cores = 16;
+  uint64_t job_ms = 10000;
+  uint64_t duration_s = 600;
+  double thrash = 1.0;
+  double target_cpu = 90.0;
+};
+
+constexpr uint64_t kTickMs = 500;
+
+// Jobs end once they have done job_ms of work; advance() hands out the host's
+// cores among the live ones.
+class SharedHostSpawner : public heidi::IProcessSpawner {
+public:
+  explicit SharedHostSpawner(const Options& opt) : opt_(opt) {}
+
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    job.process_group = next_pgid_++;
+    remaining_ms_[job.process_group] = static_cast<double>(opt_.job_ms);
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    return true;
+  }
+  bool reap_job(heidi::Job& job, int* wait_status) override {
+    auto it = remaining_ms_.find(job.process_group);
+    if (it == remaining_ms_.end() || it->second > 0)
+      return false;
+    remaining_ms_.erase(it);
+    *wait_status = 0;
+    return true;
+  }
+
+  // Runs the live jobs for dt_ms on `cores` cores; returns the core-ms of
+  // useful work done.
+  double advance(uint64_t dt_ms, int cores) {
+    size_t n = running();
+    if (n == 0)
+      return 0;
+    double share = std::min(1.0, static_cast<double>(cores) / n);
+    double over = n > static_cast<size_t>(cores) ? static_cast<double>(n - cores) : 0.0;
+    double speed = share / (1.0 + opt_.thrash * over / cores);
+    for (auto& [pgid, remaining] : remaining_ms_)
+      remaining -= dt_ms * speed;
+    return dt_ms * speed * n;
+  }
+  // Live jobs, finished ones included until they are reaped.
+  size_t running() const {
+    size_t n = 0;
+    for (const auto& [pgid, remaining] : remaining_ms_)
+      n += remaining > 0;
+    return n;
+  }
+
+private:
+  const Options& opt_;
+  // Far above pid_max, so a stray kill() cannot reach a real process group.
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_map<pid_t, double> remaining_ms_;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+// limit 0 runs the adaptive controller.
+void run(const Options& opt, const char* name, int limit) {
+  SharedHostSpawner spawner(opt);
+  FakeInspector inspector;
+  int ceiling = opt.cores * 4;
+  heidi::JobRunner runner(ceiling, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = limit > 0 ? limit : ceiling;
+  policy.max_queue_depth = ceiling * 4 + 1;
+  policy.min_start_gap_ms = 0;
+  // Only the running limit holds starts here.
+  policy.cpu_high_watermark_pct = 100.0;
+  policy.adaptive_concurrency = limit == 0;
+  policy.adaptive_target_cpu_pct = opt.target_cpu;
+  policy.adaptive_band_pct = 5.0;
+  runner.set_governor_policy(policy);
+  runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+  runner.set_output_reactor_enabled(false);
+
+  uint64_t end_ms = opt.duration_s * 1000;
+  size_t done_first_half = 0;
+  double useful_core_ms = 0;
+  double running_sum = 0;
+  uint64_t ticks = 0;
+  heidi::SystemMetrics metrics{0.0, {1000, 500, 500}, 0};
+  metrics.pressure_available = true;
+  for (uint64_t now_ms = 0; now_ms < end_ms; now_ms += kTickMs) {
+    if (now_ms == end_ms / 2 / kTickMs * kTickMs)
+      done_first_half = runner.count_jobs(heidi::JobStatus::COMPLETED);
+    int cores = now_ms < end_ms / 2 ? opt.cores : std::max(opt.cores / 2, 1);
+    while (runner.count_jobs(heidi::JobStatus::QUEUED) < static_cast<size_t>(ceiling) * 2)
+      runner.submit_job("work");
+
+    runner.tick(now_ms, metrics, ceiling, ceiling);
+    useful_core_ms += spawner.advance(kTickMs, cores);
+    size_t n = spawner.running();
+    running_sum += n;
+    ticks++;
+    metrics.cpu_usage_percent = std::min(100.0, 100.0 * n / cores);
+    metrics.cpu_pressure.some_avg10 =
+        n > static_cast<size_t>(cores) ? 100.0 * (n - cores) / n : 0.0;
+  }
+  size_t done = runner.count_jobs(heidi::JobStatus::COMPLETED);
+  printf("%-9s %12zu %13zu %12.1f %13.1f\n", name, done_first_half, done - done_first_half,
+         running_sum / ticks, useful_core_ms / end_ms);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+      opt.cores = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--job-ms") == 0 && i + 1 < argc) {
+      opt.job_ms = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--duration-s") == 0 && i + 1 < argc) {
+      opt.duration_s = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--thrash") == 0 && i + 1 < argc) {
+      opt.thrash = strtod(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--target-cpu") == 0 && i + 1 < argc) {
+      opt.target_cpu = strtod(argv[++i], nullptr);
+    } else {
+      fprintf(stderr, "Usage: bench_adaptive [--cores N] [--job-ms N] [--duration-s N] "
+                      "[--thrash X] [--target-cpu PCT]\n");
+      return 1;
+    }
+  }
+  if (opt.cores < 2 || opt.job_ms == 0 || opt.duration_s == 0) {
+    fprintf(stderr, "--cores must be at least 2, --job-ms and --duration-s positive\n");
+    return 1;
+  }
+
+  printf("%-9s %12s %13s %12s %13s\n", "limit", "done_1st_half", "done_2nd_half", "mean_running",
+         "useful_cores");
+  char name[32];
+  for (int factor : {1, 2, 8}) {
+    snprintf(name, sizeof(name), "static-%d", opt.cores * factor / 2);
+    run(opt, name, opt.cores * factor / 2);
+  }
+  run(opt, "adaptive", 0);
+  return 0;
+}
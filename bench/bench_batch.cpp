@@ -0,0 +1,175 @@
+// One-by-one against batched job submission.
+//
+//   bench_batch [--jobs 10000] [--batch 1000] [--socket <path>]
+//
+// Without --socket, queues --jobs jobs on a JobRunner with submit_job() and
+// then with submit_jobs() in batches of --batch, reporting the time spent
+// submitting and the time the next lookup spends draining the jobs into
+// the run queue. With --socket, does the same against a running daemon:
+// one `job run` connection per job against one `job batch` request per
+// --batch jobs. It first raises the daemon's max_queue_depth to 10000, which
+// has to hold both runs (--jobs defaults to 5000 there); the jobs run `true`.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void print_row(const char* mode, size_t jobs, size_t batch, size_t accepted, double submit_ms,
+               double drain_ms) {
+  printf("%-10s %8zu %8zu %9zu %11.2f %11.3f %10.2f\n", mode, jobs, batch, accepted, submit_ms,
+         submit_ms * 1000.0 / jobs, drain_ms);
+}
+
+heidi::JobRunner* make_runner(size_t jobs) {
+  auto* runner = new heidi::JobRunner();
+  heidi::GovernorPolicy policy;
+  policy.max_queue_depth = static_cast<int>(jobs + 1);
+  runner->set_governor_policy(policy);
+  return runner;
+}
+
+void bench_runner(size_t jobs, size_t batch) {
+  std::vector<heidi::JobSpec> specs(jobs);
+  for (size_t i = 0; i < jobs; ++i)
+    specs[i].command = "echo " + std::to_string(i);
+
+  {
+    heidi::JobRunner* runner = make_runner(jobs);
+    size_t accepted = 0;
+    auto start = Clock::now();
+    for (const auto& spec : specs)
+      accepted += !runner->submit_job(spec).empty();
+    double submit_ms = ms_since(start);
+    start = Clock::now();
+    runner->get_recent_jobs(1);
+    print_row("single", jobs, 1, accepted, submit_ms, ms_since(start));
+    delete runner;
+  }
+  {
+    heidi::JobRunner* runner = make_runner(jobs);
+    size_t accepted = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < jobs; i += batch) {
+      std::span<const heidi::JobSpec> chunk(specs.data() + i, std::min(batch, jobs - i));
+      accepted += runner->submit_jobs(chunk).accepted;
+    }
+    double submit_ms = ms_since(start);
+    start = Clock::now();
+    runner->get_recent_jobs(1);
+    print_row("batched", jobs, batch, accepted, submit_ms, ms_since(start));
+    delete runner;
+  }
+}
+
+// One request per connection, as the daemon serves them.
+bool request(const std::string& socket_path, const std::string& req, std::string* response) {
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    return false;
+  struct sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(sock);
+    return false;
+  }
+  size_t sent = 0;
+  while (sent < req.size()) {
+    ssize_t n = write(sock, req.data() + sent, req.size() - sent);
+    if (n <= 0) {
+      close(sock);
+      return false;
+    }
+    sent += n;
+  }
+  response->clear();
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(sock, buffer, sizeof(buffer))) > 0)
+    response->append(buffer, n);
+  close(sock);
+  return true;
+}
+
+int bench_socket(const std::string& socket_path, size_t jobs, size_t batch) {
+  std::string response;
+  if (!request(socket_path, "governor/policy_update {\"max_queue_depth\": 10000}\n", &response) ||
+      response.rfind("policy_updated", 0) != 0) {
+    fprintf(stderr, "cannot raise max_queue_depth: %s\n", response.c_str());
+    return 1;
+  }
+
+  size_t accepted = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < jobs; ++i) {
+    if (request(socket_path, "job run true\n", &response) &&
+        response.rfind("job_submitted", 0) == 0)
+      accepted++;
+  }
+  print_row("single", jobs, 1, accepted, ms_since(start), 0);
+
+  accepted = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < jobs; i += batch) {
+    size_t n = std::min(batch, jobs - i);
+    std::string req = "job batch " + std::to_string(n) + "\n";
+    for (size_t j = 0; j < n; ++j)
+      req += "true\n";
+    if (!request(socket_path, req, &response))
+      continue;
+    const char* line = strstr(response.c_str(), "accepted: ");
+    if (line)
+      accepted += strtoull(line + strlen("accepted: "), nullptr, 10);
+  }
+  print_row("batched", jobs, batch, accepted, ms_since(start), 0);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  size_t jobs = 0;
+  size_t batch = 1000;
+  std::string socket_path;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: bench_batch [--jobs N] [--batch N] [--socket <path>]\n");
+      return 1;
+    }
+  }
+  if (jobs == 0)
+    jobs = socket_path.empty() ? 10000 : 5000;
+  if (batch == 0)
+    batch = 1;
+
+  printf("%-10s %8s %8s %9s %11s %11s %10s\n", "mode", "jobs", "batch", "accepted", "submit_ms",
+         "us_per_job", "drain_ms");
+  if (!socket_path.empty())
+    return bench_socket(socket_path, jobs, batch);
+  bench_runner(jobs, batch);
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Cost of cancelling many running jobs at once.
+//
+//   bench_cancel [--jobs 1000] [--grace-ms 2000] [--ignore-term]
+//
+// Starts --jobs real `sleep 600` jobs, then cancels them all while another
+// thread keeps querying job status. Reported are the time spent in
+// cancel_job() calls, the worst status query latency meanwhile (both used
+// to grow by 500ms per cancel), and the time until every job is CANCELLED
+// with the runner ticking every 10ms. With --ignore-term the jobs ignore
+// SIGTERM, so they end only through SIGKILL after --grace-ms.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_spawner.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  size_t jobs = 1000;
+  uint64_t grace_ms = 2000;
+  bool ignore_term = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--grace-ms") == 0 && i + 1 < argc) {
+      grace_ms = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--ignore-term") == 0) {
+      ignore_term = true;
+    } else {
+      fprintf(stderr, "Usage: bench_cancel [--jobs N] [--grace-ms N] [--ignore-term]\n");
+      return 1;
+    }
+  }
+
+  heidi::RealProcessSpawner spawner;
+  heidi::JobRunner runner(jobs, &spawner);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = static_cast<int>(jobs);
+  policy.max_queue_depth = static_cast<int>(jobs + 1);
+  runner.set_governor_policy(policy);
+  runner.start();
+
+  heidi::JobLimits limits;
+  limits.kill_grace_ms = grace_ms;
+  heidi::JobSpec spec;
+  if (ignore_term) {
+    spec.command = "trap '' TERM; sleep 600";
+  } else {
+    spec.exec_mode = heidi::ExecMode::DIRECT;
+    spec.argv = {"sleep", "600"};
+  }
+  std::vector<std::string> ids;
+  for (size_t i = 0; i < jobs; ++i)
+    ids.push_back(runner.submit_job(spec, limits));
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  uint64_t now_ms = 1000;
+  runner.tick(now_ms, metrics, jobs, 0);
+  if (runner.count_jobs(heidi::JobStatus::RUNNING) != jobs) {
+    fprintf(stderr, "only %zu of %zu jobs started\n", runner.count_jobs(heidi::JobStatus::RUNNING),
+            jobs);
+    return 1;
+  }
+  // Let the shells install their trap.
+  std::this_thread::sleep_for(std::chrono::milliseconds(ignore_term ? 500 : 50));
+
+  std::atomic<bool> cancelling{true};
+  double worst_query_ms = 0;
+  std::thread query([&] {
+    while (cancelling.load()) {
+      auto start = Clock::now();
+      runner.get_job_status(ids[jobs / 2]);
+      worst_query_ms = std::max(worst_query_ms, ms_since(start));
+    }
+  });
+
+  auto start = Clock::now();
+  for (const auto& id : ids)
+    runner.cancel_job(id);
+  double cancel_ms = ms_since(start);
+  cancelling = false;
+  query.join();
+
+  while (runner.count_jobs(heidi::JobStatus::CANCELLED) < jobs) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    now_ms += 10;
+    runner.tick(now_ms, metrics, 0, 0);
+  }
+  double done_ms = ms_since(start);
+  runner.stop();
+
+  printf("%-8s %10s %12s %14s %12s\n", "jobs", "grace_ms", "cancel_ms", "worst_query_ms",
+         "all_done_ms");
+  printf("%-8zu %10llu %12.2f %14.2f %12.1f\n", jobs, static_cast<unsigned long long>(grace_ms),
+         cancel_ms, worst_query_ms, done_ms);
+  return 0;
+}
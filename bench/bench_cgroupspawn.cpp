@@ -0,0 +1,128 @@
+// Cost of putting a spawned job into a cgroup, on the spawn's critical path.
+//
+//   bench_cgroupspawn [--root /sys/fs/cgroup/heidi-bench] [--spawns 200]
+//
+// Spawns `true` through the spawner --spawns times per mode and reports the
+// mean time from "job is about to start" to "leader is spawned and contained":
+//
+//   none    no cgroup at all (the floor)
+//   attach  mkdir a cgroup per job, posix_spawn, then write the pid into its
+//           cgroup.procs (the leader runs uncontained until then)
+//   pooled  take a warm cgroup from the pool and start the leader in it with
+//           clone3(CLONE_INTO_CGROUP); the pool is refilled off the clock
+//
+// --root must be on a writable cgroup2 mount; the directory is removed after.
+
+#include "heidi-kernel/cgroup_driver.h"
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+enum class Mode { NONE, ATTACH, POOLED };
+
+const char* mode_name(Mode mode) {
+  switch (mode) {
+  case Mode::NONE:
+    return "none";
+  case Mode::ATTACH:
+    return "attach";
+  case Mode::POOLED:
+    return "pooled";
+  }
+  return "?";
+}
+
+double run(heidi::gov::CgroupDriver& driver, Mode mode, int spawns) {
+  heidi::RealProcessSpawner spawner(mode == Mode::ATTACH ? heidi::SpawnBackend::POSIX_SPAWN
+                                                         : heidi::SpawnBackend::VFORK);
+  driver.set_pool_size(mode == Mode::POOLED ? 8 : 0);
+  driver.refill_pool();
+  double total = 0;
+  auto one = [&](bool timed) {
+    heidi::Job job;
+    job.command = "true";
+    heidi::gov::CgroupDriver::JobCgroup cgroup;
+    int out_fd = -1, err_fd = -1;
+
+    auto start = std::chrono::steady_clock::now();
+    // With the pool empty (attach), acquiring is a mkdir on the spot.
+    if (mode != Mode::NONE) {
+      if (driver.acquire_job_cgroup(&cgroup) != 0) {
+        fprintf(stderr, "acquire failed\n");
+        exit(1);
+      }
+      if (mode == Mode::POOLED)
+        job.cgroup_handle = std::move(cgroup.handle);
+    }
+    if (!spawner.spawn_job(job, &out_fd, &err_fd)) {
+      fprintf(stderr, "spawn failed: %s\n", job.error.c_str());
+      exit(1);
+    }
+    if (mode == Mode::ATTACH)
+      cgroup.handle.move_pid(job.process_group);
+    if (timed)
+      total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+                   .count();
+
+    close(out_fd);
+    close(err_fd);
+    waitpid(job.process_group, nullptr, 0);
+    if (job.pidfd >= 0)
+      close(job.pidfd);
+    if (mode != Mode::NONE) {
+      if (mode == Mode::POOLED)
+        cgroup.handle = std::move(job.cgroup_handle);
+      while (driver.release_job_cgroup(&cgroup) == EBUSY)
+        usleep(100);
+      driver.refill_pool();
+    }
+  };
+
+  for (int i = 0; i < 5; ++i)
+    one(false);
+  for (int i = 0; i < spawns; ++i)
+    one(true);
+  return total / spawns;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string root = "/sys/fs/cgroup/heidi-bench";
+  int spawns = 200;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+      root = argv[++i];
+    } else if (strcmp(argv[i], "--spawns") == 0 && i + 1 < argc) {
+      spawns = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_cgroupspawn [--root DIR] [--spawns N]\n");
+      return 1;
+    }
+  }
+
+  {
+    heidi::gov::CgroupDriver driver(root);
+    if (!driver.is_available()) {
+      fprintf(stderr, "%s is not a writable cgroup2 directory\n", root.c_str());
+      rmdir(root.c_str());
+      return 1;
+    }
+    printf("%-8s %14s\n", "mode", "us/spawn");
+    for (Mode mode : {Mode::NONE, Mode::ATTACH, Mode::POOLED})
+      printf("%-8s %14.1f\n", mode_name(mode), run(driver, mode, spawns));
+  }
+  rmdir(root.c_str());
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Per-cgroup cost of updating limits and reading stats across many cgroups.
+//
+//   bench_cgroupupdate [--root /sys/fs/cgroup/heidi-bench] [--cgroups 1000] [--rounds 20]
+//
+// Creates --cgroups empty cgroups under --root, then for --rounds rounds
+// touches every one of them, once by path (build the path, open, write or
+// read, close: what CgroupDriver::apply() used to do per file) and once
+// through an open CgroupHandle (one pwrite() or pread()). Limit writes go
+// to pids.max and are skipped when the pids controller is not delegated to
+// --root; the read is cgroup.events, present in every cgroup.
+
+#include "heidi-kernel/cgroup_driver.h"
+#include "heidi-kernel/cgroup_handle.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using heidi::gov::CgroupHandle;
+
+template <typename Fn>
+double per_op_ns(int cgroups, int rounds, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    for (int i = 0; i < cgroups; ++i)
+      fn(i, r);
+  double ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / (static_cast<double>(cgroups) * rounds);
+}
+
+bool write_by_path(const std::string& dir, const char* file, const char* value) {
+  std::string path = dir + "/" + file;
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  bool ok = write(fd, value, strlen(value)) == static_cast<ssize_t>(strlen(value));
+  close(fd);
+  return ok;
+}
+
+bool read_by_path(const std::string& dir, const char* file) {
+  std::string path = dir + "/" + file;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  char buf[256];
+  bool ok = read(fd, buf, sizeof(buf)) > 0;
+  close(fd);
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string root = "/sys/fs/cgroup/heidi-bench";
+  int cgroups = 1000;
+  int rounds = 20;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+      root = argv[++i];
+    } else if (strcmp(argv[i], "--cgroups") == 0 && i + 1 < argc) {
+      cgroups = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_cgroupupdate [--root DIR] [--cgroups N] [--rounds N]\n");
+      return 1;
+    }
+  }
+
+  heidi::gov::CgroupDriver driver(root);
+  if (!driver.is_available()) {
+    fprintf(stderr, "%s is not a writable cgroup2 directory\n", root.c_str());
+    rmdir(root.c_str());
+    return 1;
+  }
+
+  // No pool: every cgroup is made on the spot and removed on release.
+  driver.set_pool_size(0);
+  std::vector<heidi::gov::CgroupDriver::JobCgroup> jobs(cgroups);
+  for (int i = 0; i < cgroups; ++i) {
+    if (driver.acquire_job_cgroup(&jobs[i]) != 0) {
+      fprintf(stderr, "cannot create cgroup %d\n", i);
+      return 1;
+    }
+  }
+
+  printf("%-22s %12s %12s\n", "op", "path ns", "handle ns");
+  bool pids = has_capability(driver.capability(), heidi::gov::CgroupDriver::Capability::PIDS);
+  if (pids) {
+    int failed = 0;
+    double by_path = per_op_ns(cgroups, rounds, [&](int i, int r) {
+      failed += !write_by_path(jobs[i].path, "pids.max", r % 2 ? "1000" : "2000");
+    });
+    double by_handle = per_op_ns(cgroups, rounds, [&](int i, int r) {
+      failed += jobs[i].handle.set_pids_max(r % 2 ? 1000 : 2000) != 0;
+    });
+    printf("%-22s %12.0f %12.0f\n", "write pids.max", by_path, by_handle);
+    if (failed)
+      fprintf(stderr, "%d writes failed\n", failed);
+  } else {
+    printf("%-22s %12s %12s\n", "write pids.max", "skipped", "skipped");
+  }
+  double by_path =
+      per_op_ns(cgroups, rounds, [&](int i, int) { read_by_path(jobs[i].path, "cgroup.events"); });
+  double by_handle = per_op_ns(cgroups, rounds, [&](int i, int) {
+    CgroupHandle::Stats stats;
+    jobs[i].handle.read_stats(CgroupHandle::STAT_POPULATED, &stats);
+  });
+  printf("%-22s %12.0f %12.0f\n", "read cgroup.events", by_path, by_handle);
+
+  for (auto& job : jobs)
+    driver.release_job_cgroup(&job);
+  rmdir(root.c_str());
+  return 0;
+}
@@ -0,0 +1,195 @@
+// Fairness and throughput of the run queue under skewed load (simulated).
+//
+//   bench_fairness [--bulk 5000] [--tenants 4] [--slots 10] [--job-ms 1000]
+//                  [--arrival-ms 500] [--duration-s 60] [--weight 1]
+//
+// One "bulk" group queues --bulk jobs at t=0, then each of --tenants small
+// groups submits one job every --arrival-ms for --duration-s. Every job
+// runs --job-ms on --slots slots, on a synthetic clock ticked every 10ms.
+// Run once with every job in the default group (a single FIFO, as before
+// groups existed) and once with a group per tenant, where each small
+// tenant has --weight. Reported per group kind: jobs, queue wait (start
+// minus submission) mean / p99 / max, and when the kind's last job
+// finished; then overall throughput and the mean wall time per tick.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Jobs end job_ms after they were spawned, on the shared synthetic clock.
+class TimedSpawner : public heidi::IProcessSpawner {
+public:
+  TimedSpawner(const uint64_t* now_ms, uint64_t job_ms) : now_ms_(now_ms), job_ms_(job_ms) {}
+
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    job.process_group = next_pgid_++;
+    ends_[job.process_group] = *now_ms_ + job_ms_;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    return true;
+  }
+  bool reap_job(heidi::Job& job, int* wait_status) override {
+    auto it = ends_.find(job.process_group);
+    if (it == ends_.end() || *now_ms_ < it->second)
+      return false;
+    ends_.erase(it);
+    *wait_status = 0;
+    return true;
+  }
+
+private:
+  const uint64_t* now_ms_;
+  uint64_t job_ms_;
+  // Far above pid_max, so a stray kill() cannot reach a real process group.
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_map<pid_t, uint64_t> ends_;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+struct Submitted {
+  std::string id;
+  uint64_t submit_ms;
+  bool bulk;
+};
+
+struct Options {
+  int bulk = 5000;
+  int tenants = 4;
+  int slots = 10;
+  uint64_t job_ms = 1000;
+  uint64_t arrival_ms = 500;
+  uint64_t duration_s = 60;
+  uint32_t weight = 1;
+};
+
+void report(const char* mode, const char* kind, std::vector<uint64_t>& waits, uint64_t last_end) {
+  std::sort(waits.begin(), waits.end());
+  double mean = 0;
+  for (uint64_t w : waits)
+    mean += w;
+  mean = waits.empty() ? 0 : mean / waits.size();
+  uint64_t p99 = waits.empty() ? 0 : waits[(waits.size() - 1) * 99 / 100];
+  printf("%-6s %-8s %7zu %12.0f %11llu %11llu %12.1f\n", mode, kind, waits.size(), mean,
+         static_cast<unsigned long long>(p99),
+         static_cast<unsigned long long>(waits.empty() ? 0 : waits.back()), last_end / 1000.0);
+}
+
+void run(const Options& opt, bool grouped) {
+  uint64_t now_ms = 0;
+  TimedSpawner spawner(&now_ms, opt.job_ms);
+  FakeInspector inspector;
+  heidi::JobRunner runner(opt.slots, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = opt.slots;
+  policy.max_queue_depth = opt.bulk + 10000;
+  policy.min_start_gap_ms = 0;
+  runner.set_governor_policy(policy);
+  runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+  runner.set_output_reactor_enabled(false);
+  for (int t = 0; grouped && t < opt.tenants; ++t)
+    runner.set_group_share("tenant" + std::to_string(t), heidi::GroupShare{opt.weight, 0});
+
+  std::vector<Submitted> submitted;
+  heidi::JobSpec spec;
+  spec.command = "work";
+  spec.group = grouped ? "bulk" : "";
+  for (int i = 0; i < opt.bulk; ++i)
+    submitted.push_back({runner.submit_job(spec), 0, true});
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  uint64_t arrivals_end = opt.duration_s * 1000;
+  double tick_us = 0;
+  uint64_t ticks = 0;
+  size_t total = opt.bulk + opt.tenants * (arrivals_end / opt.arrival_ms);
+  while (runner.count_jobs(heidi::JobStatus::COMPLETED) < total) {
+    if (now_ms < arrivals_end && now_ms % opt.arrival_ms == 0) {
+      for (int t = 0; t < opt.tenants; ++t) {
+        spec.group = grouped ? "tenant" + std::to_string(t) : "";
+        submitted.push_back({runner.submit_job(spec), now_ms, false});
+      }
+    }
+    auto start = std::chrono::steady_clock::now();
+    runner.tick(now_ms, metrics, opt.slots, opt.slots * 2);
+    tick_us +=
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    ticks++;
+    now_ms += 10;
+  }
+
+  std::vector<uint64_t> bulk_waits, tenant_waits;
+  uint64_t bulk_end = 0, tenant_end = 0;
+  for (const auto& s : submitted) {
+    auto job = runner.get_job_status(s.id);
+    uint64_t wait = job->started_at_ms - s.submit_ms;
+    uint64_t end = job->started_at_ms + opt.job_ms;
+    if (s.bulk) {
+      bulk_waits.push_back(wait);
+      bulk_end = std::max(bulk_end, end);
+    } else {
+      tenant_waits.push_back(wait);
+      tenant_end = std::max(tenant_end, end);
+    }
+  }
+  const char* mode = grouped ? "drr" : "fifo";
+  report(mode, "bulk", bulk_waits, bulk_end);
+  report(mode, "tenants", tenant_waits, tenant_end);
+  printf("%-6s throughput %.2f jobs/s over %.1f s, %.2f us/tick\n", mode,
+         total * 1000.0 / std::max(bulk_end, tenant_end), std::max(bulk_end, tenant_end) / 1000.0,
+         tick_us / ticks);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--bulk") == 0 && i + 1 < argc) {
+      opt.bulk = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--tenants") == 0 && i + 1 < argc) {
+      opt.tenants = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--slots") == 0 && i + 1 < argc) {
+      opt.slots = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--job-ms") == 0 && i + 1 < argc) {
+      opt.job_ms = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--arrival-ms") == 0 && i + 1 < argc) {
+      opt.arrival_ms = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--duration-s") == 0 && i + 1 < argc) {
+      opt.duration_s = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--weight") == 0 && i + 1 < argc) {
+      opt.weight = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: bench_fairness [--bulk N] [--tenants N] [--slots N] [--job-ms N] "
+                      "[--arrival-ms N] [--duration-s N] [--weight N]\n");
+      return 1;
+    }
+  }
+  if (opt.arrival_ms == 0 || opt.arrival_ms % 10 != 0) {
+    fprintf(stderr, "--arrival-ms must be a positive multiple of the 10ms tick\n");
+    return 1;
+  }
+
+  printf("%-6s %-8s %7s %12s %11s %11s %12s\n", "mode", "group", "jobs", "mean_wait_ms",
+         "p99_wait_ms", "max_wait_ms", "last_end_s");
+  run(opt, false);
+  run(opt, true);
+  return 0;
+}
@@ -0,0 +1,177 @@
+// Newline search and line framing throughput on multi-MB job output.
+//
+//   bench_framing [--mb 64] [--rounds 5]
+//
+// For three output shapes (80-byte lines, 4KB lines, no newlines at all)
+// this reports how fast each find_newline() implementation walks the buffer,
+// how fast LineFramer frames it into a 10MB LogRing in 64KB reads (the
+// reactor's chunk size), and what fetching the last 100 lines costs through
+// the line index versus rescanning the retained log. Build with
+// CMAKE_BUILD_TYPE=Release; unoptimized intrinsics say little.
+
+#include "heidi-kernel/line_framer.h"
+#include "heidi-kernel/log_ring.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string make_output(uint64_t bytes, size_t avg_line) {
+  std::mt19937 rng(7);
+  std::string out(bytes, 'x');
+  for (size_t i = 0; i < out.size(); ++i)
+    out[i] = static_cast<char>('a' + rng() % 26);
+  if (avg_line == 0)
+    return out;
+  // Line lengths uniform in [avg/2, 3*avg/2].
+  size_t pos = 0;
+  while (true) {
+    pos += avg_line / 2 + rng() % (avg_line + 1);
+    if (pos >= out.size())
+      break;
+    out[pos] = '\n';
+  }
+  return out;
+}
+
+size_t count_lines(const std::string& data, bool use_memchr, heidi::NewlineScan scan) {
+  size_t lines = 0;
+  const char* p = data.data();
+  size_t left = data.size();
+  while (left > 0) {
+    size_t nl;
+    if (use_memchr) {
+      const void* hit = memchr(p, '\n', left);
+      nl = hit ? static_cast<const char*>(hit) - p : left;
+    } else {
+      nl = heidi::find_newline(p, left, scan);
+    }
+    if (nl == left)
+      break;
+    ++lines;
+    p += nl + 1;
+    left -= nl + 1;
+  }
+  return lines;
+}
+
+void bench_scan(const char* shape, const std::string& data, int rounds) {
+  struct Variant {
+    const char* name;
+    bool use_memchr;
+    heidi::NewlineScan scan;
+  };
+  std::vector<Variant> variants = {{"scalar", false, heidi::NewlineScan::SCALAR}};
+  if (heidi::best_newline_scan() != heidi::NewlineScan::SCALAR)
+    variants.push_back({"sse2", false, heidi::NewlineScan::SSE2});
+  if (heidi::best_newline_scan() == heidi::NewlineScan::AVX2)
+    variants.push_back({"avx2", false, heidi::NewlineScan::AVX2});
+  variants.push_back({"memchr", true, heidi::NewlineScan::SCALAR});
+
+  for (const auto& v : variants) {
+    size_t lines = 0;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; ++r)
+      lines = count_lines(data, v.use_memchr, v.scan);
+    double secs = seconds_since(start);
+    printf("%-8s %-10s %10zu %12.2f\n", shape, v.name, lines,
+           data.size() * rounds / secs / (1024.0 * 1024.0 * 1024.0));
+  }
+}
+
+void bench_framer(const char* shape, const std::string& data, int rounds) {
+  const size_t kChunk = 64 * 1024;
+  heidi::LogRing ring;
+  heidi::LineFramer framer;
+  auto start = Clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    ring.reset(64 * 1024, 10 * 1024 * 1024 - 64 * 1024);
+    framer.reset(65536, 10 * 1024 * 1024);
+    for (size_t off = 0; off < data.size(); off += kChunk)
+      framer.append(ring, data.data() + off, std::min(kChunk, data.size() - off));
+  }
+  double secs = seconds_since(start);
+
+  // Last 100 lines: index lookup versus a backwards scan of the retained log.
+  const int kLookups = 1000;
+  struct iovec iov[heidi::LogRing::kMaxIov];
+  size_t indexed_bytes = 0;
+  auto t0 = Clock::now();
+  for (int i = 0; i < kLookups; ++i) {
+    size_t n = framer.tail_lines(ring, 100, iov);
+    indexed_bytes = 0;
+    for (size_t j = 0; j < n; ++j)
+      indexed_bytes += iov[j].iov_len;
+  }
+  double indexed_us = seconds_since(t0) * 1e6 / kLookups;
+
+  size_t scanned_bytes = 0;
+  auto t1 = Clock::now();
+  for (int i = 0; i < kLookups / 100; ++i) {
+    std::string log = ring.str();
+    size_t pos = log.size();
+    int found = log.empty() || log.back() == '\n' ? -1 : 0;
+    while (pos > 0 && found < 100) {
+      if (log[pos - 1] == '\n' && ++found == 100)
+        break;
+      --pos;
+    }
+    scanned_bytes = log.size() - pos;
+  }
+  double scanned_us = seconds_since(t1) * 1e6 / (kLookups / 100);
+
+  printf("%-8s %12.2f %10llu %10llu %12.2f %12.2f %10zu %10zu\n", shape,
+         data.size() * rounds / secs / (1024.0 * 1024.0 * 1024.0),
+         static_cast<unsigned long long>(framer.lines()),
+         static_cast<unsigned long long>(framer.lines_truncated()), indexed_us, scanned_us,
+         indexed_bytes, scanned_bytes);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  uint64_t mb = 64;
+  int rounds = 5;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--mb") == 0 && i + 1 < argc) {
+      mb = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_framing [--mb N] [--rounds N]\n");
+      return 1;
+    }
+  }
+
+  struct Shape {
+    const char* name;
+    size_t avg_line;
+  };
+  const Shape shapes[] = {{"80B", 80}, {"4KB", 4096}, {"nolines", 0}};
+  std::vector<std::string> outputs;
+  for (const auto& shape : shapes)
+    outputs.push_back(make_output(mb * 1024 * 1024, shape.avg_line));
+
+  printf("%-8s %-10s %10s %12s\n", "shape", "scan", "lines", "GB/s");
+  for (size_t i = 0; i < outputs.size(); ++i)
+    bench_scan(shapes[i].name, outputs[i], rounds);
+
+  printf("\n%-8s %12s %10s %10s %12s %12s %10s %10s\n", "shape", "frame_GB/s", "lines", "cut",
+         "tail100_idx", "tail100_scan", "idx_bytes", "scan_bytes");
+  for (size_t i = 0; i < outputs.size(); ++i)
+    bench_framer(shapes[i].name, outputs[i], rounds);
+  return 0;
+}
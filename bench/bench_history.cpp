@@ -0,0 +1,128 @@
+// Daemon memory as finished jobs accumulate, with and without retention.
+//
+//   bench_history [--jobs 200000] [--output-bytes 2048] [--archive DIR]
+//
+// A fake spawner "runs" each job instantly, writing --output-bytes of
+// output into its log. The runner ticks until every job is done; RSS is
+// printed every 20% of the way. With the default retention policy (and
+// evicted jobs archived under DIR when given) RSS should level off; with
+// retention disabled it grows with every job.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+class FakeSpawner : public heidi::IProcessSpawner {
+public:
+  explicit FakeSpawner(size_t output_bytes) : output_(output_bytes, 'o') {
+    for (size_t i = 79; i < output_.size(); i += 80)
+      output_[i] = '\n';
+  }
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    // Far above pid_max, so a stray kill() cannot reach a real process group.
+    job.process_group = next_pgid_++;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    heidi::append_job_output(job, heidi::LogStream::STDOUT, output_.data(), output_.size());
+    finished_.insert(job.process_group);
+    return true;
+  }
+  bool reap_job(heidi::Job& job, int* wait_status) override {
+    if (finished_.erase(job.process_group) == 0)
+      return false;
+    *wait_status = 0;
+    return true;
+  }
+
+private:
+  std::string output_;
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_set<pid_t> finished_;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+uint64_t rss_kb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0)
+      return strtoull(line.c_str() + 6, nullptr, 10);
+  }
+  return 0;
+}
+
+void run(bool retain_all, size_t jobs, size_t output_bytes, const std::string& archive_dir) {
+  FakeSpawner spawner(output_bytes);
+  FakeInspector inspector;
+  heidi::JobRunner runner(2000, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = 1000;
+  policy.max_queue_depth = 1000000;
+  runner.set_governor_policy(policy);
+  if (retain_all)
+    runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+  else if (!archive_dir.empty() && !runner.enable_job_archive(archive_dir))
+    fprintf(stderr, "cannot open archive in %s\n", archive_dir.c_str());
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  heidi::JobLimits limits;
+  limits.max_log_bytes = 64 * 1024;
+  uint64_t now_ms = 1;
+  uint64_t rss_start = rss_kb();
+  size_t submitted = 0;
+  for (int step = 1; step <= 5; ++step) {
+    size_t target = jobs * step / 5;
+    for (; submitted < target; ++submitted)
+      runner.submit_job("true", limits);
+    while (runner.count_jobs(heidi::JobStatus::QUEUED) > 0 ||
+           runner.count_jobs(heidi::JobStatus::RUNNING) > 0)
+      runner.tick(now_ms++, metrics, 1000, 2000);
+    printf("%-10s %10zu %12llu %12llu\n", retain_all ? "all" : "retention", submitted,
+           static_cast<unsigned long long>(runner.get_jobs_evicted()),
+           static_cast<unsigned long long>(rss_kb() - rss_start));
+    fflush(stdout);
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  size_t jobs = 200000;
+  size_t output_bytes = 2048;
+  std::string archive_dir;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--output-bytes") == 0 && i + 1 < argc) {
+      output_bytes = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+      archive_dir = argv[++i];
+    } else {
+      fprintf(stderr,
+              "Usage: bench_history [--jobs N] [--output-bytes N] [--archive DIR]\n");
+      return 1;
+    }
+  }
+
+  printf("%-10s %10s %12s %12s\n", "mode", "jobs", "evicted", "rss_delta_kb");
+  // Bounded run first: RSS rarely shrinks once the unbounded run grew it.
+  run(false, jobs, output_bytes, archive_dir);
+  run(true, jobs, output_bytes, archive_dir);
+  return 0;
+}
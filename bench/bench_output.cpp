@@ -0,0 +1,135 @@
+// Output capture throughput with the epoll reactor versus per-tick polling,
+// and daemon memory when the log is kept in strings versus spooled to files.
+//
+//   bench_output [--mb 64] [--tick-ms 500] [--seconds 10] [--log-mb 64]
+//
+// A single job writes --mb megabytes to stdout while the runner ticks every
+// --tick-ms, as the daemon's monitor does. Reported is how long it took until
+// all bytes were captured (or how much arrived before --seconds ran out), and
+// how much this process's RSS grew with a --log-mb log cap.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+
+namespace {
+
+enum class Mode { REACTOR, POLLING, SPOOL };
+
+const char* mode_name(Mode mode) {
+  switch (mode) {
+  case Mode::REACTOR:
+    return "reactor";
+  case Mode::POLLING:
+    return "polling";
+  case Mode::SPOOL:
+    return "spool";
+  }
+  return "?";
+}
+
+uint64_t rss_kb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0)
+      return strtoull(line.c_str() + 6, nullptr, 10);
+  }
+  return 0;
+}
+
+void run(Mode mode, uint64_t mb, int tick_ms, int seconds, uint64_t log_mb) {
+  bool reactor = mode != Mode::POLLING;
+  uint64_t rss_before = rss_kb();
+  heidi::RealProcessSpawner spawner;
+  heidi::JobRunner runner(4, &spawner);
+  runner.set_output_reactor_enabled(reactor);
+  if (mode == Mode::SPOOL) {
+    std::string dir = "/tmp/bench_output_spool";
+    mkdir(dir.c_str(), 0700);
+    runner.enable_log_spool(dir);
+  }
+  runner.start();
+
+  uint64_t bytes = mb * 1024 * 1024;
+  heidi::JobLimits limits;
+  limits.max_log_bytes = log_mb * 1024 * 1024;
+  std::string id = runner.submit_job("head -c " + std::to_string(bytes) + " /dev/zero", limits);
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  auto next_tick = start;
+  uint64_t now_ms = 1000;
+  auto job = runner.get_job_status(id);
+  uint64_t captured = 0;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (std::chrono::steady_clock::now() >= next_tick) {
+      runner.tick(now_ms, metrics);
+      now_ms += tick_ms;
+      next_tick += std::chrono::milliseconds(tick_ms);
+    }
+    // In polling mode bytes_written only changes inside tick(), on this thread.
+    captured = reactor ? runner.output_reactor().bytes_read() : job->bytes_written;
+    if (captured >= bytes)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t rss_after = rss_kb();
+  printf("%-8s %10llu %10llu %10.3f %12.2f %12lld\n", mode_name(mode),
+         static_cast<unsigned long long>(mb),
+         static_cast<unsigned long long>(captured / (1024 * 1024)), secs,
+         captured / (1024.0 * 1024.0) / secs,
+         static_cast<long long>(rss_after) - static_cast<long long>(rss_before));
+  fflush(stdout);
+
+  if (job->process_group > 0)
+    kill(-job->process_group, SIGKILL);
+  runner.stop();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  uint64_t mb = 64;
+  int tick_ms = 500;
+  int seconds = 10;
+  uint64_t log_mb = 64;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--mb") == 0 && i + 1 < argc) {
+      mb = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+      tick_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--log-mb") == 0 && i + 1 < argc) {
+      log_mb = strtoull(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr,
+              "Usage: bench_output [--mb N] [--tick-ms N] [--seconds N] [--log-mb N]\n");
+      return 1;
+    }
+  }
+
+  printf("%-8s %10s %10s %10s %12s %12s\n", "mode", "target_mb", "got_mb", "secs", "MB/s",
+         "rss_delta_kb");
+  // Spool first: RSS rarely shrinks once the string runs have grown it.
+  run(Mode::SPOOL, mb, tick_ms, seconds, log_mb);
+  run(Mode::REACTOR, mb, tick_ms, seconds, log_mb);
+  run(Mode::POLLING, mb, tick_ms, seconds, log_mb);
+  return 0;
+}
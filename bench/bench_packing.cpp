@@ -0,0 +1,185 @@
+// Utilization under count-based admission and under resource packing
+// (simulated).
+//
+//   bench_packing [--cores 16] [--jobs 2000] [--big-pct 10] [--big-cores 8]
+//                 [--big-ms 20000] [--small-ms 2000]
+//
+// A backlog of --jobs jobs is queued at t=0 in a fixed pseudo-random order:
+// --big-pct percent of them use --big-cores cores for --big-ms, the rest one
+// core for --small-ms, each declaring twice its run time as max_runtime_ms.
+// They run on a host of --cores cores, on a synthetic clock ticked every
+// 10ms, admitted three ways:
+//   count-safe  cores / big-cores running slots, so even all-big never
+//               overcommits; no requests declared
+//   count-full  one running slot per core; no requests declared
+//   packed      requests declared and packed into the host's cores, with
+//               backfill
+// Reported per mode: when the last job finished, mean and peak cores in use
+// (above --cores is overcommit), and the mean queue wait of big and small
+// jobs.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Options {
+  int cores = 16;
+  int jobs = 2000;
+  int big_pct = 10;
+  int big_cores = 8;
+  uint64_t big_ms = 20000;
+  uint64_t small_ms = 2000;
+};
+
+// "big" jobs run big_ms on big_cores, anything else small_ms on one core,
+// on the shared synthetic clock.
+class TimedSpawner : public heidi::IProcessSpawner {
+public:
+  TimedSpawner(const uint64_t* now_ms, const Options& opt) : now_ms_(now_ms), opt_(opt) {}
+
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    bool big = job.command == "big";
+    job.process_group = next_pgid_++;
+    live_[job.process_group] = {*now_ms_ + (big ? opt_.big_ms : opt_.small_ms),
+                                big ? opt_.big_cores : 1};
+    cores_in_use_ += big ? opt_.big_cores : 1;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    return true;
+  }
+  bool reap_job(heidi::Job& job, int* wait_status) override {
+    auto it = live_.find(job.process_group);
+    if (it == live_.end() || *now_ms_ < it->second.end_ms)
+      return false;
+    cores_in_use_ -= it->second.cores;
+    live_.erase(it);
+    *wait_status = 0;
+    return true;
+  }
+  int cores_in_use() const {
+    return cores_in_use_;
+  }
+
+private:
+  struct Live {
+    uint64_t end_ms;
+    int cores;
+  };
+  const uint64_t* now_ms_;
+  const Options& opt_;
+  // Far above pid_max, so a stray kill() cannot reach a real process group.
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_map<pid_t, Live> live_;
+  int cores_in_use_ = 0;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+enum class Mode { COUNT_SAFE, COUNT_FULL, PACKED };
+
+void run(const Options& opt, Mode mode) {
+  uint64_t now_ms = 0;
+  TimedSpawner spawner(&now_ms, opt);
+  FakeInspector inspector;
+  int slots = mode == Mode::COUNT_SAFE   ? std::max(opt.cores / opt.big_cores, 1)
+              : mode == Mode::COUNT_FULL ? opt.cores
+                                         : 1000;
+  heidi::JobRunner runner(slots, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = slots;
+  policy.max_queue_depth = opt.jobs + 1;
+  policy.min_start_gap_ms = 0;
+  policy.cpu_capacity_millicores = opt.cores * 1000;
+  runner.set_governor_policy(policy);
+  runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+  runner.set_output_reactor_enabled(false);
+
+  std::vector<std::pair<std::string, bool>> submitted;
+  uint32_t rng = 12345;
+  for (int i = 0; i < opt.jobs; ++i) {
+    rng = rng * 1103515245 + 12345;
+    bool big = static_cast<int>((rng >> 16) % 100) < opt.big_pct;
+    heidi::JobSpec spec;
+    spec.command = big ? "big" : "small";
+    heidi::JobLimits limits;
+    limits.max_runtime_ms = 2 * (big ? opt.big_ms : opt.small_ms);
+    if (mode == Mode::PACKED)
+      spec.resources.cpu_millicores = (big ? opt.big_cores : 1) * 1000;
+    submitted.emplace_back(runner.submit_job(spec, limits), big);
+  }
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  uint64_t core_ms = 0;
+  int peak = 0;
+  while (runner.count_jobs(heidi::JobStatus::COMPLETED) < static_cast<size_t>(opt.jobs)) {
+    runner.tick(now_ms, metrics, 64, 1000);
+    core_ms += spawner.cores_in_use() * 10;
+    peak = std::max(peak, spawner.cores_in_use());
+    now_ms += 10;
+  }
+
+  double wait_ms[2] = {0, 0};
+  size_t count[2] = {0, 0};
+  for (const auto& [id, big] : submitted) {
+    wait_ms[big] += runner.get_job_status(id)->started_at_ms;
+    count[big]++;
+  }
+  const char* name = mode == Mode::COUNT_SAFE   ? "count-safe"
+                     : mode == Mode::COUNT_FULL ? "count-full"
+                                                : "packed";
+  printf("%-11s %10.1f %10.1f %9d %13.0f %15.0f\n", name, now_ms / 1000.0,
+         static_cast<double>(core_ms) / now_ms, peak, count[1] ? wait_ms[1] / count[1] : 0.0,
+         count[0] ? wait_ms[0] / count[0] : 0.0);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+      opt.cores = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      opt.jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--big-pct") == 0 && i + 1 < argc) {
+      opt.big_pct = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--big-cores") == 0 && i + 1 < argc) {
+      opt.big_cores = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--big-ms") == 0 && i + 1 < argc) {
+      opt.big_ms = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--small-ms") == 0 && i + 1 < argc) {
+      opt.small_ms = strtoull(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: bench_packing [--cores N] [--jobs N] [--big-pct N] "
+                      "[--big-cores N] [--big-ms N] [--small-ms N]\n");
+      return 1;
+    }
+  }
+  if (opt.cores < 1 || opt.big_cores < 1 || opt.jobs < 1) {
+    fprintf(stderr, "--cores, --big-cores and --jobs must be positive\n");
+    return 1;
+  }
+
+  printf("%-11s %10s %10s %9s %13s %15s\n", "mode", "makespan_s", "mean_cores", "peak_cores",
+         "big_wait_ms", "small_wait_ms");
+  run(opt, Mode::COUNT_SAFE);
+  run(opt, Mode::COUNT_FULL);
+  run(opt, Mode::PACKED);
+  return 0;
+}
@@ -0,0 +1,136 @@
+// How soon a job that forks past its process cap is stopped: /proc scans on
+// the daemon's tick against process events.
+//
+//   bench_procevents [--children 100] [--cap 20] [--runs 5] [--tick-ms 500]
+//
+// Each run starts one real job that backgrounds --children `sleep 30`s at
+// once, under max_child_processes = --cap, with the runner ticked every
+// --tick-ms as the daemon does. Reported per inspector: the runs in which
+// the job was caught, and the mean and worst time from the job's start
+// until it was TERMINATING. The events inspector needs CAP_NET_ADMIN; it is
+// skipped without.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/proc_events.h"
+#include "heidi-kernel/process_inspector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+struct Options {
+  int children = 100;
+  int cap = 20;
+  int runs = 5;
+  uint64_t tick_ms = 500;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Milliseconds from start to TERMINATING for one run, or -1 if the job
+// never hit its cap.
+double run_once(const Options& opt, heidi::IProcessInspector* inspector) {
+  heidi::JobRunner runner(4, nullptr, inspector);
+  runner.set_timer_fd_enabled(true);
+  runner.start();
+  heidi::JobLimits limits;
+  limits.max_child_processes = opt.cap;
+  limits.kill_grace_ms = 100;
+  std::string id = runner.submit_job(
+      "for i in $(seq " + std::to_string(opt.children) + "); do sleep 30 & done; wait", limits);
+
+  std::atomic<bool> ticking{true};
+  Clock::time_point t0 = Clock::now();
+  std::thread ticker([&] {
+    heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+    uint64_t now_ms = 0;
+    while (ticking.load()) {
+      runner.tick(now_ms, metrics);
+      std::this_thread::sleep_for(std::chrono::milliseconds(opt.tick_ms));
+      now_ms += opt.tick_ms;
+    }
+  });
+
+  double ms = -1;
+  Clock::time_point started{};
+  for (;;) {
+    auto job = runner.get_job_status(id);
+    if (job->status == heidi::JobStatus::RUNNING && started == Clock::time_point{})
+      started = Clock::now();
+    if (job->status == heidi::JobStatus::TERMINATING || heidi::job_status_is_final(job->status)) {
+      if (job->status == heidi::JobStatus::TERMINATING ||
+          job->status == heidi::JobStatus::PROC_LIMIT)
+        ms = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+      break;
+    }
+    if (Clock::now() - t0 > std::chrono::seconds(20))
+      break;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  // Let the termination finish so the next run starts clean.
+  while (!heidi::job_status_is_final(runner.get_job_status(id)->status) &&
+         Clock::now() - t0 < std::chrono::seconds(30))
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ticking = false;
+  ticker.join();
+  runner.stop();
+  return ms;
+}
+
+void report(const char* name, const Options& opt, heidi::IProcessInspector* inspector) {
+  double sum = 0;
+  double worst = 0;
+  int hit = 0;
+  for (int i = 0; i < opt.runs; ++i) {
+    double ms = run_once(opt, inspector);
+    if (ms < 0)
+      continue;
+    sum += ms;
+    worst = std::max(worst, ms);
+    hit++;
+  }
+  printf("%-8s %6d %12.1f %12.1f\n", name, hit, hit ? sum / hit : 0.0, worst);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--children") == 0 && i + 1 < argc) {
+      opt.children = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cap") == 0 && i + 1 < argc) {
+      opt.cap = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      opt.runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+      opt.tick_ms = strtoull(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: bench_procevents [--children N] [--cap N] [--runs N] "
+                      "[--tick-ms N]\n");
+      return 1;
+    }
+  }
+  if (opt.cap < 1 || opt.children <= opt.cap || opt.runs < 1 || opt.tick_ms == 0) {
+    fprintf(stderr, "--cap, --runs and --tick-ms must be positive, --children above --cap\n");
+    return 1;
+  }
+
+  printf("%-8s %6s %12s %12s\n", "mode", "caught", "mean_ms", "worst_ms");
+  heidi::ProcfsProcessInspector procfs;
+  report("procfs", opt, &procfs);
+  heidi::ProcEventInspector events;
+  if (events.open())
+    report("events", opt, &events);
+  else
+    printf("%-8s skipped: process events connector unavailable\n", "events");
+  return 0;
+}
@@ -0,0 +1,164 @@
+// Cost per tick of the process-cap scan: a /proc walk per job against one
+// shared snapshot.
+//
+//   bench_procscan [--procs 2000] [--jobs 50] [--per-job 4] [--ticks 50] [--real]
+//
+// Builds a procfs lookalike of --procs processes under a temp directory,
+// --jobs process groups of --per-job processes among them and the rest
+// singletons, then times --ticks ticks of answering "how many processes in
+// each job's group" two ways:
+//   per-job   the pre-snapshot inspector: for every job, opendir the root and
+//             fopen/fgets/sscanf every <pid>/stat
+//   snapshot  ProcSnapshot::refresh() once, then a lookup per job
+// With --real both read the live /proc instead (the job groups then have no
+// members; only the cost of the walk is of interest).
+
+#include "heidi-kernel/proc_snapshot.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace {
+
+struct Options {
+  int procs = 2000;
+  int jobs = 50;
+  int per_job = 4;
+  int ticks = 50;
+  bool real = false;
+};
+
+// The inspector as it was: one full walk per question.
+int count_per_job(const std::string& root, pid_t pgid) {
+  DIR* dir = opendir(root.c_str());
+  if (!dir)
+    return -1;
+  int count = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_type != DT_DIR)
+      continue;
+    char* end;
+    pid_t pid = strtol(entry->d_name, &end, 10);
+    if (*end != '\0' || pid <= 0)
+      continue;
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%d/stat", root.c_str(), pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+      continue;
+    char buf[4096];
+    if (fgets(buf, sizeof(buf), f)) {
+      char* p = strrchr(buf, ')');
+      int ppid = 0;
+      int pgrp = 0;
+      if (p && sscanf(p + 1, " %*c %d %d", &ppid, &pgrp) == 2 && pgrp == pgid)
+        count++;
+    }
+    fclose(f);
+  }
+  closedir(dir);
+  return count;
+}
+
+void write_stat(const std::string& root, pid_t pid, pid_t pgrp) {
+  std::string dir = root + "/" + std::to_string(pid);
+  std::filesystem::create_directory(dir);
+  std::ofstream(dir + "/stat") << pid << " (worker) S 1 " << pgrp << " " << pgrp
+                               << " 0 -1 4194304 100 0 0 0 1 2 0 0 20 0 1 0 " << 1000 + pid
+                               << " 1000 10 18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0 17 0\n";
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--procs") == 0 && i + 1 < argc) {
+      opt.procs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      opt.jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--per-job") == 0 && i + 1 < argc) {
+      opt.per_job = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      opt.ticks = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--real") == 0) {
+      opt.real = true;
+    } else {
+      fprintf(stderr, "Usage: bench_procscan [--procs N] [--jobs N] [--per-job N] [--ticks N] "
+                      "[--real]\n");
+      return 1;
+    }
+  }
+  if (opt.jobs < 1 || opt.per_job < 1 || opt.ticks < 1 || opt.procs < opt.jobs * opt.per_job) {
+    fprintf(stderr, "--jobs, --per-job and --ticks must be positive, and --procs at least "
+                    "jobs * per-job\n");
+    return 1;
+  }
+
+  std::string root = "/proc";
+  std::vector<pid_t> pgids;
+  if (opt.real) {
+    // Far above pid_max, so no real group matches.
+    for (int j = 0; j < opt.jobs; ++j)
+      pgids.push_back((1 << 30) + j);
+  } else {
+    char tmpl[] = "/tmp/bench_procscan_XXXXXX";
+    if (!mkdtemp(tmpl)) {
+      perror("mkdtemp");
+      return 1;
+    }
+    root = tmpl;
+    pid_t pid = 100;
+    for (int j = 0; j < opt.jobs; ++j) {
+      pgids.push_back(pid);
+      pid_t leader = pid;
+      for (int k = 0; k < opt.per_job; ++k)
+        write_stat(root, pid++, leader);
+    }
+    for (int i = opt.jobs * opt.per_job; i < opt.procs; ++i, ++pid)
+      write_stat(root, pid, pid);
+  }
+
+  long per_job_sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < opt.ticks; ++t)
+    for (pid_t pgid : pgids)
+      per_job_sum += count_per_job(root, pgid);
+  double per_job_ms = ms_since(start) / opt.ticks;
+
+  heidi::ProcSnapshot snapshot(root);
+  long snapshot_sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int t = 0; t < opt.ticks; ++t) {
+    snapshot.refresh();
+    for (pid_t pgid : pgids)
+      snapshot_sum += snapshot.count(pgid);
+  }
+  double snapshot_ms = ms_since(start) / opt.ticks;
+
+  printf("root=%s procs_seen=%zu jobs=%d ticks=%d\n", root.c_str(), snapshot.size(), opt.jobs,
+         opt.ticks);
+  printf("%-9s %12s %12s\n", "mode", "ms_per_tick", "matched");
+  printf("%-9s %12.3f %12ld\n", "per-job", per_job_ms, per_job_sum / opt.ticks);
+  printf("%-9s %12.3f %12ld\n", "snapshot", snapshot_ms, snapshot_sum / opt.ticks);
+  if (per_job_sum != snapshot_sum)
+    fprintf(stderr, "mismatch: per-job counted %ld, snapshot %ld\n", per_job_sum, snapshot_sum);
+
+  if (!opt.real)
+    std::filesystem::remove_all(root);
+  return per_job_sum == snapshot_sum ? 0 : 1;
+}
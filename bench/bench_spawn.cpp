@@ -0,0 +1,116 @@
+// Spawn throughput of each RealProcessSpawner backend as daemon RSS grows.
+//
+//   bench_spawn [--rss-mb 100,1024,4096] [--spawns 200]
+//
+// A ballast region of the requested size is allocated and touched so that it
+// is resident (and has populated page tables) before each backend spawns
+// `/bin/sh -c true` in a loop. Sizes that do not fit in MemAvailable are
+// reported as skipped.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::vector<size_t> parse_sizes(const char* arg) {
+  std::vector<size_t> sizes;
+  std::string s(arg);
+  size_t pos = 0;
+  while (pos < s.size()) {
+    size_t comma = s.find(',', pos);
+    if (comma == std::string::npos)
+      comma = s.size();
+    sizes.push_back(std::stoull(s.substr(pos, comma - pos)));
+    pos = comma + 1;
+  }
+  return sizes;
+}
+
+double run_backend(heidi::SpawnBackend backend, int spawns) {
+  heidi::RealProcessSpawner spawner(backend);
+  auto one = [&]() {
+    heidi::Job job;
+    job.command = "true";
+    int out_fd = -1, err_fd = -1;
+    if (!spawner.spawn_job(job, &out_fd, &err_fd)) {
+      fprintf(stderr, "spawn failed: %s\n", job.error.c_str());
+      exit(1);
+    }
+    close(out_fd);
+    close(err_fd);
+    waitpid(job.process_group, nullptr, 0);
+    if (job.pidfd >= 0)
+      close(job.pidfd);
+  };
+
+  for (int i = 0; i < 5; ++i)
+    one();
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < spawns; ++i)
+    one();
+  double secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return spawns / secs;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<size_t> sizes_mb = {100, 1024, 4096};
+  int spawns = 200;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--rss-mb") == 0 && i + 1 < argc) {
+      sizes_mb = parse_sizes(argv[++i]);
+    } else if (strcmp(argv[i], "--spawns") == 0 && i + 1 < argc) {
+      spawns = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_spawn [--rss-mb 100,1024,4096] [--spawns N]\n");
+      return 1;
+    }
+  }
+
+  const heidi::SpawnBackend backends[] = {heidi::SpawnBackend::FORK,
+                                          heidi::SpawnBackend::POSIX_SPAWN,
+                                          heidi::SpawnBackend::VFORK};
+
+  printf("%-10s %-12s %12s %12s\n", "rss_mb", "backend", "spawns/sec", "us/spawn");
+  for (size_t mb : sizes_mb) {
+    size_t bytes = mb * 1024 * 1024;
+    uint64_t avail_kb = heidi::MetricsSampler().sample().mem.available;
+    if (bytes / 1024 > avail_kb * 9 / 10) {
+      printf("%-10zu %-12s %12s %12s\n", mb, "-", "skipped", "(no memory)");
+      continue;
+    }
+
+    void* ballast =
+        mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ballast == MAP_FAILED) {
+      printf("%-10zu %-12s %12s %12s\n", mb, "-", "skipped", "(mmap)");
+      continue;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < bytes; off += page)
+      static_cast<char*>(ballast)[off] = 1;
+
+    for (auto backend : backends) {
+      double rate = run_backend(backend, spawns);
+      printf("%-10zu %-12s %12.1f %12.1f\n", mb, heidi::spawn_backend_name(backend), rate,
+             1e6 / rate);
+    }
+    munmap(ballast, bytes);
+  }
+  return 0;
+}
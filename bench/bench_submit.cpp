@@ -0,0 +1,155 @@
+// Submit latency under contention.
+//
+//   bench_submit [--threads 16] [--jobs 5000] [--gap-us 50] [--spawn-us 2000]
+//                [--tick-ms 10]
+//
+// --threads clients each submit --jobs jobs, pausing --gap-us between
+// submissions, while the main thread ticks the runner every --tick-ms. The
+// fake spawner sleeps --spawn-us per spawn, standing in for fork/exec and the
+// getpgid() retries a real spawn may spend inside tick(). Reported are
+// submit_job() latency percentiles over all clients, the NACK count, and the
+// mean time a tick took.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Spawns take spawn_us; every job finishes as soon as it is reaped.
+class SlowSpawner : public heidi::IProcessSpawner {
+public:
+  explicit SlowSpawner(int spawn_us) : spawn_us_(spawn_us) {}
+
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(spawn_us_));
+    job.process_group = next_pgid_++;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    return true;
+  }
+  bool reap_job(heidi::Job&, int* wait_status) override {
+    *wait_status = 0;
+    return true;
+  }
+
+private:
+  int spawn_us_;
+  // Far above pid_max, so a stray kill() cannot reach a real process group.
+  pid_t next_pgid_ = 1 << 30;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t i = static_cast<size_t>(p / 100.0 * (sorted.size() - 1));
+  return sorted[i];
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  int threads = 16;
+  int jobs = 5000;
+  int gap_us = 50;
+  int spawn_us = 2000;
+  int tick_ms = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--gap-us") == 0 && i + 1 < argc) {
+      gap_us = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--spawn-us") == 0 && i + 1 < argc) {
+      spawn_us = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+      tick_ms = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_submit [--threads N] [--jobs N] [--gap-us N] "
+                      "[--spawn-us N] [--tick-ms N]\n");
+      return 1;
+    }
+  }
+
+  SlowSpawner spawner(spawn_us);
+  FakeInspector inspector;
+  heidi::JobRunner runner(1000, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = 1000;
+  policy.max_queue_depth = threads * jobs + 1;
+  policy.min_start_gap_ms = 0;
+  runner.set_governor_policy(policy);
+  runner.set_output_reactor_enabled(false);
+  runner.start();
+
+  std::atomic<int> clients_left{threads};
+  std::vector<std::vector<double>> latencies(threads);
+  std::vector<size_t> nacks(threads, 0);
+  std::vector<std::thread> clients;
+  for (int t = 0; t < threads; ++t) {
+    clients.emplace_back([&, t] {
+      latencies[t].reserve(jobs);
+      for (int i = 0; i < jobs; ++i) {
+        auto start = Clock::now();
+        bool nacked = runner.submit_job("true").empty();
+        latencies[t].push_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        nacks[t] += nacked;
+        if (gap_us > 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+      }
+      clients_left--;
+    });
+  }
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  uint64_t now_ms = 1000;
+  int ticks = 0;
+  double tick_total_ms = 0;
+  while (clients_left.load() > 0) {
+    auto start = Clock::now();
+    runner.tick(now_ms, metrics, 5, 10);
+    tick_total_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    ticks++;
+    now_ms += tick_ms;
+    std::this_thread::sleep_for(std::chrono::milliseconds(tick_ms));
+  }
+  for (auto& client : clients)
+    client.join();
+  runner.stop();
+
+  std::vector<double> all;
+  size_t total_nacks = 0;
+  for (int t = 0; t < threads; ++t) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    total_nacks += nacks[t];
+  }
+  std::sort(all.begin(), all.end());
+
+  printf("%-8s %8s %10s %10s %10s %10s %8s %12s\n", "threads", "submits", "p50_us", "p99_us",
+         "p999_us", "max_us", "nacks", "mean_tick_ms");
+  printf("%-8d %8zu %10.2f %10.2f %10.2f %10.2f %8zu %12.2f\n", threads, all.size(),
+         percentile(all, 50), percentile(all, 99), percentile(all, 99.9), all.back(), total_nacks,
+         ticks > 0 ? tick_total_ms / ticks : 0.0);
+  return 0;
+}
@@ -0,0 +1,136 @@
+// Cost of JobRunner::tick() as finished jobs pile up.
+//
+//   bench_tick [--completed 100000] [--running 50] [--ticks 1000]
+//
+// A fake spawner stands in for processes: the first --completed jobs exit as
+// soon as they are reaped, the last --running stay up. Reported is the mean
+// tick time with no history and again once all completed jobs are retained;
+// with status-indexed job lists the two should match. recent_us is the mean
+// cost of get_recent_jobs(10), which holds the runner lock like tick() does.
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+// Jobs are "running" until reaped; pgids in `finished` reap at once.
+class FakeSpawner : public heidi::IProcessSpawner {
+public:
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    job.process_group = next_pgid_++;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    if (finish_new_jobs)
+      finished_.insert(job.process_group);
+    return true;
+  }
+  bool reap_job(heidi::Job& job, int* wait_status) override {
+    if (finished_.erase(job.process_group) == 0)
+      return false;
+    *wait_status = 0;
+    return true;
+  }
+
+  bool finish_new_jobs = true;
+
+private:
+  // Far above pid_max, so a stray kill() cannot reach a real process group.
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_set<pid_t> finished_;
+};
+
+// Every job is within its process limit; keeps /proc out of the numbers.
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+double mean_tick_us(heidi::JobRunner& runner, int ticks, uint64_t& now_ms) {
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ticks; ++i)
+    runner.tick(now_ms++, metrics, 5, 10);
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+             .count() /
+         ticks;
+}
+
+double mean_recent_us(heidi::JobRunner& runner, int calls) {
+  size_t seen = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i)
+    seen += runner.get_recent_jobs(10).size();
+  double us =
+      std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  return seen > 0 ? us / calls : 0.0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  size_t completed = 100000;
+  size_t running = 50;
+  int ticks = 1000;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--completed") == 0 && i + 1 < argc) {
+      completed = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--running") == 0 && i + 1 < argc) {
+      running = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      ticks = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: bench_tick [--completed N] [--running N] [--ticks N]\n");
+      return 1;
+    }
+  }
+
+  FakeSpawner spawner;
+  FakeInspector inspector;
+  heidi::JobRunner runner(running + 1000, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = 1000;
+  policy.max_queue_depth = static_cast<int>(completed + running + 1);
+  runner.set_governor_policy(policy);
+  // Keep every finished job: the point is a large retained history.
+  runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  heidi::JobLimits limits;
+  limits.max_runtime_ms = UINT64_MAX / 2;
+  uint64_t now_ms = 1;
+
+  spawner.finish_new_jobs = false;
+  for (size_t i = 0; i < running; ++i)
+    runner.submit_job("sleep", limits);
+  runner.tick(now_ms++, metrics, running, 0);
+  double empty_us = mean_tick_us(runner, ticks, now_ms);
+  double empty_recent_us = mean_recent_us(runner, ticks);
+
+  // Churn through the completed jobs: start them in large batches and let
+  // the limit scan reap them.
+  spawner.finish_new_jobs = true;
+  for (size_t i = 0; i < completed; ++i)
+    runner.submit_job("true", limits);
+  while (runner.count_jobs(heidi::JobStatus::COMPLETED) < completed)
+    runner.tick(now_ms++, metrics, 1000, 2000);
+  double full_us = mean_tick_us(runner, ticks, now_ms);
+  double full_recent_us = mean_recent_us(runner, std::max(ticks / 100, 1));
+
+  printf("%-12s %10s %10s %12s %12s\n", "history", "running", "ticks", "tick_us", "recent_us");
+  printf("%-12zu %10zu %10d %12.2f %12.2f\n", static_cast<size_t>(0), running, ticks, empty_us,
+         empty_recent_us);
+  printf("%-12zu %10zu %10d %12.2f %12.2f\n", completed, running, ticks, full_us,
+         full_recent_us);
+  return 0;
+}
@@ -0,0 +1,115 @@
+// How late job timeouts fire as the number of running jobs grows.
+//
+//   bench_timeouts [--jobs 100,1000,10000] [--scans 10]
+//
+// Starts --jobs never-ending fake jobs with max_runtime_ms spread over
+// 1000..1999 and ticks every (synthetic) millisecond with --scans limit
+// scans per tick until all have timed out. Lateness is how far past its
+// deadline each job was ended, in ms (= ticks).
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Jobs never exit on their own.
+class FakeSpawner : public heidi::IProcessSpawner {
+public:
+  bool spawn_job(heidi::Job& job, int* stdout_fd, int* stderr_fd) override {
+    // Far above pid_max, so a stray kill() cannot reach a real process group.
+    job.process_group = next_pgid_++;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    return true;
+  }
+  bool reap_job(heidi::Job&, int*) override {
+    return false;
+  }
+
+private:
+  pid_t next_pgid_ = 1 << 30;
+};
+
+class FakeInspector : public heidi::IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+void run(size_t jobs, size_t scans) {
+  FakeSpawner spawner;
+  FakeInspector inspector;
+  heidi::JobRunner runner(jobs, &spawner, &inspector);
+  heidi::GovernorPolicy policy;
+  policy.max_running_jobs = static_cast<int>(jobs);
+  policy.max_queue_depth = static_cast<int>(jobs + 1);
+  runner.set_governor_policy(policy);
+  runner.set_retention_policy(heidi::RetentionPolicy{0, 0, 0});
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  std::vector<std::string> ids;
+  for (size_t i = 0; i < jobs; ++i) {
+    heidi::JobLimits limits;
+    limits.max_runtime_ms = 1000 + i % 1000;
+    ids.push_back(runner.submit_job("sleep", limits));
+  }
+  uint64_t now_ms = 0;
+  runner.tick(now_ms, metrics, jobs, 0);
+  std::vector<std::shared_ptr<heidi::Job>> started;
+  for (const auto& id : ids)
+    started.push_back(runner.get_job_status(id));
+
+  while (runner.count_jobs(heidi::JobStatus::TIMEOUT) < jobs && now_ms < 10000000)
+    runner.tick(++now_ms, metrics, 0, scans);
+
+  std::vector<uint64_t> lateness;
+  for (const auto& job : started) {
+    uint64_t deadline = job->started_at_ms + job->max_runtime_ms + 1;
+    lateness.push_back(job->ended_at_ms > deadline ? job->ended_at_ms - deadline : 0);
+  }
+  std::sort(lateness.begin(), lateness.end());
+  double sum = 0;
+  for (uint64_t l : lateness)
+    sum += l;
+  printf("%-8zu %8zu %12.1f %10llu %10llu\n", jobs, scans, sum / jobs,
+         static_cast<unsigned long long>(lateness[jobs * 99 / 100]),
+         static_cast<unsigned long long>(lateness.back()));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<size_t> job_counts = {100, 1000, 10000};
+  size_t scans = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      job_counts.clear();
+      for (char* p = argv[++i]; *p;) {
+        job_counts.push_back(strtoull(p, &p, 10));
+        if (*p == ',')
+          ++p;
+      }
+    } else if (strcmp(argv[i], "--scans") == 0 && i + 1 < argc) {
+      scans = strtoull(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: bench_timeouts [--jobs N,N,...] [--scans N]\n");
+      return 1;
+    }
+  }
+
+  printf("%-8s %8s %12s %10s %10s\n", "jobs", "scans", "mean_late", "p99_late", "max_late");
+  for (size_t jobs : job_counts)
+    run(jobs, scans);
+  return 0;
+}
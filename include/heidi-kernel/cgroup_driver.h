@@ -1,10 +1,15 @@
 #pragma once
 
+#include "heidi-kernel/cgroup_handle.h"
 #include "heidi-kernel/gov_rule.h"
 
 #include <cstdint>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
 
 namespace heidi {
 namespace gov {
@@ -19,6 +24,11 @@ public:
   };
 
   CgroupDriver();
+  // Detects cgroup v2 at base_path, creating it if missing (only inside a
+  // cgroup2 mount), and keeps the driver's cgroups under it. Any of the
+  // cpu, memory and pids controllers the parent delegates are enabled for
+  // those cgroups. Tests point this at a delegated subtree.
+  explicit CgroupDriver(const std::string& base_path);
   ~CgroupDriver();
 
   bool is_available() const {
@@ -42,19 +52,85 @@ public:
     Capability applied = Capability::NONE;
   };
 
+  // Puts pid in a cgroup of its own, <base_path>/<pid>, on the first call
+  // and sets the limits of the given policies. The cgroup's handle is kept
+  // until cleanup(pid), so later calls for the pid only write the limits:
+  // no path lookup and, unless a write fails, no allocation. Thread-safe.
   ApplyResult apply(int32_t pid, const CpuPolicy& cpu, const MemPolicy& mem,
                     const PidsPolicy& pids);
+  // Writes the limits of the given policies to an open cgroup. Every write
+  // is attempted; the result reports the first that failed.
+  ApplyResult apply(CgroupHandle& cgroup, const CpuPolicy& cpu, const MemPolicy& mem,
+                    const PidsPolicy& pids) const;
 
   void cleanup(int32_t pid);
 
+  const std::string& base_path() const {
+    return base_path_;
+  }
+
+  // Job containers are pooled cgroups, driven through their CgroupHandle;
+  // see acquire_job_cgroup().
+  //
+  // rmdir of a cgroup release_job_cgroup() found busy. Returns 0 or an
+  // errno value, EBUSY while processes remain.
+  int remove_job_cgroup(const std::string& path);
+
+  // Processes in the cgroup: pids.current where the pids controller is
+  // enabled (which counts threads as well), cgroup.procs lines otherwise.
+  // -1 when neither can be read. One pread() on a file the handle keeps open.
+  int count_processes(CgroupHandle& cgroup) const;
+  // 1 or 0 from a cgroup.events fd, -1 on error.
+  static int read_populated(int events_fd);
+
+  // A job cgroup taken from the pool: its path and a handle on it, opened
+  // for clone3 (CLONE_INTO_CGROUP takes handle.dir_fd()). Files the handle
+  // opened stay open while the cgroup sits in the pool.
+  struct JobCgroup {
+    std::string path;
+    CgroupHandle handle;
+  };
+
+  // Empty cgroups made ahead of time, <base_path>/cg_<n>, so a job is put
+  // in one without a cgroup syscall on its spawn path. Cgroups of finished
+  // jobs go back in once empty. Thread-safe.
+  void set_pool_size(size_t size);
+  // Creates cgroups until the pool holds its size; off the spawn path.
+  // Returns how many were made.
+  size_t refill_pool();
+  size_t pooled() const;
+  // A pooled cgroup, or a new one when the pool is empty. Returns 0 or an
+  // errno value.
+  int acquire_job_cgroup(JobCgroup* cgroup);
+  // Puts an empty cgroup back in the pool, or removes it when the pool is
+  // full, and clears the JobCgroup. With processes left, EBUSY is returned
+  // and only the path is kept (the handle is closed), for a later
+  // remove_job_cgroup().
+  int release_job_cgroup(JobCgroup* cgroup);
+
 private:
   bool detect();
-  bool create_base_dir();
+  // Sets *created if it made the directory, for detect() to take it back.
+  bool create_base_dir(bool* created);
+  void enable_controllers();
+  // mkdir <base_path>/<name> and open a handle on it.
+  int make_pooled(const char* name, JobCgroup* cgroup);
 
   bool available_ = false;
   bool enabled_ = false;
   Capability capability_ = Capability::NONE;
   std::string base_path_;
+  CgroupHandle base_;
+
+  static constexpr size_t kDefaultPoolSize = 16;
+
+  mutable std::mutex pool_mutex_;
+  std::vector<JobCgroup> pool_;
+  size_t pool_size_ = kDefaultPoolSize;
+  uint64_t next_pooled_ = 1;
+
+  std::mutex pid_cgroups_mutex_;
+  std::unordered_map<int32_t, CgroupHandle> pid_cgroups_;
 };
 
 constexpr CgroupDriver::Capability operator|(CgroupDriver::Capability a,
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace heidi {
+namespace gov {
+
+// An open cgroup v2 directory. Control and stat files are opened relative
+// to its directory fd on first use and stay open until close(), so a limit
+// update is one pwrite() and a stat read one pread() into a stack buffer:
+// no path building, no allocation. Methods return 0 or an errno value. Not
+// thread-safe; moving the handle moves its fds.
+class CgroupHandle {
+public:
+  // Written as "max".
+  static constexpr uint64_t kUnlimited = UINT64_MAX;
+
+  CgroupHandle();
+  ~CgroupHandle();
+  CgroupHandle(CgroupHandle&& other) noexcept;
+  CgroupHandle& operator=(CgroupHandle&& other) noexcept;
+  CgroupHandle(const CgroupHandle&) = delete;
+  CgroupHandle& operator=(const CgroupHandle&) = delete;
+
+  // Opens the directory O_PATH, which is all openat() needs. for_clone opens
+  // it O_RDONLY instead, as clone3's CLONE_INTO_CGROUP rejects O_PATH fds.
+  int open(const char* path, bool for_clone = false);
+  int open_at(int parent_fd, const char* name, bool for_clone = false);
+  void close();
+
+  bool is_open() const {
+    return dir_fd_ >= 0;
+  }
+  int dir_fd() const {
+    return dir_fd_;
+  }
+
+  int move_pid(pid_t pid);
+  // quota_us of every period_us, or kUnlimited.
+  int set_cpu_max(uint64_t quota_us, uint64_t period_us);
+  int set_memory_max(uint64_t bytes);
+  int set_pids_max(uint64_t max);
+  // SIGKILLs every process in the cgroup, and those it forks meanwhile,
+  // through cgroup.kill (Linux 5.14); older kernels get signal(SIGKILL).
+  int kill();
+  // Sends sig to every process listed in cgroup.procs.
+  int signal(int sig);
+  // Lines of cgroup.procs, or -1.
+  int count_procs();
+
+  // A fresh fd on cgroup.events for the caller to own and poll (EPOLLPRI).
+  int open_events(int* fd) const;
+
+  enum Stat : unsigned {
+    STAT_PIDS = 1 << 0,
+    STAT_MEMORY = 1 << 1,
+    STAT_CPU = 1 << 2,
+    STAT_POPULATED = 1 << 3,
+  };
+  // -1 where not requested or not readable.
+  struct Stats {
+    int64_t pids_current = -1;
+    int64_t memory_current = -1;
+    int64_t cpu_usage_usec = -1;
+    int populated = -1;
+  };
+  // Reads every stat in the which mask in one pass, one pread() each.
+  // Returns 0, or the errno of the first that failed; the others are still
+  // read.
+  int read_stats(unsigned which, Stats* stats);
+
+private:
+  enum File : uint8_t {
+    PROCS_WRITE,
+    PROCS_READ,
+    KILL,
+    CPU_MAX,
+    MEMORY_MAX,
+    PIDS_MAX,
+    PIDS_CURRENT,
+    MEMORY_CURRENT,
+    CPU_STAT,
+    EVENTS,
+    FILE_COUNT,
+  };
+
+  // The file's fd, opening it first if need be; -1 with errno set.
+  int file_fd(File file);
+  int write_file(File file, const char* value, size_t len);
+  // Reads the start of the file into buf, NUL-terminated. Returns the
+  // length, or -1 with errno set.
+  ssize_t read_file(File file, char* buf, size_t size);
+  template <typename Fn>
+  int for_each_proc(Fn fn);
+
+  int dir_fd_ = -1;
+  std::array<int, FILE_COUNT> fds_;
+};
+
+} // namespace gov
+} // namespace heidi
@@ -4,6 +4,7 @@
 #include "heidi-kernel/metrics.h"
 #include "heidi-kernel/resource_governor.h"
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <string>
@@ -14,6 +15,11 @@ namespace heidi {
 
 class MetricsHistory;
 class JobRunner;
+class ProcEventInspector;
+
+namespace gov {
+class CgroupDriver;
+}
 
 class Daemon {
 public:
@@ -28,10 +34,19 @@ public:
 
   std::string update_policy(const std::string& json_body);
 
+  // job batch [<job option>...] [best_effort|all_or_nothing] <count>, where
+  // the options are those of `job run` (group=, priority=, cpu=, mem=,
+  // pids=), followed by <count> lines of one shell command each; body holds
+  // the part already read from the client, the rest is read from client_fd.
+  // Replies with the range of job ids queued.
+  std::string submit_job_batch(const std::string& request, std::string body, int client_fd);
+
 private:
   void sampling_thread();
   void monitor_loop();
   void handle_monitor_tick();
+  // Re-arms pressure_triggers_ from the policy's stall thresholds.
+  void arm_pressure_triggers();
 
   std::string socket_path_;
   std::string state_dir_;
@@ -45,6 +60,13 @@ private:
   std::condition_variable cv_;
   std::mutex cv_mutex_;
 
+  // Owned; null means JobRunner's default spawner. Selected by HK_SPAWNER.
+  IProcessSpawner* spawner_;
+  // Owned; null means JobRunner's default inspector. Selected by
+  // HK_PROC_EVENTS.
+  ProcEventInspector* proc_events_;
+  // Owned; null unless HK_CGROUP_ROOT names a usable cgroup v2 directory.
+  gov::CgroupDriver* cgroups_;
   JobRunner* job_runner_;
   ResourceGovernor* governor_;
 
@@ -52,7 +74,6 @@ private:
   mutable std::mutex governor_mutex_;
   int running_jobs_ = 0;
   int queued_jobs_ = 0;
-  int rejected_jobs_ = 0;
   BlockReason blocked_reason_ = BlockReason::NONE;
   uint64_t retry_after_ms_ = 0;
   TickDiagnostics last_tick_diagnostics_;
@@ -62,6 +83,14 @@ private:
   // Monitor timer
   int timer_fd_ = -1;
   std::thread monitor_thread_;
+
+  // Pressure is read from this cgroup's files where set (HK_PRESSURE_CGROUP).
+  std::string pressure_cgroup_;
+  // PSI triggers the monitor thread polls next to its timer; only that
+  // thread touches them, re-arming when a policy update marks them stale.
+  PressureTriggers pressure_triggers_;
+  std::atomic<bool> pressure_triggers_stale_{true};
+  std::atomic<size_t> pressure_trigger_count_{0};
 };
 
 } // namespace heidi
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+
+namespace heidi {
+
+// Links embedded in an element of an IntrusiveList. An element can be on as
+// many lists as it has hooks, but on at most one list per hook.
+template <typename T> struct ListHook {
+  T* prev = nullptr;
+  T* next = nullptr;
+};
+
+// Doubly linked list threaded through ListHook members of its elements, so
+// linking and unlinking never allocate. The list does not own its elements;
+// an element must be removed before it is destroyed.
+template <typename T, ListHook<T> T::*Hook> class IntrusiveList {
+public:
+  IntrusiveList() = default;
+  IntrusiveList(const IntrusiveList&) = delete;
+  IntrusiveList& operator=(const IntrusiveList&) = delete;
+
+  bool empty() const {
+    return size_ == 0;
+  }
+  size_t size() const {
+    return size_;
+  }
+  T* front() const {
+    return head_;
+  }
+  T* back() const {
+    return tail_;
+  }
+  static T* next(const T& item) {
+    return (item.*Hook).next;
+  }
+  static T* prev(const T& item) {
+    return (item.*Hook).prev;
+  }
+  // Whether item is on this list, given it is on no other list through the
+  // same hook.
+  bool contains(const T& item) const {
+    return (item.*Hook).prev != nullptr || head_ == &item;
+  }
+
+  void push_back(T& item) {
+    ListHook<T>& hook = item.*Hook;
+    hook.prev = tail_;
+    hook.next = nullptr;
+    if (tail_)
+      (tail_->*Hook).next = &item;
+    else
+      head_ = &item;
+    tail_ = &item;
+    ++size_;
+  }
+
+  void remove(T& item) {
+    ListHook<T>& hook = item.*Hook;
+    if (hook.prev)
+      (hook.prev->*Hook).next = hook.next;
+    else
+      head_ = hook.next;
+    if (hook.next)
+      (hook.next->*Hook).prev = hook.prev;
+    else
+      tail_ = hook.prev;
+    hook.prev = nullptr;
+    hook.next = nullptr;
+    --size_;
+  }
+
+  T* pop_front() {
+    T* item = head_;
+    if (item)
+      remove(*item);
+    return item;
+  }
+
+private:
+  T* head_ = nullptr;
+  T* tail_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace heidi
@@ -7,7 +7,11 @@
 namespace heidi {
 
 struct IpcMessage {
+  // The request line.
   std::string type;
+  // Whatever the client sent after the request line in the same read; the
+  // start of a multi-line request such as `job batch`.
+  std::string body;
 };
 
 class IpcProtocol {
@@ -28,11 +32,19 @@ public:
     request_handler_ = handler;
   }
 
+  // Consulted before the request handler. It may read the rest of a
+  // multi-line request and write its response straight to the client fd
+  // (e.g. with sendfile), and returns true if it handled the request.
+  void set_stream_handler(std::function<bool(const IpcMessage&, int)> handler) {
+    stream_handler_ = handler;
+  }
+
 private:
   void handle_client(int client_fd);
   std::string path_;
   int server_fd_ = -1;
   std::function<std::string(const std::string&)> request_handler_;
+  std::function<bool(const IpcMessage&, int)> stream_handler_;
 };
 
 } // namespace heidi
\ No newline at end of file
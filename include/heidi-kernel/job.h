@@ -1,29 +1,87 @@
 #pragma once
 
+#include "cgroup_handle.h"
+#include "intrusive_list.h"
+#include "line_framer.h"
+#include "log_ring.h"
+#include "log_spool.h"
 #include "metrics.h"
+#include "mpsc_queue.h"
 #include "process_inspector.h"
 #include "resource_governor.h"
+#include "timer_wheel.h"
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 namespace heidi {
 
+class JobArchive;
+class OutputReactor;
+struct JobGroup;
+
+namespace gov {
+class CgroupDriver;
+}
+
 struct JobLimits {
   uint64_t max_runtime_ms = 600000;
   uint64_t max_log_bytes = 10485760;
+  // Bytes at the start of each stream kept when the log is capped (at most
+  // half of the stream's share of max_log_bytes).
+  uint64_t log_head_bytes = 65536;
   uint64_t max_output_line_bytes = 65536;
   int max_child_processes = 64;
+  // Processes the job may start per kSpawnWindowMs; 0 is unlimited. Only
+  // enforced with an inspector that follows process creation.
+  int max_spawns_per_window = 0;
+  // Between SIGTERM and SIGKILL when the job is cancelled or hits a limit.
   uint64_t kill_grace_ms = 2000;
 };
 
+// How a job's program is started. SHELL runs `command` through /bin/sh -c.
+// DIRECT execs argv[0] (resolved against PATH by the daemon) with argv as
+// given, saving the shell's exec and startup for simple commands.
+enum class ExecMode { SHELL, DIRECT };
+
+// Scheduling class. Queued jobs of a higher class start before any of a
+// lower one, and under preemption (GovernorPolicy::preempt_on_pressure) the
+// lowest classes are frozen first.
+enum class JobPriority { BATCH, NORMAL, INTERACTIVE };
+
+inline constexpr size_t kJobPriorityCount = static_cast<size_t>(JobPriority::INTERACTIVE) + 1;
+
+const char* job_priority_name(JobPriority priority);
+// "batch", "normal" or "interactive".
+bool parse_job_priority(const std::string& name, JobPriority* priority);
+
+// What to run. The plain-string submit_job() overload is shorthand for a
+// SHELL spec with only `command` set.
+struct JobSpec {
+  ExecMode exec_mode = ExecMode::SHELL;
+  std::string command;           // SHELL
+  std::vector<std::string> argv; // DIRECT
+  // Complete environment as KEY=VALUE entries; empty inherits the daemon's.
+  std::vector<std::string> env;
+  // Working directory; empty inherits the daemon's.
+  std::string cwd;
+  // Tenant the job is queued and capped under (see
+  // JobRunner::set_group_share()); empty is the default group.
+  std::string group;
+  JobPriority priority = JobPriority::NORMAL;
+  // Reserved from the governor's capacity while the job runs; a job starts
+  // only once its request fits.
+  ResourceRequest resources;
+};
+
 enum class JobStatus {
   QUEUED,
   STARTING,
@@ -32,16 +90,64 @@ enum class JobStatus {
   FAILED,
   CANCELLED,
   TIMEOUT,
-  PROC_LIMIT
+  PROC_LIMIT,
+  // Signalled to stop (cancel or a limit) and waiting for its process group
+  // to go away; ends as Job::end_status. After the final statuses so
+  // archived values stay stable.
+  TERMINATING,
+  // Frozen with SIGSTOP under resource pressure to make way for a higher
+  // priority class; resumed as RUNNING. Holds its group's slot but not one
+  // of the runner's.
+  SUSPENDED
 };
 
-struct Job {
+inline constexpr size_t kJobStatusCount = static_cast<size_t>(JobStatus::SUSPENDED) + 1;
+
+const char* job_status_name(JobStatus status);
+// COMPLETED, FAILED, CANCELLED, TIMEOUT and PROC_LIMIT: the job will not run
+// (again).
+bool job_status_is_final(JobStatus status);
+
+// How many finished jobs the runner keeps in memory. Past any limit the
+// oldest finished jobs are evicted, into the archive when one is enabled.
+// A zero limit is not enforced.
+struct RetentionPolicy {
+  size_t max_finished_jobs = 10000;
+  uint64_t max_finished_age_ms = 24 * 60 * 60 * 1000;
+  // Retained log bytes (in memory or spooled) over all finished jobs.
+  uint64_t max_finished_log_bytes = 256 * 1024 * 1024;
+  // Caps on the job archive, when there is one: bytes on disk (logs and
+  // records), and time since a job ended. Past either the oldest archived
+  // jobs are dropped. 0 disables a cap.
+  uint64_t max_archive_bytes = 4ull * 1024 * 1024 * 1024;
+  uint64_t max_archive_age_ms = 7ull * 24 * 60 * 60 * 1000;
+};
+
+struct Job : std::enable_shared_from_this<Job> {
   std::string id;
+  // Submission order; id is "job_<seq>".
+  uint64_t seq = 0;
   std::string command;
+  ExecMode exec_mode = ExecMode::SHELL;
+  std::vector<std::string> argv;
+  std::vector<std::string> env;
+  std::string cwd;
+  std::string group;
+  JobPriority priority = JobPriority::NORMAL;
+  ResourceRequest resources;
   JobStatus status = JobStatus::QUEUED;
   int exit_code = -1;
-  std::string output;
+  // Captured stdout/stderr, sized by init_job_logs(), and the line framing
+  // (max_output_line_bytes) applied on the way in.
+  LogRing stdout_log;
+  LogRing stderr_log;
+  LineFramer stdout_lines;
+  LineFramer stderr_lines;
+  // Why the spawn failed, if it did.
   std::string error;
+  // Set when the runner spools output to files; the logs then stay empty and
+  // the framers index the spool's streams instead.
+  std::shared_ptr<JobSpool> spool;
   bool log_truncated = false;
   uint64_t bytes_written = 0;
   std::chrono::system_clock::time_point created_at;
@@ -49,6 +155,10 @@ struct Job {
   std::chrono::system_clock::time_point finished_at;
   uint64_t started_at_ms = 0;
   uint64_t ended_at_ms = 0;
+  // Time spent SUSPENDED, which does not count against max_runtime_ms, and
+  // when the current suspension began.
+  uint64_t suspended_ms = 0;
+  uint64_t suspended_at_ms = 0;
   pid_t process_group = -1;
   // start_time (boot-time ticks) of the leader process at spawn time. Used to
   // validate that a later-observed process group leader is the same process
@@ -56,10 +166,135 @@ struct Job {
   uint64_t leader_start_time = 0;
   uint64_t max_runtime_ms = 600000;       // 10 minutes default
   uint64_t max_log_bytes = 10485760;      // 10MB default
+  uint64_t log_head_bytes = 65536;        // 64KB default
   uint64_t max_output_line_bytes = 65536; // 64KB default
   int max_child_processes = 64;
+  int max_spawns_per_window = 0;
+  uint64_t kill_grace_ms = 2000;
+  // While TERMINATING: the final status once the group is gone, and whether
+  // kill_grace_ms ran out and the group got SIGKILL.
+  JobStatus end_status = JobStatus::CANCELLED;
+  bool kill_sent = false;
+  bool leader_reaped = false;
   int stdout_fd = -1;
   int stderr_fd = -1;
+  // pidfd for the leader when the spawner could obtain one, -1 otherwise.
+  int pidfd = -1;
+  // The job's cgroup when the runner contains jobs in cgroups (see
+  // JobRunner::set_cgroup_driver()), empty otherwise, a handle on it (its
+  // dir_fd() is what the spawner starts the leader in) and its
+  // cgroup.events. A spawner that starts the leader in the cgroup, or has
+  // it join before exec, sets cgroup_joined.
+  std::string cgroup;
+  gov::CgroupHandle cgroup_handle;
+  int cgroup_events_fd = -1;
+  bool cgroup_joined = false;
+  // Membership in the JobRunner's list for the current status, in its
+  // finished-job history once the status is final, and in its list of all
+  // retained jobs in submission order.
+  ListHook<Job> status_link;
+  ListHook<Job> history_link;
+  ListHook<Job> created_link;
+  // While QUEUED: membership in its group's run queue for its priority.
+  ListHook<Job> queue_link;
+  // The group the job was queued under; set when it enters the run queue.
+  JobGroup* queue_group = nullptr;
+  // In the JobRunner's timer wheel: max_runtime_ms while RUNNING, then
+  // kill_grace_ms while TERMINATING.
+  Timer runtime_timer;
+  Timer kill_timer;
+  std::chrono::steady_clock::time_point retired_at;
+  uint64_t history_log_bytes = 0;
+};
+
+// The Job fields status output reports, copied while the job cannot change.
+// Log counts come from the job's spool when it has one.
+struct JobSnapshot {
+  std::string id;
+  uint64_t seq = 0;
+  std::string command;
+  std::string group;
+  JobPriority priority = JobPriority::NORMAL;
+  ResourceRequest resources;
+  JobStatus status = JobStatus::QUEUED;
+  int exit_code = -1;
+  uint64_t bytes_written = 0;
+  bool log_truncated = false;
+  uint64_t log_dropped = 0;
+  uint64_t lines = 0;
+  uint64_t lines_truncated = 0;
+};
+
+// A group's share of job starts and of running slots.
+struct GroupShare {
+  // Jobs started from the group per scheduling round while others wait.
+  uint32_t weight = 1;
+  // Jobs of the group that may be active at once; 0 is unlimited.
+  size_t max_running_jobs = 0;
+};
+
+// A group's run queue for one priority class.
+struct JobLane {
+  JobGroup* group = nullptr;
+  // Starts left in the lane's current round.
+  uint32_t deficit = 0;
+  IntrusiveList<Job, &Job::queue_link> queued;
+  // On the runner's ring, for the lane's class, of lanes that have queued
+  // jobs and whose group is under its cap.
+  ListHook<JobLane> ready_link;
+
+  bool ready() const;
+};
+
+// A group's run queues and scheduling state, owned by the JobRunner.
+struct JobGroup {
+  std::string id;
+  GroupShare share;
+  // STARTING, RUNNING, TERMINATING and SUSPENDED jobs of the group.
+  size_t active = 0;
+  std::array<JobLane, kJobPriorityCount> lanes;
+
+  JobGroup() {
+    for (auto& lane : lanes)
+      lane.group = this;
+  }
+  JobGroup(const JobGroup&) = delete;
+  JobGroup& operator=(const JobGroup&) = delete;
+
+  bool under_cap() const {
+    return share.max_running_jobs == 0 || active < share.max_running_jobs;
+  }
+};
+
+inline bool JobLane::ready() const {
+  return !queued.empty() && group->under_cap();
+}
+
+// Sizes the job's logs from max_log_bytes and log_head_bytes, dropping their
+// content: stdout gets half of max_log_bytes and stderr the rest, each split
+// into a head and a tail. Lines are cut at max_output_line_bytes.
+void init_job_logs(Job& job);
+
+// Frames captured output into the job's log for the stream, or its spool
+// when it has one, and updates bytes_written and log_truncated. Call with the job mutex held.
+void append_job_output(Job& job, LogStream stream, const char* data, size_t len);
+
+// The logs enforce max_log_bytes as they are appended to; this records it.
+// Returns true (and sets log_truncated) the first time anything was dropped.
+bool apply_job_log_cap(Job& job);
+
+// Call with the job mutex held, or on a job only the caller can reach.
+JobSnapshot snapshot_job(const Job& job);
+
+// How submit_jobs() handles a batch that does not fit under max_queue_depth:
+// queue none of it, or as many jobs from the front as fit.
+enum class BatchMode { ALL_OR_NOTHING, BEST_EFFORT };
+
+// The first `accepted` specs of a batch became jobs job_<first_seq> through
+// job_<first_seq + accepted - 1>; the rest were NACKed.
+struct BatchSubmission {
+  uint64_t first_seq = 0;
+  size_t accepted = 0;
 };
 
 struct TickDiagnostics {
@@ -69,11 +304,23 @@ struct TickDiagnostics {
   uint64_t last_tick_now_ms = 0;
   int last_tick_running = 0;
   int last_tick_queued = 0;
+  ConcurrencyState concurrency;
 };
 
 struct IProcessSpawner {
   virtual ~IProcessSpawner() = default;
+  // On failure returns false with job.error and finished_at set; moving the
+  // job to FAILED is left to the runner.
   virtual bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) = 0;
+
+  // Starts several jobs at once, writing each job's pipe fds into the Job and
+  // its success into spawned[i]. Backends that can keep several spawns in
+  // flight override this; the default starts them one at a time.
+  virtual void spawn_jobs(std::span<Job* const> jobs, std::span<bool> spawned);
+
+  // Non-blocking reap of the job leader. Returns true and fills *wait_status
+  // once the leader has exited and been collected.
+  virtual bool reap_job(Job& job, int* wait_status);
 };
 
 class JobRunner {
@@ -85,10 +332,131 @@ public:
   void start();
   void stop();
 
+  // Output is captured by an epoll reactor thread started by start(), which
+  // also reaps leaders through their pidfds as soon as they exit and starts
+  // the next queued job in the freed slot. When disabled (or the reactor
+  // cannot start), check_job_limits() polls the pipes and waitpid()s instead.
+  // Set before start().
+  void set_output_reactor_enabled(bool enabled) {
+    output_reactor_enabled_ = enabled;
+  }
+  const OutputReactor& output_reactor() const {
+    return *output_reactor_;
+  }
+
+  // Runtime limits and kill escalations are held in a timer wheel that
+  // tick() advances. When enabled, a timerfd on the output reactor thread
+  // also fires at the nearest deadline, so enforcement does not wait for the
+  // next tick and no wakeup happens while nothing is due. Off by default:
+  // the timerfd follows the real clock, while tick()'s clock may be
+  // synthetic. Needs the output reactor. Set before start().
+  void set_timer_fd_enabled(bool enabled) {
+    timer_fd_enabled_ = enabled;
+  }
+
+  // Contains each job started from now on in a cgroup of its own under the
+  // driver's base path instead of by its process group alone. Cgroups come
+  // from the driver's pool, sized to max_concurrent_jobs and refilled on
+  // each tick, and go back once empty. The leader is started in the cgroup
+  // (clone3 with CLONE_INTO_CGROUP) or joins it before exec where the
+  // spawner can do that, and is moved in right after the spawn otherwise. The
+  // process cap then reads the cgroup's count, terminations signal every
+  // process in it and escalate through cgroup.kill, and a terminating job
+  // ends as soon as the reactor sees cgroup.events report it unpopulated.
+  // A job whose cgroup cannot be set up falls back to its process group.
+  // The driver must be available and outlive the runner. Set before start().
+  void set_cgroup_driver(gov::CgroupDriver* driver) {
+    cgroups_ = driver;
+  }
+  // Jobs held in a cgroup right now.
+  size_t contained_jobs() const {
+    return contained_jobs_.load(std::memory_order_relaxed);
+  }
+
+  // Spools the output of jobs started from now on into per-job files under
+  // dir (created if missing), or into memfds when dir is empty, instead of
+  // the job's in-memory logs. Needs the output reactor. Returns false if dir cannot
+  // be created.
+  bool enable_log_spool(const std::string& dir = "");
+
+  // Writes the newest max_bytes of a job's stream to fd, with sendfile() when
+  // the job is spooled. Returns bytes written, or -1 with errno set (ENOENT
+  // for an unknown job).
+  ssize_t send_job_tail(const std::string& job_id, LogStream stream, uint64_t max_bytes,
+                        int fd);
+  // Same for the last `lines` lines, found through the job's line index.
+  ssize_t send_job_tail_lines(const std::string& job_id, LogStream stream, size_t lines,
+                              int fd);
+
+  // Limits on finished jobs kept in memory, and on the archive, enforced on
+  // each tick.
+  void set_retention_policy(const RetentionPolicy& policy);
+  // Archives evicted jobs under dir, where get_job_status() and
+  // send_job_tail() find them again. Each tick writes the jobs it evicted
+  // once it has released the runner lock; until then they are still found
+  // in memory. Job numbering resumes after the highest archived job. Call
+  // before submitting jobs. Returns false if the archive cannot be opened.
+  bool enable_job_archive(const std::string& dir);
+  uint64_t get_jobs_evicted() const {
+    return jobs_evicted_.load(std::memory_order_relaxed);
+  }
+
+  // Sets a group's weight and running cap, creating the group if needed.
+  // Queued jobs of the highest priority class with any are started by
+  // deficit round robin over the groups that have queued jobs of that class
+  // and are under their cap: each such group in turn starts up to `weight`
+  // jobs, in submission order, so a group with a large backlog cannot
+  // starve the others. Picking the next job is O(1). Returns
+  // false if the group id is too long or the group table is full (see
+  // gov::kMaxGroups); jobs naming such a group run in the default group.
+  bool set_group_share(const std::string& group, const GroupShare& share);
+
+  // Replaces the policy the runner's governor applies on each tick. Its
+  // max_queue_depth also caps submissions from then on.
+  void set_governor_policy(const GovernorPolicy& policy);
+
+  // Queues a job and returns its id, or an empty string (a NACK) when
+  // max_queue_depth jobs are already queued. Never takes the runner lock:
+  // the job goes through a lock-free submission queue that tick(), and any
+  // call below that looks jobs up, moves into the run queue first.
   std::string submit_job(const std::string& command, const JobLimits& limits = JobLimits());
+  std::string submit_job(const JobSpec& spec, const JobLimits& limits = JobLimits());
+  // Queues many jobs with one admission check and one claim on the
+  // submission queue; their seqs are contiguous.
+  BatchSubmission submit_jobs(std::span<const JobSpec> specs,
+                              BatchMode mode = BatchMode::ALL_OR_NOTHING,
+                              const JobLimits& limits = JobLimits());
+  // Capacity reserved by the jobs that hold a reservation: all of their
+  // request while STARTING, RUNNING or TERMINATING, memory and pids only
+  // while SUSPENDED.
+  ResourceRequest get_reserved_resources() const;
+  // Jobs NACKed because the queue was full.
+  uint64_t get_jobs_rejected() const {
+    return jobs_rejected_.load(std::memory_order_relaxed);
+  }
+  // Times a running job was suspended to make way for a higher class.
+  uint64_t get_jobs_preempted() const {
+    return jobs_preempted_.load(std::memory_order_relaxed);
+  }
+
   bool cancel_job(const std::string& job_id);
-  std::shared_ptr<Job> get_job_status(const std::string& job_id) const;
-  std::vector<std::shared_ptr<Job>> get_recent_jobs(size_t limit = 10) const;
+  std::shared_ptr<Job> get_job_status(const std::string& job_id);
+  // For status output: the job's fields copied under the runner lock, so
+  // they can be read while the job runs. Evicted jobs come from the archive.
+  // Returns false for an unknown job.
+  bool get_job_snapshot(const std::string& job_id, JobSnapshot* out);
+  // Up to `limit` retained jobs, newest first. Walks only the jobs returned;
+  // the span forms fill `out` and never allocate.
+  std::vector<std::shared_ptr<Job>> get_recent_jobs(size_t limit = 10);
+  size_t get_recent_jobs(std::span<std::shared_ptr<Job>> out);
+  // Up to `limit` retained jobs submitted after job `since_seq`, oldest first,
+  // so the last one's seq is the cursor for the next page. 0 starts from the
+  // oldest retained job.
+  std::vector<std::shared_ptr<Job>> get_jobs_since(uint64_t since_seq, size_t limit = 10);
+  size_t get_jobs_since(uint64_t since_seq, std::span<std::shared_ptr<Job>> out);
+  // The same jobs as snapshots, copied under the runner lock.
+  std::vector<JobSnapshot> get_recent_job_snapshots(size_t limit = 10);
+  std::vector<JobSnapshot> get_job_snapshots_since(uint64_t since_seq, size_t limit = 10);
 
   // Diagnostic accessors
   const TickDiagnostics& get_last_tick_diagnostics() const {
@@ -100,6 +468,18 @@ public:
   size_t get_jobs_scanned_this_tick() const {
     return jobs_scanned_this_tick_;
   }
+  // Jobs currently held in a status (evicted jobs no longer count); kept up
+  // to date on every transition and readable without the runner lock.
+  // QUEUED includes submissions still in the submission queue.
+  size_t count_jobs(JobStatus status) const {
+    if (status == JobStatus::QUEUED)
+      return queued_jobs_.load(std::memory_order_relaxed);
+    return status_counts_[static_cast<size_t>(status)].load(std::memory_order_relaxed);
+  }
+  // Jobs started outside tick(), right after another job's leader exited.
+  uint64_t get_jobs_started_out_of_band() const {
+    return jobs_started_out_of_band_.load(std::memory_order_relaxed);
+  }
 
   // Limit enforcement methods
   void tick(uint64_t now_ms, const SystemMetrics& metrics, size_t max_starts_per_tick = 5,
@@ -108,23 +488,192 @@ public:
   bool enforce_job_timeout(std::shared_ptr<Job> job, uint64_t now_ms);
   bool enforce_job_log_cap(std::shared_ptr<Job> job);
   bool enforce_job_process_cap(std::shared_ptr<Job> job, uint64_t now_ms);
+  bool enforce_job_spawn_rate(std::shared_ptr<Job> job, uint64_t now_ms);
 
 private:
+  using JobStatusList = IntrusiveList<Job, &Job::status_link>;
+  using JobHistoryList = IntrusiveList<Job, &Job::history_link>;
+  using JobCreatedList = IntrusiveList<Job, &Job::created_link>;
+  using JobQueue = IntrusiveList<Job, &Job::queue_link>;
+  using LaneRing = IntrusiveList<JobLane, &JobLane::ready_link>;
+
   void execute_job(std::shared_ptr<Job> job, uint64_t now_ms);
+  // Moves published submissions into jobs_ and the run queue, in seq order.
+  // Called with the lock held, which also makes this the queue's only
+  // consumer.
+  void drain_submissions_locked();
+  // Adds between min_n and max_n (as many as fit) to queued_jobs_ without
+  // passing max_queue_depth_. Returns how many, or 0 if fewer than min_n fit.
+  size_t reserve_queued(size_t min_n, size_t max_n);
+  // Every status change goes through here so the per-status lists and
+  // counters stay exact.
+  void set_status_locked(Job& job, JobStatus status);
+  // The group's state, created on first use; the default group when the id
+  // is unusable or there is no room for another group.
+  JobGroup& group_locked(const std::string& id);
+  // Adds the group's lanes to, or drops them from, the ready rings as their
+  // state says.
+  void update_ready_locked(JobGroup& group);
+  // The highest class with a ready lane, or null if none is ready.
+  LaneRing* top_ready_ring_locked();
+  // The job next_queued_locked() would return, without charging its lane.
+  Job* peek_queued_locked();
+  // The next queued job of the highest ready class by deficit round robin,
+  // or null if no lane is ready. The job stays queued; starting it charges
+  // its lane.
+  Job* next_queued_locked();
+  // A queued job that can start ahead of `blocked`, whose request does not
+  // fit, without delaying it: one that fits now and either ends (at its
+  // runtime limit) before `blocked` could start as reserving jobs reach
+  // theirs, or leaves room for `blocked` then. Null if none is found among
+  // the first kMaxBackfillScan ready jobs.
+  Job* backfill_locked(const Job& blocked, uint64_t now_ms);
+  // Under pressure: SIGSTOPs up to max_preempts RUNNING jobs of classes
+  // below the highest one running or queued, lowest class and most recently
+  // started first.
+  size_t preempt_locked(uint64_t now_ms, size_t max_preempts);
+  // The SUSPENDED job to resume first: highest class, then longest frozen.
+  Job* next_suspended_locked();
+  void suspend_job_locked(Job& job, uint64_t now_ms);
+  void resume_job_locked(Job& job, uint64_t now_ms);
+  JobStatusList& jobs_in(JobStatus status) {
+    return jobs_by_status_[static_cast<size_t>(status)];
+  }
+  // Jobs whose processes may still be alive and not frozen, terminating ones
+  // included.
+  size_t active_jobs() const {
+    return count_jobs(JobStatus::RUNNING) + count_jobs(JobStatus::STARTING) +
+           count_jobs(JobStatus::TERMINATING);
+  }
+  // The first retained job submitted after job since_seq, or null.
+  Job* first_after_locked(uint64_t since_seq) const;
+  // Evicts finished jobs over the retention policy, oldest first.
+  void retire_finished_locked();
+  void evict_locked(Job& job);
+  // Writes the jobs evicted into archive_queue_ to the archive, then
+  // expires it, without holding the runner lock.
+  void archive_evicted();
+  // A retained job, or one evicted but not yet archived.
+  std::shared_ptr<Job> find_job_locked(const std::string& job_id) const;
+  // Records the leader's wait status and releases the job's fds.
+  void finish_job_locked(Job& job, int wait_status);
+  // Sends SIGTERM to the job's group and leaves it TERMINATING; never waits.
+  // Returns the errno of the kill(), or 0.
+  int terminate_job_locked(Job& job, JobStatus end_status, uint64_t now_ms);
+  // Sends sig to every process in the job's cgroup, or else to its process
+  // group. Returns the errno, or 0.
+  int signal_job_locked(Job& job, int sig);
+  // Whether any of the job's processes are left: its cgroup is populated,
+  // or its process group exists.
+  bool job_alive_locked(const Job& job) const;
+  // Reaps TERMINATING jobs' leaders and ends jobs whose group is gone.
+  void advance_terminating_locked(uint64_t now_ms);
+  // Enforces the runtime limits and kill escalations that are due.
+  void run_timers_locked(uint64_t now_ms);
+  // Points the timerfd, if in use, at the wheel's next event.
+  void rearm_timer_locked();
+  void on_timer();
+  void end_termination_locked(Job& job, uint64_t now_ms);
+  // The last tick's clock extended by the real time since that tick.
+  uint64_t tick_clock_locked() const;
+  // Starts up to max_starts queued jobs without exceeding max_concurrent_,
+  // resuming SUSPENDED jobs ahead of queued jobs of a lower class once the
+  // pressure cooldown has passed. A job whose resource request does not fit
+  // holds the queue, apart from backfill. Returns the jobs started; resumed
+  // ones use up the same budget.
+  size_t start_queued_locked(uint64_t now_ms, size_t max_starts, size_t running);
+  void on_leader_exit(const std::shared_ptr<Job>& job);
+  void on_cgroup_empty(const std::shared_ptr<Job>& job);
+  // Starts queued jobs in slots freed between ticks, with the last tick's
+  // readings.
+  void start_out_of_band_locked();
+  // Around the spawn of a job: takes a cgroup from the driver's pool for the
+  // spawner; then puts the leader in if the spawner did not and opens
+  // cgroup.events. Either leaves the job uncontained on failure.
+  void prepare_cgroup_locked(Job& job);
+  void contain_job_locked(Job& job, bool spawned);
+  // Closes the job's cgroup.events and hands the cgroup back to the pool,
+  // or keeps it in leftover_cgroups_ while processes that outlived the job
+  // remain.
+  void release_cgroup_locked(Job& job);
+  void remove_leftover_cgroups_locked();
+  // Compares the job's process count with its cap and terminates it when
+  // over. Returns whether it did.
+  bool apply_process_cap_locked(const std::shared_ptr<Job>& job, int count, uint64_t now_ms);
+  // Hands waiting process events to the inspector and checks the limits of
+  // the jobs whose process trees grew.
+  void read_process_events_locked(uint64_t now_ms);
+  void on_process_events();
 
   size_t max_concurrent_;
   std::atomic<bool> running_{false};
-  std::queue<std::shared_ptr<Job>> job_queue_;
   std::unordered_map<std::string, std::shared_ptr<Job>> jobs_;
+  // Every job in jobs_ is on exactly one of these, in order of entering the
+  // status. QUEUED jobs are also on their group's run queue.
+  std::array<JobStatusList, kJobStatusCount> jobs_by_status_;
+  std::array<std::atomic<size_t>, kJobStatusCount> status_counts_{};
+  // Jobs submitted but not yet drained. A job's seq is first_job_seq_ plus
+  // its position in this queue, so ids follow the order jobs are drained in.
+  MpscQueue<std::shared_ptr<Job>> submissions_;
+  std::atomic<uint64_t> first_job_seq_{1};
+  // QUEUED jobs plus undrained submissions, checked against max_queue_depth_
+  // on submission.
+  std::atomic<size_t> queued_jobs_{0};
+  std::atomic<size_t> max_queue_depth_;
+  std::atomic<uint64_t> jobs_rejected_{0};
+  // Every job in jobs_ in submission (seq) order.
+  JobCreatedList created_;
+  std::unordered_map<std::string, std::unique_ptr<JobGroup>> groups_;
+  // Ready lanes, one ring per priority class.
+  std::array<LaneRing, kJobPriorityCount> ready_lanes_;
+  std::atomic<uint64_t> jobs_preempted_{0};
+  // Suspended jobs stay frozen until this tick clock time: cooldown_ms after
+  // the last tick that saw pressure.
+  uint64_t resume_after_ms_ = 0;
+  // Finished jobs in the order they finished.
+  JobHistoryList history_;
+  uint64_t history_log_bytes_ = 0;
+  RetentionPolicy retention_;
+  std::unique_ptr<JobArchive> archive_;
+  // Evicted jobs waiting to be archived, oldest first: detached copies that
+  // hold the logs. archive_mutex_ makes one thread at a time write them;
+  // it is never taken while holding mutex_.
+  std::vector<std::shared_ptr<Job>> archive_queue_;
+  std::mutex archive_mutex_;
+  std::atomic<uint64_t> jobs_evicted_{0};
+  TimerWheel timers_;
+  bool timer_fd_enabled_ = false;
+  bool timer_fd_active_ = false;
+  // Wheel time the timerfd is set for, UINT64_MAX when disarmed.
+  uint64_t timer_armed_for_ = UINT64_MAX;
   mutable std::mutex mutex_;
   std::condition_variable cv_;
   TickDiagnostics last_tick_diagnostics_;
   size_t jobs_started_this_tick_ = 0;
   size_t jobs_scanned_this_tick_ = 0;
-  size_t scan_cursor_ = 0;
+  // Whether this tick's limit scan has had the inspector take its snapshot.
+  bool proc_snapshot_taken_ = false;
+  // Running jobs by process group, as handed to IProcessInspector::track(),
+  // and the groups the last read_events() reported grown.
+  std::unordered_map<pid_t, Job*> tracked_jobs_;
+  std::vector<pid_t> grown_groups_;
+  // Inputs of the last tick, reused for out-of-band starts.
+  bool have_last_tick_ = false;
+  SystemMetrics last_metrics_;
+  size_t last_max_starts_ = 0;
+  std::chrono::steady_clock::time_point last_tick_steady_;
+  std::atomic<uint64_t> jobs_started_out_of_band_{0};
   ResourceGovernor governor_;
   IProcessSpawner* spawner_;
   IProcessInspector* inspector_;
+  gov::CgroupDriver* cgroups_ = nullptr;
+  std::atomic<size_t> contained_jobs_{0};
+  // Cgroups of finished jobs that still held processes, removed once empty.
+  std::vector<std::string> leftover_cgroups_;
+  bool output_reactor_enabled_ = true;
+  bool log_spool_enabled_ = false;
+  std::string log_spool_dir_;
+  std::unique_ptr<OutputReactor> output_reactor_;
 };
 
 } // namespace heidi
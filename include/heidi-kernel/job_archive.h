@@ -0,0 +1,95 @@
+#pragma once
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/log_spool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/types.h>
+
+namespace heidi {
+
+// On-disk record of finished jobs evicted from the runner's memory.
+//
+// <dir>/jobs.idx holds one fixed-size record per job at offset
+// seq * sizeof(record), so a lookup is a single pread and holes cost no
+// disk. <dir>/jobs.log is an append-only spool of the jobs' retained logs;
+// each record holds the offset and length of its stdout and stderr there.
+// The command is stored truncated to fit the record.
+//
+// expire() bounds the archive: the oldest jobs are dropped by punching
+// their records and log bytes out of the files (FALLOC_FL_PUNCH_HOLE), so
+// the disk space is returned while every other offset stays valid. Where
+// the filesystem cannot punch holes the records are zeroed instead; lookups
+// miss them, but jobs.log keeps its size.
+class JobArchive {
+public:
+  // Returns null (errno set) if the directory or files cannot be created.
+  static std::unique_ptr<JobArchive> open(const std::string& dir);
+  ~JobArchive();
+
+  JobArchive(const JobArchive&) = delete;
+  JobArchive& operator=(const JobArchive&) = delete;
+
+  // Writes the job's logs, then its record. Only one thread may append or
+  // expire at a time; lookups may run meanwhile.
+  bool append(const Job& job);
+  // Drops jobs in the order they were archived while the archive holds more
+  // than max_bytes (logs plus records), and those that ended more than
+  // max_age_ms before now_ms (system clock). 0 disables either cap.
+  void expire(uint64_t max_bytes, uint64_t max_age_ms, uint64_t now_ms);
+
+  // Rebuilds a finished Job (logs included) from its record, or returns null
+  // if seq was never archived.
+  std::shared_ptr<Job> load(uint64_t seq) const;
+
+  // Sends the newest max_bytes of an archived stream to fd with sendfile().
+  // Returns bytes sent, or -1 with errno set (ENOENT if seq is not archived).
+  ssize_t send_tail(uint64_t seq, LogStream stream, uint64_t max_bytes, int fd) const;
+
+  // One past the highest archived seq; job numbering resumes from here.
+  uint64_t next_seq() const {
+    return next_seq_.load(std::memory_order_acquire);
+  }
+  uint64_t records_written() const {
+    return records_written_;
+  }
+  // Jobs currently held, and the bytes they take (logs plus records).
+  size_t archived_jobs() const {
+    return live_.size();
+  }
+  uint64_t archived_bytes() const;
+
+private:
+  struct Record;
+  // A held job, in archive order (which is also log order).
+  struct Entry {
+    uint64_t seq;
+    uint64_t log_off;
+    uint64_t ended_at_ms;
+  };
+
+  JobArchive() = default;
+  bool read_record(uint64_t seq, Record* record) const;
+  bool write_log(const Job& job, LogStream stream, uint64_t* off, uint64_t* len);
+  // Finds the held jobs of an existing archive.
+  void load_entries();
+
+  int index_fd_ = -1;
+  int log_fd_ = -1;
+  uint64_t log_end_ = 0;
+  std::atomic<uint64_t> next_seq_{1};
+  uint64_t records_written_ = 0;
+  // Writer side only.
+  std::deque<Entry> live_;
+  std::set<uint64_t> live_seqs_;
+  // jobs.log below log_start_, and records below index_start_, are punched.
+  uint64_t log_start_ = 0;
+  uint64_t index_start_ = 0;
+};
+
+} // namespace heidi
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "heidi-kernel/log_ring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include <vector>
+
+namespace heidi {
+
+// Newline search used by LineFramer. AUTO picks the widest implementation
+// the CPU supports; the others are exposed for tests and benchmarks.
+enum class NewlineScan { AUTO, SCALAR, SSE2, AVX2 };
+
+// Index of the first '\n' in data[0, len), or len if there is none.
+size_t find_newline(const char* data, size_t len, NewlineScan scan = NewlineScan::AUTO);
+
+// The implementation AUTO resolves to on this machine.
+NewlineScan best_newline_scan();
+
+// Splits one output stream into lines on its way into its log: a LogRing,
+// or a SpoolStream for jobs whose output is spooled to a file.
+//
+// Lines longer than max_line_bytes (excluding the '\n') are cut at the limit
+// and the rest of the line is dropped. The starts of the newest lines still
+// held by the log are indexed by their position in the log's stream, so the
+// last N lines can usually be found without rescanning the log. The index
+// holds one start per kBytesPerIndexedLine bytes of log capacity (at least
+// kMinIndexedLines); lines older than that are found by scanning the log
+// back from the oldest indexed start.
+class LineFramer {
+public:
+  static constexpr uint64_t kBytesPerIndexedLine = 64;
+  static constexpr size_t kMinIndexedLines = 1024;
+
+  LineFramer() = default;
+  explicit LineFramer(uint64_t max_line_bytes, uint64_t log_capacity = 0) {
+    reset(max_line_bytes, log_capacity);
+  }
+
+  // Drops all state; 0 means lines are never cut. log_capacity is what the
+  // log retains in all, and sizes the index.
+  void reset(uint64_t max_line_bytes, uint64_t log_capacity = 0);
+
+  // Log is LogRing or SpoolStream.
+  template <typename Log>
+  void append(Log& log, const char* data, size_t len);
+
+  // Lines started so far, and how many of them were cut.
+  uint64_t lines() const {
+    return lines_;
+  }
+  uint64_t lines_truncated() const {
+    return lines_truncated_;
+  }
+  // Line starts currently indexed (bounded by what the log retains and by
+  // the index's capacity).
+  size_t indexed_lines() const {
+    return count_;
+  }
+
+  // Fills out (LogRing::kMaxIov entries) with the last count lines of ring,
+  // including a trailing partial line. Once the ring has dropped bytes only
+  // whole lines in its tail are returned. Returns the number of entries used.
+  size_t tail_lines(const LogRing& ring, size_t count, struct iovec* out) const;
+  // The same selection as a stream position of log: where the last count
+  // lines start. Returns false if there are none to return.
+  template <typename Log>
+  bool tail_lines_start(const Log& log, size_t count, uint64_t* start) const;
+
+private:
+  void index_line_start(uint64_t pos);
+  // Stream position of the i-th oldest indexed start.
+  uint64_t start_at(size_t i, uint64_t total) const;
+
+  uint64_t max_line_bytes_ = 0;
+  uint64_t line_len_ = 0; // Bytes of the current line seen, kept or not
+  bool at_line_start_ = true;
+  uint64_t lines_ = 0;
+  uint64_t lines_truncated_ = 0;
+  // Line starts, oldest at first_, as the low 32 bits of their stream
+  // position: they are all within the log's capacity of its total, so
+  // logs of up to 4 GiB are indexed exactly. Grows up to index_capacity_,
+  // then the newest start replaces the oldest.
+  std::vector<uint32_t> starts_;
+  size_t first_ = 0;
+  size_t count_ = 0;
+  size_t index_capacity_ = kMinIndexedLines;
+};
+
+} // namespace heidi
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/uio.h>
+
+namespace heidi {
+
+// Renders the "[N bytes dropped]" line a log view shows between its head and
+// its tail into buf. Returns its length.
+size_t format_dropped_marker(char* buf, size_t size, uint64_t dropped);
+
+// Captured output of one job stream, bounded to a fixed capacity.
+//
+// The first head_capacity bytes are kept verbatim (that is usually where a
+// job reports what went wrong) and the newest tail_capacity bytes in a
+// circular buffer; whatever falls between is counted as dropped. Append is
+// O(1) in the bytes appended. Storage grows with the output until it reaches
+// the capacity and is never reallocated or moved after that.
+class LogRing {
+public:
+  // Most segments a view can have: head, dropped marker, two tail pieces.
+  static constexpr size_t kMaxIov = 4;
+
+  LogRing() = default;
+  LogRing(uint64_t head_capacity, uint64_t tail_capacity);
+
+  // Drops any content and sets new capacities.
+  void reset(uint64_t head_capacity, uint64_t tail_capacity);
+
+  void append(const char* data, size_t len);
+  void append(const std::string& data) {
+    append(data.data(), data.size());
+  }
+
+  // Bytes retained, bytes ever appended, and the difference.
+  uint64_t size() const {
+    return head_.size() + tail_.size();
+  }
+  uint64_t total() const {
+    return total_;
+  }
+  uint64_t dropped() const {
+    return total_ - size();
+  }
+  bool empty() const {
+    return total_ == 0;
+  }
+  uint64_t head_capacity() const {
+    return head_capacity_;
+  }
+  // Stream position of the oldest byte in the tail.
+  uint64_t tail_start() const {
+    return total_ - tail_.size();
+  }
+
+  // Copies len bytes from stream position pos on into buf. Returns false,
+  // copying nothing, unless they are all retained.
+  bool read_at(uint64_t pos, char* buf, size_t len) const;
+
+  // Fills out (kMaxIov entries) with the newest max_bytes of the log as it
+  // reads: head, then a "[N bytes dropped]" line if anything was, then the
+  // tail, oldest first. Returns the number of entries used. The entries point
+  // into the ring and are valid until the next append() or reset().
+  size_t tail_iov(uint64_t max_bytes, struct iovec* out) const;
+  size_t iov(struct iovec* out) const {
+    return tail_iov(UINT64_MAX, out);
+  }
+
+  // Copies the view out; for status output and tests.
+  std::string str(uint64_t max_bytes = UINT64_MAX) const;
+
+private:
+  uint64_t head_capacity_ = 0;
+  uint64_t tail_capacity_ = 0;
+  std::string head_;
+  // Grows up to tail_capacity_; once full, tail_pos_ is both the oldest byte
+  // and the next write position.
+  std::string tail_;
+  size_t tail_pos_ = 0;
+  uint64_t total_ = 0;
+  // Rendered by tail_iov(); only valid while the view is.
+  mutable char marker_[64];
+};
+
+} // namespace heidi
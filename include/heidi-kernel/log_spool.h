@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace heidi {
+
+enum class LogStream { STDOUT, STDERR };
+
+// A job's captured output kept in files instead of daemon memory.
+//
+// Each stream lives in one file (named under the spool directory, or a memfd
+// when there is none) laid out like a LogRing: its first bytes are kept
+// verbatim at offset 0, and the newest bytes in a circular region after
+// them; whatever falls between is counted as dropped. Job output is written
+// in with pwrite() as the LineFramer passes it on, and served with
+// sendfile().
+// stdout gets half of max_log_bytes and stderr the rest, each with a head
+// of up to head_bytes (at most half its share).
+class JobSpool {
+public:
+  // Returns null (errno set) if a file cannot be created. Named files are
+  // <dir>/<job_id>.out and .err and are removed when the spool is destroyed.
+  static std::unique_ptr<JobSpool> create(const std::string& dir, const std::string& job_id,
+                                          uint64_t max_log_bytes, uint64_t head_bytes = 0);
+  ~JobSpool();
+
+  JobSpool(const JobSpool&) = delete;
+  JobSpool& operator=(const JobSpool&) = delete;
+
+  // Writes data into the stream. A failed write leaves stale bytes behind
+  // but still counts, so stream positions stay consistent. Only one thread
+  // may write a given stream.
+  void append(LogStream stream, const char* data, size_t len);
+
+  // Bytes currently retained / ever written / dropped for the stream.
+  uint64_t size(LogStream stream) const;
+  uint64_t total(LogStream stream) const;
+  uint64_t dropped(LogStream stream) const {
+    return total(stream) - size(stream);
+  }
+  // Stream position of the oldest byte in the tail.
+  uint64_t tail_start(LogStream stream) const;
+  // Retained bytes over both streams, and whether anything was overwritten.
+  uint64_t retained() const {
+    return size(LogStream::STDOUT) + size(LogStream::STDERR);
+  }
+  bool truncated() const;
+
+  // Sends the newest max_bytes of the stream's view to out_fd: the head,
+  // then a "[N bytes dropped]" line if anything was, then the tail, oldest
+  // first, as LogRing::tail_iov() has it. File bytes go with sendfile().
+  // Returns bytes sent, or -1 with errno set. A writer wrapping
+  // concurrently may replace the oldest bytes while they are being sent.
+  ssize_t send_tail(int out_fd, LogStream stream, uint64_t max_bytes) const;
+  // The same from stream position pos on (no earlier than the oldest tail
+  // byte once pos is past the head) to the newest byte.
+  ssize_t send_from(int out_fd, LogStream stream, uint64_t pos) const;
+
+  // Copies the view out; for status output and tests.
+  std::string read(LogStream stream) const;
+  // Copies len bytes from stream position pos on into buf, as
+  // LogRing::read_at() does. Returns false unless they are all retained and
+  // could be read.
+  bool read_at(LogStream stream, uint64_t pos, char* buf, size_t len) const;
+
+private:
+  struct Ring {
+    int fd = -1;
+    uint64_t head_capacity = 0;
+    uint64_t tail_capacity = 0;
+    std::atomic<uint64_t> written{0};
+    std::string path;
+  };
+
+  JobSpool() = default;
+  Ring& ring(LogStream stream) {
+    return stream == LogStream::STDOUT ? out_ : err_;
+  }
+  const Ring& ring(LogStream stream) const {
+    return stream == LogStream::STDOUT ? out_ : err_;
+  }
+
+  ssize_t send_view(int out_fd, const Ring& r, uint64_t written, uint64_t skip,
+                    uint64_t max_bytes) const;
+
+  Ring out_;
+  Ring err_;
+};
+
+// One stream of a spool as the log LineFramer writes through, with the
+// parts of LogRing's interface it uses.
+class SpoolStream {
+public:
+  SpoolStream(JobSpool& spool, LogStream stream) : spool_(spool), stream_(stream) {}
+
+  void append(const char* data, size_t len) {
+    spool_.append(stream_, data, len);
+  }
+  uint64_t total() const {
+    return spool_.total(stream_);
+  }
+  uint64_t dropped() const {
+    return spool_.dropped(stream_);
+  }
+  uint64_t tail_start() const {
+    return spool_.tail_start(stream_);
+  }
+  bool read_at(uint64_t pos, char* buf, size_t len) const {
+    return spool_.read_at(stream_, pos, buf, len);
+  }
+
+private:
+  JobSpool& spool_;
+  LogStream stream_;
+};
+
+} // namespace heidi
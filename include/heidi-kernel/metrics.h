@@ -24,23 +24,92 @@ struct MemStats {
   uint64_t cached = 0;
 };
 
+// Pressure stall information for one resource: the share of the last 10s
+// in which some, or all (full), non-idle tasks were stalled on it, in
+// percent.
+struct PressureStats {
+  double some_avg10 = 0.0;
+  double full_avg10 = 0.0;
+};
+
+enum class PressureResource { CPU, MEMORY, IO };
+
 struct SystemMetrics {
   double cpu_usage_percent = 0.0;
   MemStats mem;
   uint64_t timestamp = 0;
+  // All zero when the kernel has no PSI (pressure_available false).
+  PressureStats cpu_pressure{};
+  PressureStats mem_pressure{};
+  PressureStats io_pressure{};
+  bool pressure_available = false;
 };
 
+// Memory in use, in percent of the total, counting what the kernel could
+// reclaim as free.
+inline double mem_used_pct(const MemStats& mem) {
+  return mem.total > 0 ? static_cast<double>(mem.total - mem.available) / mem.total * 100.0 : 0.0;
+}
+
+// The pressure file for a resource: <cgroup_dir>/<resource>.pressure, or
+// the system-wide /proc/pressure/<resource> when cgroup_dir is empty.
+std::string pressure_path(const std::string& cgroup_dir, PressureResource resource);
+
+// Parses the "some avg10=... avg60=... avg300=... total=..." and "full ..."
+// lines of a pressure file. Returns false when neither line is there.
+bool parse_pressure(const std::string& text, PressureStats* stats);
+
 class MetricsSampler {
 public:
-  MetricsSampler();
+  // With a cgroup_dir, pressure is read from that cgroup's *.pressure files
+  // where they exist, and system-wide otherwise.
+  explicit MetricsSampler(const std::string& cgroup_dir = "");
   SystemMetrics sample();
+  // Re-reads only the pressure files into metrics; cheap enough to call
+  // whenever a PressureTriggers fd fires.
+  void sample_pressure(SystemMetrics& metrics) const;
 
 private:
   CpuStats prev_cpu_;
   bool first_sample_ = true;
+  std::string cgroup_dir_;
 
   CpuStats read_cpu_stats();
   MemStats read_mem_stats();
+  bool read_pressure(PressureResource resource, PressureStats* stats) const;
+};
+
+// PSI triggers: fds on pressure files that poll() reports POLLPRI on once
+// tasks stall on a resource for stall_us within any window_us, so pressure
+// is seen as it builds rather than at the next sample.
+class PressureTriggers {
+public:
+  struct Trigger {
+    int fd;
+    PressureResource resource;
+    bool full;
+    // stall_us as a percentage of window_us.
+    double stall_pct;
+  };
+
+  PressureTriggers() = default;
+  ~PressureTriggers();
+  PressureTriggers(const PressureTriggers&) = delete;
+  PressureTriggers& operator=(const PressureTriggers&) = delete;
+
+  // Arms a trigger on pressure_path(cgroup_dir, resource). Returns false,
+  // arming nothing, when the kernel lacks PSI or refuses the trigger (the
+  // window must be 500ms to 10s; unprivileged callers need multiples of 2s).
+  bool add(const std::string& cgroup_dir, PressureResource resource, bool full, uint64_t stall_us,
+           uint64_t window_us);
+  void clear();
+
+  const std::vector<Trigger>& triggers() const {
+    return triggers_;
+  }
+
+private:
+  std::vector<Trigger> triggers_;
 };
 
 class MetricsHistory {
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace heidi {
+
+// Bounded lock-free queue for many producers and one consumer, after
+// Dmitry Vyukov's bounded MPMC queue. Each cell carries a sequence number
+// that says whose turn it is: a producer claims a cell by advancing the tail
+// with one CAS, fills it, then publishes it by bumping the cell's sequence;
+// the consumer takes cells in order as they are published. Neither side
+// takes a lock or allocates after construction, and a full queue makes
+// try_push() fail instead of waiting.
+//
+// A producer preempted between claiming and publishing a cell holds up the
+// consumer at that cell (try_pop() reports empty) until it publishes.
+template <typename T> class MpscQueue {
+public:
+  // capacity is rounded up to a power of two.
+  explicit MpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Claims the next cell and fills it with make(ticket), where ticket counts
+  // successful pushes from 0 and so gives the value's position in the queue.
+  // make runs before the value is visible to the consumer and should be
+  // short. Returns false, without calling make, when the queue is full.
+  template <typename F> bool try_push_with(F&& make) {
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      uint64_t seq = cell.seq.load(std::memory_order_acquire);
+      int64_t diff = static_cast<int64_t>(seq - pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = make(pos);
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The cell still holds the value from one lap ago.
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  bool try_push(T value) {
+    return try_push_with([&](uint64_t) { return std::move(value); });
+  }
+
+  // Claims up to max_n consecutive cells with one CAS, so their tickets are
+  // contiguous, and fills them in order with make(ticket). Returns how many
+  // were pushed: at least min_n (>= 1), or 0, without calling make, when
+  // fewer cells are free.
+  template <typename F> size_t try_push_n_with(size_t min_n, size_t max_n, F&& make) {
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t n = 0;
+      bool stale = false;
+      while (n < max_n) {
+        uint64_t seq = cells_[(pos + n) & mask_].seq.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(seq - (pos + n));
+        if (diff != 0) {
+          // Ahead: another producer claimed it, so pos is out of date.
+          // Behind: the queue is full from there on.
+          stale = diff > 0;
+          break;
+        }
+        ++n;
+      }
+      if (stale) {
+        pos = tail_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (n < min_n || n == 0)
+        return 0;
+      if (!tail_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+        continue;
+      for (size_t i = 0; i < n; ++i) {
+        Cell& cell = cells_[(pos + i) & mask_];
+        cell.value = make(pos + i);
+        cell.seq.store(pos + i + 1, std::memory_order_release);
+      }
+      return n;
+    }
+  }
+
+  // Consumer side; calls must not overlap. Returns false when the next value
+  // is not published yet.
+  bool try_pop(T& out) {
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    Cell& cell = cells_[pos & mask_];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+      return false;
+    out = std::move(cell.value);
+    cell.value = T();
+    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+    head_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Values claimed and not yet popped; exact only while nothing runs
+  // concurrently.
+  size_t size_approx() const {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+private:
+  struct Cell {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_ = 0;
+  // Producers and the consumer each get their own cache line.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  alignas(64) std::atomic<uint64_t> head_{0};
+};
+
+} // namespace heidi
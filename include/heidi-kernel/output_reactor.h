@@ -0,0 +1,148 @@
+#pragma once
+
+#include "heidi-kernel/job.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace heidi {
+
+// Captures job stdout/stderr on a dedicated thread. Pipe read ends are
+// registered edge-triggered with epoll and drained until EAGAIN whenever they
+// become readable, so a chatty job is never left blocked on a full pipe until
+// the next tick. Pipes that keep filling up are grown with F_SETPIPE_SZ.
+//
+// Output always goes through append_job_output(), so it is line-framed
+// whether it ends up in Job::stdout_log/stderr_log or in the job's JobSpool.
+//
+// Job output is appended under the owning JobRunner's mutex, the same lock
+// that guards every other Job field.
+//
+// The reactor also watches a duplicate of each leader's pidfd, when the
+// spawner provided one, and reports the leader's exit through the exit
+// handler as soon as it happens. With a timer handler it also owns a
+// one-shot timerfd (CLOCK_MONOTONIC) that the job runner points at its next
+// deadline, and with an event handler it watches one more descriptor of the
+// runner's (the process inspector's event fd). With a cgroup handler it
+// also watches a duplicate of each contained job's cgroup.events and reports
+// when the cgroup has no processes left.
+class OutputReactor {
+public:
+  // Called on the reactor thread, without the job mutex held.
+  using ExitHandler = std::function<void(const std::shared_ptr<Job>& job)>;
+  // Called on the reactor thread when the timer fires.
+  using TimerHandler = std::function<void()>;
+  // Called on the reactor thread, without the job mutex held, once the
+  // job's cgroup is unpopulated.
+  using CgroupHandler = std::function<void(const std::shared_ptr<Job>& job)>;
+  // Called on the reactor thread while the event fd is readable; it must
+  // drain the fd, which is watched level-triggered.
+  using EventHandler = std::function<void()>;
+
+  explicit OutputReactor(std::mutex& job_mutex);
+  ~OutputReactor();
+
+  OutputReactor(const OutputReactor&) = delete;
+  OutputReactor& operator=(const OutputReactor&) = delete;
+
+  bool start();
+  void stop();
+  bool is_running() const {
+    return running_.load();
+  }
+
+  // Set before start().
+  void set_exit_handler(ExitHandler handler) {
+    exit_handler_ = std::move(handler);
+  }
+  void set_cgroup_handler(CgroupHandler handler) {
+    cgroup_handler_ = std::move(handler);
+  }
+  void set_timer_handler(TimerHandler handler) {
+    timer_handler_ = std::move(handler);
+  }
+  // fd stays the caller's and must outlive the reactor's running.
+  void set_event_handler(int fd, EventHandler handler) {
+    event_fd_ = fd;
+    event_handler_ = std::move(handler);
+  }
+
+  // Whether start() set up the timer (a handler was set and timerfd works).
+  bool has_timer() const {
+    return timer_fd_ >= 0;
+  }
+  // Fires the timer handler once, delay_ms from now (0: right away),
+  // replacing any earlier arming. Callable from any thread.
+  void arm_timer(uint64_t delay_ms);
+  void disarm_timer();
+
+  // Takes ownership of the job's stdout_fd/stderr_fd (both are set to -1) and
+  // closes them at EOF. If an exit handler is set and the job has a pidfd, a
+  // duplicate of it is watched as well; job->pidfd stays with the job. So is
+  // one of job->cgroup_events_fd, given a cgroup handler. Call
+  // with the job mutex held. Returns false, leaving the fds with the job, if
+  // the reactor is not running.
+  bool watch(const std::shared_ptr<Job>& job);
+
+  size_t watched_fds() const;
+  uint64_t bytes_read() const {
+    return bytes_read_.load(std::memory_order_relaxed);
+  }
+  uint64_t pipe_resizes() const {
+    return pipe_resizes_.load(std::memory_order_relaxed);
+  }
+  uint64_t exits_seen() const {
+    return exits_seen_.load(std::memory_order_relaxed);
+  }
+  uint64_t cgroups_emptied() const {
+    return cgroups_emptied_.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum class WatchKind { STDOUT, STDERR, PIDFD, CGROUP };
+
+  struct Watch {
+    std::shared_ptr<Job> job;
+    int fd;
+    WatchKind kind;
+    int pipe_size;
+  };
+
+  void loop();
+  void drain(Watch* w);
+  // Empty the pipe into the job's logs. Returns false once the pipe hit EOF.
+  bool read_all(Watch* w, size_t* drained);
+  void leader_exited(Watch* w);
+  void cgroup_changed(Watch* w);
+  void unwatch(Watch* w);
+  bool add_fd(const std::shared_ptr<Job>& job, int fd, WatchKind kind);
+
+  static constexpr size_t kReadChunk = 64 * 1024;
+  static constexpr int kMaxPipeSize = 1024 * 1024;
+
+  std::mutex& job_mutex_;
+  ExitHandler exit_handler_;
+  CgroupHandler cgroup_handler_;
+  TimerHandler timer_handler_;
+  EventHandler event_handler_;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  int timer_fd_ = -1;
+  int event_fd_ = -1;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+  char* read_buffer_ = nullptr; // Reactor thread only
+  mutable std::mutex watches_mutex_;
+  std::unordered_map<int, std::unique_ptr<Watch>> watches_;
+  std::atomic<uint64_t> bytes_read_{0};
+  std::atomic<uint64_t> pipe_resizes_{0};
+  std::atomic<uint64_t> exits_seen_{0};
+  std::atomic<uint64_t> cgroups_emptied_{0};
+};
+
+} // namespace heidi
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "heidi-kernel/proc_snapshot.h"
+#include "heidi-kernel/process_inspector.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace heidi {
+
+// Jobs' process trees as followed from fork and exit events. A tree starts
+// at a job's leader, is named by the leader's pgid, and holds every process
+// descended from it whatever group or session it moved to. Each tree keeps
+// its live process count and the processes it started over the last
+// kSpawnWindowMs, to within kSpawnBucketMs. Every operation but resync() is
+// a hash lookup or two.
+class ProcessTree {
+public:
+  static constexpr uint64_t kSpawnBucketMs = 1000;
+
+  // Starts a tree at the leader `pgid`, replacing any earlier one.
+  void add_root(pid_t pgid);
+  void remove_root(pid_t pgid);
+
+  // `parent` started `child`. Returns the pgid of the tree the child joined,
+  // or 0 when the parent is not tracked.
+  pid_t on_fork(pid_t parent, pid_t child, uint64_t now_ms);
+  // Returns the pgid of the tree that lost the process, or 0.
+  pid_t on_exit(pid_t pid);
+
+  // After events were lost: drops the tracked pids for which alive() is
+  // false and adds each tree's group members from the snapshot, which
+  // catches up on missed forks that stayed in the group. Returns the pids
+  // dropped.
+  size_t resync(const ProcSnapshot& snapshot, const std::function<bool(pid_t)>& alive);
+
+  // Live processes in the tree, or -1 when pgid is not tracked.
+  int live(pid_t pgid) const;
+  // Processes the tree started in the last kSpawnWindowMs, or -1.
+  int spawns(pid_t pgid, uint64_t now_ms) const;
+  size_t roots() const {
+    return root_ids_.size();
+  }
+  size_t pids() const {
+    return owner_.size();
+  }
+
+private:
+  static constexpr size_t kSpawnBuckets = kSpawnWindowMs / kSpawnBucketMs;
+
+  struct Root {
+    pid_t pgid = 0;
+    int live = 0;
+    // Spawns per bucket, and the bucket (now_ms / kSpawnBucketMs) each
+    // count belongs to.
+    std::array<uint32_t, kSpawnBuckets> spawns{};
+    std::array<uint64_t, kSpawnBuckets> bucket{};
+  };
+
+  const Root* find(pid_t pgid) const;
+
+  // Trees get a fresh id each time, so pids left over from a removed tree
+  // cannot touch a later tree whose leader reused the pgid; they are dropped
+  // when their exit comes in.
+  uint64_t next_id_ = 1;
+  std::unordered_map<pid_t, uint64_t> root_ids_;
+  std::unordered_map<uint64_t, Root> roots_;
+  std::unordered_map<pid_t, uint64_t> owner_;
+};
+
+// Applies the proc connector messages in buf (as read from a
+// NETLINK_CONNECTOR socket) to the tree: process forks and exits, not those
+// of threads. Each event's kernel timestamp (CLOCK_MONOTONIC) is its time.
+// Appends the pgid of every tree that grew to *grown, once per run of
+// events for the same tree. Returns the events applied.
+size_t parse_proc_events(const void* buf, size_t len, ProcessTree& tree,
+                         std::vector<pid_t>* grown);
+
+// Follows process creation through the kernel's process events connector:
+// fork and exit events keep a ProcessTree of every tracked job, so a job's
+// count and spawn rate are lookups, and a fork past a limit is seen as soon
+// as the event is read from event_fd(). Until open() succeeds every call
+// goes to a ProcfsProcessInspector instead, as do counts of groups that
+// were never tracked. When the socket overflows and drops events, the
+// trees are resynchronised from a /proc snapshot.
+class ProcEventInspector : public IProcessInspector {
+public:
+  explicit ProcEventInspector(const std::string& proc_root = "/proc");
+  ~ProcEventInspector() override;
+  ProcEventInspector(const ProcEventInspector&) = delete;
+  ProcEventInspector& operator=(const ProcEventInspector&) = delete;
+
+  // Subscribes to process events and checks, with a throwaway child, that
+  // they arrive and name pids as this process sees them. Needs
+  // CAP_NET_ADMIN in the initial namespaces. Returns false, leaving the
+  // /proc fallback in charge, when that fails.
+  bool open();
+  bool connected() const {
+    return fd_ >= 0;
+  }
+
+  int count_processes_in_pgid(pid_t pgid) override;
+  void snapshot() override;
+  std::optional<uint64_t> leader_start_time(pid_t pgid) override;
+  void track(pid_t pgid) override;
+  void untrack(pid_t pgid) override;
+  int spawn_count(pid_t pgid) override;
+  int event_fd() const override {
+    return fd_;
+  }
+  size_t read_events(std::vector<pid_t>* grown) override;
+
+  // Readable from any thread.
+  uint64_t events_seen() const {
+    return events_seen_.load(std::memory_order_relaxed);
+  }
+  uint64_t overruns() const {
+    return overruns_.load(std::memory_order_relaxed);
+  }
+  size_t tracked_jobs() const {
+    return tracked_jobs_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t kRecvBuffer = 8192;
+  // Socket receive buffer, so a burst of forks does not overflow it before
+  // the reactor thread gets to it.
+  static constexpr int kSocketBuffer = 4 * 1024 * 1024;
+
+  ProcfsProcessInspector fallback_;
+  ProcSnapshot resync_snapshot_;
+  ProcessTree tree_;
+  int fd_ = -1;
+  alignas(8) char recv_buf_[kRecvBuffer];
+  std::atomic<uint64_t> events_seen_{0};
+  std::atomic<uint64_t> overruns_{0};
+  std::atomic<size_t> tracked_jobs_{0};
+};
+
+} // namespace heidi
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <dirent.h>
+#include <optional>
+#include <span>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace heidi {
+
+// Every process under a procfs root at one point, grouped by process group.
+// refresh() walks the root once (readdir on a directory kept open, then an
+// openat() and one read() of <pid>/stat per process into a reused buffer),
+// so any number of per-group lookups after it cost a hash probe rather than
+// a walk each. Storage is kept across refreshes and only grows.
+class ProcSnapshot {
+public:
+  explicit ProcSnapshot(std::string proc_root = "/proc");
+  ~ProcSnapshot();
+  ProcSnapshot(const ProcSnapshot&) = delete;
+  ProcSnapshot& operator=(const ProcSnapshot&) = delete;
+
+  // Re-walks the root. Returns false, leaving the snapshot empty, when it
+  // cannot be read.
+  bool refresh();
+  bool valid() const {
+    return valid_;
+  }
+
+  // Processes in the group; 0 when there are none.
+  int count(pid_t pgid) const;
+  // Their pids, ascending.
+  std::span<const pid_t> pids(pid_t pgid) const;
+  // Start time of the group's leader (field 22 of its stat, in clock ticks
+  // since boot); nullopt when the leader is gone.
+  std::optional<uint64_t> leader_start_time(pid_t pgid) const;
+  // Processes seen by the last refresh().
+  size_t size() const {
+    return pids_.size();
+  }
+
+private:
+  struct Entry {
+    pid_t pgid;
+    pid_t pid;
+    uint64_t start_time;
+  };
+  struct Group {
+    uint32_t first;
+    uint32_t count;
+    bool has_leader;
+    uint64_t leader_start_time;
+  };
+
+  std::string proc_root_;
+  DIR* dir_ = nullptr;
+  bool valid_ = false;
+  std::vector<Entry> entries_;
+  // Grouped by pgid, each group's pids ascending; Group::first indexes it.
+  std::vector<pid_t> pids_;
+  std::unordered_map<pid_t, Group> groups_;
+  // Field 22 of a stat line ends well inside this, whatever the comm.
+  char stat_buf_[1024];
+};
+
+} // namespace heidi
@@ -1,17 +1,76 @@
 #pragma once
 
+#include "heidi-kernel/proc_snapshot.h"
+
 #include <cstdint>
+#include <optional>
+#include <string>
 #include <unistd.h>
+#include <vector>
 
 namespace heidi {
 
+// The window IProcessInspector::spawn_count() counts new processes over.
+inline constexpr uint64_t kSpawnWindowMs = 10000;
+
 struct IProcessInspector {
   virtual ~IProcessInspector() = default;
   virtual int count_processes_in_pgid(pid_t pgid) = 0;
+  // Called once per tick before that tick's other calls, so an inspector
+  // can look at every process once and answer all of them from that.
+  virtual void snapshot() {}
+  // Start time of the group's leader in clock ticks since boot, or nullopt
+  // when the inspector does not know it; the caller then reads it itself.
+  virtual std::optional<uint64_t> leader_start_time(pid_t pgid) {
+    (void)pgid;
+    return std::nullopt;
+  }
+
+  // Inspectors that follow process creation (see ProcEventInspector) count
+  // a job by its process tree rather than by its process group, so children
+  // that leave the group with setsid() or setpgid() still count.
+  //
+  // The job's leader was started as `pgid`; its descendants are counted
+  // from now on.
+  virtual void track(pid_t pgid) {
+    (void)pgid;
+  }
+  // The job has ended; its processes are forgotten.
+  virtual void untrack(pid_t pgid) {
+    (void)pgid;
+  }
+  // Processes the job's tree started in the last kSpawnWindowMs, or -1 when
+  // the inspector does not follow process creation.
+  virtual int spawn_count(pid_t pgid) {
+    (void)pgid;
+    return -1;
+  }
+  // Readable while process events are waiting for read_events(); -1 when
+  // there are none to wait for.
+  virtual int event_fd() const {
+    return -1;
+  }
+  // Handles the waiting events without blocking and appends each tracked
+  // pgid whose tree grew to *grown. Returns the events handled.
+  virtual size_t read_events(std::vector<pid_t>* grown) {
+    (void)grown;
+    return 0;
+  }
 };
 
+// Answers from a ProcSnapshot of /proc. Until the first snapshot() call
+// every count walks /proc afresh; after it, counts come from the latest
+// snapshot.
 struct ProcfsProcessInspector : IProcessInspector {
+  explicit ProcfsProcessInspector(const std::string& proc_root = "/proc");
+
   int count_processes_in_pgid(pid_t pgid) override;
+  void snapshot() override;
+  std::optional<uint64_t> leader_start_time(pid_t pgid) override;
+
+private:
+  ProcSnapshot snapshot_;
+  bool snapshotted_ = false;
 };
 
-} // namespace heidi
\ No newline at end of file
+} // namespace heidi
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "heidi-kernel/job.h"
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace heidi {
+
+struct ExecArgs;
+
+// How RealProcessSpawner creates the job leader.
+//
+// FORK duplicates the daemon (page tables included) and is kept as a reference
+// path. POSIX_SPAWN and VFORK (clone with CLONE_VM | CLONE_VFORK) share the
+// daemon's address space until the child execs, so spawn cost does not grow
+// with daemon RSS.
+enum class SpawnBackend { FORK, POSIX_SPAWN, VFORK };
+
+const char* spawn_backend_name(SpawnBackend backend);
+std::optional<SpawnBackend> parse_spawn_backend(std::string_view name);
+
+// Resolves DIRECT-mode program names against PATH in the daemon, so the child
+// only has to execve(). Results are cached per (PATH, name); a cached entry
+// that fails to exec is dropped by the spawner and resolved again.
+//
+// Empty or relative PATH entries name directories under the job's cwd (the
+// daemon's when cwd is empty), as they would for execvp() in the child. A
+// PATH with such an entry is searched every time and never cached, since
+// what it finds depends on the cwd.
+class ExecPathResolver {
+public:
+  // Names containing '/' are returned as-is. Returns false if no executable
+  // matches in search_path.
+  bool resolve(std::string_view name, std::string_view search_path, std::string_view cwd,
+               std::string* out);
+  void invalidate(std::string_view name, std::string_view search_path);
+  size_t size() const;
+
+private:
+  static constexpr size_t kMaxEntries = 1024;
+
+  mutable std::mutex mutex_;
+  // Key is PATH + '\0' + name.
+  std::unordered_map<std::string, std::string> cache_;
+};
+
+class RealProcessSpawner : public IProcessSpawner {
+public:
+  explicit RealProcessSpawner(SpawnBackend backend = SpawnBackend::VFORK);
+
+  bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) override;
+
+  SpawnBackend backend() const {
+    return backend_;
+  }
+  ExecPathResolver& resolver() {
+    return resolver_;
+  }
+
+private:
+  // Each backend returns the leader pid (or -1 with errno set) and stores a
+  // pidfd for it in *pidfd when the kernel supports one.
+  pid_t spawn_fork(const ExecArgs& exec, int out_w, int err_w, int* pidfd);
+  pid_t spawn_posix(const ExecArgs& exec, int out_w, int err_w, int* pidfd);
+  pid_t spawn_vfork(const ExecArgs& exec, int out_w, int err_w, int* pidfd);
+  pid_t spawn_with_backend(const ExecArgs& exec, int out_w, int err_w, int* pidfd);
+
+  SpawnBackend backend_;
+  ExecPathResolver resolver_;
+};
+
+} // namespace heidi
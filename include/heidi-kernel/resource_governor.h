@@ -1,5 +1,7 @@
 #pragma once
 
+#include "heidi-kernel/metrics.h"
+
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -9,7 +11,16 @@ namespace heidi {
 
 enum class GovernorDecision { START_NOW, HOLD_QUEUE, REJECT_QUEUE_FULL };
 
-enum class BlockReason { NONE, CPU_HIGH, MEM_HIGH, QUEUE_FULL, RUNNING_LIMIT };
+enum class BlockReason {
+  NONE,
+  CPU_HIGH,
+  MEM_HIGH,
+  QUEUE_FULL,
+  RUNNING_LIMIT,
+  CPU_STALL,
+  MEM_STALL,
+  IO_STALL
+};
 
 struct GovernorResult {
   GovernorDecision decision;
@@ -17,6 +28,14 @@ struct GovernorResult {
   uint64_t retry_after_ms;
 };
 
+// Resources a job reserves while it runs, and the capacity they are packed
+// into. A zero request field reserves none of that resource.
+struct ResourceRequest {
+  uint32_t cpu_millicores = 0;
+  uint64_t mem_bytes = 0;
+  uint32_t pids = 0;
+};
+
 struct GovernorPolicy {
   int max_running_jobs = 10;
   int max_queue_depth = 100;
@@ -24,6 +43,51 @@ struct GovernorPolicy {
   double mem_high_watermark_pct = 90.0;
   uint64_t cooldown_ms = 1000;
   uint64_t min_start_gap_ms = 100;
+  // Under CPU or memory pressure, freeze (SIGSTOP) running jobs of lower
+  // priority classes instead of only holding new starts; they resume once
+  // pressure has stayed clear for cooldown_ms.
+  bool preempt_on_pressure = false;
+  // Capacity declared job requests are packed into. 0 takes the host's:
+  // its online CPUs, its physical memory scaled by mem_high_watermark_pct,
+  // and no limit on pids.
+  uint32_t cpu_capacity_millicores = 0;
+  uint64_t mem_capacity_bytes = 0;
+  uint32_t pids_capacity = 0;
+  // Pressure stall thresholds on the 10s averages, in percent; 0 disables
+  // one. Reaching one counts as pressure like a high watermark, reported as
+  // CPU_STALL, MEM_STALL or IO_STALL. Ignored where the kernel has no PSI.
+  double cpu_some_avg10_pct = 0.0;
+  double cpu_full_avg10_pct = 0.0;
+  double mem_some_avg10_pct = 0.0;
+  double mem_full_avg10_pct = 10.0;
+  double io_some_avg10_pct = 0.0;
+  double io_full_avg10_pct = 20.0;
+  // Adjust the running limit between adaptive_min_running_jobs and
+  // max_running_jobs instead of holding it at max_running_jobs: raise it
+  // while smoothed CPU stays below adaptive_target_cpu_pct minus
+  // adaptive_band_pct and the limit is in use, cut it once CPU rises above
+  // the target plus the band or the worst `some` stall reaches
+  // adaptive_stall_pct (0 ignores stalls). At most one step per cooldown_ms.
+  bool adaptive_concurrency = false;
+  double adaptive_target_cpu_pct = 75.0;
+  double adaptive_band_pct = 10.0;
+  double adaptive_stall_pct = 20.0;
+  int adaptive_min_running_jobs = 1;
+};
+
+// The adaptive running limit and what it was last decided on.
+struct ConcurrencyState {
+  // The running limit in force; max_running_jobs unless adaptive.
+  int limit = 0;
+  // Exponentially weighted moving averages of CPU usage and of the worst
+  // `some` stall over CPU, memory and IO, in percent.
+  double cpu_ewma = 0.0;
+  double stall_ewma = 0.0;
+  // Doubling on each raise until the first cut, then raising by one.
+  bool slow_start = true;
+  uint64_t last_change_ms = 0;
+  uint64_t increases = 0;
+  uint64_t decreases = 0;
 };
 
 struct PolicyValidationError {
@@ -42,14 +106,63 @@ public:
   explicit ResourceGovernor(const GovernorPolicy& policy = GovernorPolicy());
 
   GovernorResult decide(double cpu_pct, double mem_pct, int running_jobs, int queued_jobs) const;
+  // As above, also holding starts on the stall thresholds.
+  GovernorResult decide(const SystemMetrics& metrics, int running_jobs, int queued_jobs) const;
+  // CPU_HIGH or MEM_HIGH when a high watermark is reached, whatever the
+  // running and queued counts; NONE otherwise.
+  BlockReason pressure(double cpu_pct, double mem_pct) const;
+  // As above, then CPU_STALL, MEM_STALL or IO_STALL when a stall threshold
+  // is reached.
+  BlockReason pressure(const SystemMetrics& metrics) const;
 
   void update_policy(const GovernorPolicy& policy);
   const GovernorPolicy& get_policy() const;
 
+  // Feeds one tick's metrics to the adaptive running limit; a no-op unless
+  // the policy sets adaptive_concurrency.
+  void observe(const SystemMetrics& metrics, int running_jobs, uint64_t now_ms);
+  // The running limit decide() holds starts at.
+  int running_limit() const {
+    return policy_.adaptive_concurrency ? concurrency_.limit : policy_.max_running_jobs;
+  }
+  const ConcurrencyState& concurrency() const {
+    return concurrency_;
+  }
+
+  // The policy's capacity with host values filled in; a zero field is not
+  // limited.
+  ResourceRequest capacity() const;
+  // What the jobs holding reservations have reserved in total.
+  const ResourceRequest& reserved() const {
+    return reserved_;
+  }
+  // Whether the request fits next to `reserved`. A request for more of a
+  // resource than the whole capacity fits only while none of it is
+  // reserved, so the job runs alone rather than never.
+  bool fits(const ResourceRequest& request, const ResourceRequest& reserved) const;
+  bool fits(const ResourceRequest& request) const {
+    return fits(request, reserved_);
+  }
+  void reserve(const ResourceRequest& request);
+  void release(const ResourceRequest& request);
+
   PolicyUpdateResult validate_and_update(const GovernorPolicy& policy);
 
 private:
+  // Rules 1 to 5, with the pressure already worked out.
+  GovernorResult decide_under(BlockReason pressure_reason, int running_jobs,
+                              int queued_jobs) const;
+
+  // Restarts the adaptive limit from the policy's minimum, or clamps it into
+  // the policy's range when already running.
+  void reset_concurrency(bool restart);
+
   GovernorPolicy policy_;
+  ConcurrencyState concurrency_;
+  bool concurrency_primed_ = false;
+  ResourceRequest reserved_;
+  uint32_t host_cpu_millicores_;
+  uint64_t host_mem_bytes_;
 };
 
 } // namespace heidi
\ No newline at end of file
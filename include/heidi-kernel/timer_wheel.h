@@ -0,0 +1,96 @@
+#pragma once
+
+#include "intrusive_list.h"
+
+#include <array>
+#include <cstdint>
+
+namespace heidi {
+
+// A deadline held by a TimerWheel. Embedded in its owner, so scheduling and
+// cancelling never allocate; it must be cancelled before the owner goes away.
+struct Timer {
+  ListHook<Timer> link;
+  uint64_t deadline_ms = 0;
+  // For the owner to find itself from an expired timer.
+  void* owner = nullptr;
+  // Which of the wheel's lists the timer is on; -1 when not armed.
+  int slot = -1;
+
+  bool armed() const {
+    return slot != -1;
+  }
+};
+
+// Hierarchical timing wheel with 1ms resolution: four levels of 64 slots
+// cover 64ms, ~4s, ~4.5min and ~4.7h ahead of the wheel's clock; later
+// deadlines wait on an overflow list until they come into range. A timer
+// sits in the slot of the highest-order 6-bit digit in which its deadline
+// differs from the clock, and moves down a level each time the clock enters
+// that slot, so schedule() and cancel() are O(1) and advance() costs
+// O(levels) per slot it visits, skipping empty ones through per-level
+// occupancy bitmaps.
+class TimerWheel {
+public:
+  TimerWheel() = default;
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // (Re)arms the timer. Deadlines not after now_ms() expire at once, ready
+  // for pop_expired().
+  void schedule(Timer& timer, uint64_t deadline_ms);
+  void cancel(Timer& timer);
+
+  // Moves the clock forward to now_ms (never back). Timers whose deadline is
+  // reached are queued for pop_expired(), in deadline order.
+  void advance(uint64_t now_ms);
+  // Unlinks and returns the next expired timer, or null.
+  Timer* pop_expired();
+
+  // The earliest time advance() has work to do: an expiry, or moving timers
+  // down a level (at most one such step per level before a deadline).
+  // UINT64_MAX when no timer is armed; now_ms() if some have expired.
+  uint64_t next_event_ms() const;
+
+  uint64_t now_ms() const {
+    return now_ms_;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  using TimerList = IntrusiveList<Timer, &Timer::link>;
+
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr int kExpiredSlot = kLevels * kSlots;
+  static constexpr int kOverflowSlot = kExpiredSlot + 1;
+
+  TimerList& list(int slot) {
+    if (slot == kExpiredSlot)
+      return expired_;
+    if (slot == kOverflowSlot)
+      return overflow_;
+    return slots_[slot];
+  }
+  // Files a timer by its deadline relative to now_ms_.
+  void place(Timer& timer);
+  // The next time a slot comes due, ignoring already expired timers.
+  uint64_t next_slot_ms() const;
+  // Moves the clock to t, a time next_slot_ms() returned: lower-level slots
+  // reached at t are refiled, and timers due at t expire.
+  void step(uint64_t t);
+  // Re-files every timer on a list.
+  void refile_all(TimerList& from);
+
+  std::array<TimerList, kLevels * kSlots> slots_;
+  std::array<uint64_t, kLevels> occupied_{};
+  TimerList expired_;
+  TimerList overflow_;
+  uint64_t now_ms_ = 0;
+  size_t size_ = 0;
+};
+
+} // namespace heidi
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace heidi {
+
+// Spawns jobs through a small single-threaded helper process (the "zygote")
+// forked at startup, before the daemon has threads or a large heap.
+//
+// Requests go over a SOCK_SEQPACKET socketpair. The helper forks the job,
+// puts it in its own process group and passes the pidfd and the stdout/stderr
+// read ends back with SCM_RIGHTS. A job's cgroup directory fd travels with its
+// request the same way, and the leader joins the cgroup before exec. The
+// helper is the jobs' parent, so it also reaps them and reports each wait
+// status back; reap_job() hands those out.
+//
+// If the helper is not running (never started, or died), spawns fall back to
+// an in-process RealProcessSpawner.
+class ZygoteProcessSpawner : public IProcessSpawner {
+public:
+  ZygoteProcessSpawner();
+  ~ZygoteProcessSpawner() override;
+
+  // Forks the helper. Call before the daemon starts any threads.
+  bool start();
+  void stop();
+  bool is_running() const;
+  pid_t helper_pid() const {
+    return helper_pid_;
+  }
+
+  bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) override;
+  void spawn_jobs(std::span<Job* const> jobs, std::span<bool> spawned) override;
+  bool reap_job(Job& job, int* wait_status) override;
+
+private:
+  // Reads one message from the helper. Returns false when none is available
+  // (non-blocking) or the helper is gone.
+  bool read_message_locked(std::span<Job* const> jobs, std::span<bool> spawned,
+                           std::span<bool> answered, size_t* answered_count);
+  void record_exit_locked(pid_t pid, int wait_status);
+  void helper_died_locked();
+
+  static constexpr size_t kMaxPendingExits = 4096;
+
+  int sock_ = -1;
+  pid_t helper_pid_ = -1;
+  mutable std::mutex mutex_;
+  std::unordered_map<pid_t, int> exited_;
+  std::deque<pid_t> exited_order_;
+  RealProcessSpawner fallback_;
+};
+
+} // namespace heidi
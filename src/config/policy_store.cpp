@@ -63,6 +63,36 @@ GovernorPolicy PolicyStore::load() {
         policy.cooldown_ms = std::stoull(value);
       } else if (key == "min_start_gap_ms") {
         policy.min_start_gap_ms = std::stoull(value);
+      } else if (key == "preempt_on_pressure") {
+        policy.preempt_on_pressure = value.find("true") != std::string::npos;
+      } else if (key == "cpu_capacity_millicores") {
+        policy.cpu_capacity_millicores = std::stoul(value);
+      } else if (key == "mem_capacity_bytes") {
+        policy.mem_capacity_bytes = std::stoull(value);
+      } else if (key == "pids_capacity") {
+        policy.pids_capacity = std::stoul(value);
+      } else if (key == "cpu_some_avg10_pct") {
+        policy.cpu_some_avg10_pct = std::stod(value);
+      } else if (key == "cpu_full_avg10_pct") {
+        policy.cpu_full_avg10_pct = std::stod(value);
+      } else if (key == "mem_some_avg10_pct") {
+        policy.mem_some_avg10_pct = std::stod(value);
+      } else if (key == "mem_full_avg10_pct") {
+        policy.mem_full_avg10_pct = std::stod(value);
+      } else if (key == "io_some_avg10_pct") {
+        policy.io_some_avg10_pct = std::stod(value);
+      } else if (key == "io_full_avg10_pct") {
+        policy.io_full_avg10_pct = std::stod(value);
+      } else if (key == "adaptive_concurrency") {
+        policy.adaptive_concurrency = value.find("true") != std::string::npos;
+      } else if (key == "adaptive_target_cpu_pct") {
+        policy.adaptive_target_cpu_pct = std::stod(value);
+      } else if (key == "adaptive_band_pct") {
+        policy.adaptive_band_pct = std::stod(value);
+      } else if (key == "adaptive_stall_pct") {
+        policy.adaptive_stall_pct = std::stod(value);
+      } else if (key == "adaptive_min_running_jobs") {
+        policy.adaptive_min_running_jobs = std::stoi(value);
       }
     }
   }
@@ -95,7 +125,24 @@ void PolicyStore::save(const GovernorPolicy& policy) {
   file << "  \"cpu_high_watermark_pct\": " << policy.cpu_high_watermark_pct << ",\n";
   file << "  \"mem_high_watermark_pct\": " << policy.mem_high_watermark_pct << ",\n";
   file << "  \"cooldown_ms\": " << policy.cooldown_ms << ",\n";
-  file << "  \"min_start_gap_ms\": " << policy.min_start_gap_ms << "\n";
+  file << "  \"min_start_gap_ms\": " << policy.min_start_gap_ms << ",\n";
+  file << "  \"preempt_on_pressure\": " << (policy.preempt_on_pressure ? "true" : "false")
+       << ",\n";
+  file << "  \"cpu_capacity_millicores\": " << policy.cpu_capacity_millicores << ",\n";
+  file << "  \"mem_capacity_bytes\": " << policy.mem_capacity_bytes << ",\n";
+  file << "  \"pids_capacity\": " << policy.pids_capacity << ",\n";
+  file << "  \"cpu_some_avg10_pct\": " << policy.cpu_some_avg10_pct << ",\n";
+  file << "  \"cpu_full_avg10_pct\": " << policy.cpu_full_avg10_pct << ",\n";
+  file << "  \"mem_some_avg10_pct\": " << policy.mem_some_avg10_pct << ",\n";
+  file << "  \"mem_full_avg10_pct\": " << policy.mem_full_avg10_pct << ",\n";
+  file << "  \"io_some_avg10_pct\": " << policy.io_some_avg10_pct << ",\n";
+  file << "  \"io_full_avg10_pct\": " << policy.io_full_avg10_pct << ",\n";
+  file << "  \"adaptive_concurrency\": " << (policy.adaptive_concurrency ? "true" : "false")
+       << ",\n";
+  file << "  \"adaptive_target_cpu_pct\": " << policy.adaptive_target_cpu_pct << ",\n";
+  file << "  \"adaptive_band_pct\": " << policy.adaptive_band_pct << ",\n";
+  file << "  \"adaptive_stall_pct\": " << policy.adaptive_stall_pct << ",\n";
+  file << "  \"adaptive_min_running_jobs\": " << policy.adaptive_min_running_jobs << "\n";
   file << "}\n";
 
   file.close();
@@ -1,13 +1,18 @@
 #include "heidi-kernel/daemon.h"
 
+#include "heidi-kernel/cgroup_driver.h"
 #include "heidi-kernel/ipc.h"
 #include "heidi-kernel/job.h"
 #include "heidi-kernel/metrics.h"
+#include "heidi-kernel/proc_events.h"
+#include "heidi-kernel/process_spawner.h"
 #include "heidi-kernel/resource_governor.h"
+#include "heidi-kernel/zygote_spawner.h"
 
 #include <algorithm>
 #include <chrono>
 #include <csignal>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -20,6 +25,157 @@ namespace heidi {
 
 static volatile bool g_running = true;
 
+namespace {
+
+// HK_SPAWNER selects how jobs are started: "zygote", or one of the
+// RealProcessSpawner backends ("vfork", "posix_spawn", "fork"). Runs from the
+// constructor so the zygote is forked before any daemon thread exists.
+IProcessSpawner* make_spawner() {
+  const char* mode = getenv("HK_SPAWNER");
+  if (!mode || !*mode)
+    return nullptr;
+  if (strcmp(mode, "zygote") == 0) {
+    auto* zygote = new ZygoteProcessSpawner();
+    if (!zygote->start()) {
+      std::cerr << "Failed to start spawn helper, spawning in-process" << std::endl;
+    }
+    return zygote;
+  }
+  if (auto backend = parse_spawn_backend(mode)) {
+    return new RealProcessSpawner(*backend);
+  }
+  std::cerr << "Unknown HK_SPAWNER=" << mode << ", using default" << std::endl;
+  return nullptr;
+}
+
+// HK_PROC_EVENTS=1 follows job processes through the kernel's process
+// events connector instead of scanning /proc (see ProcEventInspector).
+// Null leaves JobRunner's default /proc inspector in place. Runs from the
+// constructor, before any daemon thread exists, as open() forks.
+ProcEventInspector* make_proc_events() {
+  const char* mode = getenv("HK_PROC_EVENTS");
+  if (!mode || !*mode || strcmp(mode, "0") == 0)
+    return nullptr;
+  auto* inspector = new ProcEventInspector();
+  if (!inspector->open()) {
+    std::cerr << "Process events unavailable, counting job processes from /proc" << std::endl;
+  }
+  return inspector;
+}
+
+// HK_CGROUP_ROOT=<dir> contains every job in a cgroup of its own under dir,
+// a cgroup v2 directory created if missing (see
+// JobRunner::set_cgroup_driver()). Null keeps jobs in process groups only.
+gov::CgroupDriver* make_cgroup_driver() {
+  const char* root = getenv("HK_CGROUP_ROOT");
+  if (!root || !*root)
+    return nullptr;
+  auto* driver = new gov::CgroupDriver(root);
+  if (!driver->is_available()) {
+    std::cerr << "Cannot use " << root << " as a cgroup v2 root, containing jobs by process group"
+              << std::endl;
+    delete driver;
+    return nullptr;
+  }
+  return driver;
+}
+
+// Tail size when `job tail` does not give one.
+constexpr uint64_t kDefaultTailBytes = 64 * 1024;
+// Jobs listed by `job status` without / at most with limit=.
+constexpr size_t kDefaultJobListLimit = 10;
+constexpr size_t kMaxJobListLimit = 1000;
+// Jobs per `job batch` (the largest max_queue_depth a policy may set), and
+// bytes of command lines read for one.
+constexpr size_t kMaxBatchJobs = 10000;
+constexpr size_t kMaxBatchBytes = 16 * 1024 * 1024;
+// How long a `job batch` may take to deliver its command lines. The accept
+// loop serves one client at a time, so a stalled sender must not hold it.
+constexpr int kBatchReadTimeoutMs = 2000;
+// PSI trigger window; unprivileged daemons fall back to twice this, the
+// shortest window the kernel lets them arm.
+constexpr uint64_t kPressureWindowUs = 1000000;
+
+enum class OptionResult { NOT_OPTION, APPLIED, INVALID };
+
+// Applies one of a job's leading options: group=<id>, priority=<class>,
+// cpu=<cores> (fractions allowed), mem=<bytes>[K|M|G] or pids=<n>.
+OptionResult apply_job_option(const std::string& word, JobSpec& spec) {
+  size_t eq = word.find('=');
+  if (eq == std::string::npos)
+    return OptionResult::NOT_OPTION;
+  std::string key = word.substr(0, eq);
+  const char* value = word.c_str() + eq + 1;
+  char* end = nullptr;
+  if (key == "group") {
+    spec.group = value;
+  } else if (key == "priority") {
+    if (!parse_job_priority(value, &spec.priority))
+      return OptionResult::INVALID;
+  } else if (key == "cpu") {
+    double cores = strtod(value, &end);
+    if (end == value || *end != '\0' || !(cores >= 0.0 && cores <= 1e6))
+      return OptionResult::INVALID;
+    spec.resources.cpu_millicores = static_cast<uint32_t>(cores * 1000.0 + 0.5);
+  } else if (key == "mem") {
+    uint64_t bytes = strtoull(value, &end, 10);
+    if (end == value)
+      return OptionResult::INVALID;
+    int shift = 0;
+    if (*end == 'K' || *end == 'k')
+      shift = 10;
+    else if (*end == 'M' || *end == 'm')
+      shift = 20;
+    else if (*end == 'G' || *end == 'g')
+      shift = 30;
+    if (shift > 0)
+      ++end;
+    if (*end != '\0' || bytes > (UINT64_MAX >> shift))
+      return OptionResult::INVALID;
+    spec.resources.mem_bytes = bytes << shift;
+  } else if (key == "pids") {
+    unsigned long pids = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || pids > UINT32_MAX)
+      return OptionResult::INVALID;
+    spec.resources.pids = static_cast<uint32_t>(pids);
+  } else {
+    return OptionResult::NOT_OPTION;
+  }
+  return OptionResult::APPLIED;
+}
+
+// Reads from fd onto data until it holds `lines` newline-terminated lines.
+// Returns false at EOF, past max_bytes, or once timeout_ms has passed.
+bool read_lines(int fd, std::string& data, size_t lines, size_t max_bytes, int timeout_ms) {
+  size_t seen = std::count(data.begin(), data.end(), '\n');
+  char buffer[65536];
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (seen < lines) {
+    if (data.size() > max_bytes)
+      return false;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0)
+      return false;
+    struct pollfd pfd{fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, static_cast<int>(left.count()));
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready <= 0)
+      return false;
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    seen += std::count(buffer, buffer + n, '\n');
+    data.append(buffer, n);
+  }
+  return true;
+}
+
+} // namespace
+
 void signal_handler(int sig) {
   (void)sig;
   g_running = false;
@@ -27,14 +183,38 @@ void signal_handler(int sig) {
 
 Daemon::Daemon(const std::string& socket_path, const std::string& state_dir)
     : socket_path_(socket_path), state_dir_(state_dir), history_(new MetricsHistory(state_dir)),
-      job_runner_(new JobRunner()), governor_(new ResourceGovernor()) {
+      spawner_(make_spawner()), proc_events_(make_proc_events()),
+      cgroups_(make_cgroup_driver()), job_runner_(new JobRunner(10, spawner_, proc_events_)),
+      governor_(new ResourceGovernor()) {
   std::signal(SIGINT, signal_handler);
   std::signal(SIGTERM, signal_handler);
+
+  if (const char* cgroup = getenv("HK_PRESSURE_CGROUP"))
+    pressure_cgroup_ = cgroup;
+  if (cgroups_)
+    job_runner_->set_cgroup_driver(cgroups_);
+
+  // Keep job output on disk rather than in daemon memory.
+  std::string spool_dir = state_dir_ + "/spool";
+  if (!job_runner_->enable_log_spool(spool_dir)) {
+    std::cerr << "Cannot create " << spool_dir << ", spooling job output to memfds" << std::endl;
+    job_runner_->enable_log_spool();
+  }
+
+  // Finished jobs past the retention policy move here instead of being lost.
+  std::string archive_dir = state_dir_ + "/archive";
+  if (!job_runner_->enable_job_archive(archive_dir)) {
+    std::cerr << "Cannot open job archive in " << archive_dir
+              << ", evicted jobs will be dropped" << std::endl;
+  }
 }
 
 Daemon::~Daemon() {
   delete history_;
   delete job_runner_;
+  delete spawner_;
+  delete proc_events_;
+  delete cgroups_;
   delete governor_;
 }
 
@@ -44,7 +224,9 @@ void Daemon::run() {
   // Start sampling thread
   sampler_thread_ = std::thread(&Daemon::sampling_thread, this);
 
-  // Start job runner
+  // Start job runner. Job deadlines fire from their own timerfd rather than
+  // waiting for the next monitor tick.
+  job_runner_->set_timer_fd_enabled(true);
   job_runner_->start();
 
   // Setup timerfd for monitoring (2Hz = 500ms intervals)
@@ -68,6 +250,52 @@ void Daemon::run() {
   monitor_thread_ = std::thread(&Daemon::monitor_loop, this);
 
   UnixSocketServer server(socket_path_);
+  server.set_stream_handler([this](const IpcMessage& message, int client_fd) -> bool {
+    const std::string& request = message.type;
+    if (request.rfind("job batch ", 0) == 0) {
+      std::string response = submit_job_batch(request, message.body, client_fd);
+      (void)!write(client_fd, response.data(), response.size());
+      return true;
+    }
+    // job tail <id> [stdout|stderr] [max_bytes | lines=N]: raw log bytes,
+    // sent with sendfile() when the job is spooled.
+    if (request.rfind("job tail ", 0) != 0)
+      return false;
+    std::istringstream iss(request.substr(strlen("job tail ")));
+    std::string job_id, word;
+    LogStream stream = LogStream::STDOUT;
+    uint64_t max_bytes = kDefaultTailBytes;
+    size_t lines = 0;
+    iss >> job_id;
+    while (iss >> word) {
+      if (word == "stderr") {
+        stream = LogStream::STDERR;
+      } else if (word == "stdout") {
+        stream = LogStream::STDOUT;
+      } else {
+        bool by_lines = word.rfind("lines=", 0) == 0;
+        const char* value = word.c_str() + (by_lines ? strlen("lines=") : 0);
+        char* end = nullptr;
+        uint64_t number = strtoull(value, &end, 10);
+        if (*value < '0' || *value > '9' || *end != '\0' || (by_lines && number == 0)) {
+          static const char kInvalid[] = "error\ninvalid_argument\n";
+          (void)!write(client_fd, kInvalid, sizeof(kInvalid) - 1);
+          return true;
+        }
+        if (by_lines)
+          lines = number;
+        else
+          max_bytes = number;
+      }
+    }
+    ssize_t n = lines > 0 ? job_runner_->send_job_tail_lines(job_id, stream, lines, client_fd)
+                          : job_runner_->send_job_tail(job_id, stream, max_bytes, client_fd);
+    if (n < 0 && errno == ENOENT) {
+      static const char kNotFound[] = "error\njob_not_found\n";
+      (void)!write(client_fd, kNotFound, sizeof(kNotFound) - 1);
+    }
+    return true;
+  });
   server.set_request_handler([this](const std::string& request) -> std::string {
     if (request == "ping") {
       return "pong\n";
@@ -79,7 +307,14 @@ void Daemon::run() {
           << "%\nmem_total: " << metrics.mem.total << "\nmem_free: " << metrics.mem.free << "\n";
       oss << "running_jobs: " << running_jobs_ << "\n";
       oss << "queued_jobs: " << queued_jobs_ << "\n";
-      oss << "rejected_jobs: " << rejected_jobs_ << "\n";
+      oss << "rejected_jobs: " << job_runner_->get_jobs_rejected() << "\n";
+      oss << "evicted_jobs: " << job_runner_->get_jobs_evicted() << "\n";
+      oss << "suspended_jobs: " << job_runner_->count_jobs(JobStatus::SUSPENDED) << "\n";
+      oss << "preempted_jobs: " << job_runner_->get_jobs_preempted() << "\n";
+      ResourceRequest reserved = job_runner_->get_reserved_resources();
+      oss << "reserved_cpu_millicores: " << reserved.cpu_millicores
+          << "\nreserved_mem_bytes: " << reserved.mem_bytes
+          << "\nreserved_pids: " << reserved.pids << "\n";
       oss << "blocked_reason: ";
       switch (blocked_reason_) {
       case BlockReason::NONE:
@@ -97,16 +332,144 @@ void Daemon::run() {
       case BlockReason::RUNNING_LIMIT:
         oss << "running_limit";
         break;
+      case BlockReason::CPU_STALL:
+        oss << "cpu_stall";
+        break;
+      case BlockReason::MEM_STALL:
+        oss << "mem_stall";
+        break;
+      case BlockReason::IO_STALL:
+        oss << "io_stall";
+        break;
       }
       oss << "\nretry_after_ms: " << retry_after_ms_;
       oss << "\ncpu_pct: " << metrics.cpu_usage_percent;
       oss << "\nmem_pct: " << (metrics.mem.total - metrics.mem.free) * 100.0 / metrics.mem.total;
       oss << "\n";
+      if (metrics.pressure_available) {
+        oss << "cpu_pressure: some=" << metrics.cpu_pressure.some_avg10
+            << " full=" << metrics.cpu_pressure.full_avg10 << "\n";
+        oss << "mem_pressure: some=" << metrics.mem_pressure.some_avg10
+            << " full=" << metrics.mem_pressure.full_avg10 << "\n";
+        oss << "io_pressure: some=" << metrics.io_pressure.some_avg10
+            << " full=" << metrics.io_pressure.full_avg10 << "\n";
+      }
+      oss << "pressure_triggers: " << pressure_trigger_count_.load() << "\n";
+      if (proc_events_ && proc_events_->connected()) {
+        oss << "proc_events: tracked=" << proc_events_->tracked_jobs()
+            << " events=" << proc_events_->events_seen()
+            << " overruns=" << proc_events_->overruns() << "\n";
+      } else {
+        oss << "proc_events: off\n";
+      }
+      if (cgroups_) {
+        oss << "cgroups: root=" << cgroups_->base_path()
+            << " jobs=" << job_runner_->contained_jobs() << "\n";
+      } else {
+        oss << "cgroups: off\n";
+      }
+      return oss.str();
+    } else if (request.rfind("job run ", 0) == 0) {
+      // job run [group=<id>] [priority=<class>] [cpu=<cores>] [mem=<bytes>]
+      // [pids=<n>] <command>
+      JobSpec spec;
+      spec.command = request.substr(strlen("job run "));
+      for (;;) {
+        size_t end = spec.command.find(' ');
+        OptionResult option = apply_job_option(spec.command.substr(0, end), spec);
+        if (option == OptionResult::NOT_OPTION)
+          break;
+        if (option == OptionResult::INVALID || end == std::string::npos)
+          return "error\ninvalid_argument\n";
+        spec.command.erase(0, end + 1);
+      }
+      std::string job_id = job_runner_->submit_job(spec);
+      if (job_id.empty())
+        return "error\nqueue_full\n";
+      return "job_submitted\njob_id: " + job_id + "\n";
+    } else if (request == "job status" || request.rfind("job status since=", 0) == 0 ||
+               request.rfind("job status limit=", 0) == 0) {
+      // job status [since=<seq>] [limit=N]: newest jobs first, or with since=
+      // the jobs submitted after that one, oldest first, for paging.
+      std::istringstream iss(request.substr(strlen("job status")));
+      std::string word;
+      uint64_t since = 0;
+      size_t limit = kDefaultJobListLimit;
+      bool paged = false;
+      while (iss >> word) {
+        if (word.rfind("since=", 0) == 0) {
+          since = strtoull(word.c_str() + 6, nullptr, 10);
+          paged = true;
+        } else if (word.rfind("limit=", 0) == 0) {
+          limit = std::min<size_t>(strtoull(word.c_str() + 6, nullptr, 10), kMaxJobListLimit);
+        } else {
+          return "error\ninvalid_argument\n";
+        }
+      }
+      auto jobs = paged ? job_runner_->get_job_snapshots_since(since, limit)
+                        : job_runner_->get_recent_job_snapshots(limit);
+      std::ostringstream oss;
+      oss << "job_list\n";
+      if (paged)
+        oss << "next_since: " << (jobs.empty() ? since : jobs.back().seq) << "\n";
+      for (const auto& job : jobs) {
+        oss << job.id << " " << job_status_name(job.status) << " " << job.command << "\n";
+      }
+      return oss.str();
+    } else if (request.rfind("job status ", 0) == 0) {
+      JobSnapshot job;
+      if (!job_runner_->get_job_snapshot(request.substr(strlen("job status ")), &job))
+        return "error\njob_not_found\n";
+      std::ostringstream oss;
+      oss << "job_status\njob_id: " << job.id << "\nstatus: " << job_status_name(job.status)
+          << "\nexit_code: " << job.exit_code << "\ncommand: " << job.command
+          << "\nbytes_written: " << job.bytes_written
+          << "\nlog_truncated: " << (job.log_truncated ? "true" : "false")
+          << "\nlog_dropped: " << job.log_dropped << "\nlines: " << job.lines
+          << "\nlines_truncated: " << job.lines_truncated << "\n";
+      if (!job.group.empty())
+        oss << "group: " << job.group << "\n";
+      if (job.priority != JobPriority::NORMAL)
+        oss << "priority: " << job_priority_name(job.priority) << "\n";
+      const ResourceRequest& res = job.resources;
+      if (res.cpu_millicores > 0 || res.mem_bytes > 0 || res.pids > 0) {
+        oss << "resources: cpu=" << res.cpu_millicores / 1000.0 << " mem=" << res.mem_bytes
+            << " pids=" << res.pids << "\n";
+      }
       return oss.str();
+    } else if (request.rfind("job cancel ", 0) == 0) {
+      std::string job_id = request.substr(strlen("job cancel "));
+      if (!job_runner_->cancel_job(job_id))
+        return "error\njob_not_found\n";
+      return "job_cancelled\njob_id: " + job_id + "\n";
     } else if (request.rfind("governor/policy_update ", 0) == 0) {
       // PUT policy - body follows command
       std::string json_body = request.substr(strlen("governor/policy_update "));
       return update_policy(json_body);
+    } else if (request.rfind("governor/group_share ", 0) == 0) {
+      // governor/group_share <id> [weight=N] [max_running=N]; unset fields
+      // take their defaults (weight 1, no cap).
+      std::istringstream iss(request.substr(strlen("governor/group_share ")));
+      std::string group, word;
+      GroupShare share;
+      iss >> group;
+      while (iss >> word) {
+        if (word.rfind("weight=", 0) == 0) {
+          share.weight = strtoul(word.c_str() + strlen("weight="), nullptr, 10);
+        } else if (word.rfind("max_running=", 0) == 0) {
+          share.max_running_jobs = strtoull(word.c_str() + strlen("max_running="), nullptr, 10);
+        } else {
+          return "error\ninvalid_argument\n";
+        }
+      }
+      if (group.empty() || share.weight == 0)
+        return "error\ninvalid_argument\n";
+      if (!job_runner_->set_group_share(group, share))
+        return "error\ngroup_rejected\n";
+      std::ostringstream oss;
+      oss << "group_share_updated\ngroup: " << group << "\nweight: " << share.weight
+          << "\nmax_running: " << share.max_running_jobs << "\n";
+      return oss.str();
     } else if (request == "governor/policy") {
       std::unique_lock<std::mutex> gov_lock(governor_mutex_);
       const auto& policy = governor_->get_policy();
@@ -117,6 +480,21 @@ void Daemon::run() {
           << "\nmem_high_watermark_pct: " << policy.mem_high_watermark_pct << "\n";
       oss << "cooldown_ms: " << policy.cooldown_ms
           << "\nmin_start_gap_ms: " << policy.min_start_gap_ms << "\n";
+      oss << "preempt_on_pressure: " << (policy.preempt_on_pressure ? "true" : "false") << "\n";
+      oss << "cpu_capacity_millicores: " << policy.cpu_capacity_millicores
+          << "\nmem_capacity_bytes: " << policy.mem_capacity_bytes
+          << "\npids_capacity: " << policy.pids_capacity << "\n";
+      oss << "cpu_some_avg10_pct: " << policy.cpu_some_avg10_pct
+          << "\ncpu_full_avg10_pct: " << policy.cpu_full_avg10_pct
+          << "\nmem_some_avg10_pct: " << policy.mem_some_avg10_pct
+          << "\nmem_full_avg10_pct: " << policy.mem_full_avg10_pct
+          << "\nio_some_avg10_pct: " << policy.io_some_avg10_pct
+          << "\nio_full_avg10_pct: " << policy.io_full_avg10_pct << "\n";
+      oss << "adaptive_concurrency: " << (policy.adaptive_concurrency ? "true" : "false")
+          << "\nadaptive_target_cpu_pct: " << policy.adaptive_target_cpu_pct
+          << "\nadaptive_band_pct: " << policy.adaptive_band_pct
+          << "\nadaptive_stall_pct: " << policy.adaptive_stall_pct
+          << "\nadaptive_min_running_jobs: " << policy.adaptive_min_running_jobs << "\n";
       return oss.str();
     } else if (request == "governor/diagnostics") {
       std::unique_lock<std::mutex> gov_lock(governor_mutex_);
@@ -151,6 +529,15 @@ void Daemon::run() {
       case BlockReason::RUNNING_LIMIT:
         oss << "RUNNING_LIMIT";
         break;
+      case BlockReason::CPU_STALL:
+        oss << "CPU_STALL";
+        break;
+      case BlockReason::MEM_STALL:
+        oss << "MEM_STALL";
+        break;
+      case BlockReason::IO_STALL:
+        oss << "IO_STALL";
+        break;
       }
       oss << "\nlast_retry_after_ms: " << diag.last_retry_after_ms << "\n";
       oss << "last_tick_now_ms: " << diag.last_tick_now_ms << "\n";
@@ -158,6 +545,13 @@ void Daemon::run() {
       oss << "last_tick_queued: " << diag.last_tick_queued << "\n";
       oss << "jobs_started_this_tick: " << jobs_started_this_tick_ << "\n";
       oss << "jobs_scanned_this_tick: " << jobs_scanned_this_tick_ << "\n";
+      const ConcurrencyState& concurrency = diag.concurrency;
+      oss << "running_limit: " << concurrency.limit << "\n";
+      oss << "adaptive_cpu_ewma: " << concurrency.cpu_ewma << "\n";
+      oss << "adaptive_stall_ewma: " << concurrency.stall_ewma << "\n";
+      oss << "adaptive_phase: " << (concurrency.slow_start ? "slow_start" : "additive") << "\n";
+      oss << "adaptive_increases: " << concurrency.increases << "\n";
+      oss << "adaptive_decreases: " << concurrency.decreases << "\n";
       return oss.str();
     } else {
       return "error\n";
@@ -199,6 +593,53 @@ void Daemon::run() {
   std::cout << "Daemon stopped" << std::endl;
 }
 
+std::string Daemon::submit_job_batch(const std::string& request, std::string body,
+                                     int client_fd) {
+  std::istringstream iss(request.substr(strlen("job batch ")));
+  std::string word;
+  BatchMode mode = BatchMode::ALL_OR_NOTHING;
+  // Options given in the header apply to every job in the batch.
+  JobSpec shared;
+  size_t count = 0;
+  while (iss >> word) {
+    OptionResult option = apply_job_option(word, shared);
+    if (option == OptionResult::INVALID) {
+      return "error\ninvalid_argument\n";
+    } else if (option == OptionResult::APPLIED) {
+      continue;
+    } else if (word == "best_effort") {
+      mode = BatchMode::BEST_EFFORT;
+    } else if (word == "all_or_nothing") {
+      mode = BatchMode::ALL_OR_NOTHING;
+    } else {
+      char* end = nullptr;
+      count = strtoull(word.c_str(), &end, 10);
+      if (*end != '\0')
+        return "error\ninvalid_argument\n";
+    }
+  }
+  if (count == 0 || count > kMaxBatchJobs)
+    return "error\ninvalid_argument\n";
+  if (!read_lines(client_fd, body, count, kMaxBatchBytes, kBatchReadTimeoutMs))
+    return "error\nincomplete_batch\n";
+
+  std::vector<JobSpec> specs(count, shared);
+  size_t pos = 0;
+  for (auto& spec : specs) {
+    size_t eol = body.find('\n', pos);
+    spec.command.assign(body, pos, eol - pos);
+    pos = eol + 1;
+  }
+  BatchSubmission result = job_runner_->submit_jobs(specs, mode);
+  if (result.accepted == 0)
+    return "error\nqueue_full\n";
+  std::ostringstream oss;
+  oss << "job_batch_submitted\njob_ids: job_" << result.first_seq << "..job_"
+      << result.first_seq + result.accepted - 1 << "\naccepted: " << result.accepted
+      << "\nrejected: " << count - result.accepted << "\n";
+  return oss.str();
+}
+
 std::string Daemon::update_policy(const std::string& json_body) {
   GovernorPolicy new_policy = governor_->get_policy();
 
@@ -250,6 +691,36 @@ std::string Daemon::update_policy(const std::string& json_body) {
         new_policy.cooldown_ms = std::stoull(value);
       } else if (key == "min_start_gap_ms") {
         new_policy.min_start_gap_ms = std::stoull(value);
+      } else if (key == "preempt_on_pressure") {
+        new_policy.preempt_on_pressure = value == "true";
+      } else if (key == "cpu_capacity_millicores") {
+        new_policy.cpu_capacity_millicores = std::stoul(value);
+      } else if (key == "mem_capacity_bytes") {
+        new_policy.mem_capacity_bytes = std::stoull(value);
+      } else if (key == "pids_capacity") {
+        new_policy.pids_capacity = std::stoul(value);
+      } else if (key == "cpu_some_avg10_pct") {
+        new_policy.cpu_some_avg10_pct = std::stod(value);
+      } else if (key == "cpu_full_avg10_pct") {
+        new_policy.cpu_full_avg10_pct = std::stod(value);
+      } else if (key == "mem_some_avg10_pct") {
+        new_policy.mem_some_avg10_pct = std::stod(value);
+      } else if (key == "mem_full_avg10_pct") {
+        new_policy.mem_full_avg10_pct = std::stod(value);
+      } else if (key == "io_some_avg10_pct") {
+        new_policy.io_some_avg10_pct = std::stod(value);
+      } else if (key == "io_full_avg10_pct") {
+        new_policy.io_full_avg10_pct = std::stod(value);
+      } else if (key == "adaptive_concurrency") {
+        new_policy.adaptive_concurrency = value == "true";
+      } else if (key == "adaptive_target_cpu_pct") {
+        new_policy.adaptive_target_cpu_pct = std::stod(value);
+      } else if (key == "adaptive_band_pct") {
+        new_policy.adaptive_band_pct = std::stod(value);
+      } else if (key == "adaptive_stall_pct") {
+        new_policy.adaptive_stall_pct = std::stod(value);
+      } else if (key == "adaptive_min_running_jobs") {
+        new_policy.adaptive_min_running_jobs = std::stoi(value);
       } else {
         has_unknown_fields = true;
       }
@@ -267,6 +738,8 @@ std::string Daemon::update_policy(const std::string& json_body) {
     }
     return oss.str();
   }
+  job_runner_->set_governor_policy(governor_->get_policy());
+  pressure_triggers_stale_ = true;
 
   if (has_unknown_fields) {
     // We ignore unknown fields, so just return success
@@ -281,25 +754,115 @@ std::string Daemon::update_policy(const std::string& json_body) {
       << "\nmem_high_watermark_pct: " << policy.mem_high_watermark_pct << "\n";
   oss << "cooldown_ms: " << policy.cooldown_ms << "\nmin_start_gap_ms: " << policy.min_start_gap_ms
       << "\n";
+  oss << "preempt_on_pressure: " << (policy.preempt_on_pressure ? "true" : "false") << "\n";
+  oss << "cpu_capacity_millicores: " << policy.cpu_capacity_millicores
+      << "\nmem_capacity_bytes: " << policy.mem_capacity_bytes
+      << "\npids_capacity: " << policy.pids_capacity << "\n";
+  oss << "cpu_some_avg10_pct: " << policy.cpu_some_avg10_pct
+      << "\ncpu_full_avg10_pct: " << policy.cpu_full_avg10_pct
+      << "\nmem_some_avg10_pct: " << policy.mem_some_avg10_pct
+      << "\nmem_full_avg10_pct: " << policy.mem_full_avg10_pct
+      << "\nio_some_avg10_pct: " << policy.io_some_avg10_pct
+      << "\nio_full_avg10_pct: " << policy.io_full_avg10_pct << "\n";
+  oss << "adaptive_concurrency: " << (policy.adaptive_concurrency ? "true" : "false")
+      << "\nadaptive_target_cpu_pct: " << policy.adaptive_target_cpu_pct
+      << "\nadaptive_band_pct: " << policy.adaptive_band_pct
+      << "\nadaptive_stall_pct: " << policy.adaptive_stall_pct
+      << "\nadaptive_min_running_jobs: " << policy.adaptive_min_running_jobs << "\n";
   return oss.str();
 }
 
 void Daemon::monitor_loop() {
-  struct pollfd pfd;
-  pfd.fd = timer_fd_;
-  pfd.events = POLLIN;
+  MetricsSampler pressure_sampler(pressure_cgroup_);
+  std::vector<struct pollfd> pfds;
 
   while (running_) {
-    int ret = poll(&pfd, 1, 1000); // 1 second timeout
-
-    if (ret > 0 && (pfd.revents & POLLIN)) {
+    if (pressure_triggers_stale_.exchange(false))
+      arm_pressure_triggers();
+    const auto& triggers = pressure_triggers_.triggers();
+    pfds.assign(1, {timer_fd_, POLLIN, 0});
+    for (const auto& trigger : triggers)
+      pfds.push_back({trigger.fd, POLLPRI, 0});
+
+    int ret = poll(pfds.data(), pfds.size(), 1000); // 1 second timeout
+    if (ret <= 0)
+      continue;
+
+    bool tick = false;
+    if (pfds[0].revents & POLLIN) {
       // Timer fired, consume the event
       uint64_t expirations;
-      read(timer_fd_, &expirations, sizeof(expirations));
+      (void)!read(timer_fd_, &expirations, sizeof(expirations));
+      tick = true;
+    }
 
+    // A trigger fires once a resource stalled for its threshold's share of
+    // the window, seconds before avg10 gets there; count the stall as
+    // reaching the threshold until the next sample replaces the reading.
+    SystemMetrics metrics;
+    bool fired = false;
+    for (size_t i = 1; i < pfds.size(); ++i) {
+      if (pfds[i].revents & POLLERR) {
+        // The pressure file went away with its cgroup.
+        pressure_triggers_stale_ = true;
+        continue;
+      }
+      if (!(pfds[i].revents & POLLPRI))
+        continue;
+      if (!fired) {
+        metrics = get_latest_metrics();
+        pressure_sampler.sample_pressure(metrics);
+        fired = true;
+      }
+      const auto& trigger = triggers[i - 1];
+      PressureStats& stats = trigger.resource == PressureResource::CPU      ? metrics.cpu_pressure
+                             : trigger.resource == PressureResource::MEMORY ? metrics.mem_pressure
+                                                                            : metrics.io_pressure;
+      double& avg10 = trigger.full ? stats.full_avg10 : stats.some_avg10;
+      avg10 = std::max(avg10, trigger.stall_pct);
+    }
+    if (fired) {
+      std::unique_lock<std::mutex> lock(metrics_mutex_);
+      latest_metrics_ = metrics;
+      tick = true;
+    }
+
+    if (tick)
       handle_monitor_tick();
+  }
+}
+
+void Daemon::arm_pressure_triggers() {
+  GovernorPolicy policy;
+  {
+    std::unique_lock<std::mutex> gov_lock(governor_mutex_);
+    policy = governor_->get_policy();
+  }
+  const struct {
+    PressureResource resource;
+    bool full;
+    double pct;
+  } thresholds[] = {
+      {PressureResource::CPU, false, policy.cpu_some_avg10_pct},
+      {PressureResource::CPU, true, policy.cpu_full_avg10_pct},
+      {PressureResource::MEMORY, false, policy.mem_some_avg10_pct},
+      {PressureResource::MEMORY, true, policy.mem_full_avg10_pct},
+      {PressureResource::IO, false, policy.io_some_avg10_pct},
+      {PressureResource::IO, true, policy.io_full_avg10_pct},
+  };
+
+  pressure_triggers_.clear();
+  for (const auto& threshold : thresholds) {
+    if (threshold.pct <= 0.0)
+      continue;
+    for (uint64_t window_us : {kPressureWindowUs, 2 * kPressureWindowUs}) {
+      auto stall_us = static_cast<uint64_t>(threshold.pct / 100.0 * window_us);
+      if (pressure_triggers_.add(pressure_cgroup_, threshold.resource, threshold.full, stall_us,
+                                 window_us))
+        break;
     }
   }
+  pressure_trigger_count_ = pressure_triggers_.triggers().size();
 }
 
 void Daemon::handle_monitor_tick() {
@@ -307,44 +870,19 @@ void Daemon::handle_monitor_tick() {
                         std::chrono::steady_clock::now().time_since_epoch())
                         .count();
 
-  // Get current metrics
+  // Start queued jobs and enforce limits on running ones (bounded work per
+  // tick); completions in between are handled by the runner's reactor.
   auto metrics = get_latest_metrics();
-  double cpu_pct = metrics.cpu_usage_percent;
-  double mem_pct = (metrics.mem.total - metrics.mem.free) * 100.0 / metrics.mem.total;
+  job_runner_->tick(now_ms, metrics);
+  const TickDiagnostics& diag = job_runner_->get_last_tick_diagnostics();
 
   std::unique_lock<std::mutex> gov_lock(governor_mutex_);
-
-  // Update job counts (simplified - in real impl would track from job runner)
-  // For now, just demonstrate the governor logic
-  auto decision = governor_->decide(cpu_pct, mem_pct, running_jobs_, queued_jobs_);
-
-  blocked_reason_ = decision.reason;
-  retry_after_ms_ = decision.retry_after_ms;
-
-  size_t started = 0;
-
-  // If we can start jobs, try to start up to 5 per tick
-  if (decision.decision == GovernorDecision::START_NOW && queued_jobs_ > 0) {
-    int to_start = std::min(
-        5, std::min(queued_jobs_, governor_->get_policy().max_running_jobs - running_jobs_));
-    for (int i = 0; i < to_start; ++i) {
-      // In real implementation, dequeue from job runner queue
-      queued_jobs_--;
-      running_jobs_++;
-    }
-    started = to_start;
-  }
-
-  // Check job limits with bounded work (max 10 jobs per tick)
-  job_runner_->check_job_limits(10);
-
-  last_tick_diagnostics_.last_decision = decision.decision;
-  last_tick_diagnostics_.last_block_reason = decision.reason;
-  last_tick_diagnostics_.last_retry_after_ms = decision.retry_after_ms;
-  last_tick_diagnostics_.last_tick_now_ms = now_ms;
-  last_tick_diagnostics_.last_tick_running = running_jobs_;
-  last_tick_diagnostics_.last_tick_queued = queued_jobs_;
-  jobs_started_this_tick_ = started;
+  running_jobs_ = diag.last_tick_running;
+  queued_jobs_ = diag.last_tick_queued;
+  blocked_reason_ = diag.last_block_reason;
+  retry_after_ms_ = diag.last_retry_after_ms;
+  last_tick_diagnostics_ = diag;
+  jobs_started_this_tick_ = job_runner_->get_jobs_started_this_tick();
   jobs_scanned_this_tick_ = job_runner_->get_jobs_scanned_this_tick();
 }
 
@@ -358,7 +896,7 @@ std::vector<SystemMetrics> Daemon::get_metrics_tail(size_t n) const {
 }
 
 void Daemon::sampling_thread() {
-  MetricsSampler sampler;
+  MetricsSampler sampler(pressure_cgroup_);
 
   while (running_) {
     // Sample
@@ -1,9 +1,9 @@
 #include "heidi-kernel/cgroup_driver.h"
 
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
-#include <sstream>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/types.h>
@@ -17,17 +17,25 @@ namespace {
 constexpr const char* kDefaultCgroupPath = "/sys/fs/cgroup/heidi";
 constexpr uint64_t kCpuPeriod = 100000ULL;
 
-bool is_cgroup2() {
+bool is_cgroup2(const std::string& path) {
   struct statfs fs;
-  if (statfs("/sys/fs/cgroup", &fs) != 0) {
+  if (statfs(path.c_str(), &fs) != 0) {
     return false;
   }
   return fs.f_type == 0x63677270;
 }
 
-bool check_controller(const std::string& controllers_path, const char* ctrl) {
-  std::string path = controllers_path + "/" + ctrl;
-  return access(path.c_str(), R_OK) == 0;
+// Writes all of value to <dir>/<file>. Returns 0 or an errno value.
+int write_file(const std::string& dir, const char* file, const char* value, size_t len) {
+  std::string path = dir + "/" + file;
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno;
+  }
+  ssize_t written = write(fd, value, len);
+  int err = written == static_cast<ssize_t>(len) ? 0 : (written < 0 ? errno : EIO);
+  close(fd);
+  return err;
 }
 
 } // namespace
@@ -41,17 +49,36 @@ CgroupDriver::CgroupDriver() {
   available_ = detect();
 }
 
-CgroupDriver::~CgroupDriver() = default;
+CgroupDriver::CgroupDriver(const std::string& base_path) : enabled_(true), base_path_(base_path) {
+  available_ = detect();
+}
+
+CgroupDriver::~CgroupDriver() {
+  set_pool_size(0);
+}
 
 bool CgroupDriver::detect() {
-  if (!is_cgroup2()) {
+  // Job containment needs no controller, only a writable cgroup v2
+  // directory.
+  bool created = false;
+  if (!create_base_dir(&created) || !is_cgroup2(base_path_) ||
+      base_.open(base_path_.c_str()) != 0) {
+    if (created) {
+      rmdir(base_path_.c_str());
+    }
     return false;
   }
+  enable_controllers();
+  return true;
+}
 
-  std::string controllers_path = "/sys/fs/cgroup/cgroup.controllers";
+void CgroupDriver::enable_controllers() {
+  // What the parent delegates to the base directory; each is enabled for
+  // the base's children on its own, so one refusal does not cost the rest.
+  std::string controllers_path = base_path_ + "/cgroup.controllers";
   FILE* f = fopen(controllers_path.c_str(), "r");
   if (!f) {
-    return false;
+    return;
   }
 
   char buf[256];
@@ -75,30 +102,39 @@ bool CgroupDriver::detect() {
   fclose(f);
 
   Capability caps = Capability::NONE;
-  if (has_cpu) {
+  if (has_cpu && write_file(base_path_, "cgroup.subtree_control", "+cpu", 4) == 0) {
     caps = caps | Capability::CPU;
   }
-  if (has_memory) {
+  if (has_memory && write_file(base_path_, "cgroup.subtree_control", "+memory", 7) == 0) {
     caps = caps | Capability::MEMORY;
   }
-  if (has_pids) {
+  if (has_pids && write_file(base_path_, "cgroup.subtree_control", "+pids", 5) == 0) {
     caps = caps | Capability::PIDS;
   }
 
   capability_ = caps;
-
-  if (caps == Capability::NONE) {
-    return false;
-  }
-
-  return create_base_dir();
 }
 
-bool CgroupDriver::create_base_dir() {
-  base_path_ = kDefaultCgroupPath;
+bool CgroupDriver::create_base_dir(bool* created) {
+  if (base_path_.empty()) {
+    base_path_ = kDefaultCgroupPath;
+  }
 
-  if (mkdir(base_path_.c_str(), 0755) != 0 && errno != EEXIST) {
-    return false;
+  if (access(base_path_.c_str(), F_OK) != 0) {
+    // Only made inside a cgroup2 mount; anywhere else it would be left
+    // behind for nothing.
+    size_t slash = base_path_.find_last_of('/');
+    std::string parent = slash == std::string::npos ? "."
+                         : slash == 0               ? "/"
+                                                    : base_path_.substr(0, slash);
+    if (!is_cgroup2(parent)) {
+      return false;
+    }
+    if (mkdir(base_path_.c_str(), 0755) == 0) {
+      *created = true;
+    } else if (errno != EEXIST) {
+      return false;
+    }
   }
 
   if (access(base_path_.c_str(), R_OK | W_OK) != 0) {
@@ -110,93 +146,216 @@ bool CgroupDriver::create_base_dir() {
 
 CgroupDriver::ApplyResult CgroupDriver::apply(int32_t pid, const CpuPolicy& cpu,
                                               const MemPolicy& mem, const PidsPolicy& pids) {
-  ApplyResult result;
-
   if (!available_) {
+    ApplyResult result;
     result.success = true;
     return result;
   }
 
-  std::stringstream ss;
-  ss << base_path_ << "/" << pid;
+  std::lock_guard<std::mutex> lock(pid_cgroups_mutex_);
+  auto it = pid_cgroups_.find(pid);
+  if (it == pid_cgroups_.end()) {
+    ApplyResult result;
+    char name[16];
+    snprintf(name, sizeof(name), "%d", pid);
+    if (mkdirat(base_.dir_fd(), name, 0755) != 0 && errno != EEXIST) {
+      result.err = errno;
+      result.error_detail = "failed to create cgroup: " + std::string(strerror(result.err));
+      return result;
+    }
+    CgroupHandle cgroup;
+    result.err = cgroup.open_at(base_.dir_fd(), name);
+    if (result.err != 0) {
+      result.error_detail = "failed to open cgroup: " + std::string(strerror(result.err));
+      return result;
+    }
+    result.err = cgroup.move_pid(pid);
+    if (result.err != 0) {
+      result.error_detail =
+          "failed to write pid to cgroup.procs: " + std::string(strerror(result.err));
+      return result;
+    }
+    it = pid_cgroups_.emplace(pid, std::move(cgroup)).first;
+  }
+  return apply(it->second, cpu, mem, pids);
+}
+
+CgroupDriver::ApplyResult CgroupDriver::apply(CgroupHandle& cgroup, const CpuPolicy& cpu,
+                                              const MemPolicy& mem,
+                                              const PidsPolicy& pids) const {
+  ApplyResult result;
+  auto record = [&result](int err, Capability cap, const char* file) {
+    if (err == 0) {
+      result.applied = result.applied | cap;
+    } else if (result.err == 0) {
+      result.err = err;
+      result.error_detail = "failed to write " + std::string(file) + ": " + strerror(err);
+    }
+  };
 
-  std::string pid_path = ss.str();
-  if (mkdir(pid_path.c_str(), 0755) != 0 && errno != EEXIST) {
-    result.err = errno;
-    result.error_detail = "failed to create cgroup: " + std::string(strerror(errno));
-    return result;
+  if (cpu.max_pct && has_capability(capability_, Capability::CPU)) {
+    uint64_t quota = (*cpu.max_pct * kCpuPeriod) / 100;
+    record(cgroup.set_cpu_max(quota, kCpuPeriod), Capability::CPU, "cpu.max");
+  }
+  if (mem.max_bytes && has_capability(capability_, Capability::MEMORY)) {
+    record(cgroup.set_memory_max(*mem.max_bytes), Capability::MEMORY, "memory.max");
+  }
+  if (pids.max && has_capability(capability_, Capability::PIDS)) {
+    record(cgroup.set_pids_max(*pids.max), Capability::PIDS, "pids.max");
   }
 
-  std::string procs_path = pid_path + "/cgroup.procs";
-  int pf = open(procs_path.c_str(), O_WRONLY);
-  if (pf < 0) {
-    result.err = errno;
-    result.error_detail = "failed to open cgroup.procs: " + std::string(strerror(errno));
-    return result;
+  result.success = result.err == 0;
+  return result;
+}
+
+void CgroupDriver::cleanup(int32_t pid) {
+  if (!available_) {
+    return;
   }
 
-  char pidbuf[32];
-  int len = snprintf(pidbuf, sizeof(pidbuf), "%d", pid);
-  ssize_t written = write(pf, pidbuf, len);
-  close(pf);
+  std::lock_guard<std::mutex> lock(pid_cgroups_mutex_);
+  pid_cgroups_.erase(pid);
+  char name[16];
+  snprintf(name, sizeof(name), "%d", pid);
+  unlinkat(base_.dir_fd(), name, AT_REMOVEDIR);
+}
 
-  if (written != len) {
-    result.err = errno;
-    result.error_detail = "failed to write pid to cgroup.procs";
-    return result;
+int CgroupDriver::remove_job_cgroup(const std::string& path) {
+  return rmdir(path.c_str()) == 0 ? 0 : errno;
+}
+
+int CgroupDriver::count_processes(CgroupHandle& cgroup) const {
+  if (has_capability(capability_, Capability::PIDS)) {
+    CgroupHandle::Stats stats;
+    if (cgroup.read_stats(CgroupHandle::STAT_PIDS, &stats) == 0) {
+      return static_cast<int>(stats.pids_current);
+    }
   }
+  return cgroup.count_procs();
+}
 
-  if (cpu.max_pct && has_capability(capability_, Capability::CPU)) {
-    std::string cpu_max_path = pid_path + "/cpu.max";
-    int cf = open(cpu_max_path.c_str(), O_WRONLY);
-    if (cf >= 0) {
-      uint64_t quota = (*cpu.max_pct * kCpuPeriod) / 100;
-      char buf[64];
-      int len = snprintf(buf, sizeof(buf), "%llu %llu\n", static_cast<unsigned long long>(quota),
-                         static_cast<unsigned long long>(kCpuPeriod));
-      write(cf, buf, len);
-      close(cf);
-      result.applied = result.applied | Capability::CPU;
+int CgroupDriver::read_populated(int events_fd) {
+  char buf[256];
+  ssize_t n = pread(events_fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  const char* populated = strstr(buf, "populated ");
+  if (!populated) {
+    return -1;
+  }
+  return populated[10] == '1' ? 1 : 0;
+}
+
+void CgroupDriver::set_pool_size(size_t size) {
+  std::vector<JobCgroup> surplus;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    pool_size_ = size;
+    while (pool_.size() > pool_size_) {
+      surplus.push_back(std::move(pool_.back()));
+      pool_.pop_back();
     }
   }
+  for (JobCgroup& cgroup : surplus) {
+    cgroup.handle.close();
+    rmdir(cgroup.path.c_str());
+  }
+}
 
-  if (mem.max_bytes && has_capability(capability_, Capability::MEMORY)) {
-    std::string mem_max_path = pid_path + "/memory.max";
-    int mf = open(mem_max_path.c_str(), O_WRONLY);
-    if (mf >= 0) {
-      char buf[32];
-      int len =
-          snprintf(buf, sizeof(buf), "%llu\n", static_cast<unsigned long long>(*mem.max_bytes));
-      write(mf, buf, len);
-      close(mf);
-      result.applied = result.applied | Capability::MEMORY;
+size_t CgroupDriver::refill_pool() {
+  if (!available_) {
+    return 0;
+  }
+  size_t made = 0;
+  std::unique_lock<std::mutex> lock(pool_mutex_);
+  while (pool_.size() < pool_size_) {
+    char name[32];
+    snprintf(name, sizeof(name), "cg_%llu", static_cast<unsigned long long>(next_pooled_++));
+    lock.unlock();
+    JobCgroup cgroup;
+    int err = make_pooled(name, &cgroup);
+    lock.lock();
+    // A busy leftover of the same name is skipped; anything else will fail
+    // again right away.
+    if (err != 0 && err != EBUSY) {
+      break;
+    }
+    if (err == 0) {
+      pool_.push_back(std::move(cgroup));
+      made++;
     }
   }
+  return made;
+}
 
-  if (pids.max && has_capability(capability_, Capability::PIDS)) {
-    std::string pids_max_path = pid_path + "/pids.max";
-    int pf = open(pids_max_path.c_str(), O_WRONLY);
-    if (pf >= 0) {
-      char buf[32];
-      int len = snprintf(buf, sizeof(buf), "%u\n", *pids.max);
-      write(pf, buf, len);
-      close(pf);
-      result.applied = result.applied | Capability::PIDS;
+int CgroupDriver::make_pooled(const char* name, JobCgroup* cgroup) {
+  if (mkdirat(base_.dir_fd(), name, 0755) != 0) {
+    // Left by an earlier daemon; only an empty one can be taken over.
+    if (errno != EEXIST || unlinkat(base_.dir_fd(), name, AT_REMOVEDIR) != 0 ||
+        mkdirat(base_.dir_fd(), name, 0755) != 0) {
+      return errno;
     }
   }
+  int err = cgroup->handle.open_at(base_.dir_fd(), name, true);
+  if (err != 0) {
+    unlinkat(base_.dir_fd(), name, AT_REMOVEDIR);
+    return err;
+  }
+  cgroup->path = base_path_ + "/" + name;
+  return 0;
+}
 
-  result.success = true;
-  return result;
+size_t CgroupDriver::pooled() const {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  return pool_.size();
 }
 
-void CgroupDriver::cleanup(int32_t pid) {
+int CgroupDriver::acquire_job_cgroup(JobCgroup* cgroup) {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (!pool_.empty()) {
+      *cgroup = std::move(pool_.back());
+      pool_.pop_back();
+      return 0;
+    }
+  }
   if (!available_) {
-    return;
+    return ENODEV;
+  }
+  // The pool ran dry: make one on the spot.
+  for (;;) {
+    uint64_t seq;
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex_);
+      seq = next_pooled_++;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "cg_%llu", static_cast<unsigned long long>(seq));
+    int err = make_pooled(name, cgroup);
+    if (err != EBUSY) {
+      return err;
+    }
   }
+}
 
-  std::stringstream ss;
-  ss << base_path_ << "/" << pid;
-  rmdir(ss.str().c_str());
+int CgroupDriver::release_job_cgroup(JobCgroup* cgroup) {
+  if (cgroup->handle.count_procs() == 0) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (pool_.size() < pool_size_) {
+      pool_.push_back(std::move(*cgroup));
+      *cgroup = JobCgroup();
+      return 0;
+    }
+  }
+  cgroup->handle.close();
+  if (rmdir(cgroup->path.c_str()) != 0) {
+    // The path stays for a later remove_job_cgroup().
+    return errno;
+  }
+  cgroup->path.clear();
+  return 0;
 }
 
 } // namespace gov
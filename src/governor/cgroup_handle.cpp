@@ -0,0 +1,247 @@
+#include "heidi-kernel/cgroup_handle.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace heidi {
+namespace gov {
+
+namespace {
+
+struct FileSpec {
+  const char* name;
+  int flags;
+};
+
+// Indexed by CgroupHandle::File.
+constexpr FileSpec kFiles[] = {
+    {"cgroup.procs", O_WRONLY},   {"cgroup.procs", O_RDONLY},   {"cgroup.kill", O_WRONLY},
+    {"cpu.max", O_WRONLY},        {"memory.max", O_WRONLY},     {"pids.max", O_WRONLY},
+    {"pids.current", O_RDONLY},   {"memory.current", O_RDONLY}, {"cpu.stat", O_RDONLY},
+    {"cgroup.events", O_RDONLY},
+};
+
+int format_limit(char* buf, size_t size, uint64_t value) {
+  if (value == CgroupHandle::kUnlimited)
+    return snprintf(buf, size, "max");
+  return snprintf(buf, size, "%llu", static_cast<unsigned long long>(value));
+}
+
+} // namespace
+
+CgroupHandle::CgroupHandle() {
+  fds_.fill(-1);
+}
+
+CgroupHandle::~CgroupHandle() {
+  close();
+}
+
+CgroupHandle::CgroupHandle(CgroupHandle&& other) noexcept
+    : dir_fd_(other.dir_fd_), fds_(other.fds_) {
+  other.dir_fd_ = -1;
+  other.fds_.fill(-1);
+}
+
+CgroupHandle& CgroupHandle::operator=(CgroupHandle&& other) noexcept {
+  if (this != &other) {
+    close();
+    dir_fd_ = other.dir_fd_;
+    fds_ = other.fds_;
+    other.dir_fd_ = -1;
+    other.fds_.fill(-1);
+  }
+  return *this;
+}
+
+int CgroupHandle::open(const char* path, bool for_clone) {
+  return open_at(AT_FDCWD, path, for_clone);
+}
+
+int CgroupHandle::open_at(int parent_fd, const char* name, bool for_clone) {
+  close();
+  int flags = (for_clone ? O_RDONLY : O_PATH) | O_DIRECTORY | O_CLOEXEC;
+  dir_fd_ = openat(parent_fd, name, flags);
+  return dir_fd_ < 0 ? errno : 0;
+}
+
+void CgroupHandle::close() {
+  for (int& fd : fds_) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  if (dir_fd_ >= 0) {
+    ::close(dir_fd_);
+    dir_fd_ = -1;
+  }
+}
+
+int CgroupHandle::file_fd(File file) {
+  if (fds_[file] >= 0)
+    return fds_[file];
+  if (dir_fd_ < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  // A failed open is not remembered: a controller may be enabled later.
+  fds_[file] = openat(dir_fd_, kFiles[file].name, kFiles[file].flags | O_CLOEXEC);
+  return fds_[file];
+}
+
+int CgroupHandle::write_file(File file, const char* value, size_t len) {
+  int fd = file_fd(file);
+  if (fd < 0)
+    return errno;
+  // Control files take each write whole and ignore the offset.
+  ssize_t written = pwrite(fd, value, len, 0);
+  if (written < 0)
+    return errno;
+  return written == static_cast<ssize_t>(len) ? 0 : EIO;
+}
+
+ssize_t CgroupHandle::read_file(File file, char* buf, size_t size) {
+  int fd = file_fd(file);
+  if (fd < 0)
+    return -1;
+  ssize_t n;
+  do {
+    n = pread(fd, buf, size - 1, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+template <typename Fn>
+int CgroupHandle::for_each_proc(Fn fn) {
+  int fd = file_fd(PROCS_READ);
+  if (fd < 0)
+    return errno;
+  char buf[4096];
+  off_t offset = 0;
+  pid_t pid = 0;
+  bool in_number = false;
+  for (;;) {
+    // Reading from offset 0 again starts a fresh listing.
+    ssize_t n = pread(fd, buf, sizeof(buf), offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return errno;
+    if (n == 0)
+      break;
+    offset += n;
+    // A pid may straddle two reads.
+    for (ssize_t i = 0; i < n; ++i) {
+      if (buf[i] >= '0' && buf[i] <= '9') {
+        pid = pid * 10 + (buf[i] - '0');
+        in_number = true;
+      } else if (in_number) {
+        fn(pid);
+        pid = 0;
+        in_number = false;
+      }
+    }
+  }
+  if (in_number)
+    fn(pid);
+  return 0;
+}
+
+int CgroupHandle::move_pid(pid_t pid) {
+  char buf[16];
+  int len = snprintf(buf, sizeof(buf), "%d", pid);
+  return write_file(PROCS_WRITE, buf, len);
+}
+
+int CgroupHandle::set_cpu_max(uint64_t quota_us, uint64_t period_us) {
+  char buf[48];
+  int len = format_limit(buf, sizeof(buf), quota_us);
+  len += snprintf(buf + len, sizeof(buf) - len, " %llu",
+                  static_cast<unsigned long long>(period_us));
+  return write_file(CPU_MAX, buf, len);
+}
+
+int CgroupHandle::set_memory_max(uint64_t bytes) {
+  char buf[24];
+  int len = format_limit(buf, sizeof(buf), bytes);
+  return write_file(MEMORY_MAX, buf, len);
+}
+
+int CgroupHandle::set_pids_max(uint64_t max) {
+  char buf[24];
+  int len = format_limit(buf, sizeof(buf), max);
+  return write_file(PIDS_MAX, buf, len);
+}
+
+int CgroupHandle::kill() {
+  int err = write_file(KILL, "1", 1);
+  if (err == ENOENT)
+    err = signal(SIGKILL);
+  return err;
+}
+
+int CgroupHandle::signal(int sig) {
+  return for_each_proc([sig](pid_t pid) { ::kill(pid, sig); });
+}
+
+int CgroupHandle::count_procs() {
+  int count = 0;
+  if (for_each_proc([&count](pid_t) { count++; }) != 0)
+    return -1;
+  return count;
+}
+
+int CgroupHandle::open_events(int* fd) const {
+  *fd = -1;
+  if (dir_fd_ < 0)
+    return EBADF;
+  *fd = openat(dir_fd_, "cgroup.events", O_RDONLY | O_CLOEXEC);
+  return *fd < 0 ? errno : 0;
+}
+
+int CgroupHandle::read_stats(unsigned which, Stats* stats) {
+  *stats = Stats();
+  int err = 0;
+  char buf[256];
+  auto read_number = [&](File file, int64_t* out) {
+    if (read_file(file, buf, sizeof(buf)) < 0) {
+      if (err == 0)
+        err = errno;
+      return;
+    }
+    *out = strtoll(buf, nullptr, 10);
+  };
+  if (which & STAT_PIDS)
+    read_number(PIDS_CURRENT, &stats->pids_current);
+  if (which & STAT_MEMORY)
+    read_number(MEMORY_CURRENT, &stats->memory_current);
+  if (which & STAT_CPU) {
+    if (read_file(CPU_STAT, buf, sizeof(buf)) < 0) {
+      if (err == 0)
+        err = errno;
+    } else if (const char* usage = strstr(buf, "usage_usec ")) {
+      stats->cpu_usage_usec = strtoll(usage + 11, nullptr, 10);
+    }
+  }
+  if (which & STAT_POPULATED) {
+    if (read_file(EVENTS, buf, sizeof(buf)) < 0) {
+      if (err == 0)
+        err = errno;
+    } else if (const char* populated = strstr(buf, "populated ")) {
+      stats->populated = populated[10] == '1' ? 1 : 0;
+    }
+  }
+  return err;
+}
+
+} // namespace gov
+} // namespace heidi
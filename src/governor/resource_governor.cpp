@@ -1,13 +1,51 @@
 #include "heidi-kernel/resource_governor.h"
 
+#include <algorithm>
 #include <cmath>
+#include <unistd.h>
+#include <utility>
 
 namespace heidi {
 
-ResourceGovernor::ResourceGovernor(const GovernorPolicy& policy) : policy_(policy) {}
+ResourceGovernor::ResourceGovernor(const GovernorPolicy& policy) : policy_(policy) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  host_cpu_millicores_ = cpus > 0 ? static_cast<uint32_t>(cpus) * 1000 : 0;
+  host_mem_bytes_ =
+      pages > 0 && page_size > 0 ? static_cast<uint64_t>(pages) * static_cast<uint64_t>(page_size)
+                                 : 0;
+  reset_concurrency(true);
+}
+
+namespace {
+
+// Weight of each tick's reading in the adaptive limit's moving averages;
+// with the daemon's 500ms tick, a step change is mostly taken in after 5s.
+constexpr double kEwmaWeight = 0.2;
+// The adaptive limit's multiplicative cut. Gentler than halving, as the
+// averages it acts on already lag the overload.
+constexpr double kDecreaseFactor = 0.75;
+
+bool stalled(const PressureStats& stats, double some_pct, double full_pct) {
+  return (some_pct > 0.0 && stats.some_avg10 >= some_pct) ||
+         (full_pct > 0.0 && stats.full_avg10 >= full_pct);
+}
+
+} // namespace
 
 GovernorResult ResourceGovernor::decide(double cpu_pct, double mem_pct, int running_jobs,
                                         int queued_jobs) const {
+  return decide_under(pressure(cpu_pct, mem_pct), running_jobs, queued_jobs);
+}
+
+GovernorResult ResourceGovernor::decide(const SystemMetrics& metrics, int running_jobs,
+                                        int queued_jobs) const {
+  return decide_under(pressure(metrics), running_jobs, queued_jobs);
+}
+
+GovernorResult ResourceGovernor::decide_under(BlockReason pressure_reason, int running_jobs,
+                                              int queued_jobs) const {
   GovernorResult result;
 
   // Rule 1: If queue is full, reject
@@ -19,25 +57,17 @@ GovernorResult ResourceGovernor::decide(double cpu_pct, double mem_pct, int runn
   }
 
   // Rule 2: If running limit reached, hold
-  if (running_jobs >= policy_.max_running_jobs) {
+  if (running_jobs >= running_limit()) {
     result.decision = GovernorDecision::HOLD_QUEUE;
     result.reason = BlockReason::RUNNING_LIMIT;
     result.retry_after_ms = policy_.min_start_gap_ms;
     return result;
   }
 
-  // Rule 3: If CPU high, hold
-  if (cpu_pct >= policy_.cpu_high_watermark_pct) {
-    result.decision = GovernorDecision::HOLD_QUEUE;
-    result.reason = BlockReason::CPU_HIGH;
-    result.retry_after_ms = policy_.cooldown_ms;
-    return result;
-  }
-
-  // Rule 4: If MEM high, hold
-  if (mem_pct >= policy_.mem_high_watermark_pct) {
+  // Rules 3 and 4: If CPU, then MEM, is high, or a resource stalls, hold
+  if (pressure_reason != BlockReason::NONE) {
     result.decision = GovernorDecision::HOLD_QUEUE;
-    result.reason = BlockReason::MEM_HIGH;
+    result.reason = pressure_reason;
     result.retry_after_ms = policy_.cooldown_ms;
     return result;
   }
@@ -49,14 +79,139 @@ GovernorResult ResourceGovernor::decide(double cpu_pct, double mem_pct, int runn
   return result;
 }
 
+BlockReason ResourceGovernor::pressure(double cpu_pct, double mem_pct) const {
+  if (cpu_pct >= policy_.cpu_high_watermark_pct)
+    return BlockReason::CPU_HIGH;
+  if (mem_pct >= policy_.mem_high_watermark_pct)
+    return BlockReason::MEM_HIGH;
+  return BlockReason::NONE;
+}
+
+BlockReason ResourceGovernor::pressure(const SystemMetrics& metrics) const {
+  BlockReason reason = pressure(metrics.cpu_usage_percent, mem_used_pct(metrics.mem));
+  if (reason != BlockReason::NONE || !metrics.pressure_available)
+    return reason;
+  if (stalled(metrics.cpu_pressure, policy_.cpu_some_avg10_pct, policy_.cpu_full_avg10_pct))
+    return BlockReason::CPU_STALL;
+  if (stalled(metrics.mem_pressure, policy_.mem_some_avg10_pct, policy_.mem_full_avg10_pct))
+    return BlockReason::MEM_STALL;
+  if (stalled(metrics.io_pressure, policy_.io_some_avg10_pct, policy_.io_full_avg10_pct))
+    return BlockReason::IO_STALL;
+  return BlockReason::NONE;
+}
+
 void ResourceGovernor::update_policy(const GovernorPolicy& policy) {
+  bool restart = policy.adaptive_concurrency && !policy_.adaptive_concurrency;
   policy_ = policy;
+  reset_concurrency(restart);
+}
+
+void ResourceGovernor::reset_concurrency(bool restart) {
+  int ceiling = std::max(policy_.max_running_jobs, 1);
+  int floor = std::clamp(policy_.adaptive_min_running_jobs, 1, ceiling);
+  if (!policy_.adaptive_concurrency) {
+    concurrency_.limit = policy_.max_running_jobs;
+    return;
+  }
+  if (restart) {
+    concurrency_ = ConcurrencyState();
+    concurrency_.limit = floor;
+    concurrency_primed_ = false;
+  }
+  concurrency_.limit = std::clamp(concurrency_.limit, floor, ceiling);
+}
+
+void ResourceGovernor::observe(const SystemMetrics& metrics, int running_jobs, uint64_t now_ms) {
+  if (!policy_.adaptive_concurrency)
+    return;
+  ConcurrencyState& state = concurrency_;
+  double stall = 0.0;
+  if (metrics.pressure_available) {
+    stall = std::max({metrics.cpu_pressure.some_avg10, metrics.mem_pressure.some_avg10,
+                      metrics.io_pressure.some_avg10});
+  }
+  if (!concurrency_primed_) {
+    state.cpu_ewma = metrics.cpu_usage_percent;
+    state.stall_ewma = stall;
+    state.last_change_ms = now_ms;
+    concurrency_primed_ = true;
+  } else {
+    state.cpu_ewma += kEwmaWeight * (metrics.cpu_usage_percent - state.cpu_ewma);
+    state.stall_ewma += kEwmaWeight * (stall - state.stall_ewma);
+  }
+
+  // Give the last step time to show in the averages before the next.
+  if (now_ms < state.last_change_ms + policy_.cooldown_ms)
+    return;
+
+  int ceiling = std::max(policy_.max_running_jobs, 1);
+  int floor = std::clamp(policy_.adaptive_min_running_jobs, 1, ceiling);
+  double stall_limit = policy_.adaptive_stall_pct;
+  bool over = state.cpu_ewma > policy_.adaptive_target_cpu_pct + policy_.adaptive_band_pct ||
+              (stall_limit > 0.0 && state.stall_ewma >= stall_limit);
+  // Inside the band, or with stalls between half the limit and the limit,
+  // the limit stays put.
+  bool under = state.cpu_ewma < policy_.adaptive_target_cpu_pct - policy_.adaptive_band_pct &&
+               (stall_limit <= 0.0 || state.stall_ewma < stall_limit / 2);
+
+  if (over) {
+    int cut = std::max(floor, static_cast<int>(state.limit * kDecreaseFactor));
+    state.slow_start = false;
+    if (cut < state.limit) {
+      state.limit = cut;
+      state.last_change_ms = now_ms;
+      state.decreases++;
+    }
+  } else if (under && running_jobs >= state.limit) {
+    // Only a limit that holds jobs back is worth raising.
+    int raised = std::min(ceiling, state.slow_start ? state.limit * 2 : state.limit + 1);
+    if (raised > state.limit) {
+      state.limit = raised;
+      state.last_change_ms = now_ms;
+      state.increases++;
+    }
+  }
 }
 
 const GovernorPolicy& ResourceGovernor::get_policy() const {
   return policy_;
 }
 
+ResourceRequest ResourceGovernor::capacity() const {
+  ResourceRequest capacity;
+  capacity.cpu_millicores = policy_.cpu_capacity_millicores > 0 ? policy_.cpu_capacity_millicores
+                                                                : host_cpu_millicores_;
+  capacity.mem_bytes =
+      policy_.mem_capacity_bytes > 0
+          ? policy_.mem_capacity_bytes
+          : static_cast<uint64_t>(host_mem_bytes_ * (policy_.mem_high_watermark_pct / 100.0));
+  capacity.pids = policy_.pids_capacity;
+  return capacity;
+}
+
+bool ResourceGovernor::fits(const ResourceRequest& request,
+                            const ResourceRequest& reserved) const {
+  ResourceRequest cap = capacity();
+  auto fits_one = [](uint64_t want, uint64_t held, uint64_t limit) {
+    return want == 0 || limit == 0 || held + want <= limit || (held == 0 && want > limit);
+  };
+  return fits_one(request.cpu_millicores, reserved.cpu_millicores, cap.cpu_millicores) &&
+         fits_one(request.mem_bytes, reserved.mem_bytes, cap.mem_bytes) &&
+         fits_one(request.pids, reserved.pids, cap.pids);
+}
+
+void ResourceGovernor::reserve(const ResourceRequest& request) {
+  reserved_.cpu_millicores += request.cpu_millicores;
+  reserved_.mem_bytes += request.mem_bytes;
+  reserved_.pids += request.pids;
+}
+
+void ResourceGovernor::release(const ResourceRequest& request) {
+  reserved_.cpu_millicores -= std::min(request.cpu_millicores, reserved_.cpu_millicores);
+  reserved_.mem_bytes -= std::min(request.mem_bytes, reserved_.mem_bytes);
+  reserved_.pids -= std::min(request.pids, reserved_.pids);
+}
+
 PolicyUpdateResult ResourceGovernor::validate_and_update(const GovernorPolicy& policy) {
   PolicyUpdateResult result;
   result.success = true;
@@ -88,13 +243,53 @@ PolicyUpdateResult ResourceGovernor::validate_and_update(const GovernorPolicy& p
     result.success = false;
   }
 
+  // Validate the stall thresholds
+  const std::pair<const char*, double> stall_thresholds[] = {
+      {"cpu_some_avg10_pct", policy.cpu_some_avg10_pct},
+      {"cpu_full_avg10_pct", policy.cpu_full_avg10_pct},
+      {"mem_some_avg10_pct", policy.mem_some_avg10_pct},
+      {"mem_full_avg10_pct", policy.mem_full_avg10_pct},
+      {"io_some_avg10_pct", policy.io_some_avg10_pct},
+      {"io_full_avg10_pct", policy.io_full_avg10_pct},
+  };
+  for (const auto& [field, pct] : stall_thresholds) {
+    if (std::isnan(pct) || pct < 0.0 || pct > 100.0) {
+      result.errors.push_back({field, "must be between 0 and 100"});
+      result.success = false;
+    }
+  }
+
+  // Validate the adaptive running limit
+  if (std::isnan(policy.adaptive_target_cpu_pct) || policy.adaptive_target_cpu_pct < 0.0 ||
+      policy.adaptive_target_cpu_pct > 100.0) {
+    result.errors.push_back({"adaptive_target_cpu_pct", "must be between 0 and 100"});
+    result.success = false;
+  }
+  if (std::isnan(policy.adaptive_band_pct) || policy.adaptive_band_pct < 0.0 ||
+      policy.adaptive_band_pct > 50.0) {
+    result.errors.push_back({"adaptive_band_pct", "must be between 0 and 50"});
+    result.success = false;
+  }
+  if (std::isnan(policy.adaptive_stall_pct) || policy.adaptive_stall_pct < 0.0 ||
+      policy.adaptive_stall_pct > 100.0) {
+    result.errors.push_back({"adaptive_stall_pct", "must be between 0 and 100"});
+    result.success = false;
+  }
+  // An invalid max_running_jobs is reported on its own.
+  if (policy.adaptive_min_running_jobs < 1 ||
+      policy.adaptive_min_running_jobs > std::max(policy.max_running_jobs, 1)) {
+    result.errors.push_back(
+        {"adaptive_min_running_jobs", "must be between 1 and max_running_jobs"});
+    result.success = false;
+  }
+
   // Validate cooldown_ms - no validation needed for uint64_t (always >= 0)
 
   // Validate min_start_gap_ms - no validation needed for uint64_t (always >= 0)
 
   // Only update if validation passes
   if (result.success) {
-    policy_ = policy;
+    update_policy(policy);
     result.effective_policy = policy_;
   }
 
@@ -3,7 +3,6 @@
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
-#include <sstream>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -16,8 +15,10 @@ std::string IpcProtocol::serialize(const IpcMessage& msg) {
 
 IpcMessage IpcProtocol::deserialize(const std::string& data) {
   IpcMessage msg;
-  std::istringstream iss(data);
-  std::getline(iss, msg.type);
+  size_t eol = data.find('\n');
+  msg.type = data.substr(0, eol);
+  if (eol != std::string::npos)
+    msg.body = data.substr(eol + 1);
   return msg;
 }
 
@@ -65,15 +66,17 @@ void UnixSocketServer::stop() {
 }
 
 void UnixSocketServer::handle_client(int client_fd) {
-  char buffer[1024];
-  ssize_t n = read(client_fd, buffer, sizeof(buffer) - 1);
+  char buffer[4096];
+  ssize_t n = read(client_fd, buffer, sizeof(buffer));
   if (n <= 0)
     return;
-  buffer[n] = '\0';
 
-  IpcMessage request = IpcProtocol::deserialize(buffer);
+  IpcMessage request = IpcProtocol::deserialize(std::string(buffer, n));
   IpcMessage response;
 
+  if (stream_handler_ && stream_handler_(request, client_fd))
+    return;
+
   if (request_handler_) {
     std::string resp_str = request_handler_(request.type);
     write(client_fd, resp_str.c_str(), resp_str.size());
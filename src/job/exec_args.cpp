@@ -0,0 +1,59 @@
+#include "exec_args.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+namespace heidi {
+
+namespace {
+
+constexpr std::string_view kDefaultPath = "/usr/bin:/bin";
+
+char* mutable_cstr(const std::string& s) {
+  return const_cast<char*>(s.c_str());
+}
+
+} // namespace
+
+std::string_view exec_search_path(const Job& job) {
+  if (!job.env.empty()) {
+    for (const auto& entry : job.env) {
+      if (entry.starts_with("PATH="))
+        return std::string_view(entry).substr(5);
+    }
+    return kDefaultPath;
+  }
+  const char* path = getenv("PATH");
+  return path ? std::string_view(path) : kDefaultPath;
+}
+
+int prepare_exec(const Job& job, ExecPathResolver& resolver, ExecArgs* out) {
+  out->argv.clear();
+  out->env.clear();
+  out->cwd = job.cwd.empty() ? nullptr : job.cwd.c_str();
+
+  if (job.exec_mode == ExecMode::SHELL) {
+    out->path = "/bin/sh";
+    out->argv = {const_cast<char*>("sh"), const_cast<char*>("-c"), mutable_cstr(job.command),
+                 nullptr};
+  } else {
+    if (job.argv.empty() || job.argv[0].empty())
+      return EINVAL;
+    if (!resolver.resolve(job.argv[0], exec_search_path(job), job.cwd, &out->path))
+      return ENOENT;
+    out->argv.reserve(job.argv.size() + 1);
+    for (const auto& arg : job.argv)
+      out->argv.push_back(mutable_cstr(arg));
+    out->argv.push_back(nullptr);
+  }
+
+  if (!job.env.empty()) {
+    out->env.reserve(job.env.size() + 1);
+    for (const auto& entry : job.env)
+      out->env.push_back(mutable_cstr(entry));
+    out->env.push_back(nullptr);
+  }
+  return 0;
+}
+
+} // namespace heidi
@@ -0,0 +1,40 @@
+// Turns a Job's exec settings into execve() arguments, shared by the spawners.
+#pragma once
+
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern char** environ;
+
+namespace heidi {
+
+// Everything a child needs between fork/clone and execve, prepared up front so
+// the child does no allocation or PATH search. argv/env point into the Job,
+// which must outlive this.
+struct ExecArgs {
+  std::string path;
+  std::vector<char*> argv; // nullptr-terminated
+  std::vector<char*> env;  // nullptr-terminated; empty inherits environ
+  const char* cwd = nullptr;
+  // Directory fd of the cgroup the child is started in, or joins before
+  // exec where it cannot be started there; -1 for none.
+  int cgroup_fd = -1;
+
+  char* const* envp() const {
+    return env.empty() ? environ : env.data();
+  }
+};
+
+// PATH used to resolve a DIRECT job: the job's own PATH= entry if it sets one,
+// otherwise the daemon's.
+std::string_view exec_search_path(const Job& job);
+
+// Returns 0, or an errno value (EINVAL for an empty DIRECT argv, ENOENT when
+// argv[0] is not found on PATH).
+int prepare_exec(const Job& job, ExecPathResolver& resolver, ExecArgs* out);
+
+} // namespace heidi
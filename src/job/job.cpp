@@ -1,6 +1,11 @@
 #include "heidi-kernel/job.h"
 
+#include "heidi-kernel/cgroup_driver.h"
+#include "heidi-kernel/group_policy_store.h"
+#include "heidi-kernel/job_archive.h"
 #include "heidi-kernel/metrics.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
 #include "heidi-kernel/resource_governor.h"
 #include "procfs_starttime.h"
 
@@ -19,6 +24,8 @@
 #include <queue>
 #include <signal.h>
 #include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
@@ -76,145 +83,213 @@ inline void record_proc_cap(const std::shared_ptr<Job>& job, uint64_t tick_ms, i
   }
 }
 
-} // namespace
-
-class RealProcessSpawner : public IProcessSpawner {
-
-public:
-  bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) override {
-
-    int pipe_stdout[2];
-
-    int pipe_stderr[2];
-
-    if (pipe(pipe_stdout) == -1 || pipe(pipe_stderr) == -1) {
-
-      job.status = JobStatus::FAILED;
-
-      job.error = "Failed to create pipes";
-
-      job.finished_at = std::chrono::system_clock::now();
-
-      return false;
+// Sends a view of a job's log to fd. Called with the runner lock held:
+// whatever a socket takes without blocking goes straight from the ring, and
+// only the remainder is copied into rest for a blocking write once the lock
+// is dropped.
+ssize_t send_log_view(int fd, const struct iovec* iov, size_t count, std::string& rest) {
+  struct msghdr msg{};
+  msg.msg_iov = const_cast<struct iovec*>(iov);
+  msg.msg_iovlen = count;
+  ssize_t sent = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (sent < 0)
+    sent = 0;
+  size_t skip = sent;
+  for (size_t i = 0; i < count; ++i) {
+    size_t len = iov[i].iov_len;
+    if (skip >= len) {
+      skip -= len;
+      continue;
     }
+    rest.append(static_cast<const char*>(iov[i].iov_base) + skip, len - skip);
+    skip = 0;
+  }
+  return sent;
+}
 
-    // Set pipes non-blocking
-
-    fcntl(pipe_stdout[0], F_SETFL, O_NONBLOCK);
-
-    fcntl(pipe_stderr[0], F_SETFL, O_NONBLOCK);
-
-    pid_t pid = fork();
-
-    if (pid == -1) {
-
-      close(pipe_stdout[0]);
-
-      close(pipe_stdout[1]);
-
-      close(pipe_stderr[0]);
-
-      close(pipe_stderr[1]);
-
-      job.status = JobStatus::FAILED;
-
-      job.error = "Failed to fork";
-
-      job.finished_at = std::chrono::system_clock::now();
-
-      return false;
+ssize_t write_rest(int fd, ssize_t sent, const std::string& rest) {
+  size_t off = 0;
+  while (off < rest.size()) {
+    ssize_t n = write(fd, rest.data() + off, rest.size() - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return sent + off > 0 ? static_cast<ssize_t>(sent + off) : -1;
     }
+    off += n;
+  }
+  return sent + static_cast<ssize_t>(off);
+}
 
-    if (pid == 0) { // Child
+// "job_<seq>" -> seq.
+bool parse_job_seq(const std::string& job_id, uint64_t* seq) {
+  if (job_id.rfind("job_", 0) != 0 || job_id.size() == 4)
+    return false;
+  char* end = nullptr;
+  *seq = strtoull(job_id.c_str() + 4, &end, 10);
+  return *end == '\0';
+}
 
-      close(pipe_stdout[0]);
+// Submissions not yet drained into the run queue. Above the largest
+// max_queue_depth the governor accepts (10000), so under a valid policy only
+// the depth limit NACKs.
+constexpr size_t kSubmitQueueCapacity = 16384;
 
-      close(pipe_stderr[0]);
+// Queued jobs looked at for backfill per blocked start.
+constexpr size_t kMaxBackfillScan = 64;
 
-      // Optional debug instrumentation; only enabled when HK_DEBUG_PROC_CAP is set.
-      if (g_proc_cap_enabled) {
-        pid_t cpid = getpid();
-        pid_t cpgid_before = getpgid(0);
-        pid_t csid = getsid(0);
-        int set_err = 0;
-        int setres = setpgid(0, 0);
-        if (setres != 0)
-          set_err = errno;
-        fprintf(stderr,
-                "SPAWN_DBG child pid=%d ppid=%d pgid_before=%d setpgid_res=%d setpgid_errno=%d "
-                "sid=%d\n",
-                cpid, getppid(), (int)cpgid_before, setres, set_err, (int)csid);
-      } else {
-        // still attempt to setpgid for correct behavior, but don't log
-        setpgid(0, 0);
-      }
-
-      dup2(pipe_stdout[1], STDOUT_FILENO);
-
-      dup2(pipe_stderr[1], STDERR_FILENO);
+// A QUEUED job for the spec, not yet numbered.
+std::shared_ptr<Job> make_job(const JobSpec& spec, const JobLimits& limits) {
+  auto job = std::make_shared<Job>();
+  job->exec_mode = spec.exec_mode;
+  job->command = spec.command;
+  job->argv = spec.argv;
+  job->env = spec.env;
+  job->cwd = spec.cwd;
+  job->group = spec.group;
+  job->priority = spec.priority;
+  job->resources = spec.resources;
+  if (job->exec_mode == ExecMode::DIRECT && job->command.empty()) {
+    // Display form only; DIRECT jobs never pass this to a shell.
+    for (const auto& arg : job->argv) {
+      if (!job->command.empty())
+        job->command += ' ';
+      job->command += arg;
+    }
+  }
+  job->created_at = std::chrono::system_clock::now();
+  job->runtime_timer.owner = job.get();
+  job->kill_timer.owner = job.get();
+  job->max_runtime_ms = limits.max_runtime_ms;
+  job->max_log_bytes = limits.max_log_bytes;
+  job->log_head_bytes = limits.log_head_bytes;
+  job->max_output_line_bytes = limits.max_output_line_bytes;
+  job->max_child_processes = limits.max_child_processes;
+  job->max_spawns_per_window = limits.max_spawns_per_window;
+  job->kill_grace_ms = limits.kill_grace_ms;
+  init_job_logs(*job);
+  return job;
+}
 
-      close(pipe_stdout[1]);
+// now_ms + delay_ms without wrapping for "unlimited" delays.
+uint64_t deadline_after(uint64_t now_ms, uint64_t delay_ms) {
+  return delay_ms > UINT64_MAX - now_ms ? UINT64_MAX : now_ms + delay_ms;
+}
 
-      close(pipe_stderr[1]);
+// Statuses that hold one of the job's group's running slots.
+bool job_status_is_active(JobStatus status) {
+  return status == JobStatus::STARTING || status == JobStatus::RUNNING ||
+         status == JobStatus::TERMINATING || status == JobStatus::SUSPENDED;
+}
 
-      execl("/bin/sh", "sh", "-c", job.command.c_str(), nullptr);
+// What a job in the status holds of its request: all of it while its
+// processes may run, memory and pids while they are frozen.
+ResourceRequest held_resources(const Job& job, JobStatus status) {
+  ResourceRequest held;
+  if (!job_status_is_active(status))
+    return held;
+  held = job.resources;
+  if (status == JobStatus::SUSPENDED)
+    held.cpu_millicores = 0;
+  return held;
+}
 
-      _exit(1);
+void add_resources(ResourceRequest& to, const ResourceRequest& request) {
+  to.cpu_millicores += request.cpu_millicores;
+  to.mem_bytes += request.mem_bytes;
+  to.pids += request.pids;
+}
 
-    } else { // Parent
+void sub_resources(ResourceRequest& from, const ResourceRequest& request) {
+  from.cpu_millicores -= std::min(from.cpu_millicores, request.cpu_millicores);
+  from.mem_bytes -= std::min(from.mem_bytes, request.mem_bytes);
+  from.pids -= std::min(from.pids, request.pids);
+}
 
-      close(pipe_stdout[1]);
+// Whether any process is left in the group. EPERM still means it exists.
+bool process_group_alive(pid_t pgid) {
+  return pgid > 0 && (kill(-pgid, 0) == 0 || errno == EPERM);
+}
 
-      close(pipe_stderr[1]);
+} // namespace
 
-      // Parent: attempt to record the actual PGID of the leader (robustly).
-      // Some commands run via /bin/sh -c may re-parent or change PGID during exec;
-      // record the PGID observed from the leader pid rather than assuming pid==pgid.
-      pid_t leader_pid = pid;
-      int pg_get_errno = 0;
-      pid_t observed_pgid = -1;
-      // Try a few times with small sleeps to allow the child to set its PGID.
-      for (int attempt = 0; attempt < 10; ++attempt) {
-        observed_pgid = getpgid(leader_pid);
-        if (observed_pgid != -1)
-          break;
-        pg_get_errno = errno;
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-      }
-      if (observed_pgid == -1) {
-        // fallback: record the pid (old behavior) but log the failure once.
-        observed_pgid = pid;
-      }
-      if (g_proc_cap_enabled) {
-        fprintf(stderr, "SPAWN_DBG parent leader_pid=%d observed_pgid=%d pg_get_errno=%d\n",
-                leader_pid, (int)observed_pgid, pg_get_errno);
-      }
-      job.process_group = observed_pgid;
-
-      // Capture leader start_time to guard against PID reuse affecting later
-      // process-group attribution. Use helper to parse /proc/<pid>/stat.
-      auto start_time = read_proc_start_time_ticks(leader_pid);
-      if (start_time) {
-        job.leader_start_time = *start_time;
-        if (g_proc_cap_enabled) {
-          fprintf(stderr, "SPAWN_DBG parent leader_pid=%d leader_start_time=%llu\n", leader_pid,
-                  (unsigned long long)*start_time);
-        }
-      }
+const char* job_status_name(JobStatus status) {
+  switch (status) {
+  case JobStatus::QUEUED:
+    return "QUEUED";
+  case JobStatus::STARTING:
+    return "STARTING";
+  case JobStatus::RUNNING:
+    return "RUNNING";
+  case JobStatus::COMPLETED:
+    return "COMPLETED";
+  case JobStatus::FAILED:
+    return "FAILED";
+  case JobStatus::CANCELLED:
+    return "CANCELLED";
+  case JobStatus::TIMEOUT:
+    return "TIMEOUT";
+  case JobStatus::PROC_LIMIT:
+    return "PROC_LIMIT";
+  case JobStatus::TERMINATING:
+    return "TERMINATING";
+  case JobStatus::SUSPENDED:
+    return "SUSPENDED";
+  }
+  return "UNKNOWN";
+}
 
-      *stdout_fd = pipe_stdout[0];
+bool job_status_is_final(JobStatus status) {
+  return status != JobStatus::QUEUED && status != JobStatus::STARTING &&
+         status != JobStatus::RUNNING && status != JobStatus::TERMINATING &&
+         status != JobStatus::SUSPENDED;
+}
 
-      *stderr_fd = pipe_stderr[0];
+const char* job_priority_name(JobPriority priority) {
+  switch (priority) {
+  case JobPriority::BATCH:
+    return "batch";
+  case JobPriority::NORMAL:
+    return "normal";
+  case JobPriority::INTERACTIVE:
+    return "interactive";
+  }
+  return "unknown";
+}
 
+bool parse_job_priority(const std::string& name, JobPriority* priority) {
+  for (size_t i = 0; i < kJobPriorityCount; ++i) {
+    if (name == job_priority_name(static_cast<JobPriority>(i))) {
+      *priority = static_cast<JobPriority>(i);
       return true;
     }
   }
-};
+  return false;
+}
+
+void IProcessSpawner::spawn_jobs(std::span<Job* const> jobs, std::span<bool> spawned) {
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    spawned[i] = spawn_job(*jobs[i], &jobs[i]->stdout_fd, &jobs[i]->stderr_fd);
+  }
+}
+
+bool IProcessSpawner::reap_job(Job& job, int* wait_status) {
+  if (job.process_group <= 0)
+    return false;
+  return waitpid(job.process_group, wait_status, WNOHANG) == job.process_group;
+}
 
 JobRunner::JobRunner(size_t max_concurrent_jobs, IProcessSpawner* spawner,
                      IProcessInspector* inspector)
 
-    : max_concurrent_(max_concurrent_jobs), spawner_(spawner), inspector_(inspector) {
+    : max_concurrent_(max_concurrent_jobs), submissions_(kSubmitQueueCapacity),
+      max_queue_depth_(GovernorPolicy().max_queue_depth), spawner_(spawner),
+      inspector_(inspector), output_reactor_(new OutputReactor(mutex_)) {
+  groups_.emplace("", std::make_unique<JobGroup>());
+  output_reactor_->set_exit_handler(
+      [this](const std::shared_ptr<Job>& job) { on_leader_exit(job); });
+  output_reactor_->set_cgroup_handler(
+      [this](const std::shared_ptr<Job>& job) { on_cgroup_empty(job); });
 
   if (!spawner_) {
 
@@ -233,61 +308,236 @@ JobRunner::~JobRunner() {
 
 void JobRunner::start() {
   running_ = true;
+  if (cgroups_) {
+    // Enough warm cgroups for a full set of running jobs.
+    cgroups_->set_pool_size(max_concurrent_);
+    cgroups_->refill_pool();
+  }
+  if (output_reactor_enabled_) {
+    if (timer_fd_enabled_)
+      output_reactor_->set_timer_handler([this] { on_timer(); });
+    // Process events are handled as they arrive, not at the next tick.
+    if (inspector_->event_fd() >= 0)
+      output_reactor_->set_event_handler(inspector_->event_fd(), [this] { on_process_events(); });
+    output_reactor_->start();
+    timer_fd_active_ = output_reactor_->has_timer();
+  }
 }
 
 void JobRunner::stop() {
   running_ = false;
   cv_.notify_all();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    timer_fd_active_ = false;
+  }
+  output_reactor_->stop();
+  // Whatever the last tick evicted.
+  archive_evicted();
 }
 
-std::string JobRunner::submit_job(const std::string& command, const JobLimits& limits) {
-  static std::atomic<uint64_t> job_counter{0};
-  auto job = std::make_shared<Job>();
-  job->id = "job_" + std::to_string(++job_counter);
-  job->command = command;
-  job->created_at = std::chrono::system_clock::now();
-  job->max_runtime_ms = limits.max_runtime_ms;
-  job->max_log_bytes = limits.max_log_bytes;
-  job->max_output_line_bytes = limits.max_output_line_bytes;
-  job->max_child_processes = limits.max_child_processes;
+void JobRunner::set_governor_policy(const GovernorPolicy& policy) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  governor_.update_policy(policy);
+  max_queue_depth_.store(policy.max_queue_depth, std::memory_order_relaxed);
+}
+
+bool JobRunner::enable_log_spool(const std::string& dir) {
+  if (!dir.empty() && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+    return false;
+  std::unique_lock<std::mutex> lock(mutex_);
+  log_spool_enabled_ = true;
+  log_spool_dir_ = dir;
+  return true;
+}
 
+ssize_t JobRunner::send_job_tail(const std::string& job_id, LogStream stream, uint64_t max_bytes,
+                                 int fd) {
+  std::shared_ptr<JobSpool> spool;
+  JobArchive* archive = nullptr;
+  ssize_t sent = 0;
+  std::string rest;
   {
     std::unique_lock<std::mutex> lock(mutex_);
-    jobs_[job->id] = job;
-    job_queue_.push(job);
+    drain_submissions_locked();
+    std::shared_ptr<Job> job = find_job_locked(job_id);
+    if (!job) {
+      archive = archive_.get();
+      if (!archive) {
+        errno = ENOENT;
+        return -1;
+      }
+    } else if (job->spool) {
+      spool = job->spool;
+    } else {
+      const LogRing& log = stream == LogStream::STDOUT ? job->stdout_log : job->stderr_log;
+      struct iovec iov[LogRing::kMaxIov];
+      sent = send_log_view(fd, iov, log.tail_iov(max_bytes, iov), rest);
+    }
+  }
+  // Never block on the client while holding the runner lock.
+  if (spool)
+    return spool->send_tail(fd, stream, max_bytes);
+  if (archive) {
+    uint64_t seq;
+    if (!parse_job_seq(job_id, &seq)) {
+      errno = ENOENT;
+      return -1;
+    }
+    return archive->send_tail(seq, stream, max_bytes, fd);
+  }
+  return write_rest(fd, sent, rest);
+}
+
+ssize_t JobRunner::send_job_tail_lines(const std::string& job_id, LogStream stream, size_t lines,
+                                       int fd) {
+  std::shared_ptr<JobSpool> spool;
+  uint64_t start = 0;
+  ssize_t sent = 0;
+  std::string rest;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_locked();
+    std::shared_ptr<Job> found = find_job_locked(job_id);
+    if (!found) {
+      errno = ENOENT;
+      return -1;
+    }
+    Job& job = *found;
+    bool out = stream == LogStream::STDOUT;
+    const LineFramer& framer = out ? job.stdout_lines : job.stderr_lines;
+    if (job.spool) {
+      if (!framer.tail_lines_start(SpoolStream(*job.spool, stream), lines, &start))
+        return 0;
+      spool = job.spool;
+    } else {
+      struct iovec iov[LogRing::kMaxIov];
+      size_t count = framer.tail_lines(out ? job.stdout_log : job.stderr_log, lines, iov);
+      sent = send_log_view(fd, iov, count, rest);
+    }
+  }
+  // As in send_job_tail(): the spool is sent without the lock.
+  if (spool)
+    return spool->send_from(fd, stream, start);
+  return write_rest(fd, sent, rest);
+}
+
+std::string JobRunner::submit_job(const std::string& command, const JobLimits& limits) {
+  JobSpec spec;
+  spec.command = command;
+  return submit_job(spec, limits);
+}
+
+std::string JobRunner::submit_job(const JobSpec& spec, const JobLimits& limits) {
+  // Reserve a place in the queue first, so a NACK costs no allocation.
+  if (reserve_queued(1, 1) == 0) {
+    jobs_rejected_.fetch_add(1, std::memory_order_relaxed);
+    return "";
+  }
+
+  auto job = make_job(spec, limits);
+  // Numbered by queue position, so jobs are drained, and listed, in seq
+  // order.
+  uint64_t seq = 0;
+  bool pushed = submissions_.try_push_with([&](uint64_t ticket) {
+    seq = first_job_seq_.load(std::memory_order_relaxed) + ticket;
+    job->seq = seq;
+    return job;
+  });
+  if (!pushed) {
+    // Only when drains fall more than the queue's capacity behind.
+    queued_jobs_.fetch_sub(1, std::memory_order_relaxed);
+    jobs_rejected_.fetch_add(1, std::memory_order_relaxed);
+    return "";
   }
   cv_.notify_one();
 
-  return job->id;
+  return "job_" + std::to_string(seq);
+}
+
+BatchSubmission JobRunner::submit_jobs(std::span<const JobSpec> specs, BatchMode mode,
+                                       const JobLimits& limits) {
+  BatchSubmission result;
+  if (specs.empty())
+    return result;
+  size_t min_n = mode == BatchMode::ALL_OR_NOTHING ? specs.size() : 1;
+  size_t n = reserve_queued(min_n, specs.size());
+  if (n == 0) {
+    jobs_rejected_.fetch_add(specs.size(), std::memory_order_relaxed);
+    return result;
+  }
+
+  std::vector<std::shared_ptr<Job>> jobs;
+  jobs.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+    jobs.push_back(make_job(specs[i], limits));
+
+  // One claim for the whole batch keeps its seqs contiguous.
+  uint64_t base = first_job_seq_.load(std::memory_order_relaxed);
+  size_t next = 0;
+  size_t pushed = submissions_.try_push_n_with(std::min(min_n, n), n, [&](uint64_t ticket) {
+    auto& job = jobs[next++];
+    job->seq = base + ticket;
+    if (next == 1)
+      result.first_seq = job->seq;
+    return job;
+  });
+  if (pushed < n)
+    queued_jobs_.fetch_sub(n - pushed, std::memory_order_relaxed);
+  result.accepted = pushed;
+  if (pushed < specs.size())
+    jobs_rejected_.fetch_add(specs.size() - pushed, std::memory_order_relaxed);
+  if (pushed > 0)
+    cv_.notify_one();
+  return result;
+}
+
+size_t JobRunner::reserve_queued(size_t min_n, size_t max_n) {
+  size_t depth = max_queue_depth_.load(std::memory_order_relaxed);
+  size_t queued = queued_jobs_.load(std::memory_order_relaxed);
+  for (;;) {
+    size_t n = std::min(queued < depth ? depth - queued : 0, max_n);
+    if (n == 0 || n < min_n)
+      return 0;
+    if (queued_jobs_.compare_exchange_weak(queued, queued + n, std::memory_order_relaxed))
+      return n;
+  }
+}
+
+void JobRunner::drain_submissions_locked() {
+  std::shared_ptr<Job> job;
+  while (submissions_.try_pop(job)) {
+    // Formatted here, off the submitters' path.
+    job->id = "job_" + std::to_string(job->seq);
+    JobGroup& group = group_locked(job->group);
+    if (group.id != job->group)
+      job->group = group.id;
+    job->queue_group = &group;
+    group.lanes[static_cast<size_t>(job->priority)].queued.push_back(*job);
+    update_ready_locked(group);
+    created_.push_back(*job);
+    jobs_in(JobStatus::QUEUED).push_back(*job);
+    status_counts_[static_cast<size_t>(JobStatus::QUEUED)]++;
+    std::string id = job->id;
+    jobs_.emplace(std::move(id), std::move(job));
+  }
 }
 
 bool JobRunner::cancel_job(const std::string& job_id) {
   std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
   auto it = jobs_.find(job_id);
   if (it == jobs_.end()) {
     return false;
   }
   auto job = it->second;
-  if (job->status == JobStatus::RUNNING) {
-    // Send SIGTERM to process group
-    if (job->process_group > 0) {
-      kill(-job->process_group, SIGTERM);
-
-      // Wait briefly, then SIGKILL if needed
-      std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
-      if (kill(-job->process_group, 0) == 0) {
-        kill(-job->process_group, SIGKILL);
-      }
-    }
-
-    job->status = JobStatus::CANCELLED;
-    job->finished_at = std::chrono::system_clock::now();
-    job->ended_at_ms =
-        std::chrono::duration_cast<std::chrono::milliseconds>(job->finished_at.time_since_epoch())
-            .count();
+  if (job->status == JobStatus::RUNNING || job->status == JobStatus::SUSPENDED) {
+    // The tick (or the leader's pidfd) finishes the job once its group is
+    // gone, sending SIGKILL after kill_grace_ms.
+    terminate_job_locked(*job, JobStatus::CANCELLED, tick_clock_locked());
+    rearm_timer_locked();
   } else if (job->status == JobStatus::QUEUED) {
-    job->status = JobStatus::CANCELLED;
+    set_status_locked(*job, JobStatus::CANCELLED);
     job->finished_at = std::chrono::system_clock::now();
     job->ended_at_ms =
         std::chrono::duration_cast<std::chrono::milliseconds>(job->finished_at.time_since_epoch())
@@ -296,61 +546,139 @@ bool JobRunner::cancel_job(const std::string& job_id) {
   return true;
 }
 
-std::shared_ptr<Job> JobRunner::get_job_status(const std::string& job_id) const {
-  std::unique_lock<std::mutex> lock(mutex_);
-  auto it = jobs_.find(job_id);
-  if (it == jobs_.end()) {
+std::shared_ptr<Job> JobRunner::get_job_status(const std::string& job_id) {
+  JobArchive* archive;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_locked();
+    if (std::shared_ptr<Job> job = find_job_locked(job_id))
+      return job;
+    archive = archive_.get();
+  }
+  // Evicted jobs come back from the archive, read without the lock.
+  uint64_t seq;
+  if (!archive || !parse_job_seq(job_id, &seq))
     return nullptr;
+  return archive->load(seq);
+}
+
+bool JobRunner::get_job_snapshot(const std::string& job_id, JobSnapshot* out) {
+  JobArchive* archive;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_submissions_locked();
+    if (std::shared_ptr<Job> job = find_job_locked(job_id)) {
+      *out = snapshot_job(*job);
+      return true;
+    }
+    archive = archive_.get();
   }
-  return it->second;
+  // A loaded archive entry is the caller's alone.
+  uint64_t seq;
+  std::shared_ptr<Job> job;
+  if (!archive || !parse_job_seq(job_id, &seq) || !(job = archive->load(seq)))
+    return false;
+  *out = snapshot_job(*job);
+  return true;
 }
 
-std::vector<std::shared_ptr<Job>> JobRunner::get_recent_jobs(size_t limit) const {
+std::vector<std::shared_ptr<Job>> JobRunner::get_recent_jobs(size_t limit) {
   std::unique_lock<std::mutex> lock(mutex_);
-  std::vector<std::shared_ptr<Job>> all_jobs;
-  for (const auto& pair : jobs_) {
-    all_jobs.push_back(pair.second);
-  }
-  // Sort by creation time, most recent first
-  std::sort(all_jobs.begin(), all_jobs.end(),
-            [](const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) {
-              return a->created_at > b->created_at;
-            });
-  if (all_jobs.size() > limit) {
-    all_jobs.resize(limit);
-  }
-  return all_jobs;
+  drain_submissions_locked();
+  std::vector<std::shared_ptr<Job>> jobs;
+  jobs.reserve(std::min(limit, jobs_.size()));
+  for (Job* job = created_.back(); job && jobs.size() < limit; job = JobCreatedList::prev(*job))
+    jobs.push_back(job->shared_from_this());
+  return jobs;
 }
 
-void JobRunner::check_job_limits(uint64_t now_ms, size_t max_jobs_to_check) {
-  // std::unique_lock<std::mutex> lock(mutex_);  // Already locked by caller
-  size_t checked = 0;
+size_t JobRunner::get_recent_jobs(std::span<std::shared_ptr<Job>> out) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
+  size_t n = 0;
+  for (Job* job = created_.back(); job && n < out.size(); job = JobCreatedList::prev(*job))
+    out[n++] = job->shared_from_this();
+  return n;
+}
 
-  // Get list of jobs to check (RUNNING or STARTING)
-  std::vector<std::shared_ptr<Job>> running_jobs;
-  for (const auto& pair : jobs_) {
-    if (pair.second->status == JobStatus::RUNNING || pair.second->status == JobStatus::STARTING) {
-      running_jobs.push_back(pair.second);
-    }
-  }
+std::vector<std::shared_ptr<Job>> JobRunner::get_jobs_since(uint64_t since_seq,
+                                                            size_t limit) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
+  std::vector<std::shared_ptr<Job>> jobs;
+  jobs.reserve(std::min(limit, jobs_.size()));
+  for (Job* job = first_after_locked(since_seq); job && jobs.size() < limit;
+       job = JobCreatedList::next(*job))
+    jobs.push_back(job->shared_from_this());
+  return jobs;
+}
 
-  size_t num_running = running_jobs.size();
-  if (num_running == 0)
-    return;
+size_t JobRunner::get_jobs_since(uint64_t since_seq, std::span<std::shared_ptr<Job>> out) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
+  size_t n = 0;
+  for (Job* job = first_after_locked(since_seq); job && n < out.size();
+       job = JobCreatedList::next(*job))
+    out[n++] = job->shared_from_this();
+  return n;
+}
+
+std::vector<JobSnapshot> JobRunner::get_recent_job_snapshots(size_t limit) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
+  std::vector<JobSnapshot> jobs;
+  jobs.reserve(std::min(limit, jobs_.size()));
+  for (Job* job = created_.back(); job && jobs.size() < limit; job = JobCreatedList::prev(*job))
+    jobs.push_back(snapshot_job(*job));
+  return jobs;
+}
+
+std::vector<JobSnapshot> JobRunner::get_job_snapshots_since(uint64_t since_seq, size_t limit) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
+  std::vector<JobSnapshot> jobs;
+  jobs.reserve(std::min(limit, jobs_.size()));
+  for (Job* job = first_after_locked(since_seq); job && jobs.size() < limit;
+       job = JobCreatedList::next(*job))
+    jobs.push_back(snapshot_job(*job));
+  return jobs;
+}
 
-  // Round-robin scanning starting from scan_cursor_
-  for (size_t i = 0; i < num_running && checked < max_jobs_to_check; ++i) {
-    size_t idx = (scan_cursor_ + i) % num_running;
-    auto job = running_jobs[idx];
-    checked++;
+Job* JobRunner::first_after_locked(uint64_t since_seq) const {
+  if (since_seq == 0)
+    return created_.front();
+  // The cursor is normally a job the client just saw and still retained: one
+  // lookup. If it was evicted meanwhile, walk back to the first newer job.
+  auto it = jobs_.find("job_" + std::to_string(since_seq));
+  if (it != jobs_.end())
+    return JobCreatedList::next(*it->second);
+  Job* first = nullptr;
+  for (Job* job = created_.back(); job && job->seq > since_seq; job = JobCreatedList::prev(*job))
+    first = job;
+  return first;
+}
 
-    // Read from stdout_fd non-blockingly
+void JobRunner::check_job_limits(uint64_t now_ms, size_t max_jobs_to_check) {
+  // std::unique_lock<std::mutex> lock(mutex_);  // Already locked by caller
+  // Round-robin over running jobs only: each scanned job moves to the back
+  // of the list, so the next scan resumes with the ones not yet seen.
+  JobStatusList& running = jobs_in(JobStatus::RUNNING);
+  size_t to_check = std::min(max_jobs_to_check, running.size());
+  size_t checked = 0;
+  proc_snapshot_taken_ = false;
+  read_process_events_locked(now_ms);
+  for (; checked < to_check && !running.empty(); ++checked) {
+    std::shared_ptr<Job> job = running.front()->shared_from_this();
+    running.remove(*job);
+    running.push_back(*job);
+
+    // Output is normally captured by the reactor, which takes the fds. These
+    // reads only cover jobs it is not watching.
     if (job->stdout_fd != -1) {
       char buffer[4096];
       ssize_t n = read(job->stdout_fd, buffer, sizeof(buffer));
       if (n > 0) {
-        job->output.append(buffer, n);
-        job->bytes_written += n;
+        append_job_output(*job, LogStream::STDOUT, buffer, n);
       } else if (n == 0) {
         // EOF, close fd
         close(job->stdout_fd);
@@ -363,8 +691,7 @@ void JobRunner::check_job_limits(uint64_t now_ms, size_t max_jobs_to_check) {
       char buffer[4096];
       ssize_t n = read(job->stderr_fd, buffer, sizeof(buffer));
       if (n > 0) {
-        job->error.append(buffer, n);
-        job->bytes_written += n;
+        append_job_output(*job, LogStream::STDERR, buffer, n);
       } else if (n == 0) {
         // EOF, close fd
         close(job->stderr_fd);
@@ -375,90 +702,603 @@ void JobRunner::check_job_limits(uint64_t now_ms, size_t max_jobs_to_check) {
     // Check if job finished
     if (job->process_group > 0) {
       int status;
-      pid_t result = waitpid(job->process_group, &status, WNOHANG);
-      if (result == job->process_group) {
-        // Job finished
-        job->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-        job->finished_at = std::chrono::system_clock::now();
-        job->ended_at_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                               job->finished_at.time_since_epoch())
-                               .count();
-        job->status = (job->exit_code == 0) ? JobStatus::COMPLETED : JobStatus::FAILED;
-        // Close any remaining fds
-        if (job->stdout_fd != -1)
-          close(job->stdout_fd);
-        if (job->stderr_fd != -1)
-          close(job->stderr_fd);
-        job->stdout_fd = -1;
-        job->stderr_fd = -1;
+      if (spawner_->reap_job(*job, &status)) {
+        finish_job_locked(*job, status);
         continue;
-      } else if (result == -1 && errno != ECHILD) {
-        // Error, but continue
       }
     }
 
-    // Check timeout
-    if (enforce_job_timeout(job, now_ms))
-      continue;
+    // Runtime limits are enforced by the timer wheel.
 
     // Check log cap
     if (enforce_job_log_cap(job))
       continue;
 
     // Check process cap
-    enforce_job_process_cap(job, now_ms);
+    if (enforce_job_process_cap(job, now_ms))
+      continue;
+
+    enforce_job_spawn_rate(job, now_ms);
   }
 
-  scan_cursor_ = (scan_cursor_ + checked) % num_running;
   jobs_scanned_this_tick_ = checked;
 }
 
-bool JobRunner::enforce_job_timeout(std::shared_ptr<Job> job, uint64_t now_ms) {
-  uint64_t runtime_ms = now_ms - job->started_at_ms;
+void JobRunner::set_status_locked(Job& job, JobStatus status) {
+  JobStatus old_status = job.status;
+  if (old_status == status)
+    return;
+  jobs_in(old_status).remove(job);
+  status_counts_[static_cast<size_t>(old_status)]--;
+  governor_.release(held_resources(job, old_status));
+  governor_.reserve(held_resources(job, status));
+  if (old_status == JobStatus::QUEUED)
+    queued_jobs_.fetch_sub(1, std::memory_order_relaxed);
+
+  if (JobGroup* group = job.queue_group) {
+    if (old_status == JobStatus::QUEUED)
+      group->lanes[static_cast<size_t>(job.priority)].queued.remove(job);
+    bool was_active = job_status_is_active(old_status);
+    bool is_active = job_status_is_active(status);
+    if (is_active && !was_active)
+      group->active++;
+    else if (was_active && !is_active)
+      group->active--;
+    update_ready_locked(*group);
+  }
+  job.status = status;
+  jobs_in(status).push_back(job);
+  status_counts_[static_cast<size_t>(status)]++;
+
+  if (job_status_is_final(status) && !job_status_is_final(old_status)) {
+    job.retired_at = std::chrono::steady_clock::now();
+    job.history_log_bytes = job.bytes_written;
+    history_log_bytes_ += job.history_log_bytes;
+    history_.push_back(job);
+    if (job.process_group > 0 && tracked_jobs_.erase(job.process_group))
+      inspector_->untrack(job.process_group);
+    if (!job.cgroup.empty())
+      release_cgroup_locked(job);
+  }
+}
 
-  if (runtime_ms > static_cast<uint64_t>(job->max_runtime_ms)) {
-    // Send SIGTERM to process group
-    if (job->process_group > 0) {
-      kill(-job->process_group, SIGTERM);
-    }
+JobGroup& JobRunner::group_locked(const std::string& id) {
+  auto it = groups_.find(id);
+  if (it != groups_.end())
+    return *it->second;
+  if (id.size() > gov::kMaxGroupIdLen || groups_.size() >= gov::kMaxGroups)
+    return *groups_[""];
+  auto group = std::make_unique<JobGroup>();
+  group->id = id;
+  JobGroup& ref = *group;
+  groups_.emplace(id, std::move(group));
+  return ref;
+}
 
-    auto now_system = std::chrono::system_clock::now();
-    job->status = JobStatus::TIMEOUT;
-    job->finished_at = now_system;
-    job->ended_at_ms = now_ms;
-    return true;
+void JobRunner::update_ready_locked(JobGroup& group) {
+  for (size_t p = 0; p < kJobPriorityCount; ++p) {
+    JobLane& lane = group.lanes[p];
+    bool ready = lane.ready();
+    bool linked = ready_lanes_[p].contains(lane);
+    if (ready == linked)
+      continue;
+    // A lane (re)joining its ring starts a fresh round; one leaving it
+    // forfeits the rest of its round.
+    lane.deficit = 0;
+    if (ready)
+      ready_lanes_[p].push_back(lane);
+    else
+      ready_lanes_[p].remove(lane);
   }
-  return false;
 }
 
-bool JobRunner::enforce_job_log_cap(std::shared_ptr<Job> job) {
-  uint64_t total_bytes = job->output.size() + job->error.size();
-  if (total_bytes > job->max_log_bytes) {
-    // Truncate logs and mark as truncated
-    size_t keep_bytes = job->max_log_bytes / 2;
+JobRunner::LaneRing* JobRunner::top_ready_ring_locked() {
+  for (size_t p = kJobPriorityCount; p-- > 0;) {
+    if (!ready_lanes_[p].empty())
+      return &ready_lanes_[p];
+  }
+  return nullptr;
+}
+
+Job* JobRunner::peek_queued_locked() {
+  LaneRing* ring = top_ready_ring_locked();
+  return ring ? ring->front()->queued.front() : nullptr;
+}
+
+Job* JobRunner::next_queued_locked() {
+  auto* ring = top_ready_ring_locked();
+  if (!ring)
+    return nullptr;
+  JobLane* lane = ring->front();
+  if (lane->deficit == 0)
+    lane->deficit = std::max<uint32_t>(lane->group->share.weight, 1);
+  if (--lane->deficit == 0 && ring->size() > 1) {
+    // Round used up: the next ready group's turn.
+    ring->remove(*lane);
+    ring->push_back(*lane);
+  }
+  return lane->queued.front();
+}
 
-    if (job->output.size() > keep_bytes) {
-      job->output = job->output.substr(job->output.size() - keep_bytes);
+Job* JobRunner::backfill_locked(const Job& blocked, uint64_t now_ms) {
+  // The shadow time: when `blocked` could start if every job holding a
+  // reservation ran until it had to be gone, and what would still be
+  // reserved then. Suspended jobs have no such time.
+  std::vector<std::pair<uint64_t, const Job*>> ends;
+  for (JobStatus status : {JobStatus::STARTING, JobStatus::RUNNING, JobStatus::TERMINATING}) {
+    JobStatusList& list = jobs_in(status);
+    for (Job* job = list.front(); job; job = JobStatusList::next(*job)) {
+      uint64_t since_ms = status == JobStatus::RUNNING ? job->started_at_ms + job->suspended_ms
+                                                       : now_ms;
+      uint64_t left_ms = status == JobStatus::TERMINATING
+                             ? job->kill_grace_ms
+                             : deadline_after(job->max_runtime_ms, job->kill_grace_ms);
+      ends.emplace_back(deadline_after(since_ms, left_ms), job);
     }
+  }
+  std::sort(ends.begin(), ends.end());
+  ResourceRequest at_shadow = governor_.reserved();
+  uint64_t shadow_ms = now_ms;
+  for (const auto& [end_ms, job] : ends) {
+    if (governor_.fits(blocked.resources, at_shadow))
+      break;
+    sub_resources(at_shadow, job->resources);
+    shadow_ms = std::max(shadow_ms, end_ms);
+  }
+  if (!governor_.fits(blocked.resources, at_shadow))
+    shadow_ms = UINT64_MAX;
+  ResourceRequest with_blocked = at_shadow;
+  add_resources(with_blocked, blocked.resources);
+
+  // First fit, in the order the queue would start jobs in.
+  size_t scanned = 0;
+  for (size_t p = kJobPriorityCount; p-- > 0;) {
+    for (JobLane* lane = ready_lanes_[p].front(); lane; lane = LaneRing::next(*lane)) {
+      for (Job* job = lane->queued.front(); job; job = JobQueue::next(*job)) {
+        if (++scanned > kMaxBackfillScan)
+          return nullptr;
+        if (job == &blocked || !governor_.fits(job->resources))
+          continue;
+        uint64_t end_ms =
+            deadline_after(now_ms, deadline_after(job->max_runtime_ms, job->kill_grace_ms));
+        if (end_ms <= shadow_ms || governor_.fits(job->resources, with_blocked))
+          return job;
+      }
+    }
+  }
+  return nullptr;
+}
+
+size_t JobRunner::preempt_locked(uint64_t now_ms, size_t max_preempts) {
+  JobStatusList& running = jobs_in(JobStatus::RUNNING);
+  Job* waiting = peek_queued_locked();
+  JobPriority top = waiting ? waiting->priority : JobPriority::BATCH;
+  for (Job* job = running.front(); job; job = JobStatusList::next(*job))
+    top = std::max(top, job->priority);
+
+  std::vector<Job*> victims;
+  for (Job* job = running.front(); job; job = JobStatusList::next(*job)) {
+    if (job->priority < top && job->process_group > 0)
+      victims.push_back(job);
+  }
+  // Freezing the youngest jobs of the least important class loses the least
+  // progress if they end up killed anyway.
+  std::sort(victims.begin(), victims.end(), [](const Job* a, const Job* b) {
+    if (a->priority != b->priority)
+      return a->priority < b->priority;
+    return a->started_at_ms > b->started_at_ms;
+  });
+  if (victims.size() > max_preempts)
+    victims.resize(max_preempts);
+  for (Job* job : victims)
+    suspend_job_locked(*job, now_ms);
+  return victims.size();
+}
+
+Job* JobRunner::next_suspended_locked() {
+  Job* best = nullptr;
+  JobStatusList& suspended = jobs_in(JobStatus::SUSPENDED);
+  for (Job* job = suspended.front(); job; job = JobStatusList::next(*job)) {
+    if (!best || job->priority > best->priority)
+      best = job;
+  }
+  return best;
+}
+
+void JobRunner::suspend_job_locked(Job& job, uint64_t now_ms) {
+  // A group that is already gone is left RUNNING for the scan to reap.
+  if (signal_job_locked(job, SIGSTOP) != 0)
+    return;
+  job.suspended_at_ms = now_ms;
+  timers_.cancel(job.runtime_timer);
+  set_status_locked(job, JobStatus::SUSPENDED);
+  jobs_preempted_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void JobRunner::resume_job_locked(Job& job, uint64_t now_ms) {
+  signal_job_locked(job, SIGCONT);
+  if (now_ms > job.suspended_at_ms)
+    job.suspended_ms += now_ms - job.suspended_at_ms;
+  set_status_locked(job, JobStatus::RUNNING);
+  // The runtime limit picks up where it stopped.
+  timers_.schedule(job.runtime_timer,
+                   deadline_after(job.started_at_ms + job.suspended_ms, job.max_runtime_ms + 1));
+}
+
+bool JobRunner::set_group_share(const std::string& id, const GroupShare& share) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  JobGroup& group = group_locked(id);
+  if (group.id != id)
+    return false;
+  group.share = share;
+  update_ready_locked(group);
+  return true;
+}
+
+ResourceRequest JobRunner::get_reserved_resources() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return governor_.reserved();
+}
+
+void JobRunner::set_retention_policy(const RetentionPolicy& policy) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  retention_ = policy;
+}
+
+bool JobRunner::enable_job_archive(const std::string& dir) {
+  auto archive = JobArchive::open(dir);
+  if (!archive)
+    return false;
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t next = archive->next_seq();
+  if (next > first_job_seq_.load())
+    first_job_seq_ = next;
+  archive_ = std::move(archive);
+  return true;
+}
+
+void JobRunner::retire_finished_locked() {
+  auto now = std::chrono::steady_clock::now();
+  auto max_age = std::chrono::milliseconds(retention_.max_finished_age_ms);
+  Job* job = history_.front();
+  while (job) {
+    bool over = (retention_.max_finished_jobs > 0 &&
+                 history_.size() > retention_.max_finished_jobs) ||
+                (retention_.max_finished_log_bytes > 0 &&
+                 history_log_bytes_ > retention_.max_finished_log_bytes) ||
+                (retention_.max_finished_age_ms > 0 && now - job->retired_at >= max_age);
+    if (!over)
+      break;
+    Job* next = JobHistoryList::next(*job);
+    // A leader not yet reaped still needs its Job; it goes once reaped.
+    if (job->pidfd == -1)
+      evict_locked(*job);
+    job = next;
+  }
+}
+
+void JobRunner::evict_locked(Job& job) {
+  if (archive_) {
+    // A detached copy of what the archive and status output read, written
+    // by archive_evicted() after the tick lets go of the lock. The logs are
+    // moved, not copied; output still arriving for the job is dropped.
+    auto copy = std::make_shared<Job>();
+    copy->id = job.id;
+    copy->seq = job.seq;
+    copy->command = job.command;
+    copy->exec_mode = job.exec_mode;
+    copy->group = job.group;
+    copy->priority = job.priority;
+    copy->resources = job.resources;
+    copy->status = job.status;
+    copy->exit_code = job.exit_code;
+    copy->error = job.error;
+    copy->stdout_log = std::move(job.stdout_log);
+    copy->stderr_log = std::move(job.stderr_log);
+    copy->stdout_lines = std::move(job.stdout_lines);
+    copy->stderr_lines = std::move(job.stderr_lines);
+    copy->spool = job.spool;
+    copy->log_truncated = job.log_truncated;
+    copy->bytes_written = job.bytes_written;
+    copy->created_at = job.created_at;
+    copy->finished_at = job.finished_at;
+    copy->started_at_ms = job.started_at_ms;
+    copy->ended_at_ms = job.ended_at_ms;
+    job.stdout_log.reset(0, 0);
+    job.stderr_log.reset(0, 0);
+    job.stdout_lines.reset(0);
+    job.stderr_lines.reset(0);
+    archive_queue_.push_back(std::move(copy));
+  }
+  jobs_in(job.status).remove(job);
+  status_counts_[static_cast<size_t>(job.status)]--;
+  timers_.cancel(job.runtime_timer);
+  timers_.cancel(job.kill_timer);
+  history_.remove(job);
+  created_.remove(job);
+  history_log_bytes_ -= job.history_log_bytes;
+  jobs_evicted_.fetch_add(1, std::memory_order_relaxed);
+  // Last: this may destroy the job.
+  jobs_.erase(job.id);
+}
+
+void JobRunner::finish_job_locked(Job& job, int wait_status) {
+  // Jobs being terminated, or already ended, keep their status; they are
+  // only being reaped now.
+  if (job.status == JobStatus::RUNNING || job.status == JobStatus::STARTING ||
+      job.status == JobStatus::SUSPENDED) {
+    job.exit_code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1;
+    job.finished_at = std::chrono::system_clock::now();
+    job.ended_at_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(job.finished_at.time_since_epoch())
+            .count();
+    set_status_locked(job, job.exit_code == 0 ? JobStatus::COMPLETED : JobStatus::FAILED);
+  }
+  job.leader_reaped = true;
+  timers_.cancel(job.runtime_timer);
+  // Close any remaining fds. A closed pidfd also marks the leader as reaped.
+  if (job.stdout_fd != -1)
+    close(job.stdout_fd);
+  if (job.stderr_fd != -1)
+    close(job.stderr_fd);
+  if (job.pidfd != -1)
+    close(job.pidfd);
+  job.stdout_fd = -1;
+  job.stderr_fd = -1;
+  job.pidfd = -1;
+}
+
+void JobRunner::on_leader_exit(const std::shared_ptr<Job>& job) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (job->pidfd == -1)
+    return; // Already reaped by the tick scan
+  drain_submissions_locked();
+
+  // Spawners whose jobs are not our children (the zygote) may not have heard
+  // about the exit yet; the tick scan picks those up.
+  int status;
+  if (!spawner_->reap_job(*job, &status))
+    return;
+  finish_job_locked(*job, status);
+  if (job->status == JobStatus::TERMINATING) {
+    // Children that outlive the leader keep the job terminating until a tick
+    // (or the cgroup's events) find them gone.
+    if (job_alive_locked(*job))
+      return;
+    end_termination_locked(*job, tick_clock_locked());
+  }
+  start_out_of_band_locked();
+}
+
+void JobRunner::on_cgroup_empty(const std::shared_ptr<Job>& job) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (job->status != JobStatus::TERMINATING)
+    return; // A finished job's leftovers are gone; the tick removes the cgroup.
+  drain_submissions_locked();
+  // The leader has exited too, but may not have been reaped yet; without the
+  // wait status the leader exit handler ends the job instead.
+  int status;
+  if (!job->leader_reaped) {
+    if (!spawner_->reap_job(*job, &status))
+      return;
+    finish_job_locked(*job, status);
+  }
+  end_termination_locked(*job, tick_clock_locked());
+  start_out_of_band_locked();
+}
+
+void JobRunner::start_out_of_band_locked() {
+  // Hand the slot to the next queued job now rather than at the next tick,
+  // using the resource readings the last tick decided on.
+  size_t queued = count_jobs(JobStatus::QUEUED);
+  if (!have_last_tick_ || queued == 0)
+    return;
+  size_t running = active_jobs();
+  GovernorResult result = governor_.decide(last_metrics_, running, 0);
+  if (result.decision != GovernorDecision::START_NOW)
+    return;
+
+  size_t started = start_queued_locked(tick_clock_locked(), last_max_starts_, running);
+  jobs_started_out_of_band_.fetch_add(started, std::memory_order_relaxed);
+  rearm_timer_locked();
+}
+
+int JobRunner::terminate_job_locked(Job& job, JobStatus end_status, uint64_t now_ms) {
+  int kill_errno = signal_job_locked(job, SIGTERM);
+  // A stopped group only acts on the SIGTERM once continued.
+  if (job.status == JobStatus::SUSPENDED && kill_errno == 0)
+    signal_job_locked(job, SIGCONT);
+  job.end_status = end_status;
+  timers_.cancel(job.runtime_timer);
+  timers_.schedule(job.kill_timer, deadline_after(now_ms, job.kill_grace_ms));
+  set_status_locked(job, JobStatus::TERMINATING);
+  return kill_errno;
+}
+
+int JobRunner::signal_job_locked(Job& job, int sig) {
+  // The cgroup also reaches descendants that left the group.
+  if (job.cgroup_handle.is_open() && job.cgroup_handle.signal(sig) == 0)
+    return 0;
+  if (job.process_group > 0 && kill(-job.process_group, sig) != 0)
+    return errno;
+  return 0;
+}
+
+bool JobRunner::job_alive_locked(const Job& job) const {
+  if (job.cgroup_events_fd != -1) {
+    int populated = gov::CgroupDriver::read_populated(job.cgroup_events_fd);
+    if (populated >= 0)
+      return populated == 1;
+  }
+  return process_group_alive(job.process_group);
+}
 
-    size_t remaining = job->max_log_bytes - job->output.size();
-    if (job->error.size() > remaining) {
-      job->error = job->error.substr(job->error.size() - remaining);
+void JobRunner::advance_terminating_locked(uint64_t now_ms) {
+  JobStatusList& terminating = jobs_in(JobStatus::TERMINATING);
+  Job* job = terminating.front();
+  while (job) {
+    Job* next = JobStatusList::next(*job);
+    // Reap first: an unreaped leader keeps its group alive as a zombie.
+    int status;
+    if (!job->leader_reaped && job->process_group > 0 && spawner_->reap_job(*job, &status))
+      finish_job_locked(*job, status);
+    if (!job_alive_locked(*job))
+      end_termination_locked(*job, now_ms);
+    job = next;
+  }
+}
+
+void JobRunner::end_termination_locked(Job& job, uint64_t now_ms) {
+  timers_.cancel(job.kill_timer);
+  job.finished_at = std::chrono::system_clock::now();
+  job.ended_at_ms = now_ms;
+  set_status_locked(job, job.end_status);
+}
+
+void JobRunner::run_timers_locked(uint64_t now_ms) {
+  timers_.advance(now_ms);
+  // The wheel never goes back, should now_ms have.
+  now_ms = timers_.now_ms();
+  while (Timer* timer = timers_.pop_expired()) {
+    Job& job = *static_cast<Job*>(timer->owner);
+    if (timer == &job.runtime_timer) {
+      if (job.status == JobStatus::RUNNING)
+        enforce_job_timeout(job.shared_from_this(), now_ms);
+    } else if (job.status == JobStatus::TERMINATING && !job.kill_sent) {
+      // cgroup.kill also catches processes forked while it runs.
+      if (!job.cgroup_handle.is_open() || job.cgroup_handle.kill() != 0) {
+        if (job.process_group > 0)
+          kill(-job.process_group, SIGKILL);
+      }
+      job.kill_sent = true;
     }
+  }
+}
 
-    job->log_truncated = true;
-    job->bytes_written = job->max_log_bytes;
+void JobRunner::rearm_timer_locked() {
+  if (!timer_fd_active_ || !have_last_tick_)
+    return;
+  uint64_t next = timers_.next_event_ms();
+  if (next == timer_armed_for_)
+    return;
+  timer_armed_for_ = next;
+  if (next == UINT64_MAX) {
+    output_reactor_->disarm_timer();
+    return;
+  }
+  uint64_t now_ms = tick_clock_locked();
+  output_reactor_->arm_timer(next > now_ms ? next - now_ms : 0);
+}
+
+void JobRunner::on_timer() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // One-shot: it is disarmed now.
+  timer_armed_for_ = UINT64_MAX;
+  if (!have_last_tick_)
+    return;
+  run_timers_locked(tick_clock_locked());
+  rearm_timer_locked();
+}
+
+uint64_t JobRunner::tick_clock_locked() const {
+  return last_tick_diagnostics_.last_tick_now_ms +
+         std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                               last_tick_steady_)
+             .count();
+}
+
+bool JobRunner::enforce_job_timeout(std::shared_ptr<Job> job, uint64_t now_ms) {
+  // A job started out of band can be a little ahead of the next tick's clock.
+  uint64_t active_since_ms = job->started_at_ms + job->suspended_ms;
+  uint64_t runtime_ms = now_ms > active_since_ms ? now_ms - active_since_ms : 0;
+
+  if (runtime_ms > static_cast<uint64_t>(job->max_runtime_ms)) {
+    terminate_job_locked(*job, JobStatus::TIMEOUT, now_ms);
     return true;
   }
   return false;
 }
 
+void init_job_logs(Job& job) {
+  uint64_t out_share = job.max_log_bytes / 2;
+  uint64_t err_share = job.max_log_bytes - out_share;
+  uint64_t out_head = std::min(job.log_head_bytes, out_share / 2);
+  uint64_t err_head = std::min(job.log_head_bytes, err_share / 2);
+  job.stdout_log.reset(out_head, out_share - out_head);
+  job.stderr_log.reset(err_head, err_share - err_head);
+  job.stdout_lines.reset(job.max_output_line_bytes, out_share);
+  job.stderr_lines.reset(job.max_output_line_bytes, err_share);
+}
+
+void append_job_output(Job& job, LogStream stream, const char* data, size_t len) {
+  LineFramer& framer = stream == LogStream::STDOUT ? job.stdout_lines : job.stderr_lines;
+  if (job.spool) {
+    SpoolStream sink(*job.spool, stream);
+    framer.append(sink, data, len);
+    job.bytes_written = job.spool->retained();
+    job.log_truncated = job.spool->truncated();
+    return;
+  }
+  framer.append(stream == LogStream::STDOUT ? job.stdout_log : job.stderr_log, data, len);
+  job.bytes_written = job.stdout_log.size() + job.stderr_log.size();
+  apply_job_log_cap(job);
+}
+
+bool apply_job_log_cap(Job& job) {
+  if (job.log_truncated || job.stdout_log.dropped() + job.stderr_log.dropped() == 0)
+    return false;
+  job.log_truncated = true;
+  return true;
+}
+
+JobSnapshot snapshot_job(const Job& job) {
+  JobSnapshot snapshot;
+  snapshot.id = job.id;
+  snapshot.seq = job.seq;
+  snapshot.command = job.command;
+  snapshot.group = job.group;
+  snapshot.priority = job.priority;
+  snapshot.resources = job.resources;
+  snapshot.status = job.status;
+  snapshot.exit_code = job.exit_code;
+  snapshot.bytes_written = job.bytes_written;
+  snapshot.log_truncated = job.log_truncated;
+  if (job.spool) {
+    snapshot.log_dropped =
+        job.spool->dropped(LogStream::STDOUT) + job.spool->dropped(LogStream::STDERR);
+  } else {
+    snapshot.log_dropped = job.stdout_log.dropped() + job.stderr_log.dropped();
+  }
+  snapshot.lines = job.stdout_lines.lines() + job.stderr_lines.lines();
+  snapshot.lines_truncated =
+      job.stdout_lines.lines_truncated() + job.stderr_lines.lines_truncated();
+  return snapshot;
+}
+
+bool JobRunner::enforce_job_log_cap(std::shared_ptr<Job> job) {
+  return apply_job_log_cap(*job);
+}
+
 bool JobRunner::enforce_job_process_cap(std::shared_ptr<Job> job, uint64_t now_ms) {
+  // A cgroup counts the job's processes wherever they went, and pid reuse
+  // cannot put a stranger in it.
+  if (job->cgroup_handle.is_open()) {
+    int count = cgroups_->count_processes(job->cgroup_handle);
+    if (count >= 0)
+      return apply_process_cap_locked(job, count, now_ms);
+  }
+
   if (!inspector_) {
     record_proc_cap(job, now_ms, 0, job->max_child_processes, 3, 1, 0);
     return false;
   }
 
+  // One look at every process serves all the jobs checked this tick.
+  if (!proc_snapshot_taken_) {
+    inspector_->snapshot();
+    proc_snapshot_taken_ = true;
+  }
+
   // Instrumentation: log what PGID we think we're inspecting and a cheap probe
   if (getenv("HK_DEBUG_PROC_CAP")) {
     pid_t stored_pgid = job->process_group;
@@ -486,7 +1326,9 @@ bool JobRunner::enforce_job_process_cap(std::shared_ptr<Job> job, uint64_t now_m
   // process group leader still matches that start_time to protect against PID
   // reuse. If mismatch, skip enforcement for this job (treat as unknown).
   if (job->leader_start_time != 0 && job->process_group > 0) {
-    auto st = read_proc_start_time_ticks(job->process_group);
+    std::optional<uint64_t> st = inspector_->leader_start_time(job->process_group);
+    if (!st)
+      st = read_proc_start_time_ticks(job->process_group);
     if (st && *st != job->leader_start_time) {
       // PID was likely reused; skip enforcement to avoid killing wrong
       // processes. Record the skip and return.
@@ -507,24 +1349,16 @@ bool JobRunner::enforce_job_process_cap(std::shared_ptr<Job> job, uint64_t now_m
     record_proc_cap(job, now_ms, count, job->max_child_processes, 3, 2, 0);
     return false; // Unknown, skip enforcement
   }
+  return apply_process_cap_locked(job, count, now_ms);
+}
 
+bool JobRunner::apply_process_cap_locked(const std::shared_ptr<Job>& job, int count,
+                                         uint64_t now_ms) {
   if (count > job->max_child_processes) {
     // record that we would kill
     record_proc_cap(job, now_ms, count, job->max_child_processes, 1, 0, 0);
 
-    int kill_errno = 0;
-    // Terminate process group
-    if (job->process_group > 0) {
-      if (kill(-job->process_group, SIGTERM) != 0) {
-        kill_errno = errno;
-      }
-      // Optionally, schedule SIGKILL after grace period, but for simplicity, mark immediately
-    }
-
-    auto now_system = std::chrono::system_clock::now();
-    job->status = JobStatus::PROC_LIMIT;
-    job->finished_at = now_system;
-    job->ended_at_ms = now_ms;
+    int kill_errno = terminate_job_locked(*job, JobStatus::PROC_LIMIT, now_ms);
 
     record_proc_cap(job, now_ms, count, job->max_child_processes, 2, 0, kill_errno);
     return true;
@@ -534,26 +1368,135 @@ bool JobRunner::enforce_job_process_cap(std::shared_ptr<Job> job, uint64_t now_m
   return false;
 }
 
+bool JobRunner::enforce_job_spawn_rate(std::shared_ptr<Job> job, uint64_t now_ms) {
+  if (job->max_spawns_per_window <= 0 || !inspector_)
+    return false;
+  // -1 (not followed) never exceeds the limit.
+  int spawns = inspector_->spawn_count(job->process_group);
+  if (spawns <= job->max_spawns_per_window)
+    return false;
+  terminate_job_locked(*job, JobStatus::PROC_LIMIT, now_ms);
+  return true;
+}
+
+void JobRunner::read_process_events_locked(uint64_t now_ms) {
+  grown_groups_.clear();
+  if (!inspector_ || inspector_->read_events(&grown_groups_) == 0)
+    return;
+  for (pid_t pgid : grown_groups_) {
+    auto it = tracked_jobs_.find(pgid);
+    if (it == tracked_jobs_.end() || it->second->status != JobStatus::RUNNING)
+      continue;
+    std::shared_ptr<Job> job = it->second->shared_from_this();
+    if (!enforce_job_process_cap(job, now_ms))
+      enforce_job_spawn_rate(job, now_ms);
+  }
+}
+
+void JobRunner::on_process_events() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  read_process_events_locked(have_last_tick_ ? tick_clock_locked() : 0);
+  // A job over its limit now has a kill deadline.
+  rearm_timer_locked();
+}
+
+size_t JobRunner::start_queued_locked(uint64_t now_ms, size_t max_starts, size_t running) {
+  // The whole batch is handed to the spawner at once so backends that
+  // pipeline spawns can keep them all in flight.
+  std::vector<std::shared_ptr<Job>> batch;
+  size_t resumed = 0;
+  // The governor's running limit may sit below the runner's when adaptive.
+  size_t limit =
+      std::min(max_concurrent_, static_cast<size_t>(std::max(governor_.running_limit(), 0)));
+  while (batch.size() + resumed < max_starts && running + batch.size() + resumed < limit) {
+    if (now_ms >= resume_after_ms_ && count_jobs(JobStatus::SUSPENDED) > 0) {
+      // Frozen jobs go ahead of queued jobs of their own class or below,
+      // once their CPU fits again.
+      Job* frozen = next_suspended_locked();
+      Job* waiting = peek_queued_locked();
+      ResourceRequest cpu;
+      cpu.cpu_millicores = frozen->resources.cpu_millicores;
+      if ((!waiting || frozen->priority >= waiting->priority) && governor_.fits(cpu)) {
+        resume_job_locked(*frozen, now_ms);
+        resumed++;
+        continue;
+      }
+    }
+    Job* next = peek_queued_locked();
+    if (!next)
+      break;
+    if (governor_.fits(next->resources)) {
+      next_queued_locked();
+    } else {
+      // The head keeps its place; smaller jobs may slip past it.
+      next = backfill_locked(*next, now_ms);
+      if (!next)
+        break;
+    }
+    auto job = next->shared_from_this();
+    set_status_locked(*job, JobStatus::STARTING);
+    batch.push_back(job);
+  }
+  if (batch.empty())
+    return 0;
+  if (cgroups_) {
+    for (const auto& job : batch)
+      prepare_cgroup_locked(*job);
+  }
+
+  std::vector<Job*> batch_jobs;
+  batch_jobs.reserve(batch.size());
+  for (const auto& job : batch)
+    batch_jobs.push_back(job.get());
+  std::unique_ptr<bool[]> spawned(new bool[batch.size()]());
+  spawner_->spawn_jobs(batch_jobs, std::span<bool>(spawned.get(), batch.size()));
+
+  size_t started = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto& job = batch[i];
+    if (!job->cgroup.empty())
+      contain_job_locked(*job, spawned[i]);
+    if (spawned[i]) {
+      set_status_locked(*job, JobStatus::RUNNING);
+      job->started_at_ms = now_ms;
+      if (job->process_group > 0) {
+        tracked_jobs_[job->process_group] = job.get();
+        inspector_->track(job->process_group);
+      }
+      // Fires once runtime exceeds max_runtime_ms.
+      timers_.schedule(job->runtime_timer, deadline_after(now_ms, job->max_runtime_ms + 1));
+      if (log_spool_enabled_ && output_reactor_->is_running()) {
+        // On failure the job falls back to in-memory capture.
+        job->spool = JobSpool::create(log_spool_dir_, job->id, job->max_log_bytes,
+                                      job->log_head_bytes);
+      }
+      output_reactor_->watch(job);
+      started++;
+    } else {
+      set_status_locked(*job, JobStatus::FAILED);
+    }
+  }
+  return started;
+}
+
 void JobRunner::tick(uint64_t now_ms, const SystemMetrics& metrics, size_t max_starts_per_tick,
                      size_t max_limit_scans_per_tick) {
-  std::cout << "tick called" << std::endl << std::flush;
   std::unique_lock<std::mutex> lock(mutex_);
+  drain_submissions_locked();
 
   jobs_started_this_tick_ = 0;
   jobs_scanned_this_tick_ = 0;
 
-  // Count current running and queued jobs
-  size_t running = 0, queued = 0;
-  for (const auto& pair : jobs_) {
-    if (pair.second->status == JobStatus::RUNNING || pair.second->status == JobStatus::STARTING)
-      running++;
-    else if (pair.second->status == JobStatus::QUEUED)
-      queued++;
-  }
+  size_t running = active_jobs();
+  size_t queued = count_jobs(JobStatus::QUEUED);
 
-  double mem_pct =
-      metrics.mem.total > 0 ? (double)metrics.mem.available / metrics.mem.total * 100.0 : 0.0;
-  GovernorResult result = governor_.decide(metrics.cpu_usage_percent, mem_pct, running, queued);
+  // max_queue_depth is enforced by submit_job(); a full queue must still be
+  // allowed to drain, so it does not hold starts here.
+  governor_.observe(metrics, running, now_ms);
+  GovernorResult result = governor_.decide(metrics, running, 0);
+  bool pressure = governor_.pressure(metrics) != BlockReason::NONE;
+  if (pressure)
+    resume_after_ms_ = deadline_after(now_ms, governor_.get_policy().cooldown_ms);
 
   // Record diagnostics
   last_tick_diagnostics_.last_decision = result.decision;
@@ -562,31 +1505,117 @@ void JobRunner::tick(uint64_t now_ms, const SystemMetrics& metrics, size_t max_s
   last_tick_diagnostics_.last_tick_now_ms = now_ms;
   last_tick_diagnostics_.last_tick_running = running;
   last_tick_diagnostics_.last_tick_queued = queued;
+  last_tick_diagnostics_.concurrency = governor_.concurrency();
+
+  have_last_tick_ = true;
+  last_metrics_ = metrics;
+  last_max_starts_ = max_starts_per_tick;
+  last_tick_steady_ = std::chrono::steady_clock::now();
 
   size_t started = 0;
 
-  // Start jobs if governor allows
+  // Start jobs if governor allows; under pressure, make room for the more
+  // important classes if the policy says so.
   if (result.decision == GovernorDecision::START_NOW) {
-    while (!job_queue_.empty() && started < max_starts_per_tick &&
-           running + started < max_concurrent_) {
-      auto job = job_queue_.front();
-      job_queue_.pop();
-      job->status = JobStatus::STARTING;
-      bool success = spawner_->spawn_job(*job, &job->stdout_fd, &job->stderr_fd);
-      if (success) {
-        job->status = JobStatus::RUNNING;
-        job->started_at_ms = now_ms;
-        started++;
-      } else {
-        job->status = JobStatus::FAILED;
-      }
-    }
+    started = start_queued_locked(now_ms, max_starts_per_tick, running);
+  } else if (pressure && governor_.get_policy().preempt_on_pressure) {
+    preempt_locked(now_ms, max_starts_per_tick);
   }
 
   jobs_started_this_tick_ = started;
 
   // Check limits on running jobs
   check_job_limits(now_ms, max_limit_scans_per_tick);
+  run_timers_locked(now_ms);
+  advance_terminating_locked(now_ms);
+
+  if (cgroups_) {
+    remove_leftover_cgroups_locked();
+    // Made here rather than on the spawn path.
+    cgroups_->refill_pool();
+  }
+  retire_finished_locked();
+  rearm_timer_locked();
+  lock.unlock();
+  archive_evicted();
+}
+
+void JobRunner::archive_evicted() {
+  if (!archive_)
+    return;
+  std::unique_lock<std::mutex> writer(archive_mutex_);
+  std::vector<std::shared_ptr<Job>> jobs;
+  RetentionPolicy retention;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs = archive_queue_;
+    retention = retention_;
+  }
+  // Still in the queue, so lookups find them, until they are written.
+  for (const auto& job : jobs)
+    archive_->append(*job);
+  uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+  archive_->expire(retention.max_archive_bytes, retention.max_archive_age_ms, now_ms);
+  if (jobs.empty())
+    return;
+  std::unique_lock<std::mutex> lock(mutex_);
+  archive_queue_.erase(archive_queue_.begin(), archive_queue_.begin() + jobs.size());
+}
+
+std::shared_ptr<Job> JobRunner::find_job_locked(const std::string& job_id) const {
+  auto it = jobs_.find(job_id);
+  if (it != jobs_.end())
+    return it->second;
+  for (const auto& job : archive_queue_) {
+    if (job->id == job_id)
+      return job;
+  }
+  return nullptr;
+}
+
+void JobRunner::prepare_cgroup_locked(Job& job) {
+  // Normally a pooled cgroup, so the spawn makes no cgroup syscall.
+  gov::CgroupDriver::JobCgroup cgroup;
+  if (cgroups_->acquire_job_cgroup(&cgroup) != 0)
+    return;
+  job.cgroup = std::move(cgroup.path);
+  job.cgroup_handle = std::move(cgroup.handle);
+}
+
+void JobRunner::contain_job_locked(Job& job, bool spawned) {
+  bool contained = spawned && job.cgroup_joined;
+  if (spawned && !contained && job.process_group > 0) {
+    // Racy against the leader's first forks, unlike starting it there.
+    contained = job.cgroup_handle.move_pid(job.process_group) == 0;
+  }
+  if (contained && job.cgroup_handle.open_events(&job.cgroup_events_fd) == 0) {
+    contained_jobs_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Not spawned, or not contained: the process group stands in.
+  job.cgroup_joined = false;
+  release_cgroup_locked(job);
+}
+
+void JobRunner::release_cgroup_locked(Job& job) {
+  if (job.cgroup_events_fd != -1) {
+    close(job.cgroup_events_fd);
+    job.cgroup_events_fd = -1;
+    contained_jobs_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  // The cgroup may go to another job next; this one lets go of it.
+  gov::CgroupDriver::JobCgroup cgroup{std::move(job.cgroup), std::move(job.cgroup_handle)};
+  job.cgroup.clear();
+  if (cgroups_->release_job_cgroup(&cgroup) == EBUSY)
+    leftover_cgroups_.push_back(std::move(cgroup.path));
+}
+
+void JobRunner::remove_leftover_cgroups_locked() {
+  std::erase_if(leftover_cgroups_, [this](const std::string& path) {
+    return cgroups_->remove_job_cgroup(path) != EBUSY;
+  });
 }
 
 } // namespace heidi
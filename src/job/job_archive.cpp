@@ -0,0 +1,293 @@
+#include "heidi-kernel/job_archive.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace heidi {
+
+struct JobArchive::Record {
+  uint32_t magic;
+  int32_t status;
+  int32_t exit_code;
+  uint32_t flags;
+  uint64_t seq;
+  uint64_t created_at_ms; // system clock
+  uint64_t started_at_ms;
+  uint64_t ended_at_ms;
+  uint64_t bytes_written;
+  uint64_t stdout_off;
+  uint64_t stdout_len;
+  uint64_t stderr_off;
+  uint64_t stderr_len;
+  char command[168];
+};
+
+namespace {
+
+constexpr uint32_t kRecordMagic = 0x4a4b4831; // "1HKJ"
+constexpr uint32_t kFlagLogTruncated = 1u << 0;
+constexpr uint32_t kFlagDirect = 1u << 1;
+
+bool write_all_at(int fd, const char* data, size_t len, uint64_t off) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, static_cast<off_t>(off));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+
+// Frees [off, off + len) of the file, which then reads back as zeros.
+// Returns false if the filesystem cannot punch holes.
+bool punch(int fd, uint64_t off, uint64_t len) {
+  if (len == 0)
+    return true;
+  return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(off),
+                   static_cast<off_t>(len)) == 0;
+}
+
+bool read_all_at(int fd, char* data, size_t len, uint64_t off) {
+  while (len > 0) {
+    ssize_t n = pread(fd, data, len, static_cast<off_t>(off));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+
+} // namespace
+
+std::unique_ptr<JobArchive> JobArchive::open(const std::string& dir) {
+  static_assert(sizeof(Record) == 256, "archive records are fixed-size");
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+    return nullptr;
+  std::unique_ptr<JobArchive> archive(new JobArchive());
+  archive->index_fd_ = ::open((dir + "/jobs.idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (archive->index_fd_ < 0)
+    return nullptr;
+  archive->log_fd_ = ::open((dir + "/jobs.log").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (archive->log_fd_ < 0)
+    return nullptr;
+
+  struct stat st;
+  if (fstat(archive->log_fd_, &st) != 0)
+    return nullptr;
+  archive->log_end_ = st.st_size;
+  if (fstat(archive->index_fd_, &st) != 0)
+    return nullptr;
+  archive->next_seq_ = std::max<uint64_t>(1, st.st_size / sizeof(Record));
+  archive->load_entries();
+  return archive;
+}
+
+void JobArchive::load_entries() {
+  // Expired records are holes (or zeros); start at the first data.
+  uint64_t end = next_seq_ * sizeof(Record);
+  off_t data = lseek(index_fd_, 0, SEEK_DATA);
+  uint64_t off = data < 0 ? end : data / sizeof(Record) * sizeof(Record);
+  index_start_ = off / sizeof(Record);
+  std::vector<Record> chunk(256);
+  for (; off < end; off += chunk.size() * sizeof(Record)) {
+    size_t n = std::min<uint64_t>(chunk.size(), (end - off) / sizeof(Record));
+    if (!read_all_at(index_fd_, reinterpret_cast<char*>(chunk.data()), n * sizeof(Record), off))
+      break;
+    for (size_t i = 0; i < n; ++i) {
+      const Record& record = chunk[i];
+      if (record.magic != kRecordMagic || record.seq != off / sizeof(Record) + i)
+        continue;
+      live_.push_back({record.seq, record.stdout_off,
+                       record.ended_at_ms ? record.ended_at_ms : record.created_at_ms});
+      live_seqs_.insert(record.seq);
+    }
+  }
+  // Logs are appended in archive order.
+  std::stable_sort(live_.begin(), live_.end(),
+                   [](const Entry& a, const Entry& b) { return a.log_off < b.log_off; });
+  log_start_ = live_.empty() ? log_end_ : live_.front().log_off;
+}
+
+JobArchive::~JobArchive() {
+  if (index_fd_ >= 0)
+    close(index_fd_);
+  if (log_fd_ >= 0)
+    close(log_fd_);
+}
+
+bool JobArchive::write_log(const Job& job, LogStream stream, uint64_t* off, uint64_t* len) {
+  *off = log_end_;
+  *len = 0;
+  if (job.spool) {
+    // Straight from the spool file into the archive log.
+    off_t out_off = static_cast<off_t>(log_end_);
+    if (lseek(log_fd_, out_off, SEEK_SET) < 0)
+      return false;
+    ssize_t n = job.spool->send_tail(log_fd_, stream, UINT64_MAX);
+    if (n < 0)
+      return false;
+    *len = n;
+  } else {
+    const LogRing& log = stream == LogStream::STDOUT ? job.stdout_log : job.stderr_log;
+    struct iovec iov[LogRing::kMaxIov];
+    size_t count = log.iov(iov);
+    for (size_t i = 0; i < count; ++i) {
+      if (!write_all_at(log_fd_, static_cast<const char*>(iov[i].iov_base), iov[i].iov_len,
+                        log_end_ + *len))
+        return false;
+      *len += iov[i].iov_len;
+    }
+  }
+  log_end_ += *len;
+  return true;
+}
+
+bool JobArchive::append(const Job& job) {
+  Record record{};
+  record.magic = kRecordMagic;
+  record.status = static_cast<int32_t>(job.status);
+  record.exit_code = job.exit_code;
+  record.flags = (job.log_truncated ? kFlagLogTruncated : 0) |
+                 (job.exec_mode == ExecMode::DIRECT ? kFlagDirect : 0);
+  record.seq = job.seq;
+  record.created_at_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             job.created_at.time_since_epoch())
+                             .count();
+  record.started_at_ms = job.started_at_ms;
+  record.ended_at_ms = job.ended_at_ms;
+  record.bytes_written = job.bytes_written;
+  strncpy(record.command, job.command.c_str(), sizeof(record.command) - 1);
+
+  // Logs first: a record never points at bytes that are not there yet.
+  if (!write_log(job, LogStream::STDOUT, &record.stdout_off, &record.stdout_len) ||
+      !write_log(job, LogStream::STDERR, &record.stderr_off, &record.stderr_len))
+    return false;
+  if (!write_all_at(index_fd_, reinterpret_cast<const char*>(&record), sizeof(record),
+                    job.seq * sizeof(Record)))
+    return false;
+  if (job.seq + 1 > next_seq_.load(std::memory_order_relaxed))
+    next_seq_.store(job.seq + 1, std::memory_order_release);
+  records_written_++;
+  live_.push_back({job.seq, record.stdout_off,
+                   record.ended_at_ms ? record.ended_at_ms : record.created_at_ms});
+  live_seqs_.insert(job.seq);
+  return true;
+}
+
+uint64_t JobArchive::archived_bytes() const {
+  if (live_.empty())
+    return 0;
+  return log_end_ - live_.front().log_off + live_.size() * sizeof(Record);
+}
+
+void JobArchive::expire(uint64_t max_bytes, uint64_t max_age_ms, uint64_t now_ms) {
+  size_t dropped = 0;
+  while (!live_.empty()) {
+    const Entry& oldest = live_.front();
+    bool over = (max_bytes > 0 && archived_bytes() > max_bytes) ||
+                (max_age_ms > 0 && oldest.ended_at_ms + max_age_ms <= now_ms);
+    if (!over)
+      break;
+    uint64_t off = oldest.seq * sizeof(Record);
+    if (!punch(index_fd_, off, sizeof(Record))) {
+      static const Record kZero{};
+      write_all_at(index_fd_, reinterpret_cast<const char*>(&kZero), sizeof(kZero), off);
+    }
+    live_seqs_.erase(oldest.seq);
+    live_.pop_front();
+    dropped++;
+  }
+  if (dropped == 0)
+    return;
+
+  // Whole runs of log bytes and records no held job needs any more.
+  uint64_t log_floor = live_.empty() ? log_end_ : live_.front().log_off;
+  if (punch(log_fd_, log_start_, log_floor - log_start_))
+    log_start_ = log_floor;
+  uint64_t seq_floor = live_seqs_.empty() ? next_seq_.load() : *live_seqs_.begin();
+  if (seq_floor > index_start_ &&
+      punch(index_fd_, index_start_ * sizeof(Record), (seq_floor - index_start_) * sizeof(Record)))
+    index_start_ = seq_floor;
+}
+
+bool JobArchive::read_record(uint64_t seq, Record* record) const {
+  if (seq == 0 || seq >= next_seq_.load(std::memory_order_acquire))
+    return false;
+  if (!read_all_at(index_fd_, reinterpret_cast<char*>(record), sizeof(*record),
+                   seq * sizeof(Record)))
+    return false;
+  return record->magic == kRecordMagic && record->seq == seq;
+}
+
+std::shared_ptr<Job> JobArchive::load(uint64_t seq) const {
+  Record record;
+  if (!read_record(seq, &record))
+    return nullptr;
+
+  auto job = std::make_shared<Job>();
+  job->seq = seq;
+  job->id = "job_" + std::to_string(seq);
+  job->command.assign(record.command, strnlen(record.command, sizeof(record.command)));
+  job->exec_mode = record.flags & kFlagDirect ? ExecMode::DIRECT : ExecMode::SHELL;
+  job->status = static_cast<JobStatus>(record.status);
+  job->exit_code = record.exit_code;
+  job->created_at = std::chrono::system_clock::time_point(
+      std::chrono::milliseconds(record.created_at_ms));
+  job->started_at_ms = record.started_at_ms;
+  job->ended_at_ms = record.ended_at_ms;
+  job->bytes_written = record.bytes_written;
+  job->log_truncated = record.flags & kFlagLogTruncated;
+
+  // The stored text is the rendered view, dropped marker included.
+  auto load_log = [this](uint64_t off, uint64_t len, LogRing& log) {
+    std::string text(len, '\0');
+    if (!read_all_at(log_fd_, text.data(), len, off))
+      text.clear();
+    log.reset(0, text.size());
+    log.append(text);
+  };
+  load_log(record.stdout_off, record.stdout_len, job->stdout_log);
+  load_log(record.stderr_off, record.stderr_len, job->stderr_log);
+  return job;
+}
+
+ssize_t JobArchive::send_tail(uint64_t seq, LogStream stream, uint64_t max_bytes, int fd) const {
+  Record record;
+  if (!read_record(seq, &record)) {
+    errno = ENOENT;
+    return -1;
+  }
+  uint64_t off = stream == LogStream::STDOUT ? record.stdout_off : record.stderr_off;
+  uint64_t len = stream == LogStream::STDOUT ? record.stdout_len : record.stderr_len;
+  uint64_t want = std::min(len, max_bytes);
+  off_t pos = static_cast<off_t>(off + len - want);
+  ssize_t sent = 0;
+  while (want > 0) {
+    ssize_t n = sendfile(fd, log_fd_, &pos, want);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return sent > 0 ? sent : n;
+    sent += n;
+    want -= n;
+  }
+  return sent;
+}
+
+} // namespace heidi
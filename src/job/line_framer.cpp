@@ -0,0 +1,237 @@
+#include "heidi-kernel/line_framer.h"
+
+#include "heidi-kernel/log_spool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace heidi {
+
+namespace {
+
+size_t find_newline_scalar(const char* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i] == '\n')
+      return i;
+  }
+  return len;
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of the x86-64 baseline, so this needs no dispatch.
+size_t find_newline_sse2(const char* data, size_t len) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + find_newline_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) size_t find_newline_avx2(const char* data, size_t len) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nl)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + find_newline_sse2(data + i, len - i);
+}
+
+#endif
+
+// Stream position of the last '\n' in log's range [from, to), or UINT64_MAX
+// if there is none (or it cannot be read).
+template <typename Log>
+uint64_t rfind_newline(const Log& log, uint64_t from, uint64_t to) {
+  char buf[4096];
+  while (to > from) {
+    size_t len = std::min<uint64_t>(sizeof(buf), to - from);
+    to -= len;
+    if (!log.read_at(to, buf, len))
+      return UINT64_MAX;
+    const void* hit = memrchr(buf, '\n', len);
+    if (hit)
+      return to + (static_cast<const char*>(hit) - buf);
+  }
+  return UINT64_MAX;
+}
+
+NewlineScan detect_newline_scan() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return NewlineScan::AVX2;
+  return NewlineScan::SSE2;
+#else
+  return NewlineScan::SCALAR;
+#endif
+}
+
+} // namespace
+
+NewlineScan best_newline_scan() {
+  static const NewlineScan best = detect_newline_scan();
+  return best;
+}
+
+size_t find_newline(const char* data, size_t len, NewlineScan scan) {
+  if (scan == NewlineScan::AUTO)
+    scan = best_newline_scan();
+  switch (scan) {
+#if defined(__x86_64__)
+  case NewlineScan::AVX2:
+    return find_newline_avx2(data, len);
+  case NewlineScan::SSE2:
+    return find_newline_sse2(data, len);
+#endif
+  default:
+    return find_newline_scalar(data, len);
+  }
+}
+
+void LineFramer::reset(uint64_t max_line_bytes, uint64_t log_capacity) {
+  max_line_bytes_ = max_line_bytes;
+  line_len_ = 0;
+  at_line_start_ = true;
+  lines_ = 0;
+  lines_truncated_ = 0;
+  starts_ = {};
+  first_ = 0;
+  count_ = 0;
+  index_capacity_ = std::max<uint64_t>(kMinIndexedLines, log_capacity / kBytesPerIndexedLine);
+}
+
+void LineFramer::index_line_start(uint64_t pos) {
+  if (count_ == starts_.size() && starts_.size() < index_capacity_) {
+    // Grow, oldest first, doubling up to the capacity.
+    size_t size = std::min<size_t>(index_capacity_, std::max<size_t>(16, 2 * count_));
+    std::vector<uint32_t> grown(size);
+    for (size_t i = 0; i < count_; ++i)
+      grown[i] = starts_[(first_ + i) % starts_.size()];
+    starts_ = std::move(grown);
+    first_ = 0;
+  }
+  if (count_ < starts_.size()) {
+    starts_[(first_ + count_) % starts_.size()] = static_cast<uint32_t>(pos);
+    ++count_;
+  } else {
+    // Full: the newest start replaces the oldest.
+    starts_[first_] = static_cast<uint32_t>(pos);
+    first_ = (first_ + 1) % starts_.size();
+  }
+  ++lines_;
+  at_line_start_ = false;
+}
+
+uint64_t LineFramer::start_at(size_t i, uint64_t total) const {
+  uint32_t low = starts_[(first_ + i) % starts_.size()];
+  return total - static_cast<uint32_t>(static_cast<uint32_t>(total) - low);
+}
+
+template <typename Log>
+void LineFramer::append(Log& log, const char* data, size_t len) {
+  const NewlineScan scan = best_newline_scan();
+  // Kept bytes go to the log in runs, so a chunk without a cut line is one
+  // append (one pwrite() for a spool) however many lines it holds. Lines
+  // starting in the run are indexed by where they will land.
+  const char* run = data;
+  while (len > 0) {
+    size_t nl = find_newline(data, len, scan);
+    bool ends_line = nl < len;
+    if (at_line_start_)
+      index_line_start(log.total() + (data - run));
+
+    uint64_t room = max_line_bytes_ == 0     ? UINT64_MAX
+                    : line_len_ < max_line_bytes_ ? max_line_bytes_ - line_len_
+                                                  : 0;
+    size_t keep = std::min<uint64_t>(nl, room);
+    if (keep < nl) {
+      if (line_len_ <= max_line_bytes_)
+        ++lines_truncated_;
+      // End the run at the cut; the next one starts at the newline, if any.
+      if (data + keep > run)
+        log.append(run, data + keep - run);
+      run = data + nl;
+    }
+    line_len_ += nl;
+
+    if (ends_line) {
+      line_len_ = 0;
+      at_line_start_ = true;
+      ++nl;
+    }
+    data += nl;
+    len -= nl;
+  }
+  if (data > run)
+    log.append(run, data - run);
+
+  // Forget lines whose start the log has overwritten.
+  uint64_t tail_start = log.tail_start();
+  if (log.dropped() > 0) {
+    uint64_t total = log.total();
+    while (count_ > 0 && start_at(0, total) < tail_start) {
+      first_ = (first_ + 1) % starts_.size();
+      --count_;
+    }
+  }
+}
+
+template void LineFramer::append(LogRing&, const char*, size_t);
+template void LineFramer::append(SpoolStream&, const char*, size_t);
+
+size_t LineFramer::tail_lines(const LogRing& ring, size_t count, struct iovec* out) const {
+  uint64_t start;
+  if (!tail_lines_start(ring, count, &start))
+    return 0;
+  return ring.tail_iov(ring.total() - start, out);
+}
+
+template <typename Log>
+bool LineFramer::tail_lines_start(const Log& log, size_t count, uint64_t* start) const {
+  if (count == 0)
+    return false;
+  // A trailing partial line counts as the last line.
+  uint64_t total = log.total();
+  if (count <= count_) {
+    *start = start_at(count_ - count, total);
+    return true;
+  }
+
+  // Past the index: scan back from the oldest indexed start. Once the log
+  // has dropped bytes only whole lines in its tail count.
+  uint64_t pos = count_ > 0 ? start_at(0, total) : total;
+  uint64_t bound = log.dropped() > 0 ? log.tail_start() : 0;
+  size_t found = count_;
+  while (found < count && pos > bound) {
+    // The byte before pos ends the previous line, if pos starts one.
+    uint64_t nl = rfind_newline(log, bound, pos - 1);
+    if (nl != UINT64_MAX)
+      pos = nl + 1;
+    else if (bound == 0)
+      pos = 0;
+    else
+      break;
+    ++found;
+  }
+  if (found == 0)
+    return false;
+  *start = pos;
+  return true;
+}
+
+template bool LineFramer::tail_lines_start(const LogRing&, size_t, uint64_t*) const;
+template bool LineFramer::tail_lines_start(const SpoolStream&, size_t, uint64_t*) const;
+
+} // namespace heidi
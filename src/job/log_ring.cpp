@@ -0,0 +1,122 @@
+#include "heidi-kernel/log_ring.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace heidi {
+
+size_t format_dropped_marker(char* buf, size_t size, uint64_t dropped) {
+  int n = snprintf(buf, size, "\n[%llu bytes dropped]\n", static_cast<unsigned long long>(dropped));
+  return n < 0 ? 0 : std::min(static_cast<size_t>(n), size - 1);
+}
+
+LogRing::LogRing(uint64_t head_capacity, uint64_t tail_capacity) {
+  reset(head_capacity, tail_capacity);
+}
+
+void LogRing::reset(uint64_t head_capacity, uint64_t tail_capacity) {
+  head_capacity_ = head_capacity;
+  tail_capacity_ = tail_capacity;
+  head_.clear();
+  tail_.clear();
+  tail_pos_ = 0;
+  total_ = 0;
+}
+
+void LogRing::append(const char* data, size_t len) {
+  total_ += len;
+
+  if (head_.size() < head_capacity_) {
+    size_t take = std::min<uint64_t>(len, head_capacity_ - head_.size());
+    head_.append(data, take);
+    data += take;
+    len -= take;
+  }
+  if (len == 0 || tail_capacity_ == 0)
+    return;
+
+  // Only the last tail_capacity_ bytes of a large append can survive it.
+  if (len > tail_capacity_) {
+    data += len - tail_capacity_;
+    len = tail_capacity_;
+  }
+
+  if (tail_.size() < tail_capacity_) {
+    size_t take = std::min<uint64_t>(len, tail_capacity_ - tail_.size());
+    tail_.append(data, take);
+    data += take;
+    len -= take;
+  }
+  // Full: overwrite the oldest bytes in place.
+  while (len > 0) {
+    size_t take = std::min<uint64_t>(len, tail_capacity_ - tail_pos_);
+    memcpy(&tail_[tail_pos_], data, take);
+    tail_pos_ = (tail_pos_ + take) % tail_capacity_;
+    data += take;
+    len -= take;
+  }
+}
+
+bool LogRing::read_at(uint64_t pos, char* buf, size_t len) const {
+  // Not past the newest byte, nor into what was dropped between head and tail.
+  if (pos + len > total_ || (pos < tail_start() && pos + len > head_.size()))
+    return false;
+  while (len > 0 && pos < head_.size()) {
+    size_t take = std::min<uint64_t>(len, head_.size() - pos);
+    memcpy(buf, head_.data() + pos, take);
+    buf += take;
+    pos += take;
+    len -= take;
+  }
+  // The oldest tail byte is at tail_pos_.
+  size_t i = len > 0 ? (tail_pos_ + (pos - tail_start())) % tail_.size() : 0;
+  while (len > 0) {
+    size_t take = std::min(len, tail_.size() - i);
+    memcpy(buf, tail_.data() + i, take);
+    buf += take;
+    len -= take;
+    i = 0;
+  }
+  return true;
+}
+
+size_t LogRing::tail_iov(uint64_t max_bytes, struct iovec* out) const {
+  struct iovec all[kMaxIov];
+  size_t count = 0;
+  auto add = [&](const char* base, size_t len) {
+    if (len > 0)
+      all[count++] = {const_cast<char*>(base), len};
+  };
+
+  add(head_.data(), head_.size());
+  if (dropped() > 0)
+    add(marker_, format_dropped_marker(marker_, sizeof(marker_), dropped()));
+  add(tail_.data() + tail_pos_, tail_.size() - tail_pos_);
+  add(tail_.data(), tail_pos_);
+
+  // Keep the newest max_bytes: walk back from the end.
+  size_t first = count;
+  uint64_t left = max_bytes;
+  while (first > 0 && left > 0) {
+    --first;
+    if (all[first].iov_len > left) {
+      all[first].iov_base = static_cast<char*>(all[first].iov_base) + (all[first].iov_len - left);
+      all[first].iov_len = left;
+    }
+    left -= all[first].iov_len;
+  }
+  std::copy(all + first, all + count, out);
+  return count - first;
+}
+
+std::string LogRing::str(uint64_t max_bytes) const {
+  struct iovec iov[kMaxIov];
+  size_t n = tail_iov(max_bytes, iov);
+  std::string out;
+  for (size_t i = 0; i < n; ++i)
+    out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+  return out;
+}
+
+} // namespace heidi
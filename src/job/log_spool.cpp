@@ -0,0 +1,299 @@
+#include "heidi-kernel/log_spool.h"
+
+#include "heidi-kernel/log_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace heidi {
+
+namespace {
+
+int open_ring_file(const std::string& path, const std::string& memfd_name) {
+  if (path.empty())
+    return memfd_create(memfd_name.c_str(), MFD_CLOEXEC);
+  return open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+}
+
+// What a stream retains after written bytes: the head, then the newest
+// bytes of the tail.
+struct Layout {
+  uint64_t head_len;
+  uint64_t tail_len;
+
+  Layout(uint64_t written, uint64_t head_capacity, uint64_t tail_capacity)
+      : head_len(std::min(written, head_capacity)),
+        tail_len(std::min(written - head_len, tail_capacity)) {}
+};
+
+// A stream's view as up to LogRing::kMaxIov segments, each a file range or
+// the dropped marker: its first skip bytes left out, then limited to the
+// newest max_bytes.
+struct View {
+  struct Segment {
+    uint64_t off;
+    uint64_t len;
+    bool marker;
+  };
+  Segment segments[LogRing::kMaxIov];
+  size_t count = 0;
+  char marker[64];
+};
+
+View make_view(uint64_t written, uint64_t head_capacity, uint64_t tail_capacity, uint64_t skip,
+               uint64_t max_bytes) {
+  View view;
+  Layout layout(written, head_capacity, tail_capacity);
+  View::Segment all[LogRing::kMaxIov];
+  size_t count = 0;
+  auto add = [&](uint64_t off, uint64_t len, bool marker) {
+    if (len > 0)
+      all[count++] = {off, len, marker};
+  };
+
+  add(0, layout.head_len, false);
+  uint64_t dropped = written - layout.head_len - layout.tail_len;
+  if (dropped > 0)
+    add(0, format_dropped_marker(view.marker, sizeof(view.marker), dropped), true);
+  if (layout.tail_len > 0) {
+    // Stream position of the oldest tail byte, mapped into the tail region.
+    uint64_t start = (written - layout.tail_len - head_capacity) % tail_capacity;
+    uint64_t first = std::min(layout.tail_len, tail_capacity - start);
+    add(head_capacity + start, first, false);
+    add(head_capacity, layout.tail_len - first, false);
+  }
+
+  size_t first = 0;
+  while (first < count && skip > 0) {
+    uint64_t cut = std::min(skip, all[first].len);
+    all[first].off += cut;
+    all[first].len -= cut;
+    skip -= cut;
+    if (all[first].len == 0)
+      ++first;
+  }
+  std::copy(all + first, all + count, all);
+  count -= first;
+
+  // Keep the newest max_bytes: walk back from the end.
+  first = count;
+  uint64_t left = max_bytes;
+  while (first > 0 && left > 0) {
+    --first;
+    if (all[first].len > left) {
+      all[first].off += all[first].len - left;
+      all[first].len = left;
+    }
+    left -= all[first].len;
+  }
+  std::copy(all + first, all + count, view.segments);
+  view.count = count - first;
+  return view;
+}
+
+} // namespace
+
+std::unique_ptr<JobSpool> JobSpool::create(const std::string& dir, const std::string& job_id,
+                                           uint64_t max_log_bytes, uint64_t head_bytes) {
+  std::unique_ptr<JobSpool> spool(new JobSpool());
+  uint64_t out_share = max_log_bytes / 2;
+  uint64_t err_share = max_log_bytes - out_share;
+  spool->out_.head_capacity = std::min(head_bytes, out_share / 2);
+  spool->out_.tail_capacity = out_share - spool->out_.head_capacity;
+  spool->err_.head_capacity = std::min(head_bytes, err_share / 2);
+  spool->err_.tail_capacity = err_share - spool->err_.head_capacity;
+  if (!dir.empty()) {
+    spool->out_.path = dir + "/" + job_id + ".out";
+    spool->err_.path = dir + "/" + job_id + ".err";
+  }
+  spool->out_.fd = open_ring_file(spool->out_.path, job_id + ".out");
+  if (spool->out_.fd < 0)
+    return nullptr;
+  spool->err_.fd = open_ring_file(spool->err_.path, job_id + ".err");
+  if (spool->err_.fd < 0)
+    return nullptr;
+  return spool;
+}
+
+JobSpool::~JobSpool() {
+  for (Ring* r : {&out_, &err_}) {
+    if (r->fd >= 0)
+      close(r->fd);
+    if (!r->path.empty())
+      unlink(r->path.c_str());
+  }
+}
+
+uint64_t JobSpool::size(LogStream stream) const {
+  const Ring& r = ring(stream);
+  Layout layout(r.written.load(std::memory_order_acquire), r.head_capacity, r.tail_capacity);
+  return layout.head_len + layout.tail_len;
+}
+
+uint64_t JobSpool::total(LogStream stream) const {
+  return ring(stream).written.load(std::memory_order_acquire);
+}
+
+void JobSpool::append(LogStream stream, const char* data, size_t len) {
+  Ring& r = ring(stream);
+  uint64_t written = r.written.load(std::memory_order_relaxed);
+  auto put = [&](const char* bytes, size_t n, uint64_t off) {
+    while (n > 0) {
+      ssize_t w = pwrite(r.fd, bytes, n, static_cast<off_t>(off));
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return;
+      bytes += w;
+      n -= w;
+      off += w;
+    }
+  };
+
+  if (written < r.head_capacity) {
+    size_t take = std::min<uint64_t>(len, r.head_capacity - written);
+    put(data, take, written);
+    written += take;
+    data += take;
+    len -= take;
+  }
+  if (len > 0 && r.tail_capacity > 0) {
+    // Only the last tail_capacity bytes of a large append can survive it.
+    if (len > r.tail_capacity) {
+      written += len - r.tail_capacity;
+      data += len - r.tail_capacity;
+      len = r.tail_capacity;
+    }
+    while (len > 0) {
+      uint64_t pos = (written - r.head_capacity) % r.tail_capacity;
+      size_t take = std::min<uint64_t>(len, r.tail_capacity - pos);
+      put(data, take, r.head_capacity + pos);
+      written += take;
+      data += take;
+      len -= take;
+    }
+  }
+  written += len;
+  r.written.store(written, std::memory_order_release);
+}
+
+uint64_t JobSpool::tail_start(LogStream stream) const {
+  const Ring& r = ring(stream);
+  uint64_t written = r.written.load(std::memory_order_acquire);
+  return written - Layout(written, r.head_capacity, r.tail_capacity).tail_len;
+}
+
+bool JobSpool::truncated() const {
+  return dropped(LogStream::STDOUT) > 0 || dropped(LogStream::STDERR) > 0;
+}
+
+ssize_t JobSpool::send_tail(int out_fd, LogStream stream, uint64_t max_bytes) const {
+  const Ring& r = ring(stream);
+  return send_view(out_fd, r, r.written.load(std::memory_order_acquire), 0, max_bytes);
+}
+
+ssize_t JobSpool::send_from(int out_fd, LogStream stream, uint64_t pos) const {
+  const Ring& r = ring(stream);
+  uint64_t written = r.written.load(std::memory_order_acquire);
+  Layout layout(written, r.head_capacity, r.tail_capacity);
+  // Where pos falls in the view: the head, or past the marker in the tail.
+  uint64_t skip = pos;
+  if (pos >= layout.head_len) {
+    uint64_t dropped = written - layout.head_len - layout.tail_len;
+    char marker[64];
+    uint64_t marker_len = dropped > 0 ? format_dropped_marker(marker, sizeof(marker), dropped) : 0;
+    uint64_t tail_start = written - layout.tail_len;
+    skip = layout.head_len + marker_len + (std::clamp(pos, tail_start, written) - tail_start);
+  }
+  return send_view(out_fd, r, written, skip, UINT64_MAX);
+}
+
+ssize_t JobSpool::send_view(int out_fd, const Ring& r, uint64_t written, uint64_t skip,
+                            uint64_t max_bytes) const {
+  View view = make_view(written, r.head_capacity, r.tail_capacity, skip, max_bytes);
+  ssize_t sent = 0;
+  for (size_t i = 0; i < view.count; ++i) {
+    const View::Segment& segment = view.segments[i];
+    off_t off = static_cast<off_t>(segment.off);
+    uint64_t left = segment.len;
+    while (left > 0) {
+      ssize_t n = segment.marker ? write(out_fd, view.marker + off, left)
+                                 : sendfile(out_fd, r.fd, &off, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return sent > 0 ? sent : -1;
+      }
+      if (n == 0)
+        return sent;
+      if (segment.marker)
+        off += n;
+      sent += n;
+      left -= n;
+    }
+  }
+  return sent;
+}
+
+std::string JobSpool::read(LogStream stream) const {
+  const Ring& r = ring(stream);
+  View view = make_view(r.written.load(std::memory_order_acquire), r.head_capacity,
+                        r.tail_capacity, 0, UINT64_MAX);
+  std::string out;
+  for (size_t i = 0; i < view.count; ++i) {
+    const View::Segment& segment = view.segments[i];
+    if (segment.marker) {
+      out.append(view.marker + segment.off, segment.len);
+      continue;
+    }
+    size_t pos = out.size();
+    out.resize(pos + segment.len);
+    uint64_t left = segment.len;
+    off_t off = static_cast<off_t>(segment.off);
+    while (left > 0) {
+      ssize_t n = pread(r.fd, out.data() + pos, left, off);
+      if (n <= 0) {
+        out.resize(pos);
+        return out;
+      }
+      pos += n;
+      off += n;
+      left -= n;
+    }
+  }
+  return out;
+}
+
+bool JobSpool::read_at(LogStream stream, uint64_t pos, char* buf, size_t len) const {
+  const Ring& r = ring(stream);
+  uint64_t written = r.written.load(std::memory_order_acquire);
+  Layout layout(written, r.head_capacity, r.tail_capacity);
+  uint64_t tail_start = written - layout.tail_len;
+  if (pos + len > written || (pos < tail_start && pos + len > layout.head_len))
+    return false;
+  while (len > 0) {
+    // The head is at its stream position, the tail wraps after it.
+    uint64_t off = pos;
+    uint64_t room = layout.head_len - std::min(pos, layout.head_len);
+    if (pos >= layout.head_len) {
+      uint64_t tail_pos = (pos - r.head_capacity) % r.tail_capacity;
+      off = r.head_capacity + tail_pos;
+      room = r.tail_capacity - tail_pos;
+    }
+    ssize_t n = pread(r.fd, buf, std::min<uint64_t>(len, room), static_cast<off_t>(off));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    pos += n;
+    len -= n;
+  }
+  return true;
+}
+
+} // namespace heidi
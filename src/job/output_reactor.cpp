@@ -0,0 +1,290 @@
+#include "heidi-kernel/output_reactor.h"
+
+#include "heidi-kernel/cgroup_driver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace heidi {
+
+OutputReactor::OutputReactor(std::mutex& job_mutex) : job_mutex_(job_mutex) {}
+
+OutputReactor::~OutputReactor() {
+  stop();
+}
+
+bool OutputReactor::start() {
+  if (running_.load())
+    return true;
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    return false;
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd_ < 0) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+    return false;
+  }
+  struct epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+  if (timer_handler_) {
+    // Without a timerfd, deadlines are still enforced on the runner's ticks.
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd_ >= 0) {
+      ev.data.ptr = &timer_fd_;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) != 0) {
+        close(timer_fd_);
+        timer_fd_ = -1;
+      }
+    }
+  }
+  if (event_handler_ && event_fd_ >= 0) {
+    ev.data.ptr = &event_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+  }
+
+  running_ = true;
+  thread_ = std::thread(&OutputReactor::loop, this);
+  return true;
+}
+
+void OutputReactor::stop() {
+  if (!running_.exchange(false))
+    return;
+  uint64_t one = 1;
+  (void)!write(wake_fd_, &one, sizeof(one));
+  if (thread_.joinable())
+    thread_.join();
+
+  std::unique_lock<std::mutex> lock(watches_mutex_);
+  for (auto& pair : watches_)
+    close(pair.first);
+  watches_.clear();
+  if (timer_fd_ >= 0)
+    close(timer_fd_);
+  close(wake_fd_);
+  close(epoll_fd_);
+  timer_fd_ = -1;
+  wake_fd_ = -1;
+  epoll_fd_ = -1;
+}
+
+void OutputReactor::arm_timer(uint64_t delay_ms) {
+  if (timer_fd_ < 0)
+    return;
+  struct itimerspec spec{};
+  spec.it_value.tv_sec = delay_ms / 1000;
+  // An all-zero it_value would disarm instead.
+  spec.it_value.tv_nsec = delay_ms == 0 ? 1 : (delay_ms % 1000) * 1000000;
+  timerfd_settime(timer_fd_, 0, &spec, nullptr);
+}
+
+void OutputReactor::disarm_timer() {
+  if (timer_fd_ < 0)
+    return;
+  struct itimerspec spec{};
+  timerfd_settime(timer_fd_, 0, &spec, nullptr);
+}
+
+bool OutputReactor::watch(const std::shared_ptr<Job>& job) {
+  if (!running_.load())
+    return false;
+  bool all = true;
+  if (job->stdout_fd != -1) {
+    if (add_fd(job, job->stdout_fd, WatchKind::STDOUT))
+      job->stdout_fd = -1;
+    else
+      all = false;
+  }
+  if (job->stderr_fd != -1) {
+    if (add_fd(job, job->stderr_fd, WatchKind::STDERR))
+      job->stderr_fd = -1;
+    else
+      all = false;
+  }
+  if (job->pidfd != -1 && exit_handler_) {
+    // A private duplicate: the job's pidfd may be closed by whoever reaps the
+    // leader first without leaving a stale registration behind.
+    int dup_fd = fcntl(job->pidfd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd < 0 || !add_fd(job, dup_fd, WatchKind::PIDFD)) {
+      if (dup_fd >= 0)
+        close(dup_fd);
+      all = false;
+    }
+  }
+  if (job->cgroup_events_fd != -1 && cgroup_handler_) {
+    int dup_fd = fcntl(job->cgroup_events_fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd < 0 || !add_fd(job, dup_fd, WatchKind::CGROUP)) {
+      if (dup_fd >= 0)
+        close(dup_fd);
+      all = false;
+    }
+  }
+  return all;
+}
+
+size_t OutputReactor::watched_fds() const {
+  std::unique_lock<std::mutex> lock(watches_mutex_);
+  return watches_.size();
+}
+
+bool OutputReactor::add_fd(const std::shared_ptr<Job>& job, int fd, WatchKind kind) {
+  bool pipe = kind == WatchKind::STDOUT || kind == WatchKind::STDERR;
+  int pipe_size = pipe ? fcntl(fd, F_GETPIPE_SZ) : -1;
+  auto watch = std::make_unique<Watch>(Watch{job, fd, kind, pipe_size});
+  Watch* w = watch.get();
+  {
+    std::unique_lock<std::mutex> lock(watches_mutex_);
+    watches_[fd] = std::move(watch);
+  }
+
+  // Registered after the Watch exists: data already in the pipe produces an
+  // event right away.
+  // cgroup.events signals a change with EPOLLPRI until it is read again.
+  struct epoll_event ev{};
+  ev.events = kind == WatchKind::CGROUP ? EPOLLPRI : EPOLLIN | EPOLLET;
+  ev.data.ptr = w;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    std::unique_lock<std::mutex> lock(watches_mutex_);
+    watches_.erase(fd);
+    return false;
+  }
+  return true;
+}
+
+void OutputReactor::loop() {
+  std::unique_ptr<char[]> buffer(new char[kReadChunk]);
+  read_buffer_ = buffer.get();
+
+  struct epoll_event events[64];
+  while (running_.load()) {
+    int n = epoll_wait(epoll_fd_, events, 64, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      auto* w = static_cast<Watch*>(events[i].data.ptr);
+      if (!w) {
+        uint64_t value;
+        (void)!read(wake_fd_, &value, sizeof(value));
+        continue;
+      }
+      if (events[i].data.ptr == &timer_fd_) {
+        uint64_t expirations;
+        if (read(timer_fd_, &expirations, sizeof(expirations)) > 0)
+          timer_handler_();
+        continue;
+      }
+      if (events[i].data.ptr == &event_fd_) {
+        event_handler_();
+        continue;
+      }
+      if (w->kind == WatchKind::PIDFD)
+        leader_exited(w);
+      else if (w->kind == WatchKind::CGROUP)
+        cgroup_changed(w);
+      else
+        drain(w);
+    }
+  }
+  read_buffer_ = nullptr;
+}
+
+bool OutputReactor::read_all(Watch* w, size_t* drained) {
+  for (;;) {
+    ssize_t n = read(w->fd, read_buffer_, kReadChunk);
+    if (n > 0) {
+      *drained += n;
+      bytes_read_.fetch_add(n, std::memory_order_relaxed);
+      std::unique_lock<std::mutex> lock(job_mutex_);
+      append_job_output(*w->job,
+                        w->kind == WatchKind::STDERR ? LogStream::STDERR : LogStream::STDOUT,
+                        read_buffer_, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return true;
+
+    // EOF (or a read error, which we treat the same way).
+    return false;
+  }
+}
+
+void OutputReactor::drain(Watch* w) {
+  // Edge-triggered: empty the pipe now, we will not hear about this data
+  // again.
+  size_t drained = 0;
+  if (!read_all(w, &drained)) {
+    unwatch(w);
+    return;
+  }
+
+  // A pass that read a whole pipe's worth means the writer was (or was about
+  // to be) blocked on a full pipe. Give it more room.
+  if (w->pipe_size > 0 && drained >= static_cast<size_t>(w->pipe_size) &&
+      w->pipe_size < kMaxPipeSize) {
+    int grown = fcntl(w->fd, F_SETPIPE_SZ, std::min(w->pipe_size * 2, kMaxPipeSize));
+    if (grown > 0) {
+      w->pipe_size = grown;
+      pipe_resizes_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      // Over fs.pipe-max-size or the user's pipe quota; stop trying.
+      w->pipe_size = -1;
+    }
+  }
+}
+
+void OutputReactor::leader_exited(Watch* w) {
+  // A pidfd only becomes readable once, when the leader exits.
+  std::shared_ptr<Job> job = w->job;
+  unwatch(w);
+  exits_seen_.fetch_add(1, std::memory_order_relaxed);
+  exit_handler_(job);
+}
+
+void OutputReactor::cgroup_changed(Watch* w) {
+  // Reading the file is what re-arms the event; other changes (frozen) keep
+  // the watch. A file that cannot be read is dropped; the runner's ticks
+  // still look at the cgroup.
+  int populated = gov::CgroupDriver::read_populated(w->fd);
+  if (populated == 1)
+    return;
+  std::shared_ptr<Job> job = w->job;
+  unwatch(w);
+  if (populated < 0)
+    return;
+  cgroups_emptied_.fetch_add(1, std::memory_order_relaxed);
+  cgroup_handler_(job);
+}
+
+void OutputReactor::unwatch(Watch* w) {
+  int fd = w->fd;
+  // Drop the entry before closing, so a job spawned meanwhile that is handed
+  // the same fd number cannot have its Watch erased instead.
+  std::unique_ptr<Watch> owned;
+  {
+    std::unique_lock<std::mutex> lock(watches_mutex_);
+    auto it = watches_.find(fd);
+    if (it != watches_.end()) {
+      owned = std::move(it->second);
+      watches_.erase(it);
+    }
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+}
+
+} // namespace heidi
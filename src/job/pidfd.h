@@ -0,0 +1,20 @@
+// Small pidfd helpers shared by the spawners and the job runner.
+#pragma once
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace heidi {
+
+// pidfd_open(2), or -1 when the kernel or libc headers lack it.
+inline int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+} // namespace heidi
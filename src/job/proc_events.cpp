@@ -0,0 +1,340 @@
+#include "heidi-kernel/proc_events.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace heidi {
+
+namespace {
+
+// How long open() waits for the event of its test child.
+constexpr int kSelfTestTimeoutMs = 500;
+// proc_event::what values. Older headers scope the enumerators inside
+// proc_event and newer ones do not; the values are ABI.
+constexpr uint32_t kEventFork = 0x00000001;
+constexpr uint32_t kEventExit = 0x80000000;
+
+uint64_t monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool subscribe(int fd, proc_cn_mcast_op op) {
+  alignas(struct nlmsghdr) char req[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))] = {};
+  auto* nl = reinterpret_cast<struct nlmsghdr*>(req);
+  nl->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  nl->nlmsg_type = NLMSG_DONE;
+  auto* cn = static_cast<struct cn_msg*>(NLMSG_DATA(nl));
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(op);
+  memcpy(cn->data, &op, sizeof(op));
+  return send(fd, req, nl->nlmsg_len, 0) == static_cast<ssize_t>(nl->nlmsg_len);
+}
+
+} // namespace
+
+void ProcessTree::add_root(pid_t pgid) {
+  remove_root(pgid);
+  uint64_t id = next_id_++;
+  Root& root = roots_[id];
+  root.pgid = pgid;
+  root.live = 1;
+  root_ids_[pgid] = id;
+  owner_[pgid] = id;
+}
+
+void ProcessTree::remove_root(pid_t pgid) {
+  auto it = root_ids_.find(pgid);
+  if (it == root_ids_.end())
+    return;
+  roots_.erase(it->second);
+  root_ids_.erase(it);
+}
+
+pid_t ProcessTree::on_fork(pid_t parent, pid_t child, uint64_t now_ms) {
+  auto owner = owner_.find(parent);
+  if (owner == owner_.end())
+    return 0;
+  auto root_it = roots_.find(owner->second);
+  if (root_it == roots_.end()) {
+    owner_.erase(owner); // Its tree is gone.
+    return 0;
+  }
+  uint64_t id = owner->second;
+  auto [child_owner, inserted] = owner_.try_emplace(child, id);
+  if (!inserted) {
+    // A reused pid whose exit went missing; it counts for its new tree only.
+    auto old_root = roots_.find(child_owner->second);
+    if (old_root != roots_.end())
+      old_root->second.live--;
+    child_owner->second = id;
+  }
+
+  Root& root = root_it->second;
+  root.live++;
+  uint64_t bucket = now_ms / kSpawnBucketMs;
+  size_t i = bucket % kSpawnBuckets;
+  if (root.bucket[i] != bucket) {
+    root.bucket[i] = bucket;
+    root.spawns[i] = 0;
+  }
+  root.spawns[i]++;
+  return root.pgid;
+}
+
+pid_t ProcessTree::on_exit(pid_t pid) {
+  auto owner = owner_.find(pid);
+  if (owner == owner_.end())
+    return 0;
+  auto root_it = roots_.find(owner->second);
+  owner_.erase(owner);
+  if (root_it == roots_.end())
+    return 0;
+  root_it->second.live--;
+  return root_it->second.pgid;
+}
+
+size_t ProcessTree::resync(const ProcSnapshot& snapshot,
+                           const std::function<bool(pid_t)>& alive) {
+  size_t dropped = 0;
+  for (auto it = owner_.begin(); it != owner_.end();) {
+    auto root_it = roots_.find(it->second);
+    if (root_it != roots_.end() && alive(it->first)) {
+      ++it;
+      continue;
+    }
+    if (root_it != roots_.end())
+      root_it->second.live--;
+    it = owner_.erase(it);
+    dropped++;
+  }
+  for (auto& [id, root] : roots_) {
+    for (pid_t pid : snapshot.pids(root.pgid)) {
+      if (owner_.try_emplace(pid, id).second)
+        root.live++;
+    }
+  }
+  return dropped;
+}
+
+const ProcessTree::Root* ProcessTree::find(pid_t pgid) const {
+  auto it = root_ids_.find(pgid);
+  if (it == root_ids_.end())
+    return nullptr;
+  auto root_it = roots_.find(it->second);
+  return root_it == roots_.end() ? nullptr : &root_it->second;
+}
+
+int ProcessTree::live(pid_t pgid) const {
+  const Root* root = find(pgid);
+  return root ? std::max(root->live, 0) : -1;
+}
+
+int ProcessTree::spawns(pid_t pgid, uint64_t now_ms) const {
+  const Root* root = find(pgid);
+  if (!root)
+    return -1;
+  uint64_t bucket = now_ms / kSpawnBucketMs;
+  uint32_t total = 0;
+  for (size_t i = 0; i < kSpawnBuckets; ++i) {
+    if (root->bucket[i] <= bucket && root->bucket[i] + kSpawnBuckets > bucket)
+      total += root->spawns[i];
+  }
+  return static_cast<int>(total);
+}
+
+size_t parse_proc_events(const void* buf, size_t len, ProcessTree& tree,
+                         std::vector<pid_t>* grown) {
+  size_t applied = 0;
+  pid_t last_grown = 0;
+  const auto* nl = static_cast<const struct nlmsghdr*>(buf);
+  // NLMSG_OK/NLMSG_NEXT want a signed remaining length.
+  int remaining = static_cast<int>(len);
+  for (; NLMSG_OK(nl, remaining); nl = NLMSG_NEXT(nl, remaining)) {
+    if (nl->nlmsg_type == NLMSG_ERROR || nl->nlmsg_type == NLMSG_NOOP)
+      continue;
+    if (nl->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)))
+      continue;
+    const auto* cn = static_cast<const struct cn_msg*>(NLMSG_DATA(nl));
+    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+      continue;
+    size_t payload = std::min<size_t>(cn->len, nl->nlmsg_len - NLMSG_LENGTH(sizeof(*cn)));
+    // Copied out: the payload is not necessarily aligned for proc_event, and
+    // kernels built against other headers may send a shorter union.
+    struct proc_event ev{};
+    memcpy(&ev, cn->data, std::min(payload, sizeof(ev)));
+    size_t header = offsetof(struct proc_event, event_data);
+    uint32_t what = static_cast<uint32_t>(ev.what);
+
+    if (what == kEventFork && payload >= header + sizeof(ev.event_data.fork)) {
+      const auto& fork = ev.event_data.fork;
+      if (fork.child_pid != fork.child_tgid)
+        continue; // A new thread.
+      pid_t pgid = tree.on_fork(fork.parent_tgid, fork.child_tgid, ev.timestamp_ns / 1000000);
+      if (pgid != 0 && pgid != last_grown) {
+        grown->push_back(pgid);
+        last_grown = pgid;
+      }
+      applied++;
+    } else if (what == kEventExit && payload >= header + sizeof(ev.event_data.exit)) {
+      const auto& exit = ev.event_data.exit;
+      if (exit.process_pid != exit.process_tgid)
+        continue;
+      tree.on_exit(exit.process_tgid);
+      applied++;
+    }
+  }
+  return applied;
+}
+
+ProcEventInspector::ProcEventInspector(const std::string& proc_root)
+    : fallback_(proc_root), resync_snapshot_(proc_root) {}
+
+ProcEventInspector::~ProcEventInspector() {
+  if (fd_ >= 0) {
+    subscribe(fd_, PROC_CN_MCAST_IGNORE);
+    close(fd_);
+  }
+}
+
+bool ProcEventInspector::open() {
+  if (fd_ >= 0)
+    return true;
+  int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (fd < 0)
+    return false;
+  struct sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      !subscribe(fd, PROC_CN_MCAST_LISTEN)) {
+    close(fd);
+    return false;
+  }
+  // Past net.core.rmem_max only with CAP_NET_ADMIN; either is best effort.
+  int size = kSocketBuffer;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  // Events only reach listeners in the initial namespaces, and carry pids
+  // as seen there: a child of our own must show up under the pid fork()
+  // gave us.
+  pid_t self = getpid();
+  pid_t child = fork();
+  if (child < 0) {
+    close(fd);
+    return false;
+  }
+  if (child == 0)
+    _exit(0);
+  waitpid(child, nullptr, 0);
+
+  ProcessTree probe;
+  probe.add_root(self);
+  std::vector<pid_t> grown;
+  uint64_t deadline = monotonic_ms() + kSelfTestTimeoutMs;
+  bool seen = false;
+  while (!seen) {
+    uint64_t now = monotonic_ms();
+    if (now >= deadline)
+      break;
+    struct pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, static_cast<int>(deadline - now)) <= 0)
+      continue;
+    ssize_t n = recv(fd, recv_buf_, sizeof(recv_buf_), 0);
+    if (n <= 0)
+      continue;
+    parse_proc_events(recv_buf_, n, probe, &grown);
+    seen = probe.live(self) > 1 || probe.spawns(self, monotonic_ms()) > 0;
+  }
+  if (!seen) {
+    close(fd);
+    return false;
+  }
+  // Whatever else arrived meanwhile predates every tracked job.
+  while (recv(fd, recv_buf_, sizeof(recv_buf_), 0) > 0) {
+  }
+  fd_ = fd;
+  return true;
+}
+
+int ProcEventInspector::count_processes_in_pgid(pid_t pgid) {
+  if (fd_ >= 0) {
+    int live = tree_.live(pgid);
+    if (live >= 0)
+      return live;
+  }
+  return fallback_.count_processes_in_pgid(pgid);
+}
+
+void ProcEventInspector::snapshot() {
+  // The trees are kept current by events; only the fallback needs a look.
+  if (fd_ < 0)
+    fallback_.snapshot();
+}
+
+std::optional<uint64_t> ProcEventInspector::leader_start_time(pid_t pgid) {
+  return fallback_.leader_start_time(pgid);
+}
+
+void ProcEventInspector::track(pid_t pgid) {
+  tree_.add_root(pgid);
+  tracked_jobs_.store(tree_.roots(), std::memory_order_relaxed);
+}
+
+void ProcEventInspector::untrack(pid_t pgid) {
+  tree_.remove_root(pgid);
+  tracked_jobs_.store(tree_.roots(), std::memory_order_relaxed);
+}
+
+int ProcEventInspector::spawn_count(pid_t pgid) {
+  if (fd_ < 0)
+    return -1;
+  return tree_.spawns(pgid, monotonic_ms());
+}
+
+size_t ProcEventInspector::read_events(std::vector<pid_t>* grown) {
+  if (fd_ < 0)
+    return 0;
+  size_t applied = 0;
+  bool lost = false;
+  for (;;) {
+    ssize_t n = recv(fd_, recv_buf_, sizeof(recv_buf_), 0);
+    if (n > 0) {
+      applied += parse_proc_events(recv_buf_, n, tree_, grown);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == ENOBUFS) {
+      // The kernel dropped events; the socket itself is still good.
+      lost = true;
+      continue;
+    }
+    break;
+  }
+  if (lost) {
+    overruns_.fetch_add(1, std::memory_order_relaxed);
+    if (resync_snapshot_.refresh()) {
+      tree_.resync(resync_snapshot_,
+                   [](pid_t pid) { return kill(pid, 0) == 0 || errno == EPERM; });
+    }
+  }
+  events_seen_.fetch_add(applied, std::memory_order_relaxed);
+  return applied;
+}
+
+} // namespace heidi
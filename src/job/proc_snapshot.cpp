@@ -0,0 +1,139 @@
+#include "heidi-kernel/proc_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+namespace heidi {
+
+namespace {
+
+// The pid a /proc entry names, or 0 for anything that is not a process.
+pid_t parse_pid(const char* name) {
+  pid_t pid = 0;
+  for (const char* p = name; *p; ++p) {
+    if (*p < '0' || *p > '9')
+      return 0;
+    pid = pid * 10 + (*p - '0');
+  }
+  return pid;
+}
+
+// Pulls pgrp (field 5) and starttime (field 22) out of a stat line in one
+// pass. comm (field 2) may hold spaces and parentheses, so fields are
+// counted from the last ')'.
+bool parse_stat(const char* line, pid_t* pgrp, uint64_t* start_time) {
+  const char* p = strrchr(line, ')');
+  if (!p)
+    return false;
+  ++p;
+  bool have_pgrp = false;
+  for (int field = 3; field <= 22; ++field) {
+    while (*p == ' ')
+      ++p;
+    if (!*p)
+      return false;
+    if (field == 5) {
+      *pgrp = static_cast<pid_t>(strtol(p, nullptr, 10));
+      have_pgrp = true;
+    } else if (field == 22) {
+      *start_time = strtoull(p, nullptr, 10);
+      return have_pgrp;
+    }
+    while (*p && *p != ' ')
+      ++p;
+  }
+  return false;
+}
+
+} // namespace
+
+ProcSnapshot::ProcSnapshot(std::string proc_root) : proc_root_(std::move(proc_root)) {}
+
+ProcSnapshot::~ProcSnapshot() {
+  if (dir_)
+    closedir(dir_);
+}
+
+bool ProcSnapshot::refresh() {
+  entries_.clear();
+  pids_.clear();
+  groups_.clear();
+  valid_ = false;
+
+  if (!dir_) {
+    dir_ = opendir(proc_root_.c_str());
+    if (!dir_)
+      return false;
+  } else {
+    // Rewinding makes procfs list the processes as they are now.
+    rewinddir(dir_);
+  }
+
+  int dir_fd = dirfd(dir_);
+  char path[32];
+  struct dirent* entry;
+  while ((entry = readdir(dir_)) != nullptr) {
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+      continue;
+    pid_t pid = parse_pid(entry->d_name);
+    if (pid <= 0)
+      continue;
+
+    snprintf(path, sizeof(path), "%d/stat", pid);
+    int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      continue; // Exited since the listing.
+    ssize_t n = read(fd, stat_buf_, sizeof(stat_buf_) - 1);
+    close(fd);
+    if (n <= 0)
+      continue;
+    stat_buf_[n] = '\0';
+
+    Entry e{0, pid, 0};
+    if (parse_stat(stat_buf_, &e.pgid, &e.start_time))
+      entries_.push_back(e);
+  }
+
+  std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+    return a.pgid != b.pgid ? a.pgid < b.pgid : a.pid < b.pid;
+  });
+  for (const Entry& e : entries_) {
+    Group& group =
+        groups_.try_emplace(e.pgid, Group{static_cast<uint32_t>(pids_.size()), 0, false, 0})
+            .first->second;
+    group.count++;
+    if (e.pid == e.pgid) {
+      group.has_leader = true;
+      group.leader_start_time = e.start_time;
+    }
+    pids_.push_back(e.pid);
+  }
+  valid_ = true;
+  return true;
+}
+
+int ProcSnapshot::count(pid_t pgid) const {
+  auto it = groups_.find(pgid);
+  return it == groups_.end() ? 0 : static_cast<int>(it->second.count);
+}
+
+std::span<const pid_t> ProcSnapshot::pids(pid_t pgid) const {
+  auto it = groups_.find(pgid);
+  if (it == groups_.end())
+    return {};
+  return std::span<const pid_t>(pids_.data() + it->second.first, it->second.count);
+}
+
+std::optional<uint64_t> ProcSnapshot::leader_start_time(pid_t pgid) const {
+  auto it = groups_.find(pgid);
+  if (it == groups_.end() || !it->second.has_leader)
+    return std::nullopt;
+  return it->second.leader_start_time;
+}
+
+} // namespace heidi
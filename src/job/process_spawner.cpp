@@ -0,0 +1,529 @@
+#include "heidi-kernel/process_spawner.h"
+
+#include "exec_args.h"
+#include "pidfd.h"
+#include "procfs_starttime.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace heidi {
+
+namespace {
+
+constexpr size_t kCloneStackSize = 64 * 1024;
+
+static bool g_spawn_debug = !!getenv("HK_DEBUG_PROC_CAP");
+
+struct CloneChildArgs {
+  const char* path;
+  char* const* argv;
+  char* const* envp;
+  const char* cwd;
+  // cgroup.procs to write "0" to, when not started in the cgroup.
+  int cgroup_procs_fd;
+  int out_w;
+  int err_w;
+  const sigset_t* mask;
+  int exec_errno;
+};
+
+// Runs on a private stack while sharing memory with the suspended parent
+// (CLONE_VM | CLONE_VFORK). Only async-signal-safe calls are allowed here: no
+// heap, no stdio, and the only parent-visible write is exec_errno.
+int clone_child_main(void* arg) {
+  auto* args = static_cast<CloneChildArgs*>(arg);
+
+  // The handler table is not shared (no CLONE_SIGHAND), so reset the daemon's
+  // handlers before unblocking; a signal taken here must not run daemon code.
+  struct sigaction sa;
+  for (int sig = 1; sig < NSIG; ++sig) {
+    if (sig == SIGKILL || sig == SIGSTOP)
+      continue;
+    if (sigaction(sig, nullptr, &sa) != 0)
+      continue;
+    if (sa.sa_handler == SIG_IGN || sa.sa_handler == SIG_DFL)
+      continue;
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, nullptr);
+  }
+
+  setpgid(0, 0);
+
+  // Into the job's cgroup before anything runs that could fork.
+  if (args->cgroup_procs_fd >= 0 && write(args->cgroup_procs_fd, "0", 1) != 1) {
+    args->exec_errno = errno;
+    _exit(127);
+  }
+
+  // The pipe ends are O_CLOEXEC; dup2() clears the flag on the copies.
+  if (args->out_w == STDOUT_FILENO) {
+    fcntl(STDOUT_FILENO, F_SETFD, 0);
+  } else {
+    dup2(args->out_w, STDOUT_FILENO);
+  }
+  if (args->err_w == STDERR_FILENO) {
+    fcntl(STDERR_FILENO, F_SETFD, 0);
+  } else {
+    dup2(args->err_w, STDERR_FILENO);
+  }
+
+  if (args->cwd && chdir(args->cwd) != 0) {
+    args->exec_errno = errno;
+    _exit(127);
+  }
+
+  sigprocmask(SIG_SETMASK, args->mask, nullptr);
+
+  execve(args->path, args->argv, args->envp);
+  args->exec_errno = errno;
+  _exit(127);
+}
+
+// struct clone_args as of Linux 5.7 (CLONE_ARGS_SIZE_VER2); declared here
+// as older headers lack the cgroup field. The layout is ABI.
+struct CloneArgs {
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+  uint64_t set_tid;
+  uint64_t set_tid_size;
+  uint64_t cgroup;
+};
+
+constexpr uint64_t kCloneIntoCgroup = 0x200000000ULL;
+
+// Whether clone3() takes CLONE_INTO_CGROUP: 0 untried, 1 yes, -1 no.
+std::atomic<int> g_clone3_into_cgroup{0};
+
+// clone3() with CLONE_VM and a stack of its own: the child starts on the
+// new stack, runs fn(arg) and exits with its result, never returning
+// through the caller's frames (which glibc's clone() wrapper guarantees for
+// clone(), but there is no wrapper for clone3()). Returns the child's pid,
+// or -1 with errno set.
+pid_t clone3_vm(CloneArgs* args, int (*fn)(void*), void* arg) {
+#if defined(__x86_64__)
+  long ret;
+  asm volatile("syscall\n\t"
+               "test %%rax, %%rax\n\t"
+               "jnz 1f\n\t"
+               // Child: rsp is the top of the new stack, 16-byte aligned.
+               "xor %%ebp, %%ebp\n\t"
+               "mov %[arg], %%rdi\n\t"
+               "call *%[fn]\n\t"
+               "mov %%eax, %%edi\n\t"
+               "mov %[exit_nr], %%eax\n\t"
+               "syscall\n\t"
+               "hlt\n"
+               "1:"
+               : "=a"(ret)
+               : "a"(SYS_clone3), "D"(args), "S"(sizeof(*args)), [fn] "r"(fn), [arg] "r"(arg),
+                 [exit_nr] "i"(SYS_exit)
+               : "rcx", "r11", "memory");
+  if (ret < 0) {
+    errno = static_cast<int>(-ret);
+    return -1;
+  }
+  return static_cast<pid_t>(ret);
+#else
+  (void)args;
+  (void)fn;
+  (void)arg;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// The runner moves the job to FAILED; status is its to change.
+void fail_spawn(Job& job, const char* what, int err) {
+  job.error = std::string(what) + ": " + strerror(err);
+  job.finished_at = std::chrono::system_clock::now();
+}
+
+// True if some PATH entry is empty or does not start with '/'.
+bool has_relative_entry(std::string_view search_path) {
+  size_t pos = 0;
+  for (;;) {
+    size_t colon = search_path.find(':', pos);
+    std::string_view dir = search_path.substr(pos, colon == std::string_view::npos
+                                                       ? std::string_view::npos
+                                                       : colon - pos);
+    if (dir.empty() || dir.front() != '/')
+      return true;
+    if (colon == std::string_view::npos)
+      return false;
+    pos = colon + 1;
+  }
+}
+
+} // namespace
+
+const char* spawn_backend_name(SpawnBackend backend) {
+  switch (backend) {
+  case SpawnBackend::FORK:
+    return "fork";
+  case SpawnBackend::POSIX_SPAWN:
+    return "posix_spawn";
+  case SpawnBackend::VFORK:
+    return "vfork";
+  }
+  return "unknown";
+}
+
+std::optional<SpawnBackend> parse_spawn_backend(std::string_view name) {
+  if (name == "fork")
+    return SpawnBackend::FORK;
+  if (name == "posix_spawn")
+    return SpawnBackend::POSIX_SPAWN;
+  if (name == "vfork")
+    return SpawnBackend::VFORK;
+  return std::nullopt;
+}
+
+bool ExecPathResolver::resolve(std::string_view name, std::string_view search_path,
+                               std::string_view cwd, std::string* out) {
+  if (name.find('/') != std::string_view::npos) {
+    out->assign(name);
+    return true;
+  }
+  if (name.empty())
+    return false;
+
+  bool relative = has_relative_entry(search_path);
+  std::string key;
+  key.reserve(search_path.size() + 1 + name.size());
+  key.append(search_path);
+  key.push_back('\0');
+  key.append(name);
+  if (!relative) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+      *out = it->second;
+      return true;
+    }
+  }
+
+  // Same search order as execvp(): first executable regular file wins, and
+  // an empty PATH entry means the current directory (the job's). Misses are
+  // not cached so a newly installed program is picked up on the next spawn.
+  std::string found;
+  size_t pos = 0;
+  for (;;) {
+    size_t colon = search_path.find(':', pos);
+    std::string_view dir = search_path.substr(pos, colon == std::string_view::npos
+                                                       ? std::string_view::npos
+                                                       : colon - pos);
+    std::string candidate = dir.empty() ? std::string(".") : std::string(dir);
+    candidate += '/';
+    candidate.append(name);
+    // A relative candidate is returned as-is, since the child has changed to
+    // the job's cwd by the time it execs; it is looked for there.
+    std::string probe = candidate;
+    if (candidate.front() != '/' && !cwd.empty())
+      probe = std::string(cwd) + '/' + candidate;
+    struct stat st;
+    if (stat(probe.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+        access(probe.c_str(), X_OK) == 0) {
+      found = std::move(candidate);
+      break;
+    }
+    if (colon == std::string_view::npos)
+      break;
+    pos = colon + 1;
+  }
+  if (found.empty())
+    return false;
+  if (relative) {
+    *out = std::move(found);
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (cache_.size() >= kMaxEntries)
+    cache_.clear();
+  cache_[std::move(key)] = found;
+  *out = std::move(found);
+  return true;
+}
+
+void ExecPathResolver::invalidate(std::string_view name, std::string_view search_path) {
+  std::string key;
+  key.append(search_path);
+  key.push_back('\0');
+  key.append(name);
+  std::unique_lock<std::mutex> lock(mutex_);
+  cache_.erase(key);
+}
+
+size_t ExecPathResolver::size() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return cache_.size();
+}
+
+RealProcessSpawner::RealProcessSpawner(SpawnBackend backend) : backend_(backend) {}
+
+bool RealProcessSpawner::spawn_job(Job& job, int* stdout_fd, int* stderr_fd) {
+  ExecArgs exec;
+  int prep_err = prepare_exec(job, resolver_, &exec);
+  if (prep_err != 0) {
+    fail_spawn(job, "Failed to resolve program", prep_err);
+    return false;
+  }
+
+  int pipe_stdout[2];
+  int pipe_stderr[2];
+
+  // O_CLOEXEC keeps each job's pipe ends out of every other job's children.
+  if (pipe2(pipe_stdout, O_CLOEXEC) == -1) {
+    fail_spawn(job, "Failed to create pipes", errno);
+    return false;
+  }
+  if (pipe2(pipe_stderr, O_CLOEXEC) == -1) {
+    int err = errno;
+    close(pipe_stdout[0]);
+    close(pipe_stdout[1]);
+    fail_spawn(job, "Failed to create pipes", err);
+    return false;
+  }
+
+  // Set pipes non-blocking
+  fcntl(pipe_stdout[0], F_SETFL, O_NONBLOCK);
+  fcntl(pipe_stderr[0], F_SETFL, O_NONBLOCK);
+
+  exec.cgroup_fd = job.cgroup_handle.dir_fd();
+  int pidfd = -1;
+  pid_t pid = spawn_with_backend(exec, pipe_stdout[1], pipe_stderr[1], &pidfd);
+  if (pid == -1 && errno == ENOENT && job.exec_mode == ExecMode::DIRECT &&
+      job.argv[0].find('/') == std::string::npos) {
+    // The cached location may be stale (program moved or removed); search
+    // PATH once more before giving up.
+    resolver_.invalidate(job.argv[0], exec_search_path(job));
+    if (prepare_exec(job, resolver_, &exec) == 0) {
+      exec.cgroup_fd = job.cgroup_handle.dir_fd();
+      pid = spawn_with_backend(exec, pipe_stdout[1], pipe_stderr[1], &pidfd);
+    } else {
+      errno = ENOENT;
+    }
+  }
+  int spawn_errno = errno;
+
+  close(pipe_stdout[1]);
+  close(pipe_stderr[1]);
+
+  if (pid == -1) {
+    close(pipe_stdout[0]);
+    close(pipe_stderr[0]);
+    fail_spawn(job, "Failed to spawn", spawn_errno);
+    return false;
+  }
+
+  // Every backend puts the leader in its own process group before exec, so
+  // the pgid is the leader pid by the time we get here.
+  job.process_group = pid;
+  job.pidfd = pidfd;
+  // posix_spawn has no hook before exec; its leader is moved by the runner.
+  job.cgroup_joined = job.cgroup_handle.is_open() && backend_ != SpawnBackend::POSIX_SPAWN;
+
+  // Capture leader start_time to guard against PID reuse affecting later
+  // process-group attribution. Use helper to parse /proc/<pid>/stat.
+  auto start_time = read_proc_start_time_ticks(pid);
+  if (start_time) {
+    job.leader_start_time = *start_time;
+  }
+  if (g_spawn_debug) {
+    fprintf(stderr, "SPAWN_DBG parent backend=%s leader_pid=%d pidfd=%d leader_start_time=%llu\n",
+            spawn_backend_name(backend_), pid, pidfd,
+            static_cast<unsigned long long>(job.leader_start_time));
+  }
+
+  *stdout_fd = pipe_stdout[0];
+  *stderr_fd = pipe_stderr[0];
+  return true;
+}
+
+pid_t RealProcessSpawner::spawn_with_backend(const ExecArgs& exec, int out_w, int err_w,
+                                             int* pidfd) {
+  switch (backend_) {
+  case SpawnBackend::FORK:
+    return spawn_fork(exec, out_w, err_w, pidfd);
+  case SpawnBackend::POSIX_SPAWN:
+    return spawn_posix(exec, out_w, err_w, pidfd);
+  case SpawnBackend::VFORK:
+    return spawn_vfork(exec, out_w, err_w, pidfd);
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+pid_t RealProcessSpawner::spawn_fork(const ExecArgs& exec, int out_w, int err_w, int* pidfd) {
+  int procs_fd = -1;
+  if (exec.cgroup_fd >= 0) {
+    procs_fd = openat(exec.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (procs_fd < 0)
+      return -1;
+  }
+  pid_t pid = fork();
+  if (pid == 0) { // Child
+    setpgid(0, 0);
+    if (procs_fd >= 0 && write(procs_fd, "0", 1) != 1)
+      _exit(127);
+    dup2(out_w, STDOUT_FILENO);
+    dup2(err_w, STDERR_FILENO);
+    if (exec.cwd && chdir(exec.cwd) != 0)
+      _exit(127);
+    execve(exec.path.c_str(), exec.argv.data(), exec.envp());
+    _exit(127);
+  }
+  if (pid > 0) {
+    // Also set the group from the parent so it is in place before we return,
+    // whichever side runs first. EACCES after the child's exec is harmless.
+    setpgid(pid, pid);
+    // Likewise the cgroup; moving it a second time is harmless.
+    if (procs_fd >= 0) {
+      char buf[16];
+      int len = snprintf(buf, sizeof(buf), "%d", pid);
+      (void)!write(procs_fd, buf, len);
+    }
+    *pidfd = open_pidfd(pid);
+  }
+  if (procs_fd >= 0) {
+    int saved_errno = errno;
+    close(procs_fd);
+    errno = saved_errno;
+  }
+  return pid;
+}
+
+pid_t RealProcessSpawner::spawn_posix(const ExecArgs& exec, int out_w, int err_w, int* pidfd) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out_w, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, err_w, STDERR_FILENO);
+  if (exec.cwd)
+    posix_spawn_file_actions_addchdir_np(&actions, exec.cwd);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t all;
+  sigfillset(&all);
+  posix_spawnattr_setsigdefault(&attr, &all);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+
+  pid_t pid = -1;
+  int rc =
+      posix_spawn(&pid, exec.path.c_str(), &actions, &attr, exec.argv.data(), exec.envp());
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  *pidfd = open_pidfd(pid);
+  return pid;
+}
+
+pid_t RealProcessSpawner::spawn_vfork(const ExecArgs& exec, int out_w, int err_w, int* pidfd) {
+  void* stack = mmap(nullptr, kCloneStackSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED) {
+    return -1;
+  }
+
+  // Block everything across the clone so no daemon handler can run on the
+  // child's stack; the child restores this mask right before execve.
+  sigset_t all, saved;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+  CloneChildArgs args{exec.path.c_str(), exec.argv.data(), exec.envp(), exec.cwd, -1,
+                      out_w, err_w, &saved, 0};
+  char* stack_top = static_cast<char*>(stack) + kCloneStackSize;
+  int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+
+  int fd = -1;
+  pid_t pid = -1;
+  bool cloned = false;
+  if (exec.cgroup_fd >= 0 && g_clone3_into_cgroup.load(std::memory_order_relaxed) >= 0) {
+    // Started in the cgroup: no migration, and nothing runs outside it.
+    CloneArgs clone_args{};
+    clone_args.flags = CLONE_VM | CLONE_VFORK | CLONE_PIDFD | kCloneIntoCgroup;
+    clone_args.pidfd = reinterpret_cast<uint64_t>(&fd);
+    clone_args.exit_signal = SIGCHLD;
+    clone_args.stack = reinterpret_cast<uint64_t>(stack);
+    clone_args.stack_size = kCloneStackSize;
+    clone_args.cgroup = static_cast<uint64_t>(exec.cgroup_fd);
+    pid = clone3_vm(&clone_args, clone_child_main, &args);
+    // ENOSYS before 5.3, E2BIG or EINVAL before 5.7.
+    cloned = pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL);
+    if (cloned)
+      g_clone3_into_cgroup.store(1, std::memory_order_relaxed);
+    else
+      g_clone3_into_cgroup.store(-1, std::memory_order_relaxed);
+  }
+  int procs_fd = -1;
+  if (!cloned && exec.cgroup_fd >= 0) {
+    // The child joins between clone and exec instead.
+    procs_fd = openat(exec.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    args.cgroup_procs_fd = procs_fd;
+  }
+  // Without cgroup.procs the spawn fails with openat()'s errno.
+  if (!cloned && (exec.cgroup_fd < 0 || procs_fd >= 0)) {
+    fd = -1;
+    pid = clone(clone_child_main, stack_top, flags | CLONE_PIDFD, &args, &fd);
+    if (pid == -1 && errno == EINVAL) {
+      // Kernel predates CLONE_PIDFD (< 5.2).
+      fd = -1;
+      pid = clone(clone_child_main, stack_top, flags, &args);
+    }
+  }
+  int clone_errno = errno;
+  if (procs_fd >= 0)
+    close(procs_fd);
+
+  pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+  munmap(stack, kCloneStackSize);
+
+  if (pid == -1) {
+    errno = clone_errno;
+    return -1;
+  }
+
+  // CLONE_VFORK guarantees the child has exec'd or exited by now.
+  if (args.exec_errno != 0) {
+    waitpid(pid, nullptr, 0);
+    if (fd >= 0)
+      close(fd);
+    errno = args.exec_errno;
+    return -1;
+  }
+
+  *pidfd = fd;
+  return pid;
+}
+
+} // namespace heidi
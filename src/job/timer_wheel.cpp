@@ -0,0 +1,105 @@
+#include "heidi-kernel/timer_wheel.h"
+
+#include <algorithm>
+
+namespace heidi {
+
+void TimerWheel::schedule(Timer& timer, uint64_t deadline_ms) {
+  cancel(timer);
+  timer.deadline_ms = deadline_ms;
+  place(timer);
+  ++size_;
+}
+
+void TimerWheel::cancel(Timer& timer) {
+  if (!timer.armed())
+    return;
+  TimerList& from = list(timer.slot);
+  from.remove(timer);
+  if (timer.slot < kExpiredSlot && from.empty())
+    occupied_[timer.slot / kSlots] &= ~(1ULL << (timer.slot % kSlots));
+  timer.slot = -1;
+  --size_;
+}
+
+Timer* TimerWheel::pop_expired() {
+  Timer* timer = expired_.pop_front();
+  if (timer) {
+    timer->slot = -1;
+    --size_;
+  }
+  return timer;
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+  for (uint64_t next = next_slot_ms(); next <= now_ms; next = next_slot_ms())
+    step(next);
+  now_ms_ = std::max(now_ms_, now_ms);
+}
+
+uint64_t TimerWheel::next_event_ms() const {
+  return expired_.empty() ? next_slot_ms() : now_ms_;
+}
+
+uint64_t TimerWheel::next_slot_ms() const {
+  // Every occupied slot lies after the clock's own slot on its level.
+  uint64_t next = UINT64_MAX;
+  for (int level = 0; level < kLevels; ++level) {
+    int shift = level * kSlotBits;
+    int current = (now_ms_ >> shift) & (kSlots - 1);
+    uint64_t later = current == kSlots - 1 ? 0 : occupied_[level] & (~0ULL << (current + 1));
+    if (later == 0)
+      continue;
+    uint64_t span_start = now_ms_ >> (shift + kSlotBits) << (shift + kSlotBits);
+    next = std::min(next, span_start + (static_cast<uint64_t>(__builtin_ctzll(later)) << shift));
+  }
+  if (!overflow_.empty()) {
+    int shift = kLevels * kSlotBits;
+    next = std::min(next, ((now_ms_ >> shift) + 1) << shift);
+  }
+  return next;
+}
+
+void TimerWheel::place(Timer& timer) {
+  uint64_t deadline = timer.deadline_ms;
+  if (deadline <= now_ms_) {
+    timer.slot = kExpiredSlot;
+    expired_.push_back(timer);
+    return;
+  }
+  int level = (63 - __builtin_clzll(deadline ^ now_ms_)) / kSlotBits;
+  if (level >= kLevels) {
+    timer.slot = kOverflowSlot;
+    overflow_.push_back(timer);
+    return;
+  }
+  int index = (deadline >> (level * kSlotBits)) & (kSlots - 1);
+  timer.slot = level * kSlots + index;
+  slots_[timer.slot].push_back(timer);
+  occupied_[level] |= 1ULL << index;
+}
+
+void TimerWheel::refile_all(TimerList& from) {
+  // Timers may land back on the same list; only take those there now.
+  for (size_t n = from.size(); n > 0; --n)
+    place(*from.pop_front());
+}
+
+void TimerWheel::step(uint64_t t) {
+  now_ms_ = t;
+  if ((t & ((1ULL << (kLevels * kSlotBits)) - 1)) == 0)
+    refile_all(overflow_);
+  for (int level = kLevels - 1; level >= 0; --level) {
+    int shift = level * kSlotBits;
+    if (t & ((1ULL << shift) - 1))
+      continue;
+    int index = (t >> shift) & (kSlots - 1);
+    if ((occupied_[level] & (1ULL << index)) == 0)
+      continue;
+    occupied_[level] &= ~(1ULL << index);
+    // On level 0 every deadline is t: they all expire.
+    refile_all(slots_[level * kSlots + index]);
+  }
+}
+
+} // namespace heidi
@@ -0,0 +1,592 @@
+#include "heidi-kernel/zygote_spawner.h"
+
+#include "exec_args.h"
+#include "pidfd.h"
+#include "procfs_starttime.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace heidi {
+
+namespace {
+
+enum class ZygoteOp : uint32_t { SPAWN = 1, SPAWNED = 2, EXITED = 3 };
+
+// Fixed header on every message in both directions. SPAWN requests carry the
+// exec arguments the daemon already resolved, as NUL-terminated strings right
+// after it: path, cwd, then argc argv entries and envc env entries (envc -1
+// inherits the helper's environment). A SPAWN for a job with a cgroup carries
+// the cgroup's directory fd as SCM_RIGHTS; the leader joins it before exec.
+// SPAWNED replies carry the pipe read ends and (when available) the pidfd as
+// SCM_RIGHTS.
+struct ZygoteHeader {
+  ZygoteOp op;
+  int32_t err;
+  uint64_t tag;
+  int32_t pid;
+  int32_t wait_status;
+  int32_t argc;
+  int32_t envc;
+};
+
+constexpr size_t kMaxRequestBytes = 32 * 1024;
+constexpr int kMaxPassedFds = 3;
+constexpr int kReplyTimeoutMs = 5000;
+
+// --- helper process side -------------------------------------------------
+
+void zygote_send(int sock, const ZygoteHeader& msg, const int* fds, int nfds) {
+  struct iovec iov{const_cast<ZygoteHeader*>(&msg), sizeof(msg)};
+  struct msghdr mh{};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  if (nfds > 0) {
+    mh.msg_control = control;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+  }
+  while (sendmsg(sock, &mh, MSG_NOSIGNAL) < 0 && errno == EINTR) {
+  }
+}
+
+// Splits a SPAWN body into the path, cwd and nullptr-terminated argv/env
+// arrays. Returns false if the counts do not match the body.
+bool parse_spawn_body(const ZygoteHeader& req, char* body, size_t len, const char** path,
+                      const char** cwd, std::vector<char*>* argv, std::vector<char*>* env) {
+  if (req.argc < 1 || req.envc < -1)
+    return false;
+  size_t want = 2 + static_cast<size_t>(req.argc) + (req.envc > 0 ? req.envc : 0);
+  std::vector<char*> strings;
+  strings.reserve(want);
+  size_t pos = 0;
+  while (pos < len && strings.size() < want) {
+    strings.push_back(body + pos);
+    pos += strlen(body + pos) + 1;
+  }
+  if (strings.size() != want)
+    return false;
+
+  *path = strings[0];
+  *cwd = strings[1][0] ? strings[1] : nullptr;
+  argv->assign(strings.begin() + 2, strings.begin() + 2 + req.argc);
+  argv->push_back(nullptr);
+  env->clear();
+  if (req.envc >= 0) {
+    env->assign(strings.begin() + 2 + req.argc, strings.end());
+    env->push_back(nullptr);
+  }
+  return true;
+}
+
+void zygote_spawn(int sock, const ZygoteHeader& req, char* body, size_t len, int cgroup_fd,
+                  const sigset_t* child_mask) {
+  ZygoteHeader reply{ZygoteOp::SPAWNED, 0, req.tag, -1, 0, 0, 0};
+
+  const char* path = nullptr;
+  const char* cwd = nullptr;
+  std::vector<char*> argv, env;
+  if (!parse_spawn_body(req, body, len, &path, &cwd, &argv, &env)) {
+    reply.err = EPROTO;
+    zygote_send(sock, reply, nullptr, 0);
+    return;
+  }
+
+  int out[2], err[2];
+  if (pipe2(out, O_CLOEXEC) == -1) {
+    reply.err = errno;
+    zygote_send(sock, reply, nullptr, 0);
+    return;
+  }
+  if (pipe2(err, O_CLOEXEC) == -1) {
+    reply.err = errno;
+    close(out[0]);
+    close(out[1]);
+    zygote_send(sock, reply, nullptr, 0);
+    return;
+  }
+  // O_NONBLOCK lives on the open file description, so it survives SCM_RIGHTS.
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  fcntl(err[0], F_SETFL, O_NONBLOCK);
+
+  // As RealProcessSpawner's fork backend: the leader joins the cgroup before
+  // it execs, so nothing of the job runs outside it.
+  int procs_fd = -1;
+  if (cgroup_fd >= 0) {
+    procs_fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (procs_fd < 0) {
+      reply.err = errno;
+      for (int fd : {out[0], out[1], err[0], err[1]})
+        close(fd);
+      zygote_send(sock, reply, nullptr, 0);
+      return;
+    }
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) { // Job leader
+    setpgid(0, 0);
+    if (procs_fd >= 0 && write(procs_fd, "0", 1) != 1)
+      _exit(127);
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_SETMASK, child_mask, nullptr);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    if (cwd && chdir(cwd) != 0)
+      _exit(127);
+    execve(path, argv.data(), env.empty() ? environ : env.data());
+    _exit(127);
+  }
+  close(out[1]);
+  close(err[1]);
+  if (procs_fd >= 0) {
+    int saved_errno = errno;
+    // Moving it a second time is harmless.
+    if (pid > 0) {
+      char buf[16];
+      int n = snprintf(buf, sizeof(buf), "%d", pid);
+      (void)!write(procs_fd, buf, n);
+    }
+    close(procs_fd);
+    errno = saved_errno;
+  }
+
+  if (pid < 0) {
+    reply.err = errno;
+    close(out[0]);
+    close(err[0]);
+    zygote_send(sock, reply, nullptr, 0);
+    return;
+  }
+
+  setpgid(pid, pid);
+  int fds[kMaxPassedFds] = {out[0], err[0], open_pidfd(pid)};
+  int nfds = fds[2] >= 0 ? 3 : 2;
+  reply.pid = pid;
+  zygote_send(sock, reply, fds, nfds);
+  for (int i = 0; i < nfds; ++i)
+    close(fds[i]);
+}
+
+[[noreturn]] void zygote_main(int sock) {
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGPIPE, SIG_IGN);
+
+  sigset_t child_mask;
+  sigprocmask(SIG_SETMASK, nullptr, &child_mask);
+
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, nullptr);
+  int sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (sfd < 0)
+    _exit(1);
+
+  static char buf[sizeof(ZygoteHeader) + kMaxRequestBytes + 1];
+  for (;;) {
+    struct pollfd pfds[2] = {{sock, POLLIN, 0}, {sfd, POLLIN, 0}};
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      _exit(1);
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      struct signalfd_siginfo si;
+      while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+      }
+      int status = 0;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        ZygoteHeader msg{ZygoteOp::EXITED, 0, 0, pid, status, 0, 0};
+        zygote_send(sock, msg, nullptr, 0);
+      }
+    }
+
+    if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      struct iovec iov{buf, sizeof(buf) - 1};
+      alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+      struct msghdr mh{};
+      mh.msg_iov = &iov;
+      mh.msg_iovlen = 1;
+      mh.msg_control = control;
+      mh.msg_controllen = sizeof(control);
+      ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+      if (n == 0 || (n < 0 && errno != EINTR))
+        _exit(0); // Daemon went away
+      if (n < 0)
+        continue;
+      // The first passed fd is the job's cgroup; any others are stray.
+      int cgroup_fd = -1;
+      for (struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+          continue;
+        int nfds = static_cast<int>((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < nfds; ++i) {
+          int fd;
+          memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+          if (cgroup_fd < 0)
+            cgroup_fd = fd;
+          else
+            close(fd);
+        }
+      }
+      if (n >= static_cast<ssize_t>(sizeof(ZygoteHeader))) {
+        buf[n] = '\0';
+        ZygoteHeader req;
+        memcpy(&req, buf, sizeof(req));
+        if (req.op == ZygoteOp::SPAWN)
+          zygote_spawn(sock, req, buf + sizeof(req), n - sizeof(req), cgroup_fd, &child_mask);
+      }
+      if (cgroup_fd >= 0)
+        close(cgroup_fd);
+    }
+  }
+}
+
+// As fail_spawn(): the runner moves the job to FAILED.
+void fail_job(Job& job, const std::string& error) {
+  job.error = error;
+  job.finished_at = std::chrono::system_clock::now();
+}
+
+} // namespace
+
+// --- daemon side ----------------------------------------------------------
+
+ZygoteProcessSpawner::ZygoteProcessSpawner() = default;
+
+ZygoteProcessSpawner::~ZygoteProcessSpawner() {
+  stop();
+}
+
+bool ZygoteProcessSpawner::start() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (sock_ >= 0)
+    return true;
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    return false;
+
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  if (pid == 0) {
+    // Die with the daemon, and drop every inherited fd except our socket.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent)
+      _exit(0);
+    close(sv[0]);
+    if (sv[1] > STDERR_FILENO + 1)
+      close_range(STDERR_FILENO + 1, sv[1] - 1, 0);
+    close_range(sv[1] + 1, ~0U, 0);
+    zygote_main(sv[1]);
+  }
+
+  close(sv[1]);
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  sock_ = sv[0];
+  helper_pid_ = pid;
+  return true;
+}
+
+void ZygoteProcessSpawner::stop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (sock_ < 0)
+    return;
+  // Closing our end makes the helper exit; running jobs are unaffected.
+  close(sock_);
+  sock_ = -1;
+  waitpid(helper_pid_, nullptr, 0);
+  helper_pid_ = -1;
+}
+
+bool ZygoteProcessSpawner::is_running() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return sock_ >= 0;
+}
+
+bool ZygoteProcessSpawner::spawn_job(Job& job, int* stdout_fd, int* stderr_fd) {
+  Job* jobs[1] = {&job};
+  bool spawned[1] = {false};
+  spawn_jobs(jobs, spawned);
+  *stdout_fd = job.stdout_fd;
+  *stderr_fd = job.stderr_fd;
+  return spawned[0];
+}
+
+void ZygoteProcessSpawner::spawn_jobs(std::span<Job* const> jobs, std::span<bool> spawned) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (sock_ < 0) {
+    lock.unlock();
+    fallback_.spawn_jobs(jobs, spawned);
+    return;
+  }
+
+  // Requests are written while replies are read, so the helper never blocks
+  // on a full socket and the whole batch is in flight at once.
+  std::unique_ptr<bool[]> answered(new bool[jobs.size()]());
+  std::span<bool> answered_span(answered.get(), jobs.size());
+  std::string body;
+  size_t sent = 0;
+  size_t answered_count = 0;
+
+  while (answered_count < jobs.size() && sock_ >= 0) {
+    struct pollfd pfd{sock_, POLLIN, 0};
+    if (sent < jobs.size())
+      pfd.events |= POLLOUT;
+    int rc = poll(&pfd, 1, kReplyTimeoutMs);
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      helper_died_locked();
+      break;
+    }
+    if (rc == 0) {
+      // An unresponsive helper is as good as dead.
+      helper_died_locked();
+      break;
+    }
+
+    if (pfd.revents & POLLIN) {
+      read_message_locked(jobs, spawned, answered_span, &answered_count);
+      continue;
+    }
+    if (pfd.revents & (POLLHUP | POLLERR)) {
+      helper_died_locked();
+      break;
+    }
+
+    if (sent < jobs.size() && (pfd.revents & POLLOUT)) {
+      Job& job = *jobs[sent];
+      // PATH lookup happens here, against the daemon's cache, so the helper
+      // only execs.
+      ExecArgs exec;
+      int prep_err = prepare_exec(job, fallback_.resolver(), &exec);
+      if (prep_err == 0) {
+        body.assign(exec.path);
+        body.push_back('\0');
+        if (exec.cwd)
+          body.append(exec.cwd);
+        body.push_back('\0');
+        for (size_t i = 0; exec.argv[i]; ++i)
+          body.append(exec.argv[i]).push_back('\0');
+        for (size_t i = 0; i + 1 < exec.env.size(); ++i)
+          body.append(exec.env[i]).push_back('\0');
+      }
+      if (prep_err != 0 || body.size() > kMaxRequestBytes) {
+        if (prep_err != 0)
+          fail_job(job, std::string("Failed to resolve program: ") + strerror(prep_err));
+        else
+          fail_job(job, "Command too long for spawn helper");
+        spawned[sent] = false;
+        answered[sent] = true;
+        ++answered_count;
+        ++sent;
+        continue;
+      }
+
+      int32_t argc = static_cast<int32_t>(exec.argv.size() - 1);
+      int32_t envc = exec.env.empty() ? -1 : static_cast<int32_t>(exec.env.size() - 1);
+      ZygoteHeader req{ZygoteOp::SPAWN, 0, sent, -1, 0, argc, envc};
+      struct iovec iov[2] = {{&req, sizeof(req)}, {body.data(), body.size()}};
+      struct msghdr mh{};
+      mh.msg_iov = iov;
+      mh.msg_iovlen = 2;
+      alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+      if (job.cgroup_handle.is_open()) {
+        int cgroup_fd = job.cgroup_handle.dir_fd();
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &cgroup_fd, sizeof(int));
+      }
+      if (sendmsg(sock_, &mh, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+          continue;
+        helper_died_locked();
+        break;
+      }
+      ++sent;
+    }
+  }
+
+  // Whatever the helper never answered: jobs it never saw are retried in
+  // process, jobs it may have started are reported as failed.
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (answered[i])
+      continue;
+    if (i >= sent) {
+      spawned[i] = fallback_.spawn_job(*jobs[i], &jobs[i]->stdout_fd, &jobs[i]->stderr_fd);
+    } else {
+      fail_job(*jobs[i], "Spawn helper exited");
+      spawned[i] = false;
+    }
+  }
+}
+
+bool ZygoteProcessSpawner::read_message_locked(std::span<Job* const> jobs, std::span<bool> spawned,
+                                               std::span<bool> answered,
+                                               size_t* answered_count) {
+  if (sock_ < 0)
+    return false;
+
+  ZygoteHeader msg;
+  struct iovec iov{&msg, sizeof(msg)};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  struct msghdr mh{};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof(control);
+
+  ssize_t n = recvmsg(sock_, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (n == 0) {
+    helper_died_locked();
+    return false;
+  }
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR)
+      helper_died_locked();
+    return false;
+  }
+
+  int fds[kMaxPassedFds] = {-1, -1, -1};
+  int nfds = 0;
+  for (struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      nfds = static_cast<int>((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      if (nfds > kMaxPassedFds)
+        nfds = kMaxPassedFds;
+      memcpy(fds, CMSG_DATA(cm), sizeof(int) * nfds);
+    }
+  }
+
+  if (n != static_cast<ssize_t>(sizeof(msg))) {
+    for (int i = 0; i < nfds; ++i)
+      close(fds[i]);
+    return true;
+  }
+
+  if (msg.op == ZygoteOp::EXITED) {
+    record_exit_locked(msg.pid, msg.wait_status);
+    return true;
+  }
+
+  if (msg.op != ZygoteOp::SPAWNED || msg.tag >= jobs.size() || answered[msg.tag]) {
+    // Stale reply (e.g. from a batch that timed out); nothing owns the fds.
+    for (int i = 0; i < nfds; ++i)
+      close(fds[i]);
+    return true;
+  }
+
+  Job& job = *jobs[msg.tag];
+  answered[msg.tag] = true;
+  ++*answered_count;
+
+  if (msg.err != 0 || nfds < 2) {
+    for (int i = 0; i < nfds; ++i)
+      close(fds[i]);
+    fail_job(job, std::string("Failed to spawn: ") + strerror(msg.err ? msg.err : EPROTO));
+    spawned[msg.tag] = false;
+    return true;
+  }
+
+  // A pid that was recycled must not inherit an old, unclaimed exit status.
+  exited_.erase(msg.pid);
+
+  job.process_group = msg.pid;
+  job.stdout_fd = fds[0];
+  job.stderr_fd = fds[1];
+  job.pidfd = fds[2];
+  // The helper had the leader join before exec.
+  job.cgroup_joined = job.cgroup_handle.is_open();
+  auto start_time = read_proc_start_time_ticks(msg.pid);
+  if (start_time)
+    job.leader_start_time = *start_time;
+  spawned[msg.tag] = true;
+  return true;
+}
+
+void ZygoteProcessSpawner::record_exit_locked(pid_t pid, int wait_status) {
+  exited_[pid] = wait_status;
+  exited_order_.push_back(pid);
+  // Exits nobody asks for (jobs that were killed and forgotten) must not
+  // accumulate forever.
+  while (exited_order_.size() > kMaxPendingExits) {
+    exited_.erase(exited_order_.front());
+    exited_order_.pop_front();
+  }
+}
+
+void ZygoteProcessSpawner::helper_died_locked() {
+  if (sock_ < 0)
+    return;
+  close(sock_);
+  sock_ = -1;
+  kill(helper_pid_, SIGKILL);
+  waitpid(helper_pid_, nullptr, 0);
+  helper_pid_ = -1;
+}
+
+bool ZygoteProcessSpawner::reap_job(Job& job, int* wait_status) {
+  bool helper_gone;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (read_message_locked({}, {}, {}, nullptr)) {
+    }
+    auto it = exited_.find(job.process_group);
+    if (it != exited_.end()) {
+      *wait_status = it->second;
+      exited_.erase(it);
+      return true;
+    }
+    helper_gone = sock_ < 0;
+  }
+
+  // Jobs started by the in-process fallback are our own children.
+  if (IProcessSpawner::reap_job(job, wait_status))
+    return true;
+
+  // If the helper died, its children were reparented and their statuses are
+  // lost. Once the pidfd says the leader is gone, report it as exit 255.
+  if (helper_gone && job.pidfd >= 0) {
+    struct pollfd pfd{job.pidfd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) == 1) {
+      *wait_status = 255 << 8;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace heidi
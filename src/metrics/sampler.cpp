@@ -1,10 +1,14 @@
 #include "heidi-kernel/metrics.h"
 
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -113,7 +117,33 @@ MemStats MetricsSampler::read_mem_stats() {
   return stats;
 }
 
-MetricsSampler::MetricsSampler() = default;
+std::string pressure_path(const std::string& cgroup_dir, PressureResource resource) {
+  const char* name = resource == PressureResource::CPU      ? "cpu"
+                     : resource == PressureResource::MEMORY ? "memory"
+                                                            : "io";
+  if (cgroup_dir.empty())
+    return std::string("/proc/pressure/") + name;
+  return cgroup_dir + "/" + name + ".pressure";
+}
+
+bool parse_pressure(const std::string& text, PressureStats* stats) {
+  std::istringstream iss(text);
+  std::string line;
+  bool found = false;
+  while (std::getline(iss, line)) {
+    bool full = line.rfind("full ", 0) == 0;
+    if (!full && line.rfind("some ", 0) != 0)
+      continue;
+    double avg10;
+    if (sscanf(line.c_str() + strlen("some "), "avg10=%lf", &avg10) != 1)
+      continue;
+    (full ? stats->full_avg10 : stats->some_avg10) = avg10;
+    found = true;
+  }
+  return found;
+}
+
+MetricsSampler::MetricsSampler(const std::string& cgroup_dir) : cgroup_dir_(cgroup_dir) {}
 
 SystemMetrics MetricsSampler::sample() {
   SystemMetrics metrics;
@@ -141,8 +171,66 @@ SystemMetrics MetricsSampler::sample() {
   prev_cpu_ = current;
   metrics.mem = mem;
   first_sample_ = false;
+  sample_pressure(metrics);
 
   return metrics;
 }
 
+void MetricsSampler::sample_pressure(SystemMetrics& metrics) const {
+  PressureStats cpu, memory, io;
+  metrics.pressure_available = read_pressure(PressureResource::CPU, &cpu);
+  metrics.pressure_available &= read_pressure(PressureResource::MEMORY, &memory);
+  metrics.pressure_available &= read_pressure(PressureResource::IO, &io);
+  metrics.cpu_pressure = cpu;
+  metrics.mem_pressure = memory;
+  metrics.io_pressure = io;
+}
+
+bool MetricsSampler::read_pressure(PressureResource resource, PressureStats* stats) const {
+  // A pressure file is two short lines; read it with one read() as the
+  // kernel formats it in one go.
+  auto read_file = [stats](const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    char buffer[256];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    return n > 0 && parse_pressure(std::string(buffer, n), stats);
+  };
+  if (!cgroup_dir_.empty() && read_file(pressure_path(cgroup_dir_, resource)))
+    return true;
+  return read_file(pressure_path("", resource));
+}
+
+PressureTriggers::~PressureTriggers() {
+  clear();
+}
+
+bool PressureTriggers::add(const std::string& cgroup_dir, PressureResource resource, bool full,
+                           uint64_t stall_us, uint64_t window_us) {
+  if (stall_us == 0 || window_us == 0)
+    return false;
+  int fd = open(pressure_path(cgroup_dir, resource).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  char spec[64];
+  int len = snprintf(spec, sizeof(spec), "%s %llu %llu", full ? "full" : "some",
+                     static_cast<unsigned long long>(stall_us),
+                     static_cast<unsigned long long>(window_us));
+  // The kernel parses the trigger from one write, terminator included.
+  if (write(fd, spec, len + 1) < 0) {
+    close(fd);
+    return false;
+  }
+  triggers_.push_back({fd, resource, full, 100.0 * stall_us / window_us});
+  return true;
+}
+
+void PressureTriggers::clear() {
+  for (const Trigger& trigger : triggers_)
+    close(trigger.fd);
+  triggers_.clear();
+}
+
 } // namespace heidi
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include <cerrno>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <sys/socket.h>
@@ -21,24 +23,41 @@ std::string send_request(const std::string& socket_path, const std::string& requ
     throw std::runtime_error("Failed to connect to daemon");
   }
 
-  write(sock, request.c_str(), request.size());
+  // Batches can be larger than one write.
+  size_t sent = 0;
+  while (sent < request.size()) {
+    ssize_t n = write(sock, request.data() + sent, request.size() - sent);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      close(sock);
+      throw std::runtime_error("Failed to send request");
+    }
+    sent += n;
+  }
 
-  char buffer[1024];
-  ssize_t n = read(sock, buffer, sizeof(buffer) - 1);
+  // The daemon closes the connection after its response, which can be larger
+  // than one read (e.g. job tail).
+  std::string response;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(sock, buffer, sizeof(buffer))) > 0) {
+    response.append(buffer, n);
+  }
   close(sock);
 
-  if (n <= 0) {
+  if (response.empty()) {
     throw std::runtime_error("Failed to read response");
   }
 
-  buffer[n] = '\0';
-  return std::string(buffer);
+  return response;
 }
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
     std::cout << "Usage: heidi-kernelctl <command> [--socket <path>]" << std::endl;
-    std::cout << "Commands: ping, status, metrics latest|tail <n>, job run|status|tail|cancel"
+    std::cout << "Commands: ping, status, metrics latest|tail <n>, "
+                 "job run|batch|status|tail|cancel"
               << std::endl;
     return 1;
   }
@@ -75,15 +94,20 @@ int main(int argc, char* argv[]) {
       }
     } else if (command == "job") {
       if (argc < 3) {
-        std::cout << "Usage: heidi-kernelctl job run <command>|status [id]|tail <id>|cancel <id> "
-                     "[--socket <path>]"
+        std::cout << "Usage: heidi-kernelctl job run [group=<id>] [priority=<class>] "
+                     "[cpu=<cores>] [mem=<bytes>] [pids=<n>] <command>|batch [--best-effort] "
+                     "[--group|--priority|--cpu|--mem|--pids <value>] <file|->|"
+                     "status [id|since=<seq> limit=N]|tail <id>|cancel <id> [--socket <path>]"
                   << std::endl;
         return 1;
       }
       std::string subcommand = argv[2];
       if (subcommand == "run") {
         if (argc < 4) {
-          std::cout << "Usage: heidi-kernelctl job run <command> [--socket <path>]" << std::endl;
+          std::cout << "Usage: heidi-kernelctl job run [group=<id>] "
+                       "[priority=batch|normal|interactive] [cpu=<cores>] [mem=<bytes>[K|M|G]] "
+                       "[pids=<n>] <command> [--socket <path>]"
+                    << std::endl;
           return 1;
         }
         std::string job_cmd = argv[3];
@@ -94,10 +118,65 @@ int main(int argc, char* argv[]) {
         }
         std::string response = send_request(socket_path, "job run " + job_cmd + "\n");
         std::cout << response;
+      } else if (subcommand == "batch") {
+        // One shell command per line of the file (or stdin), sent in one
+        // request; blank lines are skipped.
+        // --group, --priority, --cpu, --mem and --pids apply to every job.
+        std::string mode = "all_or_nothing";
+        std::string options;
+        std::string path;
+        for (int i = 3; i < argc; ++i) {
+          std::string arg = argv[i];
+          if (arg == "--socket") {
+            ++i;
+          } else if ((arg == "--group" || arg == "--priority" || arg == "--cpu" ||
+                      arg == "--mem" || arg == "--pids") &&
+                     i + 1 < argc) {
+            options += " " + arg.substr(2) + "=" + argv[++i];
+          } else if (arg == "--best-effort") {
+            mode = "best_effort";
+          } else {
+            path = arg;
+          }
+        }
+        if (path.empty()) {
+          std::cout << "Usage: heidi-kernelctl job batch [--best-effort] [--group <id>] "
+                       "[--priority <class>] [--cpu <cores>] [--mem <bytes>] [--pids <n>] "
+                       "<file|-> [--socket <path>]"
+                    << std::endl;
+          return 1;
+        }
+        std::ifstream file;
+        if (path != "-") {
+          file.open(path);
+          if (!file) {
+            std::cerr << "Cannot open " << path << std::endl;
+            return 1;
+          }
+        }
+        std::istream& in = path == "-" ? std::cin : file;
+        std::string line, body;
+        size_t count = 0;
+        while (std::getline(in, line)) {
+          if (line.empty())
+            continue;
+          body += line + "\n";
+          count++;
+        }
+        std::string header = "job batch " + mode + options;
+        std::string response =
+            send_request(socket_path, header + " " + std::to_string(count) + "\n" + body);
+        std::cout << response;
       } else if (subcommand == "status") {
         if (argc >= 4 && std::string(argv[3]) != "--socket") {
-          std::string job_id = argv[3];
-          std::string response = send_request(socket_path, "job status " + job_id + "\n");
+          // A job id, or list options: since=<seq> limit=N.
+          std::string status_args = argv[3];
+          for (int i = 4; i < argc; ++i) {
+            if (std::string(argv[i]) == "--socket")
+              break;
+            status_args += " " + std::string(argv[i]);
+          }
+          std::string response = send_request(socket_path, "job status " + status_args + "\n");
           std::cout << response;
         } else {
           std::string response = send_request(socket_path, "job status\n");
@@ -105,11 +184,18 @@ int main(int argc, char* argv[]) {
         }
       } else if (subcommand == "tail") {
         if (argc < 4) {
-          std::cout << "Usage: heidi-kernelctl job tail <id> [--socket <path>]" << std::endl;
+          std::cout << "Usage: heidi-kernelctl job tail <id> [stdout|stderr] [max_bytes|lines=N] "
+                       "[--socket <path>]"
+                    << std::endl;
           return 1;
         }
-        std::string job_id = argv[3];
-        std::string response = send_request(socket_path, "job tail " + job_id + "\n");
+        std::string tail_args = argv[3];
+        for (int i = 4; i < argc; ++i) {
+          if (std::string(argv[i]) == "--socket")
+            break;
+          tail_args += " " + std::string(argv[i]);
+        }
+        std::string response = send_request(socket_path, "job tail " + tail_args + "\n");
         std::cout << response;
       } else if (subcommand == "cancel") {
         if (argc < 4) {
@@ -125,7 +211,8 @@ int main(int argc, char* argv[]) {
       }
     } else {
       std::cout << "Unknown command: " << command << std::endl;
-      std::cout << "Available: ping, status, metrics latest|tail <n>, job run|status|tail|cancel"
+      std::cout << "Available: ping, status, metrics latest|tail <n>, "
+                   "job run|batch|status|tail|cancel"
                 << std::endl;
       return 1;
     }
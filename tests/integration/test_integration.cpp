@@ -15,8 +15,8 @@
 
 namespace heidi {
 
-// RealProcessSpawner for integration tests
-class RealProcessSpawner : public IProcessSpawner {
+// Test-local spawner (named apart from the library's RealProcessSpawner to avoid an ODR clash)
+class IntegrationProcessSpawner : public IProcessSpawner {
 public:
   bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) override {
     pid_t pid = fork();
@@ -61,7 +61,7 @@ public:
 class IntegrationTest : public ::testing::Test {
 protected:
   void SetUp() override {
-    spawner_ = new RealProcessSpawner();
+    spawner_ = new IntegrationProcessSpawner();
     inspector_ = new RealProcessInspector();
     job_runner_ = new JobRunner(20, spawner_, inspector_);
     job_runner_->start();
@@ -75,7 +75,7 @@ protected:
   }
 
   JobRunner* job_runner_;
-  RealProcessSpawner* spawner_;
+  IntegrationProcessSpawner* spawner_;
   RealProcessInspector* inspector_;
 };
 
@@ -0,0 +1,402 @@
+#include "heidi-kernel/cgroup_driver.h"
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
+#include "heidi-kernel/zygote_spawner.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace heidi {
+namespace {
+
+// The first cgroup2 mount, or empty.
+std::string cgroup2_mount() {
+  std::ifstream mounts("/proc/self/mounts");
+  std::string line;
+  while (std::getline(mounts, line)) {
+    std::istringstream fields(line);
+    std::string device, dir, type;
+    fields >> device >> dir >> type;
+    if (type == "cgroup2")
+      return dir;
+  }
+  return "";
+}
+
+bool wait_for(const std::function<bool()>& done, int timeout_ms = 5000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+// The processes in the cgroup at path, or -1 if it cannot be opened.
+int count_in(const gov::CgroupDriver& driver, const std::string& path) {
+  gov::CgroupHandle cgroup;
+  cgroup.open(path.c_str());
+  return driver.count_processes(cgroup);
+}
+
+void kill_in(const std::string& path) {
+  gov::CgroupHandle cgroup;
+  if (cgroup.open(path.c_str()) == 0)
+    cgroup.kill();
+}
+
+// Runs against a private subtree of the host's cgroup2 mount; skipped where
+// there is none or it cannot be written (no root, no delegation).
+class CgroupDriverTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    std::string mount = cgroup2_mount();
+    if (mount.empty())
+      GTEST_SKIP() << "no cgroup2 mount";
+    base_ = mount + "/hk_test_" + std::to_string(getpid());
+    driver_ = std::make_unique<gov::CgroupDriver>(base_);
+    if (!driver_->is_available()) {
+      rmdir(base_.c_str());
+      GTEST_SKIP() << "cannot create cgroups under " << mount;
+    }
+  }
+
+  void TearDown() override {
+    if (!driver_ || !driver_->is_available())
+      return;
+    for (const auto& entry : fs::directory_iterator(base_)) {
+      if (entry.is_directory()) {
+        kill_in(entry.path());
+        wait_for([&] { return rmdir(entry.path().c_str()) == 0; }, 2000);
+      }
+    }
+    rmdir(base_.c_str());
+  }
+
+  std::string base_;
+  std::unique_ptr<gov::CgroupDriver> driver_;
+};
+
+TEST(CgroupDriverRootTest, UnavailableOutsideCgroup2) {
+  char tmpl[] = "/tmp/hk_not_cgroup_XXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  gov::CgroupDriver driver(dir + "/heidi");
+  EXPECT_FALSE(driver.is_available());
+  gov::CgroupDriver::JobCgroup cgroup;
+  EXPECT_EQ(driver.acquire_job_cgroup(&cgroup), ENODEV);
+  // Nothing is left behind in the wrong filesystem.
+  EXPECT_FALSE(fs::exists(dir + "/heidi"));
+  fs::remove_all(dir);
+}
+
+TEST_F(CgroupDriverTest, CountsSignalsAndKillsEveryProcessInTheCgroup) {
+  gov::CgroupDriver::JobCgroup cgroup;
+  ASSERT_EQ(driver_->acquire_job_cgroup(&cgroup), 0);
+  std::string path = cgroup.path;
+  EXPECT_EQ(path.rfind(base_ + "/cg_", 0), 0u);
+  int procs_fd = open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+  int events_fd = -1;
+  ASSERT_GE(procs_fd, 0);
+  ASSERT_EQ(cgroup.handle.open_events(&events_fd), 0);
+  EXPECT_EQ(driver_->count_processes(cgroup.handle), 0);
+  EXPECT_EQ(gov::CgroupDriver::read_populated(events_fd), 0);
+
+  int ready[2];
+  ASSERT_EQ(pipe(ready), 0);
+  pid_t leader = fork();
+  ASSERT_GE(leader, 0);
+  if (leader == 0) {
+    if (write(procs_fd, "0", 1) != 1)
+      _exit(1);
+    // Leaves the process group and session, not the cgroup.
+    if (fork() == 0) {
+      setsid();
+      pause();
+      _exit(0);
+    }
+    (void)!write(ready[1], "x", 1);
+    pause();
+    _exit(0);
+  }
+  close(procs_fd);
+  char c;
+  ASSERT_EQ(read(ready[0], &c, 1), 1);
+  close(ready[0]);
+  close(ready[1]);
+
+  EXPECT_EQ(driver_->count_processes(cgroup.handle), 2);
+  EXPECT_EQ(gov::CgroupDriver::read_populated(events_fd), 1);
+  EXPECT_EQ(driver_->remove_job_cgroup(path), EBUSY);
+
+  // Emptying the cgroup is reported on the events fd.
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev{};
+  ev.events = EPOLLPRI;
+  ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, events_fd, &ev), 0);
+  EXPECT_EQ(cgroup.handle.kill(), 0);
+  waitpid(leader, nullptr, 0);
+  bool emptied = wait_for([&] {
+    struct epoll_event out;
+    return epoll_wait(epfd, &out, 1, 100) == 1 &&
+           gov::CgroupDriver::read_populated(events_fd) == 0;
+  });
+  EXPECT_TRUE(emptied);
+  EXPECT_EQ(driver_->count_processes(cgroup.handle), 0);
+  close(epfd);
+  close(events_fd);
+  EXPECT_EQ(driver_->release_job_cgroup(&cgroup), 0);
+}
+
+TEST_F(CgroupDriverTest, HandleWritesLimitsAndReadsStatsThroughOpenFiles) {
+  gov::CgroupDriver::JobCgroup job;
+  ASSERT_EQ(driver_->acquire_job_cgroup(&job), 0);
+  job.handle.close();
+  std::string path = job.path;
+  gov::CgroupHandle cgroup;
+  EXPECT_EQ(cgroup.set_pids_max(8), EBADF);
+  ASSERT_EQ(cgroup.open(path.c_str()), 0);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+  ASSERT_EQ(cgroup.move_pid(pid), 0);
+  EXPECT_EQ(cgroup.count_procs(), 1);
+  EXPECT_EQ(cgroup.count_procs(), 1);
+  gov::CgroupHandle::Stats stats;
+  EXPECT_EQ(cgroup.read_stats(gov::CgroupHandle::STAT_POPULATED, &stats), 0);
+  EXPECT_EQ(stats.populated, 1);
+  EXPECT_EQ(stats.pids_current, -1);
+
+  // Limits land in the files, or fail with the controller's absence.
+  using Cap = gov::CgroupDriver::Capability;
+  int err = cgroup.set_pids_max(8);
+  if (has_capability(driver_->capability(), Cap::PIDS)) {
+    EXPECT_EQ(err, 0);
+    std::ifstream max(path + "/pids.max");
+    std::string value;
+    max >> value;
+    EXPECT_EQ(value, "8");
+    EXPECT_EQ(cgroup.set_pids_max(gov::CgroupHandle::kUnlimited), 0);
+    EXPECT_EQ(driver_->count_processes(cgroup), 1);
+  } else {
+    EXPECT_EQ(err, ENOENT);
+  }
+
+  EXPECT_EQ(cgroup.kill(), 0);
+  waitpid(pid, nullptr, 0);
+  EXPECT_TRUE(wait_for([&] { return cgroup.count_procs() == 0; }));
+  EXPECT_EQ(cgroup.read_stats(gov::CgroupHandle::STAT_POPULATED, &stats), 0);
+  EXPECT_EQ(stats.populated, 0);
+  cgroup.close();
+  EXPECT_EQ(driver_->remove_job_cgroup(path), 0);
+}
+
+TEST_F(CgroupDriverTest, ApplyKeepsACgroupPerPidUntilCleanup) {
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+  gov::CpuPolicy cpu;
+  cpu.max_pct = 50;
+  gov::MemPolicy mem;
+  mem.max_bytes = 64 << 20;
+  gov::PidsPolicy pids;
+  pids.max = 16;
+  auto result = driver_->apply(pid, cpu, mem, pids);
+  EXPECT_TRUE(result.success) << result.error_detail;
+  std::string path = base_ + "/" + std::to_string(pid);
+  EXPECT_EQ(count_in(*driver_, path), 1);
+  // Only the limits this time.
+  pids.max = 32;
+  result = driver_->apply(pid, cpu, mem, pids);
+  EXPECT_TRUE(result.success) << result.error_detail;
+  EXPECT_EQ(result.applied, driver_->capability());
+
+  ::kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+  EXPECT_TRUE(wait_for([&] { return count_in(*driver_, path) == 0; }));
+  driver_->cleanup(pid);
+  EXPECT_FALSE(fs::exists(path));
+}
+
+TEST_F(CgroupDriverTest, PoolHandsOutWarmCgroupsAndTakesEmptyOnesBack) {
+  driver_->set_pool_size(2);
+  EXPECT_EQ(driver_->refill_pool(), 2u);
+  EXPECT_EQ(driver_->refill_pool(), 0u);
+
+  gov::CgroupDriver::JobCgroup a, b, c;
+  ASSERT_EQ(driver_->acquire_job_cgroup(&a), 0);
+  ASSERT_EQ(driver_->acquire_job_cgroup(&b), 0);
+  EXPECT_EQ(driver_->pooled(), 0u);
+  // A dry pool makes one on the spot.
+  ASSERT_EQ(driver_->acquire_job_cgroup(&c), 0);
+  EXPECT_TRUE(a.handle.is_open());
+  EXPECT_NE(a.path, b.path);
+  EXPECT_NE(b.path, c.path);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    pause();
+    _exit(0);
+  }
+  ASSERT_EQ(a.handle.move_pid(pid), 0);
+  std::string busy = a.path;
+  EXPECT_EQ(driver_->release_job_cgroup(&a), EBUSY);
+  EXPECT_EQ(a.path, busy);
+  EXPECT_FALSE(a.handle.is_open());
+
+  EXPECT_EQ(driver_->release_job_cgroup(&b), 0);
+  EXPECT_EQ(driver_->release_job_cgroup(&c), 0);
+  EXPECT_TRUE(b.path.empty());
+  // Pool full: the second one went away.
+  EXPECT_EQ(driver_->pooled(), 2u);
+
+  kill_in(busy);
+  waitpid(pid, nullptr, 0);
+  EXPECT_TRUE(wait_for([&] { return driver_->remove_job_cgroup(busy) == 0; }));
+}
+
+TEST_F(CgroupDriverTest, SpawnerStartsLeaderInTheCgroup) {
+  for (SpawnBackend backend : {SpawnBackend::VFORK, SpawnBackend::FORK}) {
+    gov::CgroupDriver::JobCgroup cgroup;
+    ASSERT_EQ(driver_->acquire_job_cgroup(&cgroup), 0);
+    RealProcessSpawner spawner(backend);
+    Job job;
+    job.command = "exec sleep 5";
+    job.cgroup_handle = std::move(cgroup.handle);
+    int out_fd = -1, err_fd = -1;
+    ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd));
+    EXPECT_TRUE(job.cgroup_joined);
+    EXPECT_EQ(driver_->count_processes(job.cgroup_handle), 1) << spawn_backend_name(backend);
+
+    job.cgroup_handle.kill();
+    waitpid(job.process_group, nullptr, 0);
+    for (int fd : {out_fd, err_fd, job.pidfd})
+      if (fd >= 0)
+        close(fd);
+    cgroup.handle = std::move(job.cgroup_handle);
+    EXPECT_EQ(driver_->release_job_cgroup(&cgroup), 0);
+  }
+}
+
+TEST_F(CgroupDriverTest, ZygoteLeaderJoinsTheCgroupBeforeExec) {
+  ZygoteProcessSpawner spawner;
+  ASSERT_TRUE(spawner.start());
+  gov::CgroupDriver::JobCgroup cgroup;
+  ASSERT_EQ(driver_->acquire_job_cgroup(&cgroup), 0);
+  Job job;
+  // Already in the cgroup by its first instruction, so it sees itself there.
+  job.command = "exec cat /proc/self/cgroup";
+  job.cgroup_handle = std::move(cgroup.handle);
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd)) << job.error;
+  EXPECT_TRUE(job.cgroup_joined);
+
+  int status = 0;
+  EXPECT_TRUE(wait_for([&] { return spawner.reap_job(job, &status); }));
+  std::string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(out_fd, buf, sizeof(buf))) > 0)
+    out.append(buf, n);
+  std::string relative = "/" + fs::path(base_).filename().string() + "/" +
+                         fs::path(cgroup.path).filename().string();
+  EXPECT_NE(out.find("0::" + relative + "\n"), std::string::npos) << out;
+  for (int fd : {out_fd, err_fd, job.pidfd})
+    if (fd >= 0)
+      close(fd);
+  cgroup.handle = std::move(job.cgroup_handle);
+  EXPECT_TRUE(wait_for([&] { return driver_->release_job_cgroup(&cgroup) == 0; }));
+  spawner.stop();
+}
+
+TEST_F(CgroupDriverTest, RunnerCancelReachesProcessesThatLeftTheGroup) {
+  JobRunner runner(4);
+  runner.set_cgroup_driver(driver_.get());
+  runner.start();
+  JobLimits limits;
+  limits.kill_grace_ms = 100;
+  std::string id = runner.submit_job("setsid sleep 30 & sleep 30 & wait", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(0, metrics);
+  auto job = runner.get_job_status(id);
+  ASSERT_EQ(job->status, JobStatus::RUNNING);
+  std::string cgroup = job->cgroup;
+  EXPECT_EQ(cgroup.rfind(base_ + "/cg_", 0), 0u);
+  EXPECT_EQ(runner.contained_jobs(), 1u);
+  // The tick refilled the pool to the runner's 4; make room for one more.
+  EXPECT_EQ(driver_->pooled(), 4u);
+  gov::CgroupDriver::JobCgroup taken;
+  ASSERT_EQ(driver_->acquire_job_cgroup(&taken), 0);
+  ASSERT_TRUE(wait_for([&] { return count_in(*driver_, cgroup) == 3; }));
+
+  ASSERT_TRUE(runner.cancel_job(id));
+  // Ended by the reactor once the cgroup is empty, without further ticks.
+  EXPECT_TRUE(wait_for([&] { return runner.get_job_status(id)->status == JobStatus::CANCELLED; }));
+  EXPECT_EQ(runner.contained_jobs(), 0u);
+  // The empty cgroup went back to the pool.
+  EXPECT_TRUE(job->cgroup.empty());
+  EXPECT_EQ(driver_->pooled(), 4u);
+  EXPECT_TRUE(fs::exists(cgroup));
+  driver_->release_job_cgroup(&taken);
+  EXPECT_GE(runner.output_reactor().cgroups_emptied() + runner.output_reactor().exits_seen(), 1u);
+  runner.stop();
+}
+
+TEST_F(CgroupDriverTest, RunnerCapsProcessesByCgroupCount) {
+  JobRunner runner(4);
+  runner.set_cgroup_driver(driver_.get());
+  runner.start();
+  JobLimits limits;
+  limits.max_child_processes = 3;
+  limits.kill_grace_ms = 100;
+  // In sessions of their own, out of reach of the group's count.
+  std::string id = runner.submit_job(
+      "for i in 1 2 3 4 5; do setsid sleep 30 & done; wait", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  uint64_t now_ms = 0;
+  runner.tick(now_ms, metrics);
+  std::string cgroup = runner.get_job_status(id)->cgroup;
+  ASSERT_FALSE(cgroup.empty());
+  ASSERT_TRUE(wait_for([&] { return count_in(*driver_, cgroup) == 6; }));
+
+  runner.tick(now_ms += 100, metrics);
+  EXPECT_EQ(runner.get_job_status(id)->status, JobStatus::TERMINATING);
+  EXPECT_TRUE(wait_for([&] {
+    runner.tick(now_ms += 100, metrics);
+    return runner.get_job_status(id)->status == JobStatus::PROC_LIMIT;
+  }));
+  // Back in the pool, or removed.
+  EXPECT_LE(count_in(*driver_, cgroup), 0);
+  runner.stop();
+}
+
+} // namespace
+} // namespace heidi
@@ -148,4 +148,174 @@ TEST_F(ResourceGovernorTest, ValidateAndUpdate_MultipleErrors) {
   EXPECT_EQ(current.max_queue_depth, 100); // Still default
 }
 
-} // namespace heidi
\ No newline at end of file
+TEST_F(ResourceGovernorTest, ReservationsPackUpToCapacity) {
+  GovernorPolicy policy;
+  policy.cpu_capacity_millicores = 4000;
+  policy.mem_capacity_bytes = 1 << 20;
+  governor_.update_policy(policy);
+
+  ResourceRequest big{3000, 1 << 19, 0};
+  ResourceRequest small{1000, 1 << 18, 0};
+  EXPECT_TRUE(governor_.fits(big));
+  governor_.reserve(big);
+  EXPECT_TRUE(governor_.fits(small));
+  governor_.reserve(small);
+  // Out of CPU, though memory is left; an empty request always fits.
+  EXPECT_FALSE(governor_.fits(small));
+  EXPECT_TRUE(governor_.fits(ResourceRequest{}));
+
+  governor_.release(big);
+  EXPECT_EQ(governor_.reserved().cpu_millicores, 1000u);
+  EXPECT_EQ(governor_.reserved().mem_bytes, 1u << 18);
+  EXPECT_TRUE(governor_.fits(small));
+}
+
+TEST_F(ResourceGovernorTest, OversizedRequestRunsAlone) {
+  GovernorPolicy policy;
+  policy.cpu_capacity_millicores = 2000;
+  governor_.update_policy(policy);
+
+  ResourceRequest huge{8000, 0, 0};
+  EXPECT_TRUE(governor_.fits(huge));
+  governor_.reserve(ResourceRequest{500, 0, 0});
+  EXPECT_FALSE(governor_.fits(huge));
+}
+
+TEST_F(ResourceGovernorTest, UnsetCapacityTakesTheHosts) {
+  ResourceRequest capacity = governor_.capacity();
+  EXPECT_GT(capacity.cpu_millicores, 0u);
+  EXPECT_GT(capacity.mem_bytes, 0u);
+  EXPECT_EQ(capacity.pids, 0u);
+}
+
+TEST_F(ResourceGovernorTest, StallThresholdsHoldStarts) {
+  SystemMetrics metrics{50.0, {1000, 500, 500}, 0};
+  metrics.pressure_available = true;
+  metrics.mem_pressure.full_avg10 = 12.0;
+  auto result = governor_.decide(metrics, 5, 5);
+  EXPECT_EQ(result.decision, GovernorDecision::HOLD_QUEUE);
+  EXPECT_EQ(result.reason, BlockReason::MEM_STALL);
+  EXPECT_EQ(result.retry_after_ms, 1000);
+
+  metrics.mem_pressure.full_avg10 = 0.0;
+  metrics.io_pressure.full_avg10 = 25.0;
+  EXPECT_EQ(governor_.pressure(metrics), BlockReason::IO_STALL);
+
+  // A busy CPU that nothing waits on is no reason to hold, until a some
+  // threshold is set; watermarks still come first.
+  metrics.io_pressure.full_avg10 = 0.0;
+  metrics.cpu_pressure.some_avg10 = 60.0;
+  EXPECT_EQ(governor_.pressure(metrics), BlockReason::NONE);
+  GovernorPolicy policy;
+  policy.cpu_some_avg10_pct = 50.0;
+  governor_.update_policy(policy);
+  EXPECT_EQ(governor_.pressure(metrics), BlockReason::CPU_STALL);
+  metrics.cpu_usage_percent = 90.0;
+  EXPECT_EQ(governor_.pressure(metrics), BlockReason::CPU_HIGH);
+
+  // Readings from a kernel without PSI are not stalls.
+  metrics.cpu_usage_percent = 50.0;
+  metrics.pressure_available = false;
+  EXPECT_EQ(governor_.decide(metrics, 5, 5).decision, GovernorDecision::START_NOW);
+}
+
+TEST_F(ResourceGovernorTest, ValidateAndUpdate_StallThresholdRange) {
+  GovernorPolicy policy;
+  policy.io_some_avg10_pct = 120.0;
+  auto result = governor_.validate_and_update(policy);
+  EXPECT_FALSE(result.success);
+  ASSERT_EQ(result.errors.size(), 1u);
+  EXPECT_EQ(result.errors[0].field, "io_some_avg10_pct");
+}
+
+TEST_F(ResourceGovernorTest, AdaptiveLimitFollowsLoad) {
+  GovernorPolicy policy;
+  policy.max_running_jobs = 16;
+  policy.adaptive_concurrency = true;
+  governor_.update_policy(policy);
+  EXPECT_EQ(governor_.running_limit(), 1);
+
+  // Slow start: the limit doubles per cooldown_ms while it is in use and
+  // the CPU has room, up to max_running_jobs.
+  SystemMetrics light{20.0, {1000, 500, 500}, 0};
+  uint64_t now_ms = 0;
+  for (int expected : {1, 2, 4, 8, 16, 16}) {
+    governor_.observe(light, governor_.running_limit(), now_ms);
+    EXPECT_EQ(governor_.running_limit(), expected);
+    now_ms += 1000;
+  }
+  EXPECT_EQ(governor_.decide(light, 16, 0).reason, BlockReason::RUNNING_LIMIT);
+
+  // Overload cuts it by a quarter once the average passes target + band,
+  // and not again within cooldown_ms.
+  SystemMetrics heavy{100.0, {1000, 500, 500}, 0};
+  while (governor_.running_limit() == 16) {
+    governor_.observe(heavy, 16, now_ms);
+    now_ms += 500;
+    ASSERT_LT(now_ms, 60000u);
+  }
+  EXPECT_EQ(governor_.running_limit(), 12);
+  EXPECT_GT(governor_.concurrency().cpu_ewma, 85.0);
+  EXPECT_FALSE(governor_.concurrency().slow_start);
+  governor_.observe(heavy, 12, now_ms);
+  EXPECT_EQ(governor_.running_limit(), 12);
+
+  // Once the average is back inside the band the limit holds.
+  SystemMetrics on_target{75.0, {1000, 500, 500}, 0};
+  for (int i = 0; i < 20; ++i) {
+    governor_.observe(on_target, 16, now_ms);
+    now_ms += 500;
+  }
+  int settled = governor_.running_limit();
+  for (int i = 0; i < 40; ++i) {
+    governor_.observe(on_target, 16, now_ms);
+    now_ms += 500;
+  }
+  EXPECT_EQ(governor_.running_limit(), settled);
+
+  // Past slow start it grows by one, and only while jobs are held back.
+  for (int i = 0; i < 20; ++i) {
+    governor_.observe(light, 0, now_ms);
+    now_ms += 500;
+  }
+  EXPECT_EQ(governor_.running_limit(), settled);
+  governor_.observe(light, settled, now_ms);
+  EXPECT_EQ(governor_.running_limit(), settled + 1);
+}
+
+TEST_F(ResourceGovernorTest, AdaptiveLimitBacksOffOnStalls) {
+  GovernorPolicy policy;
+  policy.max_running_jobs = 8;
+  policy.adaptive_concurrency = true;
+  policy.adaptive_min_running_jobs = 2;
+  governor_.update_policy(policy);
+
+  SystemMetrics stalled{20.0, {1000, 500, 500}, 0};
+  stalled.pressure_available = true;
+  stalled.io_pressure.some_avg10 = 50.0;
+  uint64_t now_ms = 0;
+  for (int i = 0; i < 100; ++i) {
+    governor_.observe(stalled, 8, now_ms);
+    now_ms += 500;
+  }
+  EXPECT_EQ(governor_.running_limit(), 2);
+  EXPECT_EQ(governor_.concurrency().increases, 0u);
+  EXPECT_GT(governor_.concurrency().stall_ewma, 20.0);
+
+  // Turning the controller off puts max_running_jobs back in force.
+  policy.adaptive_concurrency = false;
+  governor_.update_policy(policy);
+  EXPECT_EQ(governor_.running_limit(), 8);
+}
+
+TEST_F(ResourceGovernorTest, ValidateAndUpdate_AdaptiveMinAboveMax) {
+  GovernorPolicy policy;
+  policy.max_running_jobs = 4;
+  policy.adaptive_min_running_jobs = 5;
+  auto result = governor_.validate_and_update(policy);
+  EXPECT_FALSE(result.success);
+  ASSERT_EQ(result.errors.size(), 1u);
+  EXPECT_EQ(result.errors[0].field, "adaptive_min_running_jobs");
+}
+
+} // namespace heidi
@@ -18,5 +18,12 @@ TEST(IpcProtocolTest, DeserializePong) {
   EXPECT_EQ(msg.type, "pong");
 }
 
+TEST(IpcProtocolTest, DeserializeKeepsBodyAfterRequestLine) {
+  IpcMessage msg = IpcProtocol::deserialize("job batch 2\ntrue\nfalse\n");
+  EXPECT_EQ(msg.type, "job batch 2");
+  EXPECT_EQ(msg.body, "true\nfalse\n");
+  EXPECT_TRUE(IpcProtocol::deserialize("ping").body.empty());
+}
+
 } // namespace
 } // namespace heidi
\ No newline at end of file
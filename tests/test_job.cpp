@@ -1,13 +1,17 @@
+#include "heidi-kernel/group_policy_store.h"
 #include "heidi-kernel/job.h"
 #include "heidi-kernel/metrics.h"
 #include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/process_spawner.h"
 // Include the procfs starttime helper for a small unit test below.
 #include "../src/job/procfs_starttime.h"
 
 #include <chrono>
 #include <gtest/gtest.h>
+#include <span>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace heidi {
 
@@ -33,9 +37,35 @@ public:
   }
 
   int count_processes_in_pgid(pid_t pgid) override {
+    counts_asked_++;
     auto it = counts_.find(pgid);
     return it != counts_.end() ? it->second : 0;
   }
+  void snapshot() override {
+    snapshots_++;
+  }
+  void track(pid_t pgid) override {
+    tracked_[pgid] = true;
+  }
+  void untrack(pid_t pgid) override {
+    tracked_[pgid] = false;
+  }
+  int spawn_count(pid_t pgid) override {
+    auto it = spawns_.find(pgid);
+    return it != spawns_.end() ? it->second : -1;
+  }
+  size_t read_events(std::vector<pid_t>* grown) override {
+    size_t n = grown_.size();
+    grown->insert(grown->end(), grown_.begin(), grown_.end());
+    grown_.clear();
+    return n;
+  }
+
+  int snapshots_ = 0;
+  int counts_asked_ = 0;
+  std::unordered_map<pid_t, bool> tracked_;
+  std::unordered_map<pid_t, int> spawns_;
+  std::vector<pid_t> grown_;
 
 private:
   std::unordered_map<pid_t, int> counts_;
@@ -77,6 +107,24 @@ TEST_F(JobTest, GetJobStatusAfterSubmit) {
               job->status == heidi::JobStatus::STARTING);
 }
 
+TEST_F(JobTest, SubmitSpecCopiesExecSettings) {
+  JobSpec spec;
+  spec.exec_mode = ExecMode::DIRECT;
+  spec.argv = {"printf", "%s\n", "a b"};
+  spec.env = {"HK_TEST=1"};
+  spec.cwd = "/tmp";
+  std::string job_id = job_runner_->submit_job(spec);
+
+  auto job = job_runner_->get_job_status(job_id);
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->exec_mode, ExecMode::DIRECT);
+  EXPECT_EQ(job->argv, spec.argv);
+  EXPECT_EQ(job->env, spec.env);
+  EXPECT_EQ(job->cwd, "/tmp");
+  // DIRECT jobs get a display command built from argv.
+  EXPECT_EQ(job->command, "printf %s\n a b");
+}
+
 TEST_F(JobTest, JobCompletesSuccessfully) {
   std::string job_id = job_runner_->submit_job("echo hello");
 
@@ -189,6 +237,434 @@ TEST_F(JobTest, Determinism_RepeatedTicksSameInputsSameOutputs) {
   EXPECT_EQ(diag1.last_tick_now_ms, diag2.last_tick_now_ms);
 }
 
+TEST_F(JobTest, StatusCountersFollowTransitions) {
+  std::string a = job_runner_->submit_job("sleep 10");
+  std::string b = job_runner_->submit_job("sleep 10");
+  std::string c = job_runner_->submit_job("sleep 10");
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 3u);
+
+  job_runner_->cancel_job(b);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 2u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::CANCELLED), 1u);
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 0u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 2u);
+  EXPECT_EQ(job_runner_->get_last_tick_diagnostics().last_tick_queued, 2);
+  EXPECT_EQ(job_runner_->get_job_status(b)->status, JobStatus::CANCELLED);
+
+  // Past max_runtime_ms both time out.
+  job_runner_->tick(700000, metrics);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 0u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::TIMEOUT), 2u);
+  EXPECT_EQ(job_runner_->get_job_status(a)->status, JobStatus::TIMEOUT);
+  EXPECT_EQ(job_runner_->get_job_status(c)->status, JobStatus::TIMEOUT);
+}
+
+TEST_F(JobTest, LimitScanRotatesThroughRunningJobs) {
+  heidi::JobLimits limits;
+  limits.max_child_processes = 1;
+  std::vector<std::string> ids;
+  for (int i = 0; i < 5; ++i)
+    ids.push_back(job_runner_->submit_job("sleep 10", limits));
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 5, 0);
+  ASSERT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 5u);
+
+  for (const auto& id : ids)
+    inspector_->set_process_count(job_runner_->get_job_status(id)->process_group, 2);
+
+  // Two scans per tick: every job is reached, none twice.
+  job_runner_->tick(10, metrics, 5, 2);
+  EXPECT_EQ(job_runner_->get_jobs_scanned_this_tick(), 2u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::PROC_LIMIT), 2u);
+  job_runner_->tick(20, metrics, 5, 2);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::PROC_LIMIT), 4u);
+  job_runner_->tick(30, metrics, 5, 2);
+  EXPECT_EQ(job_runner_->get_jobs_scanned_this_tick(), 1u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::PROC_LIMIT), 5u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 0u);
+}
+
+TEST_F(JobTest, SpawnRateOverLimitEndsJob) {
+  heidi::JobLimits limits;
+  limits.max_spawns_per_window = 30;
+  std::string fast = job_runner_->submit_job("sleep 10", limits);
+  std::string slow = job_runner_->submit_job("sleep 10", limits);
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics);
+  pid_t fast_pg = job_runner_->get_job_status(fast)->process_group;
+  pid_t slow_pg = job_runner_->get_job_status(slow)->process_group;
+  EXPECT_TRUE(inspector_->tracked_[fast_pg]);
+
+  inspector_->spawns_[fast_pg] = 31;
+  inspector_->spawns_[slow_pg] = 30;
+  job_runner_->tick(500, metrics);
+  EXPECT_EQ(job_runner_->get_job_status(fast)->status, JobStatus::PROC_LIMIT);
+  EXPECT_EQ(job_runner_->get_job_status(slow)->status, JobStatus::RUNNING);
+  // Finished jobs are no longer followed.
+  EXPECT_FALSE(inspector_->tracked_[fast_pg]);
+  EXPECT_TRUE(inspector_->tracked_[slow_pg]);
+}
+
+TEST_F(JobTest, GrownProcessTreesAreCheckedOutsideTheScan) {
+  heidi::JobLimits limits;
+  limits.max_child_processes = 2;
+  std::string a = job_runner_->submit_job("sleep 10", limits);
+  std::string b = job_runner_->submit_job("sleep 10", limits);
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 5, 0);
+  pid_t a_pg = job_runner_->get_job_status(a)->process_group;
+  pid_t b_pg = job_runner_->get_job_status(b)->process_group;
+  inspector_->set_process_count(a_pg, 3);
+  inspector_->set_process_count(b_pg, 3);
+
+  // No limit scans this tick: only the job whose tree was reported grown is
+  // looked at.
+  inspector_->grown_.push_back(b_pg);
+  job_runner_->tick(500, metrics, 5, 0);
+  EXPECT_EQ(job_runner_->get_job_status(a)->status, JobStatus::RUNNING);
+  EXPECT_EQ(job_runner_->get_job_status(b)->status, JobStatus::PROC_LIMIT);
+}
+
+TEST_F(JobTest, LimitScanSnapshotsProcessesOncePerTick) {
+  for (int i = 0; i < 5; ++i)
+    job_runner_->submit_job("sleep 10");
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 5, 10);
+  ASSERT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 5u);
+  EXPECT_EQ(inspector_->snapshots_, 1);
+  EXPECT_EQ(inspector_->counts_asked_, 5);
+
+  job_runner_->tick(1000, metrics, 5, 10);
+  EXPECT_EQ(inspector_->snapshots_, 2);
+  EXPECT_EQ(inspector_->counts_asked_, 10);
+}
+
+TEST_F(JobTest, RecentJobsAreNewestFirst) {
+  std::vector<std::string> ids;
+  for (int i = 0; i < 5; ++i)
+    ids.push_back(job_runner_->submit_job("sleep 10"));
+
+  auto jobs = job_runner_->get_recent_jobs(3);
+  ASSERT_EQ(jobs.size(), 3u);
+  EXPECT_EQ(jobs[0]->id, ids[4]);
+  EXPECT_EQ(jobs[1]->id, ids[3]);
+  EXPECT_EQ(jobs[2]->id, ids[2]);
+
+  std::shared_ptr<Job> out[8];
+  EXPECT_EQ(job_runner_->get_recent_jobs(std::span<std::shared_ptr<Job>>(out)), 5u);
+  EXPECT_EQ(out[4]->id, ids[0]);
+  EXPECT_EQ(out[5], nullptr);
+}
+
+TEST_F(JobTest, JobsSincePagesInSubmissionOrder) {
+  std::vector<std::string> ids;
+  for (int i = 0; i < 5; ++i)
+    ids.push_back(job_runner_->submit_job("sleep 10"));
+
+  auto page = job_runner_->get_jobs_since(0, 2);
+  ASSERT_EQ(page.size(), 2u);
+  EXPECT_EQ(page[0]->id, ids[0]);
+  EXPECT_EQ(page[1]->id, ids[1]);
+
+  page = job_runner_->get_jobs_since(page.back()->seq, 2);
+  ASSERT_EQ(page.size(), 2u);
+  EXPECT_EQ(page[0]->id, ids[2]);
+  EXPECT_EQ(page[1]->id, ids[3]);
+
+  page = job_runner_->get_jobs_since(page.back()->seq, 2);
+  ASSERT_EQ(page.size(), 1u);
+  EXPECT_EQ(page[0]->id, ids[4]);
+  EXPECT_TRUE(job_runner_->get_jobs_since(page.back()->seq, 2).empty());
+
+  // New jobs show up after the last cursor.
+  uint64_t cursor = page.back()->seq;
+  std::string later = job_runner_->submit_job("sleep 10");
+  page = job_runner_->get_jobs_since(cursor, 10);
+  ASSERT_EQ(page.size(), 1u);
+  EXPECT_EQ(page[0]->id, later);
+}
+
+TEST_F(JobTest, SubmitNacksAtMaxQueueDepth) {
+  GovernorPolicy policy;
+  policy.max_queue_depth = 2;
+  job_runner_->set_governor_policy(policy);
+
+  std::string a = job_runner_->submit_job("sleep 10");
+  std::string b = job_runner_->submit_job("sleep 10");
+  EXPECT_FALSE(a.empty());
+  EXPECT_FALSE(b.empty());
+  EXPECT_TRUE(job_runner_->submit_job("sleep 10").empty());
+  EXPECT_EQ(job_runner_->get_jobs_rejected(), 1u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 2u);
+
+  // A full queue still starts jobs, which makes room again.
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 2u);
+  std::string c = job_runner_->submit_job("sleep 10");
+  EXPECT_FALSE(c.empty());
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 1u);
+}
+
+TEST_F(JobTest, SubmitJobsAllOrNothingRespectsQueueDepth) {
+  GovernorPolicy policy;
+  policy.max_queue_depth = 5;
+  job_runner_->set_governor_policy(policy);
+  job_runner_->submit_job("sleep 10");
+
+  std::vector<JobSpec> specs(4);
+  for (size_t i = 0; i < specs.size(); ++i)
+    specs[i].command = "echo " + std::to_string(i);
+  BatchSubmission batch = job_runner_->submit_jobs(specs);
+  EXPECT_EQ(batch.accepted, 4u);
+  EXPECT_EQ(batch.first_seq, 2u);
+  for (size_t i = 0; i < specs.size(); ++i) {
+    auto job = job_runner_->get_job_status("job_" + std::to_string(batch.first_seq + i));
+    ASSERT_NE(job, nullptr);
+    EXPECT_EQ(job->command, specs[i].command);
+  }
+
+  // One slot left after a cancel: a batch of two is refused whole.
+  job_runner_->cancel_job("job_1");
+  batch = job_runner_->submit_jobs(std::span<const JobSpec>(specs.data(), 2));
+  EXPECT_EQ(batch.accepted, 0u);
+  EXPECT_EQ(job_runner_->get_jobs_rejected(), 2u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 4u);
+}
+
+TEST_F(JobTest, SubmitJobsBestEffortQueuesWhatFits) {
+  GovernorPolicy policy;
+  policy.max_queue_depth = 3;
+  job_runner_->set_governor_policy(policy);
+
+  std::vector<JobSpec> specs(5);
+  for (auto& spec : specs)
+    spec.command = "sleep 10";
+  BatchSubmission batch = job_runner_->submit_jobs(specs, BatchMode::BEST_EFFORT);
+  EXPECT_EQ(batch.accepted, 3u);
+  EXPECT_EQ(batch.first_seq, 1u);
+  EXPECT_EQ(job_runner_->get_jobs_rejected(), 2u);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 3u);
+  EXPECT_EQ(job_runner_->get_recent_jobs(10).size(), 3u);
+  EXPECT_EQ(job_runner_->submit_jobs(specs, BatchMode::BEST_EFFORT).accepted, 0u);
+}
+
+TEST_F(JobTest, GroupsShareStartsByWeight) {
+  ASSERT_TRUE(job_runner_->set_group_share("a", GroupShare{2, 0}));
+  ASSERT_TRUE(job_runner_->set_group_share("b", GroupShare{1, 0}));
+  JobSpec a, b;
+  a.command = b.command = "sleep 10";
+  a.group = "a";
+  b.group = "b";
+  std::vector<std::string> a_ids, b_ids;
+  // All of a's backlog is queued ahead of b's.
+  for (int i = 0; i < 6; ++i)
+    a_ids.push_back(job_runner_->submit_job(a));
+  for (int i = 0; i < 3; ++i)
+    b_ids.push_back(job_runner_->submit_job(b));
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 6);
+  auto status = [&](const std::string& id) { return job_runner_->get_job_status(id)->status; };
+  // Rounds of two from a, one from b.
+  for (int i = 0; i < 4; ++i)
+    EXPECT_EQ(status(a_ids[i]), JobStatus::RUNNING) << i;
+  EXPECT_EQ(status(a_ids[4]), JobStatus::QUEUED);
+  EXPECT_EQ(status(b_ids[0]), JobStatus::RUNNING);
+  EXPECT_EQ(status(b_ids[1]), JobStatus::RUNNING);
+  EXPECT_EQ(status(b_ids[2]), JobStatus::QUEUED);
+  EXPECT_EQ(job_runner_->get_job_status(a_ids[0])->group, "a");
+}
+
+TEST_F(JobTest, GroupRunningCapHoldsOnlyThatGroup) {
+  ASSERT_TRUE(job_runner_->set_group_share("capped", GroupShare{1, 1}));
+  JobSpec capped, other;
+  capped.command = other.command = "sleep 10";
+  capped.group = "capped";
+  std::vector<std::string> capped_ids;
+  for (int i = 0; i < 3; ++i)
+    capped_ids.push_back(job_runner_->submit_job(capped));
+  job_runner_->submit_job(other);
+  job_runner_->submit_job(other);
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 5);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 3u);
+  EXPECT_EQ(job_runner_->get_job_status(capped_ids[0])->status, JobStatus::RUNNING);
+  EXPECT_EQ(job_runner_->get_job_status(capped_ids[1])->status, JobStatus::QUEUED);
+
+  // Raising the cap lets the group's next job start.
+  ASSERT_TRUE(job_runner_->set_group_share("capped", GroupShare{1, 2}));
+  job_runner_->tick(1000, metrics, 5);
+  EXPECT_EQ(job_runner_->get_job_status(capped_ids[1])->status, JobStatus::RUNNING);
+  EXPECT_EQ(job_runner_->get_job_status(capped_ids[2])->status, JobStatus::QUEUED);
+}
+
+TEST_F(JobTest, OverlongGroupIdFallsBackToDefaultGroup) {
+  std::string overlong(gov::kMaxGroupIdLen + 1, 'x');
+  EXPECT_FALSE(job_runner_->set_group_share(overlong, GroupShare{}));
+  JobSpec spec;
+  spec.command = "sleep 10";
+  spec.group = overlong;
+  auto job = job_runner_->get_job_status(job_runner_->submit_job(spec));
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->group, "");
+}
+
+TEST_F(JobTest, HigherPriorityClassesStartFirst) {
+  JobSpec batch, normal, interactive;
+  batch.command = normal.command = interactive.command = "sleep 10";
+  batch.priority = JobPriority::BATCH;
+  interactive.priority = JobPriority::INTERACTIVE;
+  interactive.group = "tenant";
+  std::string batch_id = job_runner_->submit_job(batch);
+  std::string normal_id = job_runner_->submit_job(normal);
+  std::string interactive_id = job_runner_->submit_job(interactive);
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  auto status = [&](const std::string& id) { return job_runner_->get_job_status(id)->status; };
+  job_runner_->tick(0, metrics, 1);
+  EXPECT_EQ(status(interactive_id), JobStatus::RUNNING);
+  EXPECT_EQ(status(normal_id), JobStatus::QUEUED);
+  job_runner_->tick(1000, metrics, 1);
+  EXPECT_EQ(status(normal_id), JobStatus::RUNNING);
+  EXPECT_EQ(status(batch_id), JobStatus::QUEUED);
+  job_runner_->tick(2000, metrics, 1);
+  EXPECT_EQ(status(batch_id), JobStatus::RUNNING);
+}
+
+TEST_F(JobTest, AdaptiveRunningLimitCapsStartsWithinATick) {
+  GovernorPolicy policy;
+  policy.max_running_jobs = 8;
+  policy.min_start_gap_ms = 0;
+  policy.adaptive_concurrency = true;
+  policy.adaptive_min_running_jobs = 2;
+  job_runner_->set_governor_policy(policy);
+  for (int i = 0; i < 12; ++i)
+    job_runner_->submit_job("sleep 10");
+
+  // The limit starts at the minimum and doubles each cooldown_ms while it
+  // holds jobs back and the CPU has room.
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics, 10);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 2u);
+  job_runner_->tick(1000, metrics, 10);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 4u);
+  EXPECT_EQ(job_runner_->get_last_tick_diagnostics().concurrency.limit, 4);
+  job_runner_->tick(2000, metrics, 10);
+  job_runner_->tick(3000, metrics, 10);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::RUNNING), 8u);
+}
+
+TEST_F(JobTest, BackfillStartsOnlyJobsThatDoNotDelayTheBlockedOne) {
+  GovernorPolicy policy;
+  policy.cpu_capacity_millicores = 4000;
+  job_runner_->set_governor_policy(policy);
+
+  JobSpec spec;
+  spec.command = "sleep 10";
+  JobLimits limits;
+  limits.kill_grace_ms = 0;
+  auto submit = [&](uint32_t cpu_millicores, uint64_t max_runtime_ms) {
+    spec.resources.cpu_millicores = cpu_millicores;
+    limits.max_runtime_ms = max_runtime_ms;
+    return job_runner_->submit_job(spec, limits);
+  };
+  std::string running = submit(2000, 10000);
+  // Needs the whole host, so it waits for `running` (10s at most).
+  std::string blocked = submit(4000, 10000);
+  // Fits now, but would still hold CPU when `blocked` could start.
+  std::string long_job = submit(1000, 60000);
+  // Fits now and is gone by then.
+  std::string short_job = submit(1000, 5000);
+  // Declares nothing, so it never waits for capacity.
+  std::string plain = submit(0, 60000);
+
+  heidi::SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  job_runner_->tick(0, metrics);
+  auto status = [&](const std::string& id) { return job_runner_->get_job_status(id)->status; };
+  EXPECT_EQ(status(running), JobStatus::RUNNING);
+  EXPECT_EQ(status(blocked), JobStatus::QUEUED);
+  EXPECT_EQ(status(long_job), JobStatus::QUEUED);
+  EXPECT_EQ(status(short_job), JobStatus::RUNNING);
+  EXPECT_EQ(status(plain), JobStatus::RUNNING);
+  EXPECT_EQ(job_runner_->get_reserved_resources().cpu_millicores, 3000u);
+
+  // Cancelling queued jobs releases nothing; only active jobs reserve.
+  job_runner_->cancel_job(long_job);
+  EXPECT_EQ(job_runner_->get_reserved_resources().cpu_millicores, 3000u);
+}
+
+TEST_F(JobTest, ParseJobPriorityRoundTrips) {
+  for (size_t i = 0; i < kJobPriorityCount; ++i) {
+    JobPriority priority = JobPriority::NORMAL;
+    auto expected = static_cast<JobPriority>(i);
+    EXPECT_TRUE(parse_job_priority(job_priority_name(expected), &priority));
+    EXPECT_EQ(priority, expected);
+  }
+  JobPriority priority = JobPriority::NORMAL;
+  EXPECT_FALSE(parse_job_priority("urgent", &priority));
+  EXPECT_EQ(priority, JobPriority::NORMAL);
+}
+
+TEST_F(JobTest, ConcurrentSubmitsGetDistinctIdsInSeqOrder) {
+  GovernorPolicy policy;
+  policy.max_queue_depth = 10000;
+  job_runner_->set_governor_policy(policy);
+
+  std::vector<std::thread> threads;
+  std::vector<std::vector<std::string>> ids(4);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 500; ++i)
+        ids[t].push_back(job_runner_->submit_job("sleep 10"));
+    });
+  }
+  // Lookups drain the submission queue while submitters are still going.
+  for (int i = 0; i < 50; ++i)
+    job_runner_->get_recent_jobs(1);
+  for (auto& thread : threads)
+    thread.join();
+
+  for (const auto& list : ids) {
+    for (const auto& id : list)
+      ASSERT_NE(job_runner_->get_job_status(id), nullptr) << id;
+  }
+  auto jobs = job_runner_->get_jobs_since(0, 3000);
+  ASSERT_EQ(jobs.size(), 2000u);
+  for (size_t i = 0; i < jobs.size(); ++i)
+    EXPECT_EQ(jobs[i]->seq, i + 1);
+  EXPECT_EQ(job_runner_->count_jobs(JobStatus::QUEUED), 2000u);
+}
+
+TEST(JobRunnerSpawnTest, FailedSpawnFreesItsSlot) {
+  RealProcessSpawner spawner;
+  JobRunner runner(2, &spawner);
+  runner.start();
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+
+  JobSpec missing;
+  missing.exec_mode = ExecMode::DIRECT;
+  missing.argv = {"hk-no-such-program"};
+  std::string first = runner.submit_job(missing);
+  std::string second = runner.submit_job(missing);
+  runner.tick(1000, metrics);
+  EXPECT_EQ(runner.get_job_status(first)->status, JobStatus::FAILED);
+  EXPECT_FALSE(runner.get_job_status(first)->error.empty());
+  EXPECT_EQ(runner.count_jobs(JobStatus::STARTING), 0u);
+  EXPECT_EQ(runner.count_jobs(JobStatus::FAILED), 2u);
+
+  // Both slots are free again.
+  auto next = runner.get_job_status(runner.submit_job("true"));
+  runner.tick(1100, metrics);
+  EXPECT_NE(next->status, JobStatus::QUEUED);
+  EXPECT_EQ(runner.get_job_status(second)->status, JobStatus::FAILED);
+  runner.stop();
+}
+
 } // namespace heidi
 
 TEST(ParseStartTime, HandlesCommWithSpaces) {
@@ -0,0 +1,310 @@
+#include "heidi-kernel/job_archive.h"
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/metrics.h"
+#include "heidi-kernel/process_inspector.h"
+#include "heidi-kernel/resource_governor.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace heidi {
+namespace {
+
+// "Runs" each job instantly: its output is written at spawn and the leader is
+// reported as exited with the status encoded in the command ("exit N").
+class FinishingSpawner : public IProcessSpawner {
+public:
+  bool spawn_job(Job& job, int* stdout_fd, int* stderr_fd) override {
+    job.process_group = next_pgid_++;
+    *stdout_fd = -1;
+    *stderr_fd = -1;
+    std::string out = "out of " + job.id + "\n";
+    std::string err = "err of " + job.id + "\n";
+    append_job_output(job, LogStream::STDOUT, out.data(), out.size());
+    append_job_output(job, LogStream::STDERR, err.data(), err.size());
+    finished_.insert(job.process_group);
+    return true;
+  }
+  bool reap_job(Job& job, int* wait_status) override {
+    if (finished_.erase(job.process_group) == 0)
+      return false;
+    int code = job.command.rfind("exit ", 0) == 0 ? atoi(job.command.c_str() + 5) : 0;
+    *wait_status = code << 8;
+    return true;
+  }
+
+private:
+  pid_t next_pgid_ = 1 << 30;
+  std::unordered_set<pid_t> finished_;
+};
+
+class AliveInspector : public IProcessInspector {
+public:
+  int count_processes_in_pgid(pid_t) override {
+    return 1;
+  }
+};
+
+std::string read_pipe(int fd) {
+  std::string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    out.append(buf, n);
+  return out;
+}
+
+class JobArchiveTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    char tmpl[] = "/tmp/hk_archive_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    dir_ = tmpl;
+    runner_ = make_runner();
+  }
+
+  void TearDown() override {
+    runner_.reset();
+    unlink((dir_ + "/jobs.idx").c_str());
+    unlink((dir_ + "/jobs.log").c_str());
+    rmdir(dir_.c_str());
+  }
+
+  std::unique_ptr<JobRunner> make_runner() {
+    auto runner = std::make_unique<JobRunner>(100, &spawner_, &inspector_);
+    GovernorPolicy policy;
+    policy.max_running_jobs = 100;
+    policy.min_start_gap_ms = 0;
+    runner->set_governor_policy(policy);
+    return runner;
+  }
+
+  // Ticks until every submitted job has finished.
+  void run_all(JobRunner& runner) {
+    SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+    for (int i = 0; i < 100; ++i) {
+      runner.tick(now_ms_, metrics, 100, 100);
+      now_ms_ += 1000;
+      if (runner.count_jobs(JobStatus::QUEUED) == 0 && runner.count_jobs(JobStatus::RUNNING) == 0)
+        return;
+    }
+  }
+
+  FinishingSpawner spawner_;
+  AliveInspector inspector_;
+  std::unique_ptr<JobRunner> runner_;
+  std::string dir_;
+  uint64_t now_ms_ = 1000;
+};
+
+TEST_F(JobArchiveTest, CountLimitEvictsOldestFinishedJobs) {
+  runner_->set_retention_policy(RetentionPolicy{3, 0, 0});
+  std::vector<std::string> ids;
+  for (int i = 0; i < 5; ++i)
+    ids.push_back(runner_->submit_job("exit 0"));
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+
+  EXPECT_EQ(runner_->count_jobs(JobStatus::COMPLETED), 3u);
+  EXPECT_EQ(runner_->get_jobs_evicted(), 2u);
+  // Without an archive the evicted jobs are gone.
+  EXPECT_EQ(runner_->get_job_status(ids[0]), nullptr);
+  EXPECT_EQ(runner_->get_job_status(ids[1]), nullptr);
+  EXPECT_NE(runner_->get_job_status(ids[2]), nullptr);
+  EXPECT_NE(runner_->get_job_status(ids[4]), nullptr);
+}
+
+TEST_F(JobArchiveTest, EvictedJobIsLoadedFromArchive) {
+  ASSERT_TRUE(runner_->enable_job_archive(dir_));
+  runner_->set_retention_policy(RetentionPolicy{1, 0, 0});
+  std::string first = runner_->submit_job("exit 3");
+  run_all(*runner_);
+  std::string second = runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  ASSERT_EQ(runner_->get_jobs_evicted(), 1u);
+  EXPECT_EQ(runner_->count_jobs(JobStatus::FAILED), 0u);
+
+  auto job = runner_->get_job_status(first);
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->id, first);
+  EXPECT_EQ(job->command, "exit 3");
+  EXPECT_EQ(job->status, JobStatus::FAILED);
+  EXPECT_EQ(job->exit_code, 3);
+  EXPECT_EQ(job->stdout_log.str(), "out of " + first + "\n");
+  EXPECT_EQ(job->stderr_log.str(), "err of " + first + "\n");
+  EXPECT_EQ(runner_->get_job_status("job_999"), nullptr);
+}
+
+TEST_F(JobArchiveTest, TailsEvictedJobFromArchive) {
+  ASSERT_TRUE(runner_->enable_job_archive(dir_));
+  runner_->set_retention_policy(RetentionPolicy{1, 0, 0});
+  std::string first = runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  ASSERT_EQ(runner_->get_jobs_evicted(), 1u);
+
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_CLOEXEC), 0);
+  ssize_t n = runner_->send_job_tail(first, LogStream::STDERR, 5, fds[1]);
+  close(fds[1]);
+  std::string tail = read_pipe(fds[0]);
+  close(fds[0]);
+  EXPECT_EQ(n, 5);
+  EXPECT_EQ(tail, ("err of " + first + "\n").substr(first.size() + 3));
+
+  errno = 0;
+  EXPECT_EQ(runner_->send_job_tail("job_999", LogStream::STDOUT, 5, 1), -1);
+  EXPECT_EQ(errno, ENOENT);
+}
+
+TEST_F(JobArchiveTest, AgeLimitEvictsOldJobs) {
+  runner_->set_retention_policy(RetentionPolicy{0, 20, 0});
+  std::string id = runner_->submit_job("exit 0");
+  run_all(*runner_);
+  EXPECT_NE(runner_->get_job_status(id), nullptr);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  EXPECT_EQ(runner_->get_job_status(id), nullptr);
+  EXPECT_EQ(runner_->get_jobs_evicted(), 1u);
+}
+
+TEST_F(JobArchiveTest, LogByteLimitEvictsUntilUnder) {
+  // Each job keeps "out of job_N\n" and "err of job_N\n": 26 bytes.
+  runner_->set_retention_policy(RetentionPolicy{0, 0, 60});
+  for (int i = 0; i < 4; ++i)
+    runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+
+  EXPECT_EQ(runner_->count_jobs(JobStatus::COMPLETED), 2u);
+  EXPECT_EQ(runner_->get_jobs_evicted(), 2u);
+}
+
+TEST_F(JobArchiveTest, ReopenedArchiveResumesNumbering) {
+  ASSERT_TRUE(runner_->enable_job_archive(dir_));
+  runner_->set_retention_policy(RetentionPolicy{1, 0, 0});
+  std::string first = runner_->submit_job("exit 0");
+  runner_->submit_job("exit 0");
+  runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  ASSERT_EQ(runner_->get_jobs_evicted(), 2u);
+
+  // A restarted daemon: fresh runner, same archive.
+  runner_ = make_runner();
+  ASSERT_TRUE(runner_->enable_job_archive(dir_));
+  EXPECT_EQ(runner_->submit_job("exit 0"), "job_3");
+  auto job = runner_->get_job_status(first);
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->status, JobStatus::COMPLETED);
+}
+
+TEST_F(JobArchiveTest, JobsSinceEvictedCursorResumesAtNextRetainedJob) {
+  runner_->set_retention_policy(RetentionPolicy{2, 0, 0});
+  std::vector<std::string> ids;
+  for (int i = 0; i < 4; ++i)
+    ids.push_back(runner_->submit_job("exit 0"));
+  auto page = runner_->get_jobs_since(0, 1);
+  ASSERT_EQ(page.size(), 1u);
+  uint64_t cursor = page[0]->seq;
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  ASSERT_EQ(runner_->get_jobs_evicted(), 2u);
+
+  // Jobs 1 and 2 are gone; the page continues with the oldest retained one.
+  page = runner_->get_jobs_since(cursor, 10);
+  ASSERT_EQ(page.size(), 2u);
+  EXPECT_EQ(page[0]->id, ids[2]);
+  EXPECT_EQ(page[1]->id, ids[3]);
+}
+
+TEST_F(JobArchiveTest, ArchiveByteCapDropsOldestArchivedJobs) {
+  ASSERT_TRUE(runner_->enable_job_archive(dir_));
+  RetentionPolicy retention{1, 0, 0};
+  retention.max_archive_bytes = 1;
+  runner_->set_retention_policy(retention);
+  std::string first = runner_->submit_job("exit 0");
+  run_all(*runner_);
+  std::string second = runner_->submit_job("exit 0");
+  run_all(*runner_);
+  runner_->tick(now_ms_, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  ASSERT_EQ(runner_->get_jobs_evicted(), 1u);
+
+  // Archived, then dropped straight away for being over the cap.
+  EXPECT_EQ(runner_->get_job_status(first), nullptr);
+  EXPECT_NE(runner_->get_job_status(second), nullptr);
+}
+
+TEST_F(JobArchiveTest, ExpireDropsOldestUntilUnderCaps) {
+  auto archive = JobArchive::open(dir_);
+  ASSERT_NE(archive, nullptr);
+  for (uint64_t seq = 1; seq <= 4; ++seq) {
+    Job job;
+    job.seq = seq;
+    job.id = "job_" + std::to_string(seq);
+    job.status = JobStatus::COMPLETED;
+    job.ended_at_ms = seq * 1000;
+    job.stdout_log.reset(0, 100);
+    job.stdout_log.append(std::string(100, 'o'));
+    ASSERT_TRUE(archive->append(job));
+  }
+  ASSERT_EQ(archive->archived_jobs(), 4u);
+  uint64_t per_job = archive->archived_bytes() / 4;
+
+  archive->expire(per_job * 3, 0, 0);
+  EXPECT_EQ(archive->archived_jobs(), 3u);
+  EXPECT_LE(archive->archived_bytes(), per_job * 3);
+  EXPECT_EQ(archive->load(1), nullptr);
+  ASSERT_NE(archive->load(2), nullptr);
+  EXPECT_EQ(archive->load(2)->stdout_log.str(), std::string(100, 'o'));
+
+  // Jobs 2 and 3 ended 2000ms or more before now.
+  archive->expire(0, 2000, 5000);
+  EXPECT_EQ(archive->archived_jobs(), 1u);
+  EXPECT_EQ(archive->load(3), nullptr);
+  ASSERT_NE(archive->load(4), nullptr);
+
+  // Reopening finds only what was kept.
+  archive.reset();
+  archive = JobArchive::open(dir_);
+  ASSERT_NE(archive, nullptr);
+  EXPECT_EQ(archive->archived_jobs(), 1u);
+  EXPECT_EQ(archive->next_seq(), 5u);
+  EXPECT_EQ(archive->archived_bytes(), per_job);
+  ASSERT_NE(archive->load(4), nullptr);
+  EXPECT_EQ(archive->load(4)->stdout_log.str(), std::string(100, 'o'));
+}
+
+TEST_F(JobArchiveTest, LongCommandIsTruncatedInRecord) {
+  auto archive = JobArchive::open(dir_);
+  ASSERT_NE(archive, nullptr);
+  Job job;
+  job.id = "job_7";
+  job.seq = 7;
+  job.command = std::string(1000, 'c');
+  job.status = JobStatus::CANCELLED;
+  ASSERT_TRUE(archive->append(job));
+  EXPECT_EQ(archive->next_seq(), 8u);
+
+  auto loaded = archive->load(7);
+  ASSERT_NE(loaded, nullptr);
+  EXPECT_EQ(loaded->id, "job_7");
+  EXPECT_EQ(loaded->status, JobStatus::CANCELLED);
+  EXPECT_LT(loaded->command.size(), job.command.size());
+  EXPECT_EQ(loaded->command, job.command.substr(0, loaded->command.size()));
+  EXPECT_EQ(archive->load(6), nullptr);
+  EXPECT_EQ(archive->load(8), nullptr);
+}
+
+} // namespace
+} // namespace heidi
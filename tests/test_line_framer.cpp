@@ -0,0 +1,261 @@
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/line_framer.h"
+#include "heidi-kernel/log_ring.h"
+#include "heidi-kernel/log_spool.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+
+namespace heidi {
+namespace {
+
+std::string join(const struct iovec* iov, size_t n) {
+  std::string s;
+  for (size_t i = 0; i < n; ++i)
+    s.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+  return s;
+}
+
+std::string last_lines(const LineFramer& framer, const LogRing& ring, size_t count) {
+  struct iovec iov[LogRing::kMaxIov];
+  return join(iov, framer.tail_lines(ring, count, iov));
+}
+
+TEST(FindNewlineTest, AllScansAgreeWithMemchr) {
+  std::mt19937 rng(42);
+  std::string data(300, 'a');
+  for (auto& c : data)
+    c = static_cast<char>('a' + rng() % 26);
+  std::vector<NewlineScan> scans = {NewlineScan::SCALAR, NewlineScan::AUTO};
+  if (best_newline_scan() != NewlineScan::SCALAR)
+    scans.push_back(NewlineScan::SSE2);
+  if (best_newline_scan() == NewlineScan::AVX2)
+    scans.push_back(NewlineScan::AVX2);
+
+  // Every newline position and length around the vector widths, unaligned.
+  for (size_t off = 0; off < 3; ++off) {
+    for (size_t len = 0; len < 100; ++len) {
+      for (size_t pos = 0; pos <= len; ++pos) {
+        std::string buf = data;
+        if (pos < len)
+          buf[off + pos] = '\n';
+        const void* hit = memchr(buf.data() + off, '\n', len);
+        size_t expected = hit ? static_cast<const char*>(hit) - (buf.data() + off) : len;
+        for (NewlineScan scan : scans)
+          ASSERT_EQ(find_newline(buf.data() + off, len, scan), expected)
+              << "scan=" << static_cast<int>(scan) << " len=" << len << " pos=" << pos;
+      }
+    }
+  }
+}
+
+TEST(LineFramerTest, FramesAcrossChunksAndIndexesLines) {
+  LogRing ring(0, 1024);
+  LineFramer framer(0);
+  std::string data = "alpha\nbeta\ngamma\ndelta";
+  for (char c : data)
+    framer.append(ring, &c, 1);
+
+  EXPECT_EQ(ring.str(), data);
+  EXPECT_EQ(framer.lines(), 4u);
+  EXPECT_EQ(framer.indexed_lines(), 4u);
+  EXPECT_EQ(last_lines(framer, ring, 1), "delta");
+  EXPECT_EQ(last_lines(framer, ring, 2), "gamma\ndelta");
+  EXPECT_EQ(last_lines(framer, ring, 10), data);
+}
+
+TEST(LineFramerTest, CutsLongLinesAtLimit) {
+  LogRing ring(0, 1024);
+  LineFramer framer(4);
+  framer.append(ring, "ok\n0123456789", 13);
+  framer.append(ring, "abcdef\nxy\n", 10);
+
+  EXPECT_EQ(ring.str(), "ok\n0123\nxy\n");
+  EXPECT_EQ(framer.lines(), 3u);
+  EXPECT_EQ(framer.lines_truncated(), 1u);
+  EXPECT_EQ(last_lines(framer, ring, 2), "0123\nxy\n");
+}
+
+TEST(LineFramerTest, OnlyWholeLinesOnceRingDrops) {
+  LogRing ring(6, 16);
+  LineFramer framer(0);
+  std::string data;
+  for (int i = 0; i < 50; ++i)
+    data += "l" + std::to_string(i) + "\n";
+  framer.append(ring, data.data(), data.size());
+
+  // The ring's tail starts mid-line; that partial line is never returned.
+  EXPECT_EQ(last_lines(framer, ring, 1), "l49\n");
+  EXPECT_EQ(last_lines(framer, ring, 3), "l47\nl48\nl49\n");
+  EXPECT_EQ(last_lines(framer, ring, 100), "l46\nl47\nl48\nl49\n");
+  // The index only holds lines the ring still has.
+  EXPECT_LE(framer.indexed_lines(), 2u + 4u);
+}
+
+TEST(LineFramerTest, BoundsIndexAndRescansPastIt) {
+  std::string data;
+  for (int i = 0; i < 5000; ++i)
+    data += std::to_string(i) + "\n";
+  auto suffix_lines = [&](const std::string& text, size_t count) {
+    size_t pos = text.size() - 1;
+    while (count-- > 0 && pos != std::string::npos && pos > 0)
+      pos = text.rfind('\n', pos - 1);
+    return pos == std::string::npos ? text : text.substr(pos + 1);
+  };
+
+  // Everything retained: older lines than the index holds come from a rescan.
+  LogRing ring(100, 64 * 1024);
+  LineFramer framer(0);
+  framer.append(ring, data.data(), data.size());
+  EXPECT_EQ(framer.lines(), 5000u);
+  EXPECT_EQ(framer.indexed_lines(), LineFramer::kMinIndexedLines);
+  EXPECT_EQ(last_lines(framer, ring, 10), suffix_lines(data, 10));
+  EXPECT_EQ(last_lines(framer, ring, 3000), suffix_lines(data, 3000));
+  EXPECT_EQ(last_lines(framer, ring, 10000), data);
+
+  // Dropping: the rescan stops at the first whole line of the tail, for the
+  // ring and the spool alike.
+  auto spool = JobSpool::create("", "job_1", 2 * 8000, 6);
+  ASSERT_TRUE(spool);
+  SpoolStream stream(*spool, LogStream::STDOUT);
+  LogRing small(6, 8000 - 6);
+  LineFramer ring_lines(0, 8000);
+  LineFramer spool_lines(0, 8000);
+  for (size_t off = 0; off < data.size(); off += 1000) {
+    size_t len = std::min<size_t>(1000, data.size() - off);
+    ring_lines.append(small, data.data() + off, len);
+    spool_lines.append(stream, data.data() + off, len);
+  }
+  EXPECT_LE(ring_lines.indexed_lines(), LineFramer::kMinIndexedLines);
+  std::string tail = data.substr(data.size() - (8000 - 6));
+  std::string whole = tail.substr(tail.find('\n') + 1);
+  EXPECT_EQ(last_lines(ring_lines, small, 100000), whole);
+  EXPECT_EQ(last_lines(ring_lines, small, 1500), suffix_lines(data, 1500));
+
+  uint64_t start;
+  ASSERT_TRUE(spool_lines.tail_lines_start(stream, 100000, &start));
+  EXPECT_EQ(start, data.size() - whole.size());
+  ASSERT_TRUE(spool_lines.tail_lines_start(stream, 1500, &start));
+  EXPECT_EQ(start, data.size() - suffix_lines(data, 1500).size());
+}
+
+bool wait_until(const std::function<bool()>& pred, int timeout_ms = 5000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (pred())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return pred();
+}
+
+TEST(JobRunnerLinesTest, EnforcesLineLimitAndTailsLines) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+
+  JobLimits limits;
+  limits.max_output_line_bytes = 8;
+  std::string id = runner.submit_job("printf 'short\\n%0100d\\nlast\\n' 0", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+  auto job = runner.get_job_status(id);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return job->status == JobStatus::COMPLETED && runner.output_reactor().watched_fds() == 0;
+  }));
+  EXPECT_EQ(job->stdout_log.str(), "short\n00000000\nlast\n");
+  EXPECT_EQ(job->stdout_lines.lines_truncated(), 1u);
+
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv), 0);
+  EXPECT_EQ(runner.send_job_tail_lines(id, LogStream::STDOUT, 2, sv[0]), 14);
+  close(sv[0]);
+  char buf[32] = {};
+  EXPECT_EQ(read(sv[1], buf, sizeof(buf)), 14);
+  close(sv[1]);
+  EXPECT_EQ(std::string(buf), "00000000\nlast\n");
+  runner.stop();
+}
+
+TEST(JobRunnerLinesTest, FramesSpooledOutput) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+  ASSERT_TRUE(runner.enable_log_spool());
+
+  JobLimits limits;
+  limits.max_output_line_bytes = 8;
+  std::string id = runner.submit_job("printf 'short\\n%0100d\\nlast\\n' 0", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+  auto job = runner.get_job_status(id);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return job->status == JobStatus::COMPLETED && runner.output_reactor().watched_fds() == 0;
+  }));
+  ASSERT_TRUE(job->spool);
+  EXPECT_EQ(job->spool->read(LogStream::STDOUT), "short\n00000000\nlast\n");
+  EXPECT_EQ(job->stdout_lines.lines_truncated(), 1u);
+  EXPECT_EQ(job->bytes_written, 20u);
+
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv), 0);
+  EXPECT_EQ(runner.send_job_tail_lines(id, LogStream::STDOUT, 2, sv[0]), 14);
+  close(sv[0]);
+  char buf[32] = {};
+  EXPECT_EQ(read(sv[1], buf, sizeof(buf)), 14);
+  close(sv[1]);
+  EXPECT_EQ(std::string(buf), "00000000\nlast\n");
+  runner.stop();
+}
+
+TEST(LineFramerTest, SpoolTailLinesMatchRing) {
+  // Same layout on both sides: stdout gets half the spool, a 64 byte head.
+  auto spool = JobSpool::create("", "job_1", 2 * 512, 64);
+  ASSERT_TRUE(spool);
+  SpoolStream stream(*spool, LogStream::STDOUT);
+  LogRing ring(64, 512 - 64);
+  LineFramer spooled(16);
+  LineFramer framed(16);
+
+  std::mt19937 rng(7);
+  for (int i = 0; i < 200; ++i) {
+    std::string chunk = "line " + std::to_string(i) + std::string(rng() % 24, 'x');
+    if (rng() % 3 != 0)
+      chunk += '\n';
+    spooled.append(stream, chunk.data(), chunk.size());
+    framed.append(ring, chunk.data(), chunk.size());
+  }
+  ASSERT_GT(ring.dropped(), 0u);
+  EXPECT_EQ(spool->dropped(LogStream::STDOUT), ring.dropped());
+  EXPECT_EQ(spooled.lines(), framed.lines());
+
+  for (size_t count : {1u, 5u, 40u}) {
+    uint64_t start;
+    ASSERT_TRUE(spooled.tail_lines_start(stream, count, &start));
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ssize_t sent = spool->send_from(fds[1], LogStream::STDOUT, start);
+    close(fds[1]);
+    std::string got(sent > 0 ? sent : 0, '\0');
+    EXPECT_EQ(read(fds[0], got.data(), got.size()), sent);
+    close(fds[0]);
+
+    struct iovec iov[LogRing::kMaxIov];
+    EXPECT_EQ(got, join(iov, framed.tail_lines(ring, count, iov))) << count;
+  }
+}
+
+} // namespace
+} // namespace heidi
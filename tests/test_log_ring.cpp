@@ -0,0 +1,95 @@
+#include "heidi-kernel/log_ring.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/uio.h>
+
+namespace heidi {
+namespace {
+
+std::string numbers(int count) {
+  std::string s;
+  for (int i = 0; i < count; ++i)
+    s += std::to_string(i) + "\n";
+  return s;
+}
+
+TEST(LogRingTest, KeepsEverythingUnderCapacity) {
+  LogRing ring(16, 64);
+  ring.append("hello ");
+  ring.append("world\n");
+  EXPECT_EQ(ring.size(), 12u);
+  EXPECT_EQ(ring.dropped(), 0u);
+  EXPECT_EQ(ring.str(), "hello world\n");
+  EXPECT_EQ(ring.str(6), "world\n");
+}
+
+TEST(LogRingTest, KeepsHeadAndNewestTailWithMarker) {
+  LogRing ring(10, 20);
+  std::string data = numbers(100);
+  // Uneven chunks so appends straddle the head and the ring's wrap point.
+  for (size_t off = 0; off < data.size(); off += 7)
+    ring.append(data.substr(off, 7));
+
+  EXPECT_EQ(ring.total(), data.size());
+  EXPECT_EQ(ring.size(), 30u);
+  EXPECT_EQ(ring.dropped(), data.size() - 30);
+  std::string marker = "\n[" + std::to_string(data.size() - 30) + " bytes dropped]\n";
+  EXPECT_EQ(ring.str(), data.substr(0, 10) + marker + data.substr(data.size() - 20));
+}
+
+TEST(LogRingTest, AppendLargerThanTail) {
+  LogRing ring(0, 8);
+  ring.append("abc");
+  ring.append("0123456789ABCDEF");
+  EXPECT_EQ(ring.str(8), "89ABCDEF");
+  ring.append("xy");
+  EXPECT_EQ(ring.str(8), "ABCDEFxy");
+}
+
+TEST(LogRingTest, TailViewIsBoundedAndPointsIntoRing) {
+  LogRing ring(4, 8);
+  ring.append("HEAD");
+  ring.append("01234");
+  ring.append("56789"); // Ring wraps: holds "23456789"
+  struct iovec iov[LogRing::kMaxIov];
+
+  size_t n = ring.tail_iov(5, iov);
+  std::string got;
+  for (size_t i = 0; i < n; ++i)
+    got.append(static_cast<char*>(iov[i].iov_base), iov[i].iov_len);
+  EXPECT_EQ(got, "56789");
+
+  // Whole view: head, marker and the two halves of the wrapped ring.
+  n = ring.iov(iov);
+  EXPECT_EQ(n, 4u);
+  EXPECT_EQ(std::string(static_cast<char*>(iov[0].iov_base), iov[0].iov_len), "HEAD");
+  EXPECT_EQ(std::string(static_cast<char*>(iov[1].iov_base), iov[1].iov_len),
+            "\n[2 bytes dropped]\n");
+  EXPECT_EQ(ring.str(), "HEAD\n[2 bytes dropped]\n23456789");
+}
+
+TEST(LogRingTest, StopsAllocatingOnceFull) {
+  LogRing ring(4, 16);
+  ring.append(std::string(64, 'a'));
+  struct iovec before[LogRing::kMaxIov];
+  size_t n = ring.iov(before);
+  ring.append(std::string(1000, 'b'));
+  struct iovec after[LogRing::kMaxIov];
+  ASSERT_EQ(ring.iov(after), n);
+  EXPECT_EQ(after[0].iov_base, before[0].iov_base);
+  EXPECT_EQ(after[n - 1].iov_base, before[n - 1].iov_base);
+  EXPECT_EQ(ring.size(), 20u);
+}
+
+TEST(LogRingTest, ResetDropsContent) {
+  LogRing ring(4, 4);
+  ring.append("0123456789");
+  ring.reset(2, 2);
+  EXPECT_TRUE(ring.empty());
+  ring.append("abcdef");
+  EXPECT_EQ(ring.str(), "ab\n[2 bytes dropped]\nef");
+}
+
+} // namespace
+} // namespace heidi
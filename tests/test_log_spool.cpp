@@ -0,0 +1,197 @@
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/log_spool.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace heidi {
+namespace {
+
+bool wait_until(const std::function<bool()>& pred, int timeout_ms = 5000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (pred())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return pred();
+}
+
+void spool_bytes(JobSpool& spool, LogStream stream, const std::string& data) {
+  spool.append(stream, data.data(), data.size());
+}
+
+// Reads everything send_tail() writes into a pipe.
+std::string tail_of(const JobSpool& spool, LogStream stream, uint64_t max_bytes) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return "";
+  fcntl(fds[1], F_SETPIPE_SZ, 1024 * 1024);
+  ssize_t n = spool.send_tail(fds[1], stream, max_bytes);
+  close(fds[1]);
+  std::string out;
+  char buf[4096];
+  ssize_t r;
+  while ((r = read(fds[0], buf, sizeof(buf))) > 0)
+    out.append(buf, r);
+  close(fds[0]);
+  EXPECT_EQ(n, static_cast<ssize_t>(out.size()));
+  return out;
+}
+
+class LogSpoolTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    char tmpl[] = "/tmp/heidi_spool_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    dir_ = tmpl;
+  }
+
+  void TearDown() override {
+    rmdir(dir_.c_str());
+  }
+
+  std::string dir_;
+};
+
+TEST_F(LogSpoolTest, KeepsNewestBytesInOrderAfterWrap) {
+  auto spool = JobSpool::create(dir_, "job_1", 2000); // 1000 bytes per stream
+  ASSERT_NE(spool, nullptr);
+  struct stat st;
+  EXPECT_EQ(stat((dir_ + "/job_1.out").c_str(), &st), 0);
+
+  std::string data;
+  for (int i = 0; data.size() < 3500; ++i)
+    data += std::to_string(i) + "\n";
+  spool_bytes(*spool, LogStream::STDOUT, data);
+
+  EXPECT_EQ(spool->total(LogStream::STDOUT), data.size());
+  EXPECT_EQ(spool->size(LogStream::STDOUT), 1000u);
+  EXPECT_TRUE(spool->truncated());
+  EXPECT_EQ(spool->dropped(LogStream::STDOUT), data.size() - 1000);
+  std::string marker = "\n[" + std::to_string(data.size() - 1000) + " bytes dropped]\n";
+  EXPECT_EQ(spool->read(LogStream::STDOUT), marker + data.substr(data.size() - 1000));
+  EXPECT_EQ(spool->read(LogStream::STDERR), "");
+
+  spool.reset();
+  EXPECT_NE(stat((dir_ + "/job_1.out").c_str(), &st), 0);
+}
+
+TEST_F(LogSpoolTest, SendsTailAcrossWrap) {
+  auto spool = JobSpool::create(dir_, "job_2", 2048);
+  ASSERT_NE(spool, nullptr);
+  std::string data;
+  for (int i = 0; i < 1500; ++i)
+    data += static_cast<char>('a' + i % 26);
+  spool_bytes(*spool, LogStream::STDERR, data);
+
+  EXPECT_EQ(tail_of(*spool, LogStream::STDERR, 100), data.substr(data.size() - 100));
+  EXPECT_EQ(tail_of(*spool, LogStream::STDERR, 1 << 20),
+            "\n[476 bytes dropped]\n" + data.substr(data.size() - 1024));
+  EXPECT_EQ(tail_of(*spool, LogStream::STDOUT, 100), "");
+}
+
+TEST_F(LogSpoolTest, KeepsHeadAndMarksWhatWasDropped) {
+  // 1000 bytes per stream: a 100-byte head and a 900-byte tail.
+  auto spool = JobSpool::create(dir_, "job_4", 2000, 100);
+  ASSERT_NE(spool, nullptr);
+  std::string data = "error: first thing that went wrong\n";
+  while (data.size() < 5000)
+    data += "line " + std::to_string(data.size()) + "\n";
+  // In small pieces, so appends wrap the tail more than once.
+  for (size_t off = 0; off < data.size(); off += 333)
+    spool_bytes(*spool, LogStream::STDOUT, data.substr(off, 333));
+
+  EXPECT_EQ(spool->total(LogStream::STDOUT), data.size());
+  EXPECT_EQ(spool->size(LogStream::STDOUT), 1000u);
+  std::string marker = "\n[" + std::to_string(data.size() - 1000) + " bytes dropped]\n";
+  std::string view = data.substr(0, 100) + marker + data.substr(data.size() - 900);
+  EXPECT_EQ(spool->read(LogStream::STDOUT), view);
+  EXPECT_EQ(tail_of(*spool, LogStream::STDOUT, 1 << 20), view);
+  // The newest bytes cut into the marker, as LogRing's view does.
+  EXPECT_EQ(tail_of(*spool, LogStream::STDOUT, 905), view.substr(view.size() - 905));
+  EXPECT_EQ(tail_of(*spool, LogStream::STDOUT, 50), data.substr(data.size() - 50));
+
+  // Short of the head, nothing is dropped and there is no marker.
+  auto small = JobSpool::create(dir_, "job_5", 2000, 100);
+  spool_bytes(*small, LogStream::STDERR, data.substr(0, 150));
+  EXPECT_EQ(small->read(LogStream::STDERR), data.substr(0, 150));
+  EXPECT_FALSE(small->truncated());
+}
+
+TEST(LogSpoolMemfdTest, WorksWithoutDirectory) {
+  auto spool = JobSpool::create("", "job_3", 4096);
+  ASSERT_NE(spool, nullptr);
+  spool_bytes(*spool, LogStream::STDOUT, "hello\n");
+  EXPECT_EQ(spool->read(LogStream::STDOUT), "hello\n");
+  EXPECT_EQ(spool->retained(), 6u);
+  EXPECT_FALSE(spool->truncated());
+}
+
+TEST_F(LogSpoolTest, RunnerSpoolsJobOutput) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  ASSERT_TRUE(runner.enable_log_spool(dir_));
+  runner.start();
+
+  JobLimits limits;
+  limits.max_log_bytes = 64 * 1024;
+  std::string id = runner.submit_job("seq 1 100000; echo oops >&2", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+
+  auto job = runner.get_job_status(id);
+  ASSERT_NE(job, nullptr);
+  ASSERT_NE(job->spool, nullptr);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return job->status == JobStatus::COMPLETED && runner.output_reactor().watched_fds() == 0;
+  }));
+
+  // Nothing was copied into daemon memory.
+  EXPECT_TRUE(job->stdout_log.empty());
+  EXPECT_TRUE(job->stderr_log.empty());
+  EXPECT_TRUE(job->log_truncated);
+  EXPECT_EQ(job->bytes_written, job->spool->retained());
+  EXPECT_EQ(job->spool->read(LogStream::STDERR), "oops\n");
+
+  // Status reports the spool's counts.
+  JobSnapshot snapshot;
+  ASSERT_TRUE(runner.get_job_snapshot(id, &snapshot));
+  EXPECT_EQ(snapshot.status, JobStatus::COMPLETED);
+  EXPECT_EQ(snapshot.bytes_written, job->spool->retained());
+  EXPECT_EQ(snapshot.log_dropped, job->spool->dropped(LogStream::STDOUT));
+  EXPECT_GT(snapshot.log_dropped, 0u);
+  EXPECT_EQ(snapshot.lines, 100001u);
+  EXPECT_FALSE(runner.get_job_snapshot("nope", &snapshot));
+  auto listed = runner.get_recent_job_snapshots(10);
+  ASSERT_EQ(listed.size(), 1u);
+  EXPECT_EQ(listed[0].id, id);
+  EXPECT_EQ(listed[0].status, JobStatus::COMPLETED);
+
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_CLOEXEC), 0);
+  EXPECT_EQ(runner.send_job_tail(id, LogStream::STDOUT, 7, fds[1]), 7);
+  close(fds[1]);
+  char buf[16] = {};
+  EXPECT_EQ(read(fds[0], buf, sizeof(buf)), 7);
+  close(fds[0]);
+  EXPECT_EQ(std::string(buf), "100000\n");
+
+  errno = 0;
+  EXPECT_EQ(runner.send_job_tail("nope", LogStream::STDOUT, 7, 1), -1);
+  EXPECT_EQ(errno, ENOENT);
+  runner.stop();
+}
+
+} // namespace
+} // namespace heidi
@@ -22,5 +22,50 @@ TEST(MetricsSamplerTest, SampleMem) {
   EXPECT_LE(metrics.mem.free, metrics.mem.total);
 }
 
+TEST(MetricsSamplerTest, ParsePressure) {
+  PressureStats stats;
+  ASSERT_TRUE(parse_pressure("some avg10=1.25 avg60=0.50 avg300=0.10 total=123456\n"
+                             "full avg10=0.75 avg60=0.25 avg300=0.05 total=65432\n",
+                             &stats));
+  EXPECT_DOUBLE_EQ(stats.some_avg10, 1.25);
+  EXPECT_DOUBLE_EQ(stats.full_avg10, 0.75);
+
+  // System-wide CPU pressure has no full line on older kernels.
+  PressureStats cpu;
+  ASSERT_TRUE(parse_pressure("some avg10=3.00 avg60=0.00 avg300=0.00 total=0\n", &cpu));
+  EXPECT_DOUBLE_EQ(cpu.some_avg10, 3.0);
+  EXPECT_DOUBLE_EQ(cpu.full_avg10, 0.0);
+
+  EXPECT_FALSE(parse_pressure("", &stats));
+  EXPECT_FALSE(parse_pressure("avg10=1.00\n", &stats));
+}
+
+TEST(MetricsSamplerTest, PressurePaths) {
+  EXPECT_EQ(pressure_path("", PressureResource::MEMORY), "/proc/pressure/memory");
+  EXPECT_EQ(pressure_path("/sys/fs/cgroup/jobs", PressureResource::IO),
+            "/sys/fs/cgroup/jobs/io.pressure");
+}
+
+TEST(MetricsSamplerTest, MissingCgroupFallsBackToSystemPressure) {
+  MetricsSampler system_wide;
+  MetricsSampler cgroup("/nonexistent-cgroup");
+  EXPECT_EQ(cgroup.sample().pressure_available, system_wide.sample().pressure_available);
+}
+
+TEST(PressureTriggersTest, RejectsBadTriggers) {
+  PressureTriggers triggers;
+  EXPECT_FALSE(triggers.add("", PressureResource::MEMORY, true, 0, 1000000));
+  EXPECT_FALSE(triggers.add("/nonexistent-cgroup", PressureResource::MEMORY, true, 100000,
+                            1000000));
+  EXPECT_TRUE(triggers.triggers().empty());
+
+  // Where the kernel takes the trigger, its fd is one poll() can wait on.
+  if (triggers.add("", PressureResource::MEMORY, true, 100000, 1000000)) {
+    ASSERT_EQ(triggers.triggers().size(), 1u);
+    EXPECT_GE(triggers.triggers()[0].fd, 0);
+    EXPECT_DOUBLE_EQ(triggers.triggers()[0].stall_pct, 10.0);
+  }
+}
+
 } // namespace
 } // namespace heidi
\ No newline at end of file
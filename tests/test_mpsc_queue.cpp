@@ -0,0 +1,139 @@
+#include "heidi-kernel/mpsc_queue.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace heidi {
+namespace {
+
+TEST(MpscQueueTest, PopsInPushOrder) {
+  MpscQueue<int> queue(4);
+  EXPECT_EQ(queue.capacity(), 4u);
+  int value;
+  EXPECT_FALSE(queue.try_pop(value));
+  for (int i = 0; i < 3; ++i)
+    EXPECT_TRUE(queue.try_push(i));
+  EXPECT_EQ(queue.size_approx(), 3u);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(queue.try_pop(value));
+  EXPECT_EQ(queue.size_approx(), 0u);
+}
+
+TEST(MpscQueueTest, FullQueueRefusesUntilPopped) {
+  MpscQueue<int> queue(3); // Rounded up to 4
+  EXPECT_EQ(queue.capacity(), 4u);
+  for (int i = 0; i < 4; ++i)
+    EXPECT_TRUE(queue.try_push(i));
+  EXPECT_FALSE(queue.try_push(4));
+
+  int value;
+  ASSERT_TRUE(queue.try_pop(value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(queue.try_push(4));
+  for (int i = 1; i <= 4; ++i) {
+    ASSERT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+}
+
+TEST(MpscQueueTest, TicketsCountSuccessfulPushes) {
+  MpscQueue<uint64_t> queue(2);
+  std::vector<uint64_t> tickets;
+  auto push = [&] {
+    return queue.try_push_with([&](uint64_t ticket) {
+      tickets.push_back(ticket);
+      return ticket;
+    });
+  };
+  uint64_t value;
+  for (int lap = 0; lap < 3; ++lap) {
+    EXPECT_TRUE(push());
+    EXPECT_TRUE(push());
+    EXPECT_FALSE(push()); // make is not called for a refused push
+    ASSERT_TRUE(queue.try_pop(value));
+    ASSERT_TRUE(queue.try_pop(value));
+  }
+  EXPECT_EQ(tickets, (std::vector<uint64_t>{0, 1, 2, 3, 4, 5}));
+}
+
+TEST(MpscQueueTest, BulkPushClaimsContiguousTickets) {
+  MpscQueue<uint64_t> queue(8);
+  auto identity = [](uint64_t ticket) { return ticket; };
+  EXPECT_TRUE(queue.try_push(100)); // ticket 0
+  EXPECT_EQ(queue.try_push_n_with(3, 3, identity), 3u);
+  // Four cells left: all-or-nothing for five fails, best effort takes four.
+  EXPECT_EQ(queue.try_push_n_with(5, 5, identity), 0u);
+  EXPECT_EQ(queue.try_push_n_with(1, 5, identity), 4u);
+  EXPECT_EQ(queue.try_push_n_with(1, 1, identity), 0u);
+
+  uint64_t value;
+  ASSERT_TRUE(queue.try_pop(value));
+  EXPECT_EQ(value, 100u);
+  for (uint64_t ticket = 1; ticket < 8; ++ticket) {
+    ASSERT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, ticket);
+  }
+  // Wraps around the ring.
+  EXPECT_EQ(queue.try_push_n_with(6, 6, identity), 6u);
+  for (uint64_t ticket = 8; ticket < 14; ++ticket) {
+    ASSERT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, ticket);
+  }
+}
+
+TEST(MpscQueueTest, PoppedValuesAreReleased) {
+  MpscQueue<std::shared_ptr<int>> queue(2);
+  auto value = std::make_shared<int>(1);
+  EXPECT_TRUE(queue.try_push(value));
+  EXPECT_EQ(value.use_count(), 2);
+  std::shared_ptr<int> out;
+  ASSERT_TRUE(queue.try_pop(out));
+  out.reset();
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(MpscQueueTest, ManyProducersDeliverEachValueOnceInProducerOrder) {
+  constexpr int kProducers = 8;
+  constexpr int kPerProducer = 20000;
+  MpscQueue<uint64_t> queue(64);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p] {
+      for (int i = 0; i < kPerProducer;) {
+        if (queue.try_push(static_cast<uint64_t>(p) << 32 | i))
+          ++i;
+        else
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  uint64_t value;
+  while (received < kProducers * kPerProducer) {
+    if (!queue.try_pop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int p = value >> 32;
+    int i = value & 0xffffffff;
+    ASSERT_LT(p, kProducers);
+    ASSERT_EQ(i, next[p]);
+    next[p]++;
+    received++;
+  }
+  for (auto& producer : producers)
+    producer.join();
+  EXPECT_FALSE(queue.try_pop(value));
+}
+
+} // namespace
+} // namespace heidi
@@ -0,0 +1,481 @@
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/output_reactor.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace heidi {
+namespace {
+
+bool wait_until(const std::function<bool()>& pred, int timeout_ms = 5000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (pred())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return pred();
+}
+
+// The state letter from /proc/<pid>/stat, or '?' if it cannot be read.
+char process_state(pid_t pid) {
+  std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+  std::string line;
+  if (!std::getline(stat, line))
+    return '?';
+  size_t paren = line.rfind(')');
+  return paren != std::string::npos && paren + 2 < line.size() ? line[paren + 2] : '?';
+}
+
+// A Job whose stdout is the read end of a fresh pipe; returns the write end.
+int make_piped_job(std::shared_ptr<Job>& job) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return -1;
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  job = std::make_shared<Job>();
+  init_job_logs(*job);
+  job->stdout_fd = fds[0];
+  return fds[1];
+}
+
+void write_all(int fd, const std::string& data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = write(fd, data.data() + off, data.size() - off);
+    if (n <= 0)
+      return;
+    off += n;
+  }
+}
+
+class OutputReactorTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    ASSERT_TRUE(reactor_.start());
+  }
+
+  size_t output_size(const std::shared_ptr<Job>& job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return job->stdout_log.size();
+  }
+
+  std::mutex mutex_;
+  OutputReactor reactor_{mutex_};
+};
+
+TEST_F(OutputReactorTest, DrainsWriterWithoutTicks) {
+  std::shared_ptr<Job> job;
+  int w = make_piped_job(job);
+  ASSERT_GE(w, 0);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ASSERT_TRUE(reactor_.watch(job));
+  }
+  EXPECT_EQ(job->stdout_fd, -1);
+  EXPECT_EQ(reactor_.watched_fds(), 1u);
+
+  // Far more than a pipe holds; a blocking writer only finishes if the
+  // reactor keeps draining.
+  std::string data(4 * 1024 * 1024, 'x');
+  for (size_t i = 63; i < data.size(); i += 64)
+    data[i] = '\n';
+  std::thread writer([&] {
+    write_all(w, data);
+    close(w);
+  });
+  writer.join();
+
+  ASSERT_TRUE(wait_until([&] { return reactor_.watched_fds() == 0; }));
+  EXPECT_EQ(output_size(job), data.size());
+  EXPECT_EQ(job->bytes_written, data.size());
+  EXPECT_EQ(reactor_.bytes_read(), data.size());
+}
+
+TEST_F(OutputReactorTest, AppliesLogCapWhileReading) {
+  std::shared_ptr<Job> job;
+  int w = make_piped_job(job);
+  ASSERT_GE(w, 0);
+  job->max_log_bytes = 64 * 1024;
+  job->log_head_bytes = 4 * 1024;
+  init_job_logs(*job);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    reactor_.watch(job);
+  }
+
+  std::string data;
+  for (int i = 0; data.size() < 1024 * 1024; ++i)
+    data += std::to_string(i) + "\n";
+  std::thread writer([&] {
+    write_all(w, data);
+    close(w);
+  });
+  writer.join();
+
+  ASSERT_TRUE(wait_until([&] { return reactor_.watched_fds() == 0; }));
+  std::unique_lock<std::mutex> lock(mutex_);
+  EXPECT_TRUE(job->log_truncated);
+  EXPECT_LE(job->stdout_log.size() + job->stderr_log.size(), job->max_log_bytes);
+  // The first and the newest bytes are the ones kept, around a marker.
+  std::string dropped = std::to_string(data.size() - job->stdout_log.size());
+  EXPECT_EQ(job->stdout_log.str(), data.substr(0, 4096) + "\n[" + dropped + " bytes dropped]\n" +
+                                       data.substr(data.size() - (32 * 1024 - 4096)));
+}
+
+TEST_F(OutputReactorTest, GrowsPipeThatFillsUp) {
+  std::shared_ptr<Job> job;
+  int w = make_piped_job(job);
+  ASSERT_GE(w, 0);
+  int initial = fcntl(w, F_GETPIPE_SZ);
+  ASSERT_GT(initial, 0);
+
+  // Fill the pipe completely before the reactor sees it.
+  fcntl(w, F_SETFL, O_NONBLOCK);
+  std::string chunk(4096, 'y');
+  while (write(w, chunk.data(), chunk.size()) > 0) {
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    reactor_.watch(job);
+  }
+
+  ASSERT_TRUE(wait_until([&] { return reactor_.pipe_resizes() >= 1; }));
+  EXPECT_EQ(output_size(job), static_cast<size_t>(initial));
+  EXPECT_GT(fcntl(w, F_GETPIPE_SZ), initial);
+  close(w);
+  ASSERT_TRUE(wait_until([&] { return reactor_.watched_fds() == 0; }));
+}
+
+TEST(OutputReactorExitTest, ReportsLeaderExitThroughPidfd) {
+  std::mutex mutex;
+  OutputReactor reactor(mutex);
+  std::atomic<int> exits{0};
+  std::shared_ptr<Job> exited;
+  reactor.set_exit_handler([&](const std::shared_ptr<Job>& job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    exited = job;
+    exits++;
+  });
+  ASSERT_TRUE(reactor.start());
+
+  RealProcessSpawner spawner;
+  auto job = std::make_shared<Job>();
+  job->command = "sleep 0.05";
+  ASSERT_TRUE(spawner.spawn_job(*job, &job->stdout_fd, &job->stderr_fd));
+  if (job->pidfd < 0)
+    GTEST_SKIP() << "kernel does not provide pidfds";
+  int pidfd = job->pidfd;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(reactor.watch(job));
+  }
+  // The reactor watches its own duplicate; the job keeps its pidfd.
+  EXPECT_EQ(job->pidfd, pidfd);
+
+  ASSERT_TRUE(wait_until([&] { return exits.load() == 1; }));
+  EXPECT_EQ(exited, job);
+  EXPECT_EQ(reactor.exits_seen(), 1u);
+
+  int status = 0;
+  EXPECT_TRUE(spawner.reap_job(*job, &status));
+  close(job->pidfd);
+  ASSERT_TRUE(wait_until([&] { return reactor.watched_fds() == 0; }));
+}
+
+TEST(JobRunnerOutputTest, CapturesOutputBetweenTicks) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+
+  JobLimits limits;
+  limits.max_log_bytes = 8 * 1024 * 1024;
+  std::string id = runner.submit_job("yes xxxxxxx | head -c 1000000", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+
+  // No further ticks: everything must arrive through the reactor.
+  auto job = runner.get_job_status(id);
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->stdout_fd, -1);
+  ASSERT_TRUE(wait_until([&] { return runner.output_reactor().watched_fds() == 0; }));
+  std::string expected;
+  for (int i = 0; i < 125000; ++i)
+    expected += "xxxxxxx\n";
+  EXPECT_EQ(job->stdout_log.str(), expected);
+
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return job->status == JobStatus::COMPLETED;
+  }));
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, TailsInMemoryLogOverSocket) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+
+  JobLimits limits;
+  limits.max_log_bytes = 2048;
+  limits.log_head_bytes = 16;
+  std::string id = runner.submit_job("seq 1 1000", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return runner.get_job_status(id)->status == JobStatus::COMPLETED &&
+           runner.output_reactor().watched_fds() == 0;
+  }));
+
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv), 0);
+  EXPECT_EQ(runner.send_job_tail(id, LogStream::STDOUT, 9, sv[0]), 9);
+  close(sv[0]);
+  char buf[32] = {};
+  EXPECT_EQ(read(sv[1], buf, sizeof(buf)), 9);
+  close(sv[1]);
+  EXPECT_EQ(std::string(buf), "999\n1000\n");
+  EXPECT_TRUE(runner.get_job_status(id)->log_truncated);
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, ExitFreesSlotWithoutTick) {
+  RealProcessSpawner spawner;
+  JobRunner runner(1, &spawner);
+  runner.start();
+
+  std::string first = runner.submit_job("sleep 0.05");
+  std::string second = runner.submit_job("exit 3");
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+
+  auto first_job = runner.get_job_status(first);
+  auto second_job = runner.get_job_status(second);
+  if (first_job->pidfd < 0)
+    GTEST_SKIP() << "kernel does not provide pidfds";
+  EXPECT_EQ(second_job->status, JobStatus::QUEUED);
+
+  // No further ticks: the first exit is reaped through its pidfd, which
+  // starts the second job in the freed slot, whose exit is reaped the same way.
+  ASSERT_TRUE(wait_until([&] { return runner.get_job_status(second)->exit_code == 3; }));
+  EXPECT_EQ(first_job->status, JobStatus::COMPLETED);
+  EXPECT_EQ(first_job->pidfd, -1);
+  EXPECT_EQ(second_job->status, JobStatus::FAILED);
+  EXPECT_EQ(runner.get_jobs_started_out_of_band(), 1u);
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, CancelReturnsAtOnceAndEndsWithGroup) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+
+  std::vector<std::string> ids;
+  for (int i = 0; i < 4; ++i)
+    ids.push_back(runner.submit_job("sleep 30"));
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& id : ids)
+    EXPECT_TRUE(runner.cancel_job(id));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+  EXPECT_EQ(runner.count_jobs(JobStatus::CANCELLED) + runner.count_jobs(JobStatus::TERMINATING),
+            4u);
+
+  // SIGTERM is enough; the jobs end well before the 2s grace period.
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1100, metrics);
+    return runner.count_jobs(JobStatus::CANCELLED) == 4;
+  }));
+  for (const auto& id : ids) {
+    auto job = runner.get_job_status(id);
+    EXPECT_FALSE(job->kill_sent);
+    EXPECT_EQ(job->pidfd, -1);
+  }
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, TerminationEscalatesAfterKillGrace) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.start();
+
+  JobLimits limits;
+  limits.kill_grace_ms = 500;
+  std::string id = runner.submit_job("trap '' TERM; echo ready; sleep 30", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+  auto job = runner.get_job_status(id);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1000, metrics);
+    return job->stdout_log.str() == "ready\n";
+  }));
+
+  ASSERT_TRUE(runner.cancel_job(id));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  runner.tick(1100, metrics);
+  EXPECT_EQ(job->status, JobStatus::TERMINATING);
+  EXPECT_FALSE(job->kill_sent);
+
+  // Past the grace period (on the tick clock) the group gets SIGKILL.
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(5000, metrics);
+    return job->status == JobStatus::CANCELLED;
+  }));
+  EXPECT_TRUE(job->kill_sent);
+  EXPECT_EQ(job->ended_at_ms, 5000u);
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, TimerFdEnforcesRuntimeWithoutTicks) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.set_timer_fd_enabled(true);
+  runner.start();
+  if (!runner.output_reactor().has_timer())
+    GTEST_SKIP() << "timerfd not available";
+
+  JobSpec spec;
+  spec.exec_mode = ExecMode::DIRECT;
+  spec.argv = {"sleep", "30"};
+  JobLimits limits;
+  limits.max_runtime_ms = 100;
+  std::string id = runner.submit_job(spec, limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  auto start = std::chrono::steady_clock::now();
+  runner.tick(1000, metrics);
+  auto job = runner.get_job_status(id);
+  if (job->pidfd < 0)
+    GTEST_SKIP() << "kernel does not provide pidfds";
+
+  // No further ticks: the timerfd sends SIGTERM and the pidfd reports the
+  // exit of the (only) process.
+  ASSERT_TRUE(wait_until([&] { return job->status == JobStatus::TIMEOUT; }));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+  EXPECT_FALSE(job->kill_sent);
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, TimerFdEscalatesWithoutTicks) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  runner.set_timer_fd_enabled(true);
+  runner.start();
+  if (!runner.output_reactor().has_timer())
+    GTEST_SKIP() << "timerfd not available";
+
+  JobLimits limits;
+  limits.kill_grace_ms = 100;
+  std::string id = runner.submit_job("trap '' TERM; echo ready; sleep 30", limits);
+  SystemMetrics metrics{10.0, {1000, 100, 400}, 0};
+  runner.tick(1000, metrics);
+  auto job = runner.get_job_status(id);
+  ASSERT_TRUE(wait_until([&] { return job->stdout_log.str() == "ready\n"; }));
+
+  ASSERT_TRUE(runner.cancel_job(id));
+  EXPECT_FALSE(job->kill_sent);
+  ASSERT_TRUE(wait_until([&] { return job->kill_sent; }));
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, PreemptionSuspendsLowerClassUntilPressureClears) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  GovernorPolicy policy;
+  policy.min_start_gap_ms = 0;
+  policy.cooldown_ms = 1000;
+  policy.preempt_on_pressure = true;
+  runner.set_governor_policy(policy);
+  runner.start();
+
+  JobSpec batch, interactive;
+  batch.exec_mode = interactive.exec_mode = ExecMode::DIRECT;
+  batch.argv = interactive.argv = {"sleep", "30"};
+  batch.priority = JobPriority::BATCH;
+  interactive.priority = JobPriority::INTERACTIVE;
+  JobLimits limits;
+  limits.max_runtime_ms = 2000;
+  SystemMetrics calm{10.0, {1000, 100, 400}, 0};
+  SystemMetrics busy{95.0, {1000, 100, 400}, 0};
+  auto job = runner.get_job_status(runner.submit_job(batch, limits));
+  runner.tick(1000, calm);
+  ASSERT_EQ(job->status, JobStatus::RUNNING);
+
+  // Pressure with a more important job waiting: the batch job is frozen,
+  // and the interactive job is still held.
+  auto waiting = runner.get_job_status(runner.submit_job(interactive));
+  runner.tick(1500, busy);
+  EXPECT_EQ(job->status, JobStatus::SUSPENDED);
+  EXPECT_EQ(waiting->status, JobStatus::QUEUED);
+  EXPECT_EQ(runner.get_jobs_preempted(), 1u);
+  EXPECT_TRUE(wait_until([&] { return process_state(job->process_group) == 'T'; }));
+
+  // Pressure clears: the interactive job starts, the batch job stays frozen
+  // through the cooldown and does not run down its runtime limit.
+  runner.tick(2000, calm);
+  EXPECT_EQ(waiting->status, JobStatus::RUNNING);
+  EXPECT_EQ(job->status, JobStatus::SUSPENDED);
+  runner.tick(2500, calm);
+  EXPECT_EQ(job->status, JobStatus::RUNNING);
+  EXPECT_EQ(job->suspended_ms, 1000u);
+  EXPECT_TRUE(wait_until([&] { return process_state(job->process_group) != 'T'; }));
+  runner.tick(3500, calm);
+  EXPECT_EQ(job->status, JobStatus::RUNNING);
+  runner.tick(4100, calm);
+  EXPECT_EQ(job->end_status, JobStatus::TIMEOUT);
+
+  runner.cancel_job(waiting->id);
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(4200, calm);
+    return job_status_is_final(job->status) && job_status_is_final(waiting->status);
+  }));
+  runner.stop();
+}
+
+TEST(JobRunnerOutputTest, CancelEndsSuspendedJob) {
+  RealProcessSpawner spawner;
+  JobRunner runner(4, &spawner);
+  GovernorPolicy policy;
+  policy.min_start_gap_ms = 0;
+  policy.preempt_on_pressure = true;
+  runner.set_governor_policy(policy);
+  runner.start();
+
+  JobSpec batch, normal;
+  batch.exec_mode = normal.exec_mode = ExecMode::DIRECT;
+  batch.argv = normal.argv = {"sleep", "30"};
+  batch.priority = JobPriority::BATCH;
+  auto job = runner.get_job_status(runner.submit_job(batch));
+  auto other = runner.get_job_status(runner.submit_job(normal));
+  runner.tick(1000, SystemMetrics{10.0, {1000, 100, 400}, 0});
+  runner.tick(1100, SystemMetrics{10.0, {1000, 20, 50}, 0});
+  // Memory pressure alone protects the running normal job.
+  ASSERT_EQ(job->status, JobStatus::SUSPENDED);
+  EXPECT_EQ(other->status, JobStatus::RUNNING);
+
+  // The stopped group is continued so it acts on SIGTERM; no SIGKILL needed.
+  ASSERT_TRUE(runner.cancel_job(job->id));
+  ASSERT_TRUE(runner.cancel_job(other->id));
+  ASSERT_TRUE(wait_until([&] {
+    runner.tick(1200, SystemMetrics{10.0, {1000, 20, 50}, 0});
+    return job->status == JobStatus::CANCELLED && other->status == JobStatus::CANCELLED;
+  }));
+  EXPECT_FALSE(job->kill_sent);
+  runner.stop();
+}
+
+} // namespace
+} // namespace heidi
@@ -0,0 +1,241 @@
+#include "heidi-kernel/proc_events.h"
+#include "heidi-kernel/proc_snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace heidi {
+namespace {
+
+TEST(ProcessTreeTest, CountsDescendantsWhereverTheyMove) {
+  ProcessTree tree;
+  tree.add_root(100);
+  EXPECT_EQ(tree.live(100), 1);
+  EXPECT_EQ(tree.on_fork(100, 101, 0), 100);
+  // 101 may have left the group; its children still count.
+  EXPECT_EQ(tree.on_fork(101, 102, 0), 100);
+  EXPECT_EQ(tree.on_fork(1, 500, 0), 0);
+  EXPECT_EQ(tree.live(100), 3);
+  EXPECT_EQ(tree.live(500), -1);
+
+  EXPECT_EQ(tree.on_exit(101), 100);
+  EXPECT_EQ(tree.on_exit(500), 0);
+  EXPECT_EQ(tree.live(100), 2);
+  EXPECT_EQ(tree.pids(), 2u);
+}
+
+TEST(ProcessTreeTest, SpawnWindowSlides) {
+  ProcessTree tree;
+  tree.add_root(100);
+  for (pid_t pid = 101; pid <= 105; ++pid)
+    tree.on_fork(100, pid, 200);
+  for (pid_t pid = 106; pid <= 108; ++pid)
+    tree.on_fork(100, pid, 9500);
+  EXPECT_EQ(tree.spawns(100, 9999), 8);
+  // The first second's spawns leave the window as the eleventh begins.
+  EXPECT_EQ(tree.spawns(100, 10000), 3);
+  EXPECT_EQ(tree.spawns(100, 19600), 0);
+  // Exits do not give spawns back.
+  tree.on_exit(108);
+  EXPECT_EQ(tree.spawns(100, 10000), 3);
+  EXPECT_EQ(tree.spawns(999, 0), -1);
+}
+
+TEST(ProcessTreeTest, RemovedTreeLeftoversDoNotTouchItsSuccessor) {
+  ProcessTree tree;
+  tree.add_root(100);
+  tree.on_fork(100, 101, 0);
+  tree.remove_root(100);
+  EXPECT_EQ(tree.live(100), -1);
+
+  // A new job's leader reuses the pgid while 101 lives on.
+  tree.add_root(100);
+  EXPECT_EQ(tree.on_fork(101, 102, 0), 0);
+  EXPECT_EQ(tree.on_exit(101), 0);
+  EXPECT_EQ(tree.live(100), 1);
+  EXPECT_EQ(tree.roots(), 1u);
+}
+
+TEST(ProcessTreeTest, ResyncDropsTheDeadAndAdoptsGroupMembers) {
+  char tmpl[] = "/tmp/hk_fake_proc_XXXXXX";
+  std::string root = mkdtemp(tmpl);
+  for (pid_t pid : {100, 103}) {
+    fs::create_directories(root + "/" + std::to_string(pid));
+    std::ofstream(root + "/" + std::to_string(pid) + "/stat")
+        << pid << " (sh) S 1 100 100 0 -1 0 0 0 0 0 0 0 0 0 20 0 1 0 " << 1000 + pid << " 0\n";
+  }
+  ProcSnapshot snapshot(root);
+  ASSERT_TRUE(snapshot.refresh());
+
+  ProcessTree tree;
+  tree.add_root(100);
+  tree.on_fork(100, 101, 0);
+  tree.on_fork(100, 102, 0); // Moved to its own session; not in the snapshot.
+  EXPECT_EQ(tree.resync(snapshot, [](pid_t pid) { return pid != 101; }), 1u);
+  // 100 and 102 kept, 103 adopted from the group.
+  EXPECT_EQ(tree.live(100), 3);
+  EXPECT_EQ(tree.on_exit(103), 100);
+  fs::remove_all(root);
+}
+
+// Appends one connector message carrying ev, as the kernel frames it.
+void append_event(std::vector<char>& buf, const proc_event& ev) {
+  size_t len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(ev));
+  size_t at = buf.size();
+  buf.resize(at + NLMSG_ALIGN(len));
+  auto* nl = reinterpret_cast<nlmsghdr*>(buf.data() + at);
+  nl->nlmsg_len = len;
+  nl->nlmsg_type = NLMSG_DONE;
+  auto* cn = static_cast<cn_msg*>(NLMSG_DATA(nl));
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(ev);
+  memcpy(cn->data, &ev, sizeof(ev));
+}
+
+proc_event fork_event(pid_t parent, pid_t child_tgid, pid_t child_pid, uint64_t ms) {
+  proc_event ev{};
+  ev.what = static_cast<decltype(ev.what)>(0x00000001);
+  ev.timestamp_ns = ms * 1000000;
+  ev.event_data.fork.parent_pid = parent;
+  ev.event_data.fork.parent_tgid = parent;
+  ev.event_data.fork.child_pid = child_pid;
+  ev.event_data.fork.child_tgid = child_tgid;
+  return ev;
+}
+
+proc_event exit_event(pid_t tgid, pid_t pid) {
+  proc_event ev{};
+  ev.what = static_cast<decltype(ev.what)>(0x80000000);
+  ev.event_data.exit.process_pid = pid;
+  ev.event_data.exit.process_tgid = tgid;
+  return ev;
+}
+
+TEST(ParseProcEventsTest, AppliesProcessForksAndExits) {
+  // Buffers from recv() are suitably aligned; so is a vector's.
+  std::vector<char> buf;
+  buf.reserve(4096);
+  append_event(buf, fork_event(100, 101, 101, 5));
+  append_event(buf, fork_event(100, 100, 150, 5)); // A thread of 100.
+  append_event(buf, fork_event(101, 102, 102, 6));
+  append_event(buf, fork_event(7, 300, 300, 6)); // Not ours.
+  append_event(buf, fork_event(200, 201, 201, 7));
+  append_event(buf, exit_event(101, 160)); // A thread of 101.
+  append_event(buf, exit_event(102, 102));
+
+  ProcessTree tree;
+  tree.add_root(100);
+  tree.add_root(200);
+  std::vector<pid_t> grown;
+  EXPECT_EQ(parse_proc_events(buf.data(), buf.size(), tree, &grown), 5u);
+  EXPECT_EQ(tree.live(100), 2);
+  EXPECT_EQ(tree.spawns(100, 10), 2);
+  EXPECT_EQ(tree.live(200), 2);
+  // One entry per run of events for the same tree.
+  EXPECT_EQ(grown, (std::vector<pid_t>{100, 200}));
+
+  // A truncated message is ignored.
+  std::vector<pid_t> none;
+  EXPECT_EQ(parse_proc_events(buf.data(), 20, tree, &none), 0u);
+  EXPECT_TRUE(none.empty());
+}
+
+TEST(ProcEventInspectorTest, FallsBackToProcfsUntilOpened) {
+  char tmpl[] = "/tmp/hk_fake_proc_XXXXXX";
+  std::string root = mkdtemp(tmpl);
+  for (pid_t pid : {100, 101}) {
+    fs::create_directories(root + "/" + std::to_string(pid));
+    std::ofstream(root + "/" + std::to_string(pid) + "/stat")
+        << pid << " (sh) S 1 100 100 0 -1 0 0 0 0 0 0 0 0 0 20 0 1 0 " << 1000 + pid << " 0\n";
+  }
+  ProcEventInspector inspector(root);
+  EXPECT_FALSE(inspector.connected());
+  EXPECT_EQ(inspector.event_fd(), -1);
+  inspector.track(100);
+  inspector.snapshot();
+  EXPECT_EQ(inspector.count_processes_in_pgid(100), 2);
+  EXPECT_EQ(inspector.spawn_count(100), -1);
+  std::vector<pid_t> grown;
+  EXPECT_EQ(inspector.read_events(&grown), 0u);
+  fs::remove_all(root);
+}
+
+// Needs CAP_NET_ADMIN in the initial namespaces; skipped elsewhere.
+TEST(ProcEventInspectorTest, FollowsProcessesThatLeaveTheGroup) {
+  ProcEventInspector inspector;
+  if (!inspector.open())
+    GTEST_SKIP() << "process events connector unavailable";
+
+  int ready[2];
+  ASSERT_EQ(pipe(ready), 0);
+  pid_t leader = fork();
+  ASSERT_GE(leader, 0);
+  if (leader == 0) {
+    setpgid(0, 0);
+    if (fork() == 0) {
+      // Reported only once it has left the group.
+      setsid();
+      pid_t self = getpid();
+      (void)!write(ready[1], &self, sizeof(self));
+      pause();
+      _exit(0);
+    }
+    pause();
+    _exit(0);
+  }
+  inspector.track(leader);
+  pid_t escaped = -1;
+  ASSERT_EQ(read(ready[0], &escaped, sizeof(escaped)), static_cast<ssize_t>(sizeof(escaped)));
+  close(ready[0]);
+  close(ready[1]);
+
+  auto read_until = [&](auto done) {
+    std::vector<pid_t> grown;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!done() && std::chrono::steady_clock::now() < deadline) {
+      struct pollfd pfd{inspector.event_fd(), POLLIN, 0};
+      poll(&pfd, 1, 100);
+      inspector.read_events(&grown);
+    }
+    return grown;
+  };
+  std::vector<pid_t> grown =
+      read_until([&] { return inspector.count_processes_in_pgid(leader) >= 2; });
+  EXPECT_EQ(inspector.count_processes_in_pgid(leader), 2);
+  EXPECT_EQ(inspector.spawn_count(leader), 1);
+  EXPECT_NE(std::find(grown.begin(), grown.end(), leader), grown.end());
+
+  // With the leader gone its group is empty, but the escaped process, in a
+  // session of its own, still counts.
+  kill(leader, SIGKILL);
+  waitpid(leader, nullptr, 0);
+  read_until([&] { return inspector.count_processes_in_pgid(leader) <= 1; });
+  EXPECT_EQ(inspector.count_processes_in_pgid(leader), 1);
+  EXPECT_NE(getpgid(escaped), leader);
+
+  kill(escaped, SIGKILL);
+  read_until([&] { return inspector.count_processes_in_pgid(leader) == 0; });
+  EXPECT_EQ(inspector.count_processes_in_pgid(leader), 0);
+  inspector.untrack(leader);
+}
+
+} // namespace
+} // namespace heidi
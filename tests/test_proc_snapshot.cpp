@@ -0,0 +1,127 @@
+#include "heidi-kernel/proc_snapshot.h"
+#include "heidi-kernel/process_inspector.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace heidi {
+namespace {
+
+// A procfs lookalike: <root>/<pid>/stat with the fields the snapshot reads.
+class FakeProc {
+public:
+  FakeProc() {
+    char tmpl[] = "/tmp/hk_fake_proc_XXXXXX";
+    root_ = mkdtemp(tmpl);
+  }
+  ~FakeProc() {
+    fs::remove_all(root_);
+  }
+
+  void add(pid_t pid, pid_t pgrp, uint64_t start_time, const std::string& comm = "sleep") {
+    fs::create_directories(root_ + "/" + std::to_string(pid));
+    std::ofstream stat(root_ + "/" + std::to_string(pid) + "/stat");
+    // pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt
+    // majflt cmajflt utime stime cutime cstime priority nice num_threads
+    // itrealvalue starttime vsize ...
+    stat << pid << " (" << comm << ") S 1 " << pgrp << " " << pgrp
+         << " 0 -1 4194304 100 0 0 0 1 2 0 0 20 0 1 0 " << start_time << " 1000 10\n";
+  }
+  void remove(pid_t pid) {
+    fs::remove_all(root_ + "/" + std::to_string(pid));
+  }
+  const std::string& root() const {
+    return root_;
+  }
+
+private:
+  std::string root_;
+};
+
+TEST(ProcSnapshotTest, GroupsProcessesByPgid) {
+  FakeProc proc;
+  proc.add(100, 100, 5000);
+  proc.add(101, 100, 5001, "worker (1)");
+  proc.add(102, 100, 5002);
+  proc.add(200, 200, 6000);
+  proc.add(301, 300, 7001); // Leader already gone.
+  fs::create_directories(proc.root() + "/self");
+
+  ProcSnapshot snapshot(proc.root());
+  ASSERT_TRUE(snapshot.refresh());
+  EXPECT_EQ(snapshot.size(), 5u);
+  EXPECT_EQ(snapshot.count(100), 3);
+  EXPECT_EQ(snapshot.count(200), 1);
+  EXPECT_EQ(snapshot.count(999), 0);
+  auto pids = snapshot.pids(100);
+  ASSERT_EQ(pids.size(), 3u);
+  EXPECT_EQ(pids[0], 100);
+  EXPECT_EQ(pids[2], 102);
+  EXPECT_EQ(snapshot.leader_start_time(100), 5000u);
+  EXPECT_EQ(snapshot.count(300), 1);
+  EXPECT_FALSE(snapshot.leader_start_time(300).has_value());
+}
+
+TEST(ProcSnapshotTest, RefreshSeesProcessesComeAndGo) {
+  FakeProc proc;
+  proc.add(100, 100, 5000);
+  proc.add(101, 100, 5001);
+  ProcSnapshot snapshot(proc.root());
+  ASSERT_TRUE(snapshot.refresh());
+  EXPECT_EQ(snapshot.count(100), 2);
+
+  proc.remove(101);
+  proc.add(400, 400, 9000);
+  ASSERT_TRUE(snapshot.refresh());
+  EXPECT_EQ(snapshot.count(100), 1);
+  EXPECT_EQ(snapshot.count(400), 1);
+  EXPECT_EQ(snapshot.size(), 2u);
+}
+
+TEST(ProcSnapshotTest, UnreadableRootIsInvalid) {
+  ProcSnapshot snapshot("/nonexistent-proc");
+  EXPECT_FALSE(snapshot.refresh());
+  EXPECT_FALSE(snapshot.valid());
+  EXPECT_EQ(snapshot.count(1), 0);
+
+  ProcfsProcessInspector inspector("/nonexistent-proc");
+  EXPECT_EQ(inspector.count_processes_in_pgid(1), -1);
+}
+
+TEST(ProcSnapshotTest, SeesOwnProcessGroup) {
+  ProcSnapshot snapshot;
+  ASSERT_TRUE(snapshot.refresh());
+  EXPECT_GE(snapshot.count(getpgrp()), 1);
+  bool found = false;
+  for (pid_t pid : snapshot.pids(getpgrp()))
+    found |= pid == getpid();
+  EXPECT_TRUE(found);
+}
+
+TEST(ProcSnapshotTest, InspectorAnswersFromItsLastSnapshot) {
+  FakeProc proc;
+  proc.add(100, 100, 5000);
+  ProcfsProcessInspector inspector(proc.root());
+  // Before any snapshot() each count looks afresh.
+  EXPECT_EQ(inspector.count_processes_in_pgid(100), 1);
+  EXPECT_FALSE(inspector.leader_start_time(100).has_value());
+  proc.add(101, 100, 5001);
+  EXPECT_EQ(inspector.count_processes_in_pgid(100), 2);
+
+  inspector.snapshot();
+  EXPECT_EQ(inspector.leader_start_time(100), 5000u);
+  proc.add(102, 100, 5002);
+  EXPECT_EQ(inspector.count_processes_in_pgid(100), 2);
+  inspector.snapshot();
+  EXPECT_EQ(inspector.count_processes_in_pgid(100), 3);
+}
+
+} // namespace
+} // namespace heidi
@@ -0,0 +1,268 @@
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/process_spawner.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace heidi {
+namespace {
+
+std::string read_all(int fd) {
+  std::string out;
+  char buf[4096];
+  for (;;) {
+    struct pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, 2000) <= 0)
+      break;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    out.append(buf, n);
+  }
+  return out;
+}
+
+void close_job_fds(Job& job, int out_fd, int err_fd) {
+  for (int fd : {out_fd, err_fd, job.pidfd})
+    if (fd >= 0)
+      close(fd);
+}
+
+int wait_exit_code(pid_t pid) {
+  int status = 0;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+class ProcessSpawnerTest : public ::testing::TestWithParam<SpawnBackend> {};
+
+TEST_P(ProcessSpawnerTest, CapturesOutputInOwnProcessGroup) {
+  RealProcessSpawner spawner(GetParam());
+  Job job;
+  job.command = "echo out; echo err 1>&2; exit 3";
+
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd));
+  ASSERT_GT(job.process_group, 0);
+  EXPECT_EQ(getpgid(job.process_group), job.process_group);
+
+  EXPECT_EQ(read_all(out_fd), "out\n");
+  EXPECT_EQ(read_all(err_fd), "err\n");
+
+  int status = 0;
+  ASSERT_EQ(waitpid(job.process_group, &status, 0), job.process_group);
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 3);
+
+  close(out_fd);
+  close(err_fd);
+  if (job.pidfd >= 0)
+    close(job.pidfd);
+}
+
+TEST_P(ProcessSpawnerTest, PipeEndsDoNotLeakIntoLaterJobs) {
+  RealProcessSpawner spawner(GetParam());
+  Job first;
+  first.command = "sleep 0.2";
+  int first_out = -1, first_err = -1;
+  ASSERT_TRUE(spawner.spawn_job(first, &first_out, &first_err));
+
+  // Spawned while the first job is alive. If it inherited the first job's
+  // write ends, the first pipe would not reach EOF until this one exits.
+  Job second;
+  second.command = "sleep 5";
+  int second_out = -1, second_err = -1;
+  ASSERT_TRUE(spawner.spawn_job(second, &second_out, &second_err));
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(read_all(first_out), "");
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1500));
+
+  kill(-second.process_group, SIGKILL);
+  waitpid(first.process_group, nullptr, 0);
+  waitpid(second.process_group, nullptr, 0);
+  for (int fd : {first_out, first_err, second_out, second_err, first.pidfd, second.pidfd})
+    if (fd >= 0)
+      close(fd);
+}
+
+TEST_P(ProcessSpawnerTest, DirectExecPassesArgvEnvAndCwd) {
+  RealProcessSpawner spawner(GetParam());
+
+  // Arguments reach the program verbatim: no word splitting, no expansion.
+  Job args;
+  args.exec_mode = ExecMode::DIRECT;
+  args.argv = {"printf", "%s|%s\n", "a b", "$HOME"};
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(args, &out_fd, &err_fd)) << args.error;
+  EXPECT_EQ(read_all(out_fd), "a b|$HOME\n");
+  EXPECT_EQ(wait_exit_code(args.process_group), 0);
+  close_job_fds(args, out_fd, err_fd);
+
+  // A job env replaces the daemon's; without PATH= the default path is used.
+  Job env;
+  env.exec_mode = ExecMode::DIRECT;
+  env.argv = {"env"};
+  env.env = {"HK_TEST=1"};
+  ASSERT_TRUE(spawner.spawn_job(env, &out_fd, &err_fd)) << env.error;
+  EXPECT_EQ(read_all(out_fd), "HK_TEST=1\n");
+  EXPECT_EQ(wait_exit_code(env.process_group), 0);
+  close_job_fds(env, out_fd, err_fd);
+
+  Job cwd;
+  cwd.exec_mode = ExecMode::DIRECT;
+  cwd.argv = {"pwd"};
+  cwd.cwd = "/";
+  ASSERT_TRUE(spawner.spawn_job(cwd, &out_fd, &err_fd)) << cwd.error;
+  EXPECT_EQ(read_all(out_fd), "/\n");
+  EXPECT_EQ(wait_exit_code(cwd.process_group), 0);
+  close_job_fds(cwd, out_fd, err_fd);
+}
+
+TEST_P(ProcessSpawnerTest, DirectExecOfUnknownProgramFails) {
+  RealProcessSpawner spawner(GetParam());
+  Job job;
+  job.exec_mode = ExecMode::DIRECT;
+  job.argv = {"hk-no-such-program"};
+  int out_fd = -1, err_fd = -1;
+  EXPECT_FALSE(spawner.spawn_job(job, &out_fd, &err_fd));
+  EXPECT_EQ(job.status, JobStatus::QUEUED);
+  EXPECT_NE(job.error.find("No such file"), std::string::npos) << job.error;
+
+  Job empty;
+  empty.exec_mode = ExecMode::DIRECT;
+  EXPECT_FALSE(spawner.spawn_job(empty, &out_fd, &err_fd));
+  EXPECT_FALSE(empty.error.empty());
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, ProcessSpawnerTest,
+                         ::testing::Values(SpawnBackend::FORK, SpawnBackend::POSIX_SPAWN,
+                                           SpawnBackend::VFORK),
+                         [](const ::testing::TestParamInfo<SpawnBackend>& info) {
+                           return std::string(spawn_backend_name(info.param));
+                         });
+
+TEST(SpawnBackendTest, ParseRoundTrips) {
+  for (auto b : {SpawnBackend::FORK, SpawnBackend::POSIX_SPAWN, SpawnBackend::VFORK}) {
+    auto parsed = parse_spawn_backend(spawn_backend_name(b));
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(*parsed, b);
+  }
+  EXPECT_FALSE(parse_spawn_backend("clone").has_value());
+}
+
+TEST(ExecPathResolverTest, CachesPerPathAndName) {
+  ExecPathResolver resolver;
+  std::string path;
+  ASSERT_TRUE(resolver.resolve("sh", "/hk-missing-dir:/bin", "", &path));
+  EXPECT_EQ(path, "/bin/sh");
+  EXPECT_EQ(resolver.size(), 1u);
+
+  ASSERT_TRUE(resolver.resolve("sh", "/hk-missing-dir:/bin", "", &path));
+  EXPECT_EQ(resolver.size(), 1u);
+  ASSERT_TRUE(resolver.resolve("sh", "/bin", "", &path));
+  EXPECT_EQ(resolver.size(), 2u);
+
+  // Names with a slash bypass PATH and the cache; misses are not cached.
+  ASSERT_TRUE(resolver.resolve("./sh", "/bin", "", &path));
+  EXPECT_EQ(path, "./sh");
+  EXPECT_FALSE(resolver.resolve("hk-no-such-program", "/bin", "", &path));
+  EXPECT_EQ(resolver.size(), 2u);
+
+  resolver.invalidate("sh", "/bin");
+  EXPECT_EQ(resolver.size(), 1u);
+}
+
+TEST(ExecPathResolverTest, StaleCacheEntryIsResolvedAgain) {
+  char tmpl[] = "/tmp/hk_exec_XXXXXX";
+  ASSERT_NE(mkdtemp(tmpl), nullptr);
+  std::string root = tmpl;
+  std::string first = root + "/a", second = root + "/b";
+  ASSERT_EQ(mkdir(first.c_str(), 0755), 0);
+  ASSERT_EQ(mkdir(second.c_str(), 0755), 0);
+  for (const auto& dir : {first, second}) {
+    std::ofstream(dir + "/hk-prog") << "#!/bin/sh\necho " << dir << "\n";
+    chmod((dir + "/hk-prog").c_str(), 0755);
+  }
+
+  RealProcessSpawner spawner(SpawnBackend::VFORK);
+  Job job;
+  job.exec_mode = ExecMode::DIRECT;
+  job.argv = {"hk-prog"};
+  job.env = {"PATH=" + first + ":" + second};
+
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd)) << job.error;
+  EXPECT_EQ(read_all(out_fd), first + "\n");
+  wait_exit_code(job.process_group);
+  close_job_fds(job, out_fd, err_fd);
+
+  // The cached path now points at a removed file.
+  unlink((first + "/hk-prog").c_str());
+  Job again;
+  again.exec_mode = ExecMode::DIRECT;
+  again.argv = job.argv;
+  again.env = job.env;
+  ASSERT_TRUE(spawner.spawn_job(again, &out_fd, &err_fd)) << again.error;
+  EXPECT_EQ(read_all(out_fd), second + "\n");
+  wait_exit_code(again.process_group);
+  close_job_fds(again, out_fd, err_fd);
+
+  unlink((second + "/hk-prog").c_str());
+  rmdir(first.c_str());
+  rmdir(second.c_str());
+  rmdir(root.c_str());
+}
+
+TEST(ExecPathResolverTest, RelativePathEntriesResolveUnderJobCwd) {
+  char tmpl[] = "/tmp/hk_exec_XXXXXX";
+  ASSERT_NE(mkdtemp(tmpl), nullptr);
+  std::string root = tmpl;
+  std::string first = root + "/a", second = root + "/b";
+  for (const auto& dir : {first, second}) {
+    ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir((dir + "/bin").c_str(), 0755), 0);
+    std::ofstream(dir + "/bin/hk-prog") << "#!/bin/sh\necho " << dir << "\n";
+    chmod((dir + "/bin/hk-prog").c_str(), 0755);
+  }
+
+  // Neither the daemon's cwd nor an earlier job's lookup decides which one runs.
+  RealProcessSpawner spawner(SpawnBackend::VFORK);
+  for (const auto& dir : {first, second}) {
+    Job job;
+    job.exec_mode = ExecMode::DIRECT;
+    job.argv = {"hk-prog"};
+    job.env = {"PATH=bin:/bin"};
+    job.cwd = dir;
+    int out_fd = -1, err_fd = -1;
+    ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd)) << job.error;
+    EXPECT_EQ(read_all(out_fd), dir + "\n");
+    wait_exit_code(job.process_group);
+    close_job_fds(job, out_fd, err_fd);
+  }
+  EXPECT_EQ(spawner.resolver().size(), 0u);
+
+  // An empty entry is the job's cwd itself.
+  std::string path;
+  ASSERT_TRUE(spawner.resolver().resolve("hk-prog", ":/bin", first + "/bin", &path));
+  EXPECT_EQ(path, "./hk-prog");
+  EXPECT_FALSE(spawner.resolver().resolve("hk-prog", ":/bin", root, &path));
+
+  for (const auto& dir : {first, second}) {
+    unlink((dir + "/bin/hk-prog").c_str());
+    rmdir((dir + "/bin").c_str());
+    rmdir(dir.c_str());
+  }
+  rmdir(root.c_str());
+}
+
+} // namespace
+} // namespace heidi
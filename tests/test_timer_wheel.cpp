@@ -0,0 +1,139 @@
+#include "heidi-kernel/timer_wheel.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace heidi {
+namespace {
+
+std::vector<uint64_t> expire(TimerWheel& wheel, uint64_t now_ms) {
+  wheel.advance(now_ms);
+  std::vector<uint64_t> deadlines;
+  while (Timer* timer = wheel.pop_expired())
+    deadlines.push_back(timer->deadline_ms);
+  return deadlines;
+}
+
+TEST(TimerWheelTest, ExpiresAtDeadlineNotBefore) {
+  TimerWheel wheel;
+  Timer timer;
+  wheel.schedule(timer, 10);
+  EXPECT_TRUE(timer.armed());
+  EXPECT_TRUE(expire(wheel, 9).empty());
+  EXPECT_EQ(expire(wheel, 10), std::vector<uint64_t>{10});
+  EXPECT_FALSE(timer.armed());
+  EXPECT_EQ(wheel.size(), 0u);
+  EXPECT_EQ(wheel.next_event_ms(), UINT64_MAX);
+}
+
+TEST(TimerWheelTest, ExpiresInDeadlineOrderAcrossLevels) {
+  TimerWheel wheel;
+  std::vector<uint64_t> deadlines = {70000, 5, 64, 4096, 63, 262144, 4095, 300};
+  std::vector<Timer> timers(deadlines.size());
+  for (size_t i = 0; i < timers.size(); ++i)
+    wheel.schedule(timers[i], deadlines[i]);
+
+  std::vector<uint64_t> expected = deadlines;
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expire(wheel, 1000000), expected);
+  EXPECT_EQ(wheel.now_ms(), 1000000u);
+}
+
+TEST(TimerWheelTest, CancelAndReschedule) {
+  TimerWheel wheel;
+  Timer a, b;
+  wheel.schedule(a, 100);
+  wheel.schedule(b, 200);
+  wheel.cancel(a);
+  wheel.cancel(a);
+  EXPECT_FALSE(a.armed());
+  wheel.schedule(b, 50);
+  EXPECT_EQ(wheel.size(), 1u);
+  EXPECT_EQ(expire(wheel, 60), std::vector<uint64_t>{50});
+  EXPECT_TRUE(expire(wheel, 1000).empty());
+}
+
+TEST(TimerWheelTest, PastDeadlineExpiresImmediately) {
+  TimerWheel wheel;
+  wheel.advance(500);
+  Timer timer;
+  wheel.schedule(timer, 400);
+  EXPECT_EQ(wheel.next_event_ms(), 500u);
+  EXPECT_EQ(wheel.pop_expired(), &timer);
+}
+
+TEST(TimerWheelTest, NextEventIsExactWithinLowestLevel) {
+  TimerWheel wheel;
+  wheel.advance(1024);
+  Timer timer;
+  wheel.schedule(timer, 1054);
+  EXPECT_EQ(wheel.next_event_ms(), 1054u);
+  // Further out only a slot boundary is known; each refile narrows it, once
+  // per level at most.
+  wheel.schedule(timer, 1024 + 3000);
+  uint64_t next = wheel.next_event_ms();
+  EXPECT_GT(next, 1024u);
+  EXPECT_LE(next, 4024u);
+  int steps = 0;
+  while (wheel.next_event_ms() < 4024 && steps++ < 4)
+    wheel.advance(wheel.next_event_ms());
+  EXPECT_EQ(wheel.next_event_ms(), 4024u);
+  EXPECT_TRUE(timer.armed());
+}
+
+TEST(TimerWheelTest, FarDeadlinesWaitInOverflow) {
+  TimerWheel wheel;
+  const uint64_t start = 1700000000000ULL; // epoch ms, as the daemon's clock
+  wheel.advance(start);
+  Timer day, week;
+  wheel.schedule(day, start + 24ULL * 3600 * 1000);
+  wheel.schedule(week, start + 7ULL * 24 * 3600 * 1000);
+  EXPECT_TRUE(expire(wheel, start + 24ULL * 3600 * 1000 - 1).empty());
+  EXPECT_EQ(expire(wheel, start + 24ULL * 3600 * 1000),
+            std::vector<uint64_t>{start + 24ULL * 3600 * 1000});
+  EXPECT_EQ(expire(wheel, start + 30ULL * 24 * 3600 * 1000),
+            std::vector<uint64_t>{start + 7ULL * 24 * 3600 * 1000});
+}
+
+TEST(TimerWheelTest, MatchesOrderedMapUnderRandomUse) {
+  std::mt19937_64 rng(42);
+  TimerWheel wheel;
+  std::vector<Timer> timers(500);
+  std::multimap<uint64_t, Timer*> model;
+  uint64_t now = 12345;
+  wheel.advance(now);
+
+  for (int round = 0; round < 2000; ++round) {
+    Timer& timer = timers[rng() % timers.size()];
+    if (timer.armed() && rng() % 3 == 0) {
+      for (auto it = model.begin(); it != model.end(); ++it) {
+        if (it->second == &timer) {
+          model.erase(it);
+          break;
+        }
+      }
+      wheel.cancel(timer);
+    } else if (!timer.armed()) {
+      // Mostly near deadlines, some hours out.
+      uint64_t delta = rng() % 4 == 0 ? rng() % (1ULL << 26) : rng() % 5000;
+      wheel.schedule(timer, now + 1 + delta);
+      model.emplace(now + 1 + delta, &timer);
+    }
+
+    now += rng() % 200 == 0 ? rng() % (1ULL << 25) : rng() % 50;
+    std::vector<uint64_t> got = expire(wheel, now);
+    std::vector<uint64_t> want;
+    while (!model.empty() && model.begin()->first <= now) {
+      want.push_back(model.begin()->first);
+      model.erase(model.begin());
+    }
+    ASSERT_EQ(got, want) << "round " << round;
+    ASSERT_EQ(wheel.size(), model.size());
+  }
+}
+
+} // namespace
+} // namespace heidi
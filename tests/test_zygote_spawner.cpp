@@ -0,0 +1,134 @@
+#include "heidi-kernel/job.h"
+#include "heidi-kernel/zygote_spawner.h"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace heidi {
+namespace {
+
+std::string read_all(int fd) {
+  std::string out;
+  char buf[4096];
+  for (;;) {
+    struct pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, 2000) <= 0)
+      break;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    out.append(buf, n);
+  }
+  return out;
+}
+
+bool reap_with_deadline(IProcessSpawner& spawner, Job& job, int* status) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (spawner.reap_job(job, status))
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return false;
+}
+
+void close_job_fds(Job& job) {
+  for (int fd : {job.stdout_fd, job.stderr_fd, job.pidfd})
+    if (fd >= 0)
+      close(fd);
+}
+
+TEST(ZygoteSpawnerTest, SpawnsBatchAndReportsExitStatus) {
+  ZygoteProcessSpawner spawner;
+  ASSERT_TRUE(spawner.start());
+  ASSERT_TRUE(spawner.is_running());
+
+  Job jobs[3];
+  Job* ptrs[3];
+  bool spawned[3] = {false, false, false};
+  for (int i = 0; i < 3; ++i) {
+    // Each job prints its own pgid (field 5 of /proc/self/stat) so the check
+    // does not race with the helper reaping it.
+    jobs[i].command = "echo job" + std::to_string(i) + " $(cut -d' ' -f5 /proc/$$/stat); exit " +
+                      std::to_string(i);
+    ptrs[i] = &jobs[i];
+  }
+  spawner.spawn_jobs(ptrs, spawned);
+
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(spawned[i]) << jobs[i].error;
+    ASSERT_GT(jobs[i].process_group, 0);
+    // The helper, not this process, is the parent.
+    EXPECT_EQ(waitpid(jobs[i].process_group, nullptr, WNOHANG), -1);
+    EXPECT_EQ(read_all(jobs[i].stdout_fd),
+              "job" + std::to_string(i) + " " + std::to_string(jobs[i].process_group) + "\n");
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    int status = 0;
+    ASSERT_TRUE(reap_with_deadline(spawner, jobs[i], &status));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), i);
+    if (jobs[i].pidfd >= 0) {
+      struct pollfd pfd{jobs[i].pidfd, POLLIN, 0};
+      EXPECT_EQ(poll(&pfd, 1, 0), 1);
+    }
+    close_job_fds(jobs[i]);
+  }
+}
+
+TEST(ZygoteSpawnerTest, DirectExecWithEnvAndCwd) {
+  ZygoteProcessSpawner spawner;
+  ASSERT_TRUE(spawner.start());
+
+  Job job;
+  job.exec_mode = ExecMode::DIRECT;
+  job.argv = {"sh", "-c", "echo \"$1|$HK_TEST|$(pwd)\"; exit 5", "sh", "a b"};
+  job.env = {"HK_TEST=1", "PATH=/usr/bin:/bin"};
+  job.cwd = "/";
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd)) << job.error;
+  EXPECT_EQ(read_all(out_fd), "a b|1|/\n");
+
+  int status = 0;
+  ASSERT_TRUE(reap_with_deadline(spawner, job, &status));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 5);
+  close_job_fds(job);
+
+  Job missing;
+  missing.exec_mode = ExecMode::DIRECT;
+  missing.argv = {"hk-no-such-program"};
+  EXPECT_FALSE(spawner.spawn_job(missing, &out_fd, &err_fd));
+  EXPECT_FALSE(missing.error.empty());
+}
+
+TEST(ZygoteSpawnerTest, FallsBackInProcessWhenHelperGone) {
+  ZygoteProcessSpawner spawner;
+  ASSERT_TRUE(spawner.start());
+  kill(spawner.helper_pid(), SIGKILL);
+  // Wait for it to die without reaping it; the spawner still owns that.
+  siginfo_t info;
+  ASSERT_EQ(waitid(P_PID, spawner.helper_pid(), &info, WEXITED | WNOWAIT), 0);
+
+  Job job;
+  job.command = "exit 4";
+  int out_fd = -1, err_fd = -1;
+  ASSERT_TRUE(spawner.spawn_job(job, &out_fd, &err_fd)) << job.error;
+  EXPECT_FALSE(spawner.is_running());
+
+  int status = 0;
+  ASSERT_TRUE(reap_with_deadline(spawner, job, &status));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 4);
+  close_job_fds(job);
+}
+
+} // namespace
+} // namespace heidi